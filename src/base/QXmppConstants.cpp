@@ -33,6 +33,8 @@ const char* ns_sasl = "urn:ietf:params:xml:ns:xmpp-sasl";
 const char* ns_bind = "urn:ietf:params:xml:ns:xmpp-bind";
 const char* ns_session = "urn:ietf:params:xml:ns:xmpp-session";
 const char* ns_stanza = "urn:ietf:params:xml:ns:xmpp-stanzas";
+// RFC 7395: XMPP over WebSocket
+const char* ns_framing = "urn:ietf:params:xml:ns:xmpp-framing";
 // XEP-0009: Jabber-RPC
 const char* ns_rpc = "jabber:iq:rpc";
 // XEP-0012: Last Activity
@@ -57,6 +59,9 @@ const char* ns_private = "jabber:iq:private";
 const char* ns_vcard = "vcard-temp";
 // XEP-0059: Result Set Management
 const char* ns_rsm = "http://jabber.org/protocol/rsm";
+// XEP-0060: Publish-Subscribe
+const char* ns_pubsub = "http://jabber.org/protocol/pubsub";
+const char* ns_pubsub_event = "http://jabber.org/protocol/pubsub#event";
 // XEP-0065: SOCKS5 Bytestreams
 const char* ns_bytestreams = "http://jabber.org/protocol/bytestreams";
 // XEP-0071: XHTML-IM
@@ -78,6 +83,8 @@ const char* ns_stream_initiation = "http://jabber.org/protocol/si";
 const char* ns_stream_initiation_file_transfer = "http://jabber.org/protocol/si/profile/file-transfer";
 // XEP-0108: User Activity
 const char* ns_activity = "http://jabber.org/protocol/activity";
+// XEP-0114: Jabber Component Protocol
+const char* ns_component = "jabber:component:accept";
 // XEP-0115: Entity Capabilities
 const char* ns_capabilities = "http://jabber.org/protocol/caps";
 // XEP-0136: Message Archiving
@@ -114,6 +121,8 @@ const char* ns_media_element = "urn:xmpp:media-element";
 const char* ns_attention = "urn:xmpp:attention:0";
 // XEP-0231: Bits of Binary
 const char* ns_bob = "urn:xmpp:bob";
+// XEP-0237: Roster Versioning
+const char* ns_rosterver = "urn:xmpp:features:rosterver";
 // XEP-0249: Direct MUC Invitations
 const char* ns_conference = "jabber:x:conference";
 // Unison Extension: attachments and presences
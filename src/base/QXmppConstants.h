@@ -34,6 +34,8 @@ extern const char* ns_sasl;
 extern const char* ns_bind;
 extern const char* ns_session;
 extern const char* ns_stanza;
+// RFC 7395: XMPP over WebSocket
+extern const char* ns_framing;
 // XEP-0009: Jabber-RPC
 extern const char* ns_rpc;
 // XEP-0012: Last Activity
@@ -58,6 +60,9 @@ extern const char* ns_private;
 extern const char* ns_vcard;
 // XEP-0059: Result Set Management
 extern const char* ns_rsm;
+// XEP-0060: Publish-Subscribe
+extern const char* ns_pubsub;
+extern const char* ns_pubsub_event;
 // XEP-0065: SOCKS5 Bytestreams
 extern const char* ns_bytestreams;
 // XEP-0071: XHTML-IM
@@ -79,6 +84,8 @@ extern const char* ns_stream_initiation;
 extern const char* ns_stream_initiation_file_transfer;
 // XEP-0108: User Activity
 extern const char* ns_activity;
+// XEP-0114: Jabber Component Protocol
+extern const char* ns_component;
 // XEP-0115: Entity Capabilities
 extern const char* ns_capabilities;
 // XEP-0136: Message Archiving
@@ -115,6 +122,8 @@ extern const char* ns_media_element;
 extern const char* ns_attention;
 // XEP-0231: Bits of Binary
 extern const char* ns_bob;
+// XEP-0237: Roster Versioning
+extern const char* ns_rosterver;
 // XEP-0249: Direct MUC Invitations
 extern const char* ns_conference;
 // Unison Extension: attachments and presences
@@ -27,8 +27,6 @@
 #include "QXmppPubSubIq.h"
 #include "QXmppUtils.h"
 
-static const char *ns_pubsub = "http://jabber.org/protocol/pubsub";
-
 static const char *pubsub_queries[] = {
     "affiliations",
     "default",
@@ -176,6 +174,23 @@ void QXmppPubSubIq::setItems(const QList<QXmppPubSubItem> &items)
     m_items = items;
 }
 
+/// Returns the subscription state, for instance "subscribed".
+///
+
+QString QXmppPubSubIq::subscriptionType() const
+{
+    return m_subscriptionType;
+}
+
+/// Sets the subscription state, for instance "subscribed".
+///
+/// \param type
+
+void QXmppPubSubIq::setSubscriptionType(const QString &type)
+{
+    m_subscriptionType = type;
+}
+
 /// \cond
 bool QXmppPubSubIq::isPubSubIq(const QDomElement &element)
 {
@@ -191,7 +206,7 @@ void QXmppPubSubIq::parseElementFromChild(const QDomElement &element)
 
     // determine query type
     const QString tagName = queryElement.tagName();
-    for (int i = ItemsQuery; i <= SubscriptionsQuery; i++)
+    for (int i = AffiliationsQuery; i <= UnsubscribeQuery; i++)
     {
         if (tagName == pubsub_queries[i])
         {
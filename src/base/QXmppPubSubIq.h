@@ -86,6 +86,9 @@ public:
     QString subscriptionId() const;
     void setSubscriptionId(const QString &id);
 
+    QString subscriptionType() const;
+    void setSubscriptionType(const QString &type);
+
     /// \cond
     static bool isPubSubIq(const QDomElement &element);
     /// \endcond
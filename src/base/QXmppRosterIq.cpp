@@ -45,6 +45,25 @@ QList<QXmppRosterIq::Item> QXmppRosterIq::items() const
     return m_items;
 }
 
+/// Returns the roster version, as defined by XEP-0237: Roster Versioning.
+///
+/// A null string means the version is not specified, while an empty string
+/// requests the full roster from a server which supports versioning.
+
+QString QXmppRosterIq::version() const
+{
+    return m_version;
+}
+
+/// Sets the roster version, as defined by XEP-0237: Roster Versioning.
+///
+/// \param version
+
+void QXmppRosterIq::setVersion(const QString &version)
+{
+    m_version = version;
+}
+
 /// \cond
 bool QXmppRosterIq::isRosterIq(const QDomElement &element)
 {
@@ -53,9 +72,14 @@ bool QXmppRosterIq::isRosterIq(const QDomElement &element)
 
 void QXmppRosterIq::parseElementFromChild(const QDomElement &element)
 {
-    QDomElement itemElement = element.
-                              firstChildElement("query").
-                              firstChildElement("item");
+    const QDomElement queryElement = element.firstChildElement("query");
+    if (queryElement.hasAttribute("ver")) {
+        m_version = queryElement.attribute("ver");
+        if (m_version.isNull())
+            m_version = QLatin1String("");
+    }
+
+    QDomElement itemElement = queryElement.firstChildElement("item");
     while(!itemElement.isNull())
     {
         QXmppRosterIq::Item item;
@@ -69,6 +93,8 @@ void QXmppRosterIq::toXmlElementFromChild(QXmlStreamWriter *writer) const
 {
     writer->writeStartElement("query");
     writer->writeAttribute( "xmlns", ns_roster);
+    if (!m_version.isNull())
+        writer->writeAttribute("ver", m_version);
 
     for(int i = 0; i < m_items.count(); ++i)
         m_items.at(i).toXml(writer);
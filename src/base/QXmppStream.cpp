@@ -27,38 +27,343 @@
 #include "QXmppLogger.h"
 #include "QXmppStanza.h"
 #include "QXmppStream.h"
+#include "QXmppTracer.h"
+#include "QXmppTrafficRecorder.h"
 #include "QXmppUtils.h"
 
+#include <QAtomicInt>
+#include <QBasicTimer>
 #include <QBuffer>
 #include <QDomDocument>
+#include <QElapsedTimer>
+#include <QHash>
 #include <QHostAddress>
+#include <QMap>
 #include <QRegExp>
 #include <QSslSocket>
 #include <QStringList>
 #include <QTime>
+#include <QTimerEvent>
 #include <QXmlStreamWriter>
 
 static bool randomSeeded = false;
+static QAtomicInt streamSerials;
 static const QByteArray streamRootElementEnd = "</stream:stream>";
 
+// WebSocket opcodes, see RFC 6455
+enum WebSocketOpcode
+{
+    ContinuationFrame = 0x0,
+    TextFrame = 0x1,
+    BinaryFrame = 0x2,
+    CloseFrame = 0x8,
+    PingFrame = 0x9,
+    PongFrame = 0xa
+};
+
+static const quint64 webSocketMessageLimit = 10 * 1024 * 1024;
+
+// number of unwritten bytes above which presence is held back
+static const qint64 presenceWindow = 16384;
+
+/// Returns the value of attribute \a name in the opening tag of \a head,
+/// or an empty array if it is not present.
+
+static QByteArray tagAttribute(const QByteArray &head, const QByteArray &name)
+{
+    int pos = 0;
+    forever {
+        pos = head.indexOf(name + "=", pos);
+        if (pos < 0)
+            return QByteArray();
+        const int valueStart = pos + name.size() + 2;
+        if (pos > 0 && (head.at(pos - 1) == ' ' || head.at(pos - 1) == '\t' || head.at(pos - 1) == '\n') && valueStart <= head.size()) {
+            const char quote = head.at(valueStart - 1);
+            const int valueEnd = head.indexOf(quote, valueStart);
+            if ((quote == '"' || quote == '\'') && valueEnd >= 0)
+                return head.mid(valueStart, valueEnd - valueStart);
+        }
+        pos += name.size();
+    }
+}
+
+/// Returns the key of the route a stanza takes, made of its sender and the
+/// bare JID of its recipient.
+
+static QByteArray routeKey(const QByteArray &head)
+{
+    const QByteArray to = tagAttribute(head, "to");
+    return tagAttribute(head, "from") + ' ' + to.left(to.indexOf('/'));
+}
+
+/// Returns true if \a data holds a presence stanza.
+
+static bool isPresence(const QByteArray &data)
+{
+    return data.startsWith("<presence") && data.size() > 9 &&
+           (data.at(9) == ' ' || data.at(9) == '/' || data.at(9) == '>');
+}
+
+/// Builds an unmasked WebSocket frame holding the given payload.
+
+static QByteArray webSocketFrame(quint8 opcode, const QByteArray &payload)
+{
+    const quint64 size = payload.size();
+
+    QByteArray frame;
+    frame.reserve(payload.size() + 10);
+    frame.append(char(0x80 | opcode));
+    if (size < 126) {
+        frame.append(char(size));
+    } else if (size < 65536) {
+        frame.append(char(126));
+        frame.append(char(size >> 8));
+        frame.append(char(size & 0xff));
+    } else {
+        frame.append(char(127));
+        for (int i = 7; i >= 0; --i)
+            frame.append(char((size >> (8 * i)) & 0xff));
+    }
+    frame.append(payload);
+    return frame;
+}
+
+/// Turns data written for a classic XML stream into a standalone document
+/// as required by RFC 7395.
+///
+/// Stanzas and stream elements no longer inherit their namespaces from the
+/// stream root, so the declarations are spliced into the first tag.
+
+static QByteArray webSocketPayload(const QByteArray &data)
+{
+    if (data == streamRootElementEnd)
+        return QByteArray("<close xmlns=\"") + ns_framing + "\"/>";
+
+    const int headEnd = data.indexOf('>');
+    if (!data.startsWith('<') || headEnd < 0)
+        return data;
+
+    int nameEnd = 1;
+    while (nameEnd < headEnd && data.at(nameEnd) != ' ' && data.at(nameEnd) != '/' &&
+           data.at(nameEnd) != '\t' && data.at(nameEnd) != '\r' && data.at(nameEnd) != '\n')
+        ++nameEnd;
+    const QByteArray name = data.mid(1, nameEnd - 1);
+    const QByteArray head = QByteArray::fromRawData(data.constData(), headEnd);
+
+    QByteArray payload(data);
+    if (name.startsWith("stream:")) {
+        if (!head.contains("xmlns:stream="))
+            payload.insert(nameEnd, QByteArray(" xmlns:stream=\"") + ns_stream + "\"");
+    } else if (name == "iq" || name == "message" || name == "presence") {
+        if (!head.contains("xmlns="))
+            payload.insert(nameEnd, QByteArray(" xmlns=\"") + ns_client + "\"");
+    }
+    return payload;
+}
+
 class QXmppStreamPrivate
 {
 public:
     QXmppStreamPrivate();
+    void flushPresence(qint64 window);
+    void flushPresenceRoute(const QByteArray &key);
+    bool queuePresence(const QByteArray &data);
+    void writePresence();
+    void refill();
+    bool takeStanzaToken();
+    void touch(QObject *stream);
+    void capture(QXmppTrafficRecorder::Direction direction, const QByteArray &data);
+    bool write(const QByteArray &data);
 
     QByteArray dataBuffer;
     QSslSocket* socket;
+    quint32 serial;
+    bool redactTraffic;
 
     // stream state
     QByteArray streamStart;
 
     bool requireStartEncryption;
+
+    // idle compaction
+    QBasicTimer compactTimer;
+    int compactTimeout;
+
+    // WebSocket framing
+    bool webSocket;
+    QByteArray messageBuffer;
+
+    // presence waiting for the socket to drain, in sending order, the
+    // position of collapsible presence by sender and recipient and the
+    // number of queued presence by route
+    QMap<qint64, QByteArray> presenceQueue;
+    QHash<QByteArray, qint64> presencePositions;
+    QHash<QByteArray, int> presenceRoutes;
+    qint64 presenceSequence;
+
+    // rate limiting, tokens are counted in thousandths and may go
+    // negative when a read exceeds the budget
+    int byteRate;
+    int stanzaRate;
+    qint64 byteTokens;
+    qint64 stanzaTokens;
+    qint64 readTime;
+    QElapsedTimer rateClock;
+    qint64 refillTime;
+    QBasicTimer throttleTimer;
+    QElapsedTimer throttleClock;
+
+    // stanzas held back when the stanza budget ran out
+    QDomDocument pendingDocument;
+    QDomElement pendingStanza;
+    bool stanzasThrottled;
 };
 
 QXmppStreamPrivate::QXmppStreamPrivate()
     : socket(0)
+    , serial(quint32(streamSerials.fetchAndAddOrdered(1)) + 1)
+    , redactTraffic(false)
     , requireStartEncryption(false)
+    , compactTimeout(0)
+    , webSocket(false)
+    , presenceSequence(0)
+    , byteRate(0)
+    , stanzaRate(0)
+    , byteTokens(0)
+    , stanzaTokens(0)
+    , readTime(0)
+    , refillTime(0)
+    , stanzasThrottled(false)
+{
+    rateClock.start();
+}
+
+/// Adds the tokens earned since the last refill, up to one second worth
+/// of traffic.
+
+void QXmppStreamPrivate::refill()
+{
+    const qint64 now = rateClock.elapsed();
+    const qint64 elapsed = now - refillTime;
+    refillTime = now;
+    byteTokens = qMin(qint64(byteRate) * 1000, byteTokens + byteRate * elapsed);
+    stanzaTokens = qMin(qint64(stanzaRate) * 1000, stanzaTokens + stanzaRate * elapsed);
+}
+
+/// Spends the token for one stanza, or returns false if the stanza budget
+/// is spent.
+
+bool QXmppStreamPrivate::takeStanzaToken()
+{
+    if (!stanzaRate)
+        return true;
+    if (stanzaTokens < 1000) {
+        stanzasThrottled = true;
+        return false;
+    }
+    stanzaTokens -= 1000;
+    return true;
+}
+
+/// Writes queued presence until the socket holds more than \a window
+/// unwritten bytes.
+
+void QXmppStreamPrivate::flushPresence(qint64 window)
+{
+    while (!presenceQueue.isEmpty() && socket->bytesToWrite() <= window)
+        writePresence();
+}
+
+/// Writes queued presence until none is left on the route with the given
+/// key, so that a stanza on that route does not overtake it.
+
+void QXmppStreamPrivate::flushPresenceRoute(const QByteArray &key)
+{
+    while (presenceRoutes.contains(key))
+        writePresence();
+}
+
+/// Writes the oldest queued presence.
+
+void QXmppStreamPrivate::writePresence()
+{
+    QMap<qint64, QByteArray>::iterator it = presenceQueue.begin();
+    const QByteArray data = it.value();
+    presenceQueue.erase(it);
+
+    const QByteArray key = routeKey(data.left(data.indexOf('>') + 1));
+    QHash<QByteArray, int>::iterator route = presenceRoutes.find(key);
+    if (route != presenceRoutes.end() && !--route.value())
+        presenceRoutes.erase(route);
+    if (presenceQueue.isEmpty())
+        presencePositions.clear();
+
+    write(data);
+}
+
+/// Queues a presence stanza, replacing a queued one it supersedes.
+///
+/// Returns true if a queued presence was replaced.
+
+bool QXmppStreamPrivate::queuePresence(const QByteArray &data)
+{
+    const QByteArray head = data.left(data.indexOf('>') + 1);
+    const QByteArray type = tagAttribute(head, "type");
+
+    // subscription requests and errors are never superseded, and later
+    // presence for the same addresses must not overtake them
+    const QByteArray key = tagAttribute(head, "from") + ' ' + tagAttribute(head, "to");
+    if (!type.isEmpty() && type != "unavailable") {
+        presencePositions.remove(key);
+        presenceRoutes[routeKey(head)]++;
+        presenceQueue.insert(presenceSequence++, data);
+        return false;
+    }
+
+    QHash<QByteArray, qint64>::const_iterator position = presencePositions.constFind(key);
+    if (position != presencePositions.constEnd()) {
+        QMap<qint64, QByteArray>::iterator it = presenceQueue.find(position.value());
+        if (it != presenceQueue.end()) {
+            it.value() = data;
+            return true;
+        }
+    }
+    presencePositions.insert(key, presenceSequence);
+    presenceRoutes[routeKey(head)]++;
+    presenceQueue.insert(presenceSequence++, data);
+    return false;
+}
+
+/// Records activity on the stream, postponing idle compaction.
+
+void QXmppStreamPrivate::touch(QObject *stream)
+{
+    if (compactTimeout > 0)
+        compactTimer.start(compactTimeout * 1000, stream);
+}
+
+/// Records traffic, hiding its contents while the stream is redacted.
+
+void QXmppStreamPrivate::capture(QXmppTrafficRecorder::Direction direction, const QByteArray &data)
+{
+    if (redactTraffic)
+        QXmppTrafficRecorder::capture(serial, direction, "<!-- " + QByteArray::number(data.size()) + " bytes redacted -->");
+    else
+        QXmppTrafficRecorder::capture(serial, direction, data);
+}
+
+/// Writes data to the socket, framing it if needed.
+
+bool QXmppStreamPrivate::write(const QByteArray &data)
 {
+    if (webSocket) {
+        // each element goes out as a single frame
+        const QByteArray frame = webSocketFrame(TextFrame, webSocketPayload(data));
+        capture(QXmppTrafficRecorder::Sent, frame);
+        return socket->write(frame) == frame.size();
+    }
+    capture(QXmppTrafficRecorder::Sent, data);
+    return socket->write(data) == data.size();
 }
 
 /// Constructs a base XMPP stream.
@@ -89,14 +394,50 @@ QXmppStream::~QXmppStream()
 
 void QXmppStream::disconnectFromHost()
 {
+    if (d->socket && d->socket->state() == QAbstractSocket::ConnectedState)
+        d->flushPresence(Q_INT64_C(0x7fffffffffffffff));
     sendData(streamRootElementEnd);
     if (d->socket)
     {
+        if (d->webSocket && d->socket->state() == QAbstractSocket::ConnectedState)
+            d->socket->write(webSocketFrame(CloseFrame, QByteArray("\x03\xe8", 2)));
         d->socket->flush();
         d->socket->disconnectFromHost();
     }
 }
 
+/// Releases memory held by the stream while it is idle.
+///
+/// The default implementation frees the slack in the receive buffers.
+/// Subclasses can reimplement this method to drop their own per-stream
+/// objects, in which case they must call the base class's method.
+///
+/// \sa setCompactTimeout()
+
+void QXmppStream::compact()
+{
+    if (d->dataBuffer.isEmpty())
+        d->dataBuffer.clear();
+    else
+        d->dataBuffer.squeeze();
+    d->streamStart.squeeze();
+    if (d->presenceQueue.isEmpty()) {
+        d->presencePositions.squeeze();
+        d->presenceRoutes.squeeze();
+    }
+    if (d->messageBuffer.isEmpty())
+        d->messageBuffer.clear();
+}
+
+/// Handles a WebSocket ping from the peer, which is answered by the stream.
+///
+/// The default implementation does nothing. Subclasses can reimplement this
+/// method to treat pings as activity on the stream.
+
+void QXmppStream::handlePing()
+{
+}
+
 /// Handles a stream start event, which occurs when the underlying transport
 /// becomes ready (socket connected, encryption started).
 ///
@@ -106,6 +447,13 @@ void QXmppStream::handleStart()
 {
     d->dataBuffer.clear();
     d->streamStart.clear();
+    d->messageBuffer.clear();
+    d->presenceQueue.clear();
+    d->presencePositions.clear();
+    d->presenceRoutes.clear();
+    d->pendingDocument = QDomDocument();
+    d->pendingStanza = QDomElement();
+    d->redactTraffic = false;
 }
 
 /// Returns true if the stream is connected.
@@ -119,14 +467,32 @@ bool QXmppStream::isConnected() const
 
 /// Sends raw data to the peer.
 ///
+/// While the socket is congested, presence stanzas are held back so that
+/// other stanzas go ahead of them. A queued presence is replaced by newer
+/// presence from the same sender to the same recipient. Stanzas never
+/// overtake presence from their sender to their recipient, so that for
+/// instance a message to a chat room follows the presence joining it.
+///
 /// \param data
 
 bool QXmppStream::sendData(const QByteArray &data)
 {
+    QXmppTracer::trace(QXmppTracer::SendStage);
     logSent(QString::fromUtf8(data));
     if (!d->socket || d->socket->state() != QAbstractSocket::ConnectedState)
         return false;
-    return d->socket->write(data) == data.size();
+    d->touch(this);
+
+    if (isPresence(data) && (!d->presenceQueue.isEmpty() || d->socket->bytesToWrite() > presenceWindow)) {
+        if (d->queuePresence(data))
+            updateCounter("stream.presence.collapsed");
+        return true;
+    } else if (!d->presenceRoutes.isEmpty() && data.startsWith('<')) {
+        d->flushPresenceRoute(routeKey(data.left(data.indexOf('>') + 1)));
+    }
+    const bool written = d->write(data);
+    QXmppTracer::trace(QXmppTracer::WriteStage);
+    return written;
 }
 
 /// Sends an XMPP packet to the peer.
@@ -154,6 +520,116 @@ void QXmppStream::setRequireStartEncryption(bool value)
     d->requireStartEncryption = value;
 }
 
+/// Returns the number of seconds without traffic after which the
+/// stream is compacted, or 0 if compaction is disabled.
+
+int QXmppStream::compactTimeout() const
+{
+    return d->compactTimeout;
+}
+
+/// Sets the number of seconds without traffic after which the stream
+/// releases its buffers by calling compact().
+///
+/// A value of 0 disables compaction, which is the default.
+///
+/// \param secs
+
+void QXmppStream::setCompactTimeout(int secs)
+{
+    d->compactTimeout = qMax(0, secs);
+    if (d->compactTimeout)
+        d->touch(this);
+    else
+        d->compactTimer.stop();
+}
+
+/// Returns the maximum number of bytes per second read from the peer,
+/// or 0 if it is not limited.
+
+int QXmppStream::byteRateLimit() const
+{
+    return d->byteRate;
+}
+
+/// Sets the maximum number of bytes per second read from the peer.
+///
+/// Data beyond the budget stays in the socket until enough time has
+/// passed, so that a single peer cannot monopolise the event loop. The
+/// budget allows bursts of up to one second of traffic.
+///
+/// A value of 0 disables the limit, which is the default.
+///
+/// \param bytesPerSecond
+
+void QXmppStream::setByteRateLimit(int bytesPerSecond)
+{
+    d->byteRate = qMax(0, bytesPerSecond);
+    d->refill();
+    d->byteTokens = qint64(d->byteRate) * 1000;
+    if (d->socket)
+        d->socket->setReadBufferSize((d->byteRate || d->stanzaRate) ? qMax(d->byteRate, 65536) : 0);
+}
+
+/// Returns the maximum number of stanzas per second accepted from the
+/// peer, or 0 if it is not limited.
+
+int QXmppStream::stanzaRateLimit() const
+{
+    return d->stanzaRate;
+}
+
+/// Sets the maximum number of stanzas per second accepted from the peer.
+///
+/// The budget is checked before each stanza is dispatched. Once it is
+/// spent, the remaining stanzas are held back and reading from the socket
+/// pauses until enough time has passed. The budget allows bursts of up to one second of
+/// traffic.
+///
+/// A value of 0 disables the limit, which is the default.
+///
+/// \param stanzasPerSecond
+
+void QXmppStream::setStanzaRateLimit(int stanzasPerSecond)
+{
+    d->stanzaRate = qMax(0, stanzasPerSecond);
+    d->refill();
+    d->stanzaTokens = qint64(d->stanzaRate) * 1000;
+    if (d->socket)
+        d->socket->setReadBufferSize((d->byteRate || d->stanzaRate) ? qMax(d->byteRate, 65536) : 0);
+}
+
+/// Returns the number identifying this stream within the process.
+///
+/// \sa QXmppTrafficRecorder
+
+quint32 QXmppStream::serial() const
+{
+    return d->serial;
+}
+
+/// Returns true if the stream is carried over a WebSocket connection.
+
+bool QXmppStream::isWebSocket() const
+{
+    return d->webSocket;
+}
+
+/// Sets whether the stream is carried over a WebSocket connection,
+/// using the framing defined in RFC 7395.
+///
+/// Each WebSocket message then holds exactly one element, which is parsed
+/// on its own instead of being buffered as part of an XML stream. This
+/// must be set once the WebSocket handshake has completed, before any
+/// XMPP data is exchanged.
+///
+/// \param webSocket
+
+void QXmppStream::setWebSocket(bool webSocket)
+{
+    d->webSocket = webSocket;
+}
+
 /// Returns the QSslSocket used for this stream.
 ///
 
@@ -162,6 +638,19 @@ QSslSocket *QXmppStream::socket() const
     return d->socket;
 }
 
+/// Sets whether the contents of the traffic are hidden from the traffic
+/// recorder, for instance while credentials are exchanged. Only the size
+/// of the data is recorded.
+///
+/// The stream stops being redacted when it restarts.
+///
+/// \param redacted
+
+void QXmppStream::setTrafficRedacted(bool redacted)
+{
+    d->redactTraffic = redacted;
+}
+
 /// Sets the QSslSocket used for this stream.
 ///
 
@@ -173,6 +662,8 @@ void QXmppStream::setSocket(QSslSocket *socket)
     d->socket = socket;
     if (!d->socket)
         return;
+    if (d->byteRate || d->stanzaRate)
+        d->socket->setReadBufferSize(qMax(d->byteRate, 65536));
 
     // socket events
     check = connect(socket, SIGNAL(connected()),
@@ -190,6 +681,33 @@ void QXmppStream::setSocket(QSslSocket *socket)
     check = connect(socket, SIGNAL(readyRead()),
                     this, SLOT(_q_socketReadyRead()));
     Q_ASSERT(check);
+
+    check = connect(socket, SIGNAL(bytesWritten(qint64)),
+                    this, SLOT(_q_socketBytesWritten()));
+    Q_ASSERT(check);
+}
+
+/// \cond
+void QXmppStream::timerEvent(QTimerEvent *event)
+{
+    if (event->timerId() == d->compactTimer.timerId()) {
+        d->compactTimer.stop();
+        compact();
+    } else if (event->timerId() == d->throttleTimer.timerId()) {
+        d->throttleTimer.stop();
+        updateCounter("stream.throttled-time", d->throttleClock.elapsed());
+        if (d->socket && (d->stanzasThrottled || d->socket->bytesAvailable()))
+            _q_socketReadyRead();
+    } else {
+        QXmppLoggable::timerEvent(event);
+    }
+}
+/// \endcond
+
+void QXmppStream::_q_socketBytesWritten()
+{
+    if (!d->presenceQueue.isEmpty())
+        d->flushPresence(presenceWindow);
 }
 
 void QXmppStream::_q_socketConnected()
@@ -214,11 +732,68 @@ void QXmppStream::_q_socketError(QAbstractSocket::SocketError socketError)
 {
     Q_UNUSED(socketError);
     warning(QString("Socket error: " + socket()->errorString()));
+    QXmppTrafficRecorder::captureError(d->serial);
 }
 
 void QXmppStream::_q_socketReadyRead()
 {
-    d->dataBuffer.append(d->socket->readAll());
+    // data stays in the socket while the peer is throttled
+    if (d->throttleTimer.isActive())
+        return;
+
+    if (!d->byteRate && !d->stanzaRate) {
+        const QByteArray data = d->socket->readAll();
+        d->capture(QXmppTrafficRecorder::Received, data);
+        d->dataBuffer.append(data);
+        d->touch(this);
+        handleData();
+        return;
+    }
+
+    // stanzas held back by the stanza budget go first
+    d->refill();
+    d->stanzasThrottled = false;
+    if (!d->pendingStanza.isNull()) {
+        const QDomElement element = d->pendingStanza;
+        d->pendingStanza = QDomElement();
+        d->pendingDocument = QDomDocument();
+        handleStanzas(element);
+    }
+
+    // read within the byte budget, then pause until the debt is paid off
+    if (!d->stanzasThrottled) {
+        const QByteArray data = d->byteRate ? d->socket->read(qMax(qint64(1), d->byteTokens / 1000)) : d->socket->readAll();
+        if (!data.isEmpty()) {
+            d->capture(QXmppTrafficRecorder::Received, data);
+            d->dataBuffer.append(data);
+            d->touch(this);
+        }
+        handleData();
+        if (d->byteRate)
+            d->byteTokens -= qint64(data.size()) * 1000;
+    }
+
+    qint64 wait = 0;
+    if (d->byteRate && d->byteTokens <= 0)
+        wait = qMax(wait, 1 - d->byteTokens / d->byteRate);
+    if (d->stanzasThrottled)
+        wait = qMax(wait, 1 + (1000 - d->stanzaTokens) / d->stanzaRate);
+    if (wait > 0) {
+        updateCounter("stream.throttled");
+        d->throttleClock.start();
+        d->throttleTimer.start(int(wait), this);
+    }
+}
+
+void QXmppStream::handleData()
+{
+    if (QXmppTracer::activeTracer())
+        d->readTime = QXmppTracer::now();
+
+    if (d->webSocket) {
+        handleWebSocketFrames();
+        return;
+    }
 
     // handle whitespace pings
     if (!d->dataBuffer.isEmpty() && d->dataBuffer.trimmed().isEmpty()) {
@@ -259,11 +834,160 @@ void QXmppStream::_q_socketReadyRead()
         handleStream(doc.documentElement());
 
     // process stanzas
-    QDomElement nodeRecv = doc.documentElement().firstChildElement();
-    while (!nodeRecv.isNull()) {
-        handleStanza(nodeRecv);
-        nodeRecv = nodeRecv.nextSiblingElement();
+    handleStanzas(doc.documentElement().firstChildElement());
+}
+
+/// Dispatches \a element and the elements following it. If the stanza
+/// budget runs out, the remaining elements are held back until it is
+/// refilled.
+
+void QXmppStream::handleStanzas(QDomElement element)
+{
+    while (!element.isNull()) {
+        if (!d->takeStanzaToken()) {
+            d->pendingDocument = element.ownerDocument();
+            d->pendingStanza = element;
+            return;
+        }
+        dispatchStanza(element);
+        element = element.nextSiblingElement();
+    }
+}
+
+/// Passes a stanza to handleStanza(), tracing it if a tracer is active.
+///
+/// The stanzas of a read are parsed together, so each stanza's parse stage
+/// ends when it is taken for dispatch.
+
+void QXmppStream::dispatchStanza(const QDomElement &element)
+{
+    QXmppTracer *tracer = QXmppTracer::activeTracer();
+    if (tracer) {
+        tracer->begin(element, d->readTime, QXmppTracer::now());
+        handleStanza(element);
+        if ((tracer = QXmppTracer::activeTracer()))
+            tracer->end();
+    } else {
+        handleStanza(element);
+    }
+}
+
+
+
+void QXmppStream::handleWebSocketFrames()
+{
+    forever {
+        const int size = d->dataBuffer.size();
+        if (size < 2)
+            return;
+
+        // frames stay in the buffer while the stanza budget is spent
+        if (d->stanzaRate && d->stanzaTokens < 1000) {
+            d->stanzasThrottled = true;
+            return;
+        }
+
+        // parse frame header
+        const uchar *header = reinterpret_cast<const uchar*>(d->dataBuffer.constData());
+        const bool fin = header[0] & 0x80;
+        const quint8 opcode = header[0] & 0x0f;
+        const bool masked = header[1] & 0x80;
+        quint64 length = header[1] & 0x7f;
+        int offset = 2;
+        if (length == 126) {
+            if (size < 4)
+                return;
+            length = (quint64(header[2]) << 8) | header[3];
+            offset = 4;
+        } else if (length == 127) {
+            if (size < 10)
+                return;
+            length = 0;
+            for (int i = 2; i < 10; ++i)
+                length = (length << 8) | header[i];
+            offset = 10;
+        }
+        if (length + d->messageBuffer.size() > webSocketMessageLimit) {
+            warning("WebSocket message exceeds size limit");
+            d->dataBuffer.clear();
+            disconnectFromHost();
+            return;
+        }
+        if (!masked) {
+            // clients must mask their frames (RFC 6455 section 5.1)
+            warning("Received an unmasked WebSocket frame");
+            d->dataBuffer.clear();
+            d->socket->write(webSocketFrame(CloseFrame, QByteArray("\x03\xea", 2)));
+            d->socket->flush();
+            d->socket->disconnectFromHost();
+            return;
+        }
+        const int maskOffset = offset;
+        offset += 4;
+        if (quint64(size) < offset + length)
+            return;
+
+        // extract payload
+        QByteArray payload = d->dataBuffer.mid(offset, int(length));
+        const char *mask = d->dataBuffer.constData() + maskOffset;
+        char *data = payload.data();
+        for (int i = 0; i < payload.size(); ++i)
+            data[i] ^= mask[i % 4];
+        d->dataBuffer.remove(0, offset + int(length));
+
+        switch (opcode) {
+        case ContinuationFrame:
+        case TextFrame:
+        case BinaryFrame:
+            if (fin && d->messageBuffer.isEmpty()) {
+                handleWebSocketMessage(payload);
+            } else {
+                d->messageBuffer.append(payload);
+                if (fin) {
+                    const QByteArray message = d->messageBuffer;
+                    d->messageBuffer.clear();
+                    handleWebSocketMessage(message);
+                }
+            }
+            break;
+        case CloseFrame:
+            d->dataBuffer.clear();
+            d->socket->write(webSocketFrame(CloseFrame, payload.left(2)));
+            d->socket->flush();
+            d->socket->disconnectFromHost();
+            return;
+        case PingFrame:
+            d->socket->write(webSocketFrame(PongFrame, payload));
+            d->touch(this);
+            handlePing();
+            break;
+        default:
+            break;
+        }
     }
 }
 
+void QXmppStream::handleWebSocketMessage(const QByteArray &message)
+{
+    logReceived(QString::fromUtf8(message));
+
+    // the message is a complete document, parse it as is
+    QDomDocument doc;
+    if (!doc.setContent(message, true)) {
+        QXmppTrafficRecorder::captureError(d->serial);
+        sendData("<stream:error><not-well-formed xmlns='urn:ietf:params:xml:ns:xmpp-streams'/></stream:error>");
+        disconnectFromHost();
+        return;
+    }
 
+    const QDomElement element = doc.documentElement();
+    if (element.namespaceURI() == ns_framing) {
+        if (element.tagName() == QLatin1String("open"))
+            handleStream(element);
+        else if (element.tagName() == QLatin1String("close"))
+            disconnectFromHost();
+    } else {
+        d->takeStanzaToken();
+        dispatchStanza(element);
+    }
+}
@@ -52,6 +52,20 @@ public:
     bool requireStartEncryption();
     void setRequireStartEncryption(bool);
 
+    int compactTimeout() const;
+    void setCompactTimeout(int secs);
+
+    bool isWebSocket() const;
+    void setWebSocket(bool webSocket);
+
+    int byteRateLimit() const;
+    void setByteRateLimit(int bytesPerSecond);
+
+    int stanzaRateLimit() const;
+    void setStanzaRateLimit(int stanzasPerSecond);
+
+    quint32 serial() const;
+
 signals:
     /// This signal is emitted when the stream is connected.
     void connected();
@@ -63,8 +77,11 @@ protected:
     // Access to underlying socket
     QSslSocket *socket() const;
     void setSocket(QSslSocket *socket);
+    void setTrafficRedacted(bool redacted);
 
     // Overridable methods
+    virtual void compact();
+    virtual void handlePing();
     virtual void handleStart();
 
     /// Handles an incoming XMPP stanza.
@@ -77,17 +94,28 @@ protected:
     /// \param element
     virtual void handleStream(const QDomElement &element) = 0;
 
+    /// \cond
+    void timerEvent(QTimerEvent *event);
+    /// \endcond
+
 public slots:
     virtual void disconnectFromHost();
     virtual bool sendData(const QByteArray&);
 
 private slots:
+    void _q_socketBytesWritten();
     void _q_socketConnected();
     void _q_socketEncrypted();
     void _q_socketError(QAbstractSocket::SocketError error);
     void _q_socketReadyRead();
 
 private:
+    void dispatchStanza(const QDomElement &element);
+    void handleData();
+    void handleStanzas(QDomElement element);
+    void handleWebSocketFrames();
+    void handleWebSocketMessage(const QByteArray &message);
+
     QXmppStreamPrivate * const d;
 };
 
@@ -30,6 +30,7 @@ QXmppStreamFeatures::QXmppStreamFeatures()
     : m_bindMode(Disabled),
     m_sessionMode(Disabled),
     m_nonSaslAuthMode(Disabled),
+    m_rosterVersionMode(Disabled),
     m_tlsMode(Disabled)
 {
 }
@@ -64,6 +65,16 @@ void QXmppStreamFeatures::setNonSaslAuthMode(QXmppStreamFeatures::Mode mode)
     m_nonSaslAuthMode = mode;
 }
 
+QXmppStreamFeatures::Mode QXmppStreamFeatures::rosterVersionMode() const
+{
+    return m_rosterVersionMode;
+}
+
+void QXmppStreamFeatures::setRosterVersionMode(QXmppStreamFeatures::Mode mode)
+{
+    m_rosterVersionMode = mode;
+}
+
 QStringList QXmppStreamFeatures::authMechanisms() const
 {
     return m_authMechanisms;
@@ -120,6 +131,7 @@ void QXmppStreamFeatures::parse(const QDomElement &element)
     m_bindMode = readFeature(element, "bind", ns_bind);
     m_sessionMode = readFeature(element, "session", ns_session);
     m_nonSaslAuthMode = readFeature(element, "auth", ns_authFeature);
+    m_rosterVersionMode = readFeature(element, "ver", ns_rosterver);
     m_tlsMode = readFeature(element, "starttls", ns_tls);
 
     // parse advertised compression methods
@@ -164,6 +176,7 @@ void QXmppStreamFeatures::toXml(QXmlStreamWriter *writer) const
     writeFeature(writer, "bind", ns_bind, m_bindMode);
     writeFeature(writer, "session", ns_session, m_sessionMode);
     writeFeature(writer, "auth", ns_authFeature, m_nonSaslAuthMode);
+    writeFeature(writer, "ver", ns_rosterver, m_rosterVersionMode);
     writeFeature(writer, "starttls", ns_tls, m_tlsMode);
 
     if (!m_compressionMethods.isEmpty())
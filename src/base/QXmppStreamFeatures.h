@@ -47,6 +47,9 @@ public:
     Mode nonSaslAuthMode() const;
     void setNonSaslAuthMode(Mode mode);
 
+    Mode rosterVersionMode() const;
+    void setRosterVersionMode(Mode mode);
+
     QStringList authMechanisms() const;
     void setAuthMechanisms(const QStringList &mechanisms);
 
@@ -67,6 +70,7 @@ private:
     Mode m_bindMode;
     Mode m_sessionMode;
     Mode m_nonSaslAuthMode;
+    Mode m_rosterVersionMode;
     Mode m_tlsMode;
     QStringList m_authMechanisms;
     QStringList m_compressionMethods;
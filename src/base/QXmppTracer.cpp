@@ -0,0 +1,287 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QDomElement>
+#include <QElapsedTimer>
+#include <QStringList>
+#include <QThreadStorage>
+
+#include "QXmppTracer.h"
+
+class QXmppTracerSlot
+{
+public:
+    QXmppTracerSlot() : tracer(0) {}
+    QXmppTracer *tracer;
+};
+
+// the enabled tracer of each thread
+static QThreadStorage<QXmppTracerSlot*> activeTracers;
+
+static QXmppTracer *&activeSlot()
+{
+    if (!activeTracers.hasLocalData())
+        activeTracers.setLocalData(new QXmppTracerSlot);
+    return activeTracers.localData()->tracer;
+}
+
+// the monotonic clock for all threads, started during static
+// initialization so that it is never started concurrently
+class QXmppTracerClock : public QElapsedTimer
+{
+public:
+    QXmppTracerClock() { start(); }
+};
+
+static const QXmppTracerClock tracerClock;
+
+static const int stageCount = QXmppTracer::WriteStage + 1;
+static const int bucketCount = 32;
+
+static const char *stageName(int stage)
+{
+    switch (stage)
+    {
+    case QXmppTracer::ReadStage:
+        return "read";
+    case QXmppTracer::ParseStage:
+        return "parse";
+    case QXmppTracer::DispatchStage:
+        return "dispatch";
+    case QXmppTracer::ExtensionStage:
+        return "extensions";
+    case QXmppTracer::RouteStage:
+        return "route";
+    case QXmppTracer::SendStage:
+        return "send";
+    case QXmppTracer::WriteStage:
+        return "write";
+    default:
+        return "";
+    }
+}
+
+class QXmppTracerPrivate
+{
+public:
+    QXmppTracerPrivate();
+
+    int depth;
+    int slowThreshold;
+    QString stanza;
+    qint64 stamps[stageCount];
+    qint64 histograms[stageCount][bucketCount];
+};
+
+QXmppTracerPrivate::QXmppTracerPrivate()
+    : depth(0),
+    slowThreshold(0)
+{
+    for (int i = 0; i < stageCount; ++i) {
+        stamps[i] = -1;
+        for (int j = 0; j < bucketCount; ++j)
+            histograms[i][j] = 0;
+    }
+}
+
+/// Constructs a new tracer, which is initially disabled.
+///
+/// \param parent
+
+QXmppTracer::QXmppTracer(QObject *parent)
+    : QXmppLoggable(parent)
+{
+    d = new QXmppTracerPrivate;
+}
+
+/// Destroys the tracer, disabling it if needed.
+///
+/// The tracer must be destroyed in the thread it was enabled in.
+
+QXmppTracer::~QXmppTracer()
+{
+    QXmppTracer *&active = activeSlot();
+    if (active == this)
+        active = 0;
+    delete d;
+}
+
+/// Returns the tracer enabled in the current thread, or 0 if tracing is
+/// disabled.
+
+QXmppTracer *QXmppTracer::activeTracer()
+{
+    return activeTracers.hasLocalData() ? activeTracers.localData()->tracer : 0;
+}
+
+/// Records that the stanza being processed in the current thread reached
+/// \a stage.
+///
+/// \param stage
+
+void QXmppTracer::trace(QXmppTracer::Stage stage)
+{
+    QXmppTracer *tracer = activeTracer();
+    if (tracer)
+        tracer->mark(stage);
+}
+
+/// Returns true if this tracer is enabled in the current thread.
+
+bool QXmppTracer::isEnabled() const
+{
+    return activeTracer() == this;
+}
+
+/// Enables or disables the tracer for the streams of the current thread.
+///
+/// Enabling a tracer disables any other tracer enabled in the current
+/// thread.
+///
+/// \param enabled
+
+void QXmppTracer::setEnabled(bool enabled)
+{
+    QXmppTracer *&active = activeSlot();
+    if (enabled) {
+        active = this;
+    } else if (active == this) {
+        active = 0;
+        d->depth = 0;
+    }
+}
+
+/// Returns the processing time in microseconds above which a stanza is
+/// logged, or 0 if slow stanzas are not logged.
+
+int QXmppTracer::slowThreshold() const
+{
+    return d->slowThreshold;
+}
+
+/// Sets the processing time in microseconds above which a stanza is
+/// logged with the time spent in each stage.
+///
+/// A value of 0 disables logging, which is the default.
+///
+/// \param usecs
+
+void QXmppTracer::setSlowThreshold(int usecs)
+{
+    d->slowThreshold = qMax(0, usecs);
+}
+
+/// Returns the histogram of the time stanzas spent reaching \a stage
+/// from the previous stage.
+///
+/// Bucket \c i counts durations of less than 2^(i + 1) microseconds,
+/// but at least 2^i for i > 0.
+///
+/// \param stage
+
+QList<qint64> QXmppTracer::histogram(QXmppTracer::Stage stage) const
+{
+    QList<qint64> buckets;
+    if (stage >= 0 && stage < stageCount) {
+        for (int i = 0; i < bucketCount; ++i)
+            buckets << d->histograms[stage][i];
+    }
+    return buckets;
+}
+
+/// Clears the histograms.
+
+void QXmppTracer::reset()
+{
+    for (int i = 0; i < stageCount; ++i)
+        for (int j = 0; j < bucketCount; ++j)
+            d->histograms[i][j] = 0;
+}
+
+/// \cond
+qint64 QXmppTracer::now()
+{
+#if (QT_VERSION >= QT_VERSION_CHECK(4, 8, 0))
+    return tracerClock.nsecsElapsed() / 1000;
+#else
+    return tracerClock.elapsed() * 1000;
+#endif
+}
+
+/// Starts the trace of a stanza which was read and parsed at the given
+/// times.
+
+void QXmppTracer::begin(const QDomElement &element, qint64 readTime, qint64 parseTime)
+{
+    // stanzas produced while handling a stanza belong to its trace
+    if (d->depth++ > 0)
+        return;
+
+    for (int i = 0; i < stageCount; ++i)
+        d->stamps[i] = -1;
+    d->stamps[ReadStage] = readTime;
+    d->stamps[ParseStage] = parseTime;
+    if (d->slowThreshold > 0)
+        d->stanza = QString("%1 from '%2' to '%3'").arg(element.tagName(), element.attribute("from"), element.attribute("to"));
+}
+
+/// Ends the trace of the current stanza, recording the time spent in
+/// each stage.
+
+void QXmppTracer::end()
+{
+    if (d->depth == 0 || --d->depth > 0)
+        return;
+
+    qint64 previous = d->stamps[ReadStage];
+    qint64 last = previous;
+    QStringList stages;
+    for (int i = ReadStage + 1; i < stageCount; ++i) {
+        const qint64 stamp = d->stamps[i];
+        if (stamp < 0)
+            continue;
+
+        qint64 duration = qMax(qint64(0), stamp - previous);
+        if (d->slowThreshold > 0)
+            stages << QString("%1 %2 us").arg(QLatin1String(stageName(i)), QString::number(duration));
+        int bucket = 0;
+        while (duration > 1 && bucket < bucketCount - 1) {
+            duration >>= 1;
+            bucket++;
+        }
+        d->histograms[i][bucket]++;
+        previous = stamp;
+        last = qMax(last, stamp);
+    }
+
+    const qint64 total = last - d->stamps[ReadStage];
+    if (d->slowThreshold > 0 && total >= d->slowThreshold)
+        warning(QString("Slow %1 took %2 us (%3)").arg(d->stanza, QString::number(total), stages.join(", ")));
+}
+
+void QXmppTracer::mark(QXmppTracer::Stage stage)
+{
+    if (d->depth > 0)
+        d->stamps[stage] = now();
+}
+/// \endcond
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPTRACER_H
+#define QXMPPTRACER_H
+
+#include <QList>
+
+#include "QXmppLogger.h"
+
+class QDomElement;
+class QXmppTracerPrivate;
+
+/// \brief The QXmppTracer class measures the time stanzas spend in each
+/// stage of their processing, from the socket read to the socket write.
+///
+/// Timestamps are taken from a monotonic clock each time a stanza
+/// reaches a stage. When the stanza has been handled, the time spent in
+/// each stage is added to a histogram and stanzas which took longer than
+/// slowThreshold() are logged.
+///
+/// A tracer traces the streams of the thread it was enabled in, and only
+/// one tracer can be enabled per thread. While no tracer is enabled, each
+/// trace point costs a thread-local lookup.
+///
+/// \ingroup Core
+
+class QXMPP_EXPORT QXmppTracer : public QXmppLoggable
+{
+    Q_OBJECT
+
+public:
+    /// This enum describes the stages of a stanza's processing.
+    enum Stage
+    {
+        ReadStage = 0,  ///< The data was read from the socket.
+        ParseStage,     ///< The stanza was parsed and taken for dispatch.
+        DispatchStage,  ///< The stanza was handed to the server.
+        ExtensionStage, ///< The server extensions have handled the stanza.
+        RouteStage,     ///< The server started routing the stanza.
+        SendStage,      ///< The recipient's stream received the data.
+        WriteStage      ///< The data was written to the recipient's socket.
+    };
+
+    QXmppTracer(QObject *parent = 0);
+    ~QXmppTracer();
+
+    bool isEnabled() const;
+    void setEnabled(bool enabled);
+
+    int slowThreshold() const;
+    void setSlowThreshold(int usecs);
+
+    QList<qint64> histogram(QXmppTracer::Stage stage) const;
+    void reset();
+
+    static QXmppTracer *activeTracer();
+    static void trace(QXmppTracer::Stage stage);
+
+    /// \cond
+    static qint64 now();
+    void begin(const QDomElement &element, qint64 readTime, qint64 parseTime);
+    void end();
+    /// \endcond
+
+private:
+    void mark(QXmppTracer::Stage stage);
+
+    QXmppTracerPrivate *d;
+};
+
+#endif
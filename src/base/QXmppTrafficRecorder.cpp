@@ -0,0 +1,359 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QAtomicPointer>
+#include <QDataStream>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QMutex>
+#include <QQueue>
+#include <QSet>
+#include <QtEndian>
+
+#include "QXmppTrafficRecorder.h"
+
+// timestamp, serial, direction and length
+static const int recordHeaderSize = 8 + 4 + 1 + 4;
+static const quint32 dumpVersion = 1;
+
+// minimum number of milliseconds between two dumps caused by errors
+static const int errorDumpInterval = 10000;
+
+// the enabled recorder, and the lock serializing access to recorders
+// since streams of any thread record to it
+static QAtomicPointer<QXmppTrafficRecorder> activeRecorder;
+static QMutex recorderLock(QMutex::Recursive);
+
+static QXmppTrafficRecorder *loadActiveRecorder()
+{
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 0, 0))
+    return activeRecorder.load();
+#else
+    return activeRecorder;
+#endif
+}
+
+class QXmppTrafficRecorderPrivate
+{
+public:
+    QXmppTrafficRecorderPrivate();
+    bool isRecorded(quint32 serial) const;
+    void read(qint64 position, char *data, int size) const;
+    void write(const char *data, int size);
+    void record(quint32 serial, QXmppTrafficRecorder::Direction direction, const QByteArray &data);
+    bool writeDump(const QString &path) const;
+
+    QByteArray ring;
+    qint64 head;
+    QQueue<qint64> records;
+
+    QString errorDumpPath;
+    QElapsedTimer errorDumpClock;
+    int samplingInterval;
+    QSet<quint32> streams;
+};
+
+QXmppTrafficRecorderPrivate::QXmppTrafficRecorderPrivate()
+    : head(0),
+    samplingInterval(1)
+{
+}
+
+/// Returns true if the stream with the given \a serial is recorded.
+
+bool QXmppTrafficRecorderPrivate::isRecorded(quint32 serial) const
+{
+    return streams.contains(serial) || (samplingInterval && !(serial % samplingInterval));
+}
+
+/// Reads \a size bytes starting at the absolute \a position.
+
+void QXmppTrafficRecorderPrivate::read(qint64 position, char *data, int size) const
+{
+    const int offset = int(position % ring.size());
+    const int first = qMin(size, ring.size() - offset);
+    memcpy(data, ring.constData() + offset, first);
+    memcpy(data + first, ring.constData(), size - first);
+}
+
+/// Appends \a size bytes at the head of the ring.
+
+void QXmppTrafficRecorderPrivate::write(const char *data, int size)
+{
+    const int offset = int(head % ring.size());
+    const int first = qMin(size, ring.size() - offset);
+    memcpy(ring.data() + offset, data, first);
+    memcpy(ring.data(), data + first, size - first);
+    head += size;
+}
+
+void QXmppTrafficRecorderPrivate::record(quint32 serial, QXmppTrafficRecorder::Direction direction, const QByteArray &data)
+{
+    // make room for the record, truncating it if it exceeds the capacity
+    const int length = qMin(data.size(), ring.size() - recordHeaderSize);
+    const qint64 end = head + recordHeaderSize + length;
+    while (!records.isEmpty() && end - records.head() > ring.size())
+        records.dequeue();
+
+    uchar header[recordHeaderSize];
+    qToBigEndian<qint64>(QDateTime::currentMSecsSinceEpoch(), header);
+    qToBigEndian<quint32>(serial, header + 8);
+    header[12] = uchar(direction);
+    qToBigEndian<quint32>(length, header + 13);
+
+    records.enqueue(head);
+    write(reinterpret_cast<const char*>(header), recordHeaderSize);
+    write(data.constData(), length);
+}
+
+/// Writes the recorded traffic to the file at \a path, oldest first.
+
+bool QXmppTrafficRecorderPrivate::writeDump(const QString &path) const
+{
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+
+    QDataStream stream(&file);
+    stream.writeRawData("QXMPPCAP", 8);
+    stream << dumpVersion;
+
+    QByteArray record;
+    foreach (qint64 position, records) {
+        char header[recordHeaderSize];
+        read(position, header, recordHeaderSize);
+        const quint32 length = qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(header + 13));
+        record.resize(recordHeaderSize + length);
+        read(position, record.data(), record.size());
+        stream.writeRawData(record.constData(), record.size());
+    }
+    return stream.status() == QDataStream::Ok;
+}
+
+/// Constructs a new traffic recorder, which is initially disabled.
+///
+/// \param parent
+
+QXmppTrafficRecorder::QXmppTrafficRecorder(QObject *parent)
+    : QXmppLoggable(parent)
+{
+    d = new QXmppTrafficRecorderPrivate;
+    setCapacity(4 * 1024 * 1024);
+}
+
+/// Destroys the recorder, disabling it if needed.
+
+QXmppTrafficRecorder::~QXmppTrafficRecorder()
+{
+    QMutexLocker locker(&recorderLock);
+    activeRecorder.testAndSetOrdered(this, 0);
+    delete d;
+}
+
+/// Returns true if this recorder is the enabled one.
+
+bool QXmppTrafficRecorder::isEnabled() const
+{
+    return loadActiveRecorder() == this;
+}
+
+/// Enables or disables the recorder.
+///
+/// Enabling a recorder disables any other enabled recorder.
+///
+/// \param enabled
+
+void QXmppTrafficRecorder::setEnabled(bool enabled)
+{
+    QMutexLocker locker(&recorderLock);
+    if (enabled)
+        activeRecorder.fetchAndStoreOrdered(this);
+    else
+        activeRecorder.testAndSetOrdered(this, 0);
+}
+
+/// Returns the size of the ring buffer in bytes.
+
+int QXmppTrafficRecorder::capacity() const
+{
+    QMutexLocker locker(&recorderLock);
+    return d->ring.size();
+}
+
+/// Sets the size of the ring buffer in bytes, discarding the recorded
+/// traffic.
+///
+/// The default is 4 MiB.
+///
+/// \param bytes
+
+void QXmppTrafficRecorder::setCapacity(int bytes)
+{
+    QMutexLocker locker(&recorderLock);
+    d->ring = QByteArray(qMax(bytes, recordHeaderSize + 1), '\0');
+    d->head = 0;
+    d->records.clear();
+}
+
+/// Returns the path of the file the traffic is dumped to when an error
+/// occurs on a recorded stream.
+
+QString QXmppTrafficRecorder::errorDumpPath() const
+{
+    QMutexLocker locker(&recorderLock);
+    return d->errorDumpPath;
+}
+
+/// Sets the path of the file the traffic is dumped to when an error
+/// occurs on a recorded stream.
+///
+/// The file is overwritten at most once every 10 seconds. An empty path
+/// disables dumps on errors, which is the default.
+///
+/// \param path
+
+void QXmppTrafficRecorder::setErrorDumpPath(const QString &path)
+{
+    QMutexLocker locker(&recorderLock);
+    d->errorDumpPath = path;
+}
+
+/// Returns the interval at which streams are sampled for recording.
+
+int QXmppTrafficRecorder::samplingInterval() const
+{
+    QMutexLocker locker(&recorderLock);
+    return d->samplingInterval;
+}
+
+/// Sets the interval at which streams are sampled for recording: one
+/// stream out of every \a interval is recorded.
+///
+/// The default is 1, which records all streams. A value of 0 records
+/// only the streams added with addStream().
+///
+/// \param interval
+
+void QXmppTrafficRecorder::setSamplingInterval(int interval)
+{
+    QMutexLocker locker(&recorderLock);
+    d->samplingInterval = qMax(0, interval);
+}
+
+/// Records the stream with the given \a serial number regardless of
+/// sampling.
+///
+/// \sa QXmppStream::serial()
+///
+/// \param serial
+
+void QXmppTrafficRecorder::addStream(quint32 serial)
+{
+    QMutexLocker locker(&recorderLock);
+    d->streams.insert(serial);
+}
+
+/// Stops recording the stream with the given \a serial number, unless
+/// it is sampled.
+///
+/// \param serial
+
+void QXmppTrafficRecorder::removeStream(quint32 serial)
+{
+    QMutexLocker locker(&recorderLock);
+    d->streams.remove(serial);
+}
+
+/// Writes the recorded traffic to the file at \a path, oldest first.
+///
+/// Returns true if the dump succeeded.
+///
+/// \param path
+
+bool QXmppTrafficRecorder::dump(const QString &path) const
+{
+    QMutexLocker locker(&recorderLock);
+    if (!d->writeDump(path)) {
+        const_cast<QXmppTrafficRecorder*>(this)->warning(QString("Could not write traffic dump %1").arg(path));
+        return false;
+    }
+    return true;
+}
+
+/// Discards the recorded traffic.
+
+void QXmppTrafficRecorder::clear()
+{
+    QMutexLocker locker(&recorderLock);
+    d->head = 0;
+    d->records.clear();
+}
+
+/// Records \a data exchanged on the stream with the given \a serial
+/// number, if a recorder is enabled.
+///
+/// This method can be called from any thread.
+///
+/// \param serial
+/// \param direction
+/// \param data
+
+void QXmppTrafficRecorder::capture(quint32 serial, QXmppTrafficRecorder::Direction direction, const QByteArray &data)
+{
+    if (!loadActiveRecorder())
+        return;
+
+    QMutexLocker locker(&recorderLock);
+    QXmppTrafficRecorder *recorder = loadActiveRecorder();
+    if (recorder && recorder->d->isRecorded(serial))
+        recorder->d->record(serial, direction, data);
+}
+
+/// Reports an error on the stream with the given \a serial number,
+/// if a recorder is enabled.
+///
+/// This method can be called from any thread.
+///
+/// \param serial
+
+void QXmppTrafficRecorder::captureError(quint32 serial)
+{
+    if (!loadActiveRecorder())
+        return;
+
+    QMutexLocker locker(&recorderLock);
+    QXmppTrafficRecorder *recorder = loadActiveRecorder();
+    if (!recorder || !recorder->d->isRecorded(serial))
+        return;
+
+    QXmppTrafficRecorderPrivate *priv = recorder->d;
+    if (priv->errorDumpPath.isEmpty() || priv->records.isEmpty())
+        return;
+    if (priv->errorDumpClock.isValid() && priv->errorDumpClock.elapsed() < errorDumpInterval)
+        return;
+
+    priv->errorDumpClock.start();
+    if (priv->writeDump(priv->errorDumpPath))
+        recorder->info(QString("Dumped traffic to %1 after an error on stream %2").arg(priv->errorDumpPath, QString::number(serial)));
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPTRAFFICRECORDER_H
+#define QXMPPTRAFFICRECORDER_H
+
+#include "QXmppLogger.h"
+
+class QXmppTrafficRecorderPrivate;
+
+/// \brief The QXmppTrafficRecorder class keeps the most recent raw XMPP
+/// traffic in a fixed-size ring buffer, which can be dumped to a file.
+///
+/// Unlike logging, recording only copies the bytes exchanged on a stream
+/// along with a timestamp and the stream's serial number, so it can stay
+/// enabled in production. All streams can be recorded, one stream out of
+/// every samplingInterval(), or just the streams added with addStream().
+///
+/// The dump starts with the 8 bytes "QXMPPCAP" followed by a 32-bit
+/// version, then each record holds a 64-bit timestamp in milliseconds
+/// since the epoch, the 32-bit stream serial number, an 8-bit direction
+/// and the 32-bit length of the data followed by the data, all in big
+/// endian order.
+///
+/// Only one recorder can be enabled at a time, and it records the streams
+/// of all threads. While no recorder is enabled, each capture point costs
+/// a single atomic pointer load.
+///
+/// \ingroup Core
+
+class QXMPP_EXPORT QXmppTrafficRecorder : public QXmppLoggable
+{
+    Q_OBJECT
+
+public:
+    /// This enum describes the direction of recorded data.
+    enum Direction
+    {
+        Received = 0,   ///< The data was received from the peer.
+        Sent = 1        ///< The data was sent to the peer.
+    };
+
+    QXmppTrafficRecorder(QObject *parent = 0);
+    ~QXmppTrafficRecorder();
+
+    bool isEnabled() const;
+    void setEnabled(bool enabled);
+
+    int capacity() const;
+    void setCapacity(int bytes);
+
+    QString errorDumpPath() const;
+    void setErrorDumpPath(const QString &path);
+
+    int samplingInterval() const;
+    void setSamplingInterval(int interval);
+
+    void addStream(quint32 serial);
+    void removeStream(quint32 serial);
+
+    bool dump(const QString &path) const;
+    void clear();
+
+    static void capture(quint32 serial, QXmppTrafficRecorder::Direction direction, const QByteArray &data);
+    static void captureError(quint32 serial);
+
+private:
+    QXmppTrafficRecorderPrivate *d;
+};
+
+#endif
@@ -31,6 +31,8 @@ INSTALL_HEADERS += \
     base/QXmppStream.h \
     base/QXmppStreamFeatures.h \
     base/QXmppStun.h \
+    base/QXmppTracer.h \
+    base/QXmppTrafficRecorder.h \
     base/QXmppUtils.h \
     base/QXmppVCardIq.h \
     base/QXmppVersionIq.h
@@ -76,6 +78,8 @@ SOURCES += \
     base/QXmppStreamFeatures.cpp \
     base/QXmppStreamInitiationIq.cpp \
     base/QXmppStun.cpp \
+    base/QXmppTracer.cpp \
+    base/QXmppTrafficRecorder.cpp \
     base/QXmppUtils.cpp \
     base/QXmppVCardIq.cpp \
     base/QXmppVersionIq.cpp
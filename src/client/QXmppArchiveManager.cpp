@@ -21,12 +21,368 @@
  *
  */
 
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
 #include <QDomElement>
+#include <QFile>
 
 #include "QXmppArchiveIq.h"
 #include "QXmppArchiveManager.h"
 #include "QXmppClient.h"
 #include "QXmppConstants.h"
+#include "QXmppUtils.h"
+
+static const quint32 indexMagic = 0x51415249;
+static const quint32 collectionMagic = 0x51415243;
+static const quint32 cacheFormat = 2;
+
+class QXmppArchiveCacheEntry
+{
+public:
+    // the collection, without its messages
+    QXmppArchiveChat chat;
+    quint32 count;
+
+    // file offsets of the pages, by index of their first message
+    QMap<quint32, qint64> pages;
+};
+
+class QXmppArchiveStream
+{
+public:
+    QXmppArchiveStream();
+    ~QXmppArchiveStream();
+
+    QString jid;
+    QDateTime start;
+    QDateTime end;
+    int pageSize;
+
+    // id of the pending list request
+    QString listId;
+
+    // collections which were listed but not retrieved yet, and the start
+    // of the newest collection listed for each bare JID
+    QList<QXmppArchiveChat> pending;
+    QHash<QString, QDateTime> newest;
+
+    // whether delivery of the cached collections resumes later
+    bool advancePending;
+
+    // collection being retrieved and the id of the pending request for
+    // its next page
+    QXmppArchiveChat chat;
+    QString chatId;
+
+    // file the messages of the collection are appended to if it is to be
+    // cached, the number of messages written to it and where its pages
+    // start
+    QFile *file;
+    quint32 count;
+    QMap<quint32, qint64> pages;
+};
+
+QXmppArchiveStream::QXmppArchiveStream()
+    : pageSize(0),
+    advancePending(false),
+    file(0),
+    count(0)
+{
+}
+
+QXmppArchiveStream::~QXmppArchiveStream()
+{
+    // an incomplete collection is not kept
+    if (file) {
+        file->remove();
+        delete file;
+    }
+}
+
+class QXmppArchiveManagerPrivate
+{
+public:
+    QXmppArchiveManagerPrivate();
+    QString collectionPath(const QString &bareJid, const QDateTime &start) const;
+    QString indexPath() const;
+    const QXmppArchiveCacheEntry *cacheEntry(const QXmppArchiveChat &chat, const QXmppArchiveStream *stream) const;
+    bool appendIndex(const QXmppArchiveCacheEntry &entry);
+    bool loadIndex();
+    bool saveIndex();
+    void startCollection(QXmppArchiveStream *stream, const QString &streamId);
+    bool finishCollection(QXmppArchiveStream *stream);
+
+    QHash<QString, QXmppArchiveStream*> streams;
+
+    // ids of the streams, by id of their pending requests
+    QHash<QString, QString> requests;
+
+    // cached collections, by bare JID and start time, and the number of
+    // index records which were superseded
+    QString cachePath;
+    QHash<QString, QMap<QDateTime, QXmppArchiveCacheEntry> > collections;
+    int staleRecords;
+};
+
+QXmppArchiveManagerPrivate::QXmppArchiveManagerPrivate()
+    : staleRecords(0)
+{
+}
+
+/// Returns the path of the file holding the messages of a collection.
+
+QString QXmppArchiveManagerPrivate::collectionPath(const QString &bareJid, const QDateTime &start) const
+{
+    const QByteArray key = bareJid.toUtf8() + '/' + QByteArray::number(start.toTime_t());
+    const QByteArray hash = QCryptographicHash::hash(key, QCryptographicHash::Sha1);
+    return QDir(cachePath).filePath("collections/" + QString::fromLatin1(hash.toHex()));
+}
+
+QString QXmppArchiveManagerPrivate::indexPath() const
+{
+    return QDir(cachePath).filePath("archive.idx");
+}
+
+/// Returns the cache entry of the given version of a collection listed by
+/// a stream, or 0 if it is not cached or may have changed.
+
+const QXmppArchiveCacheEntry *QXmppArchiveManagerPrivate::cacheEntry(const QXmppArchiveChat &chat, const QXmppArchiveStream *stream) const
+{
+    if (cachePath.isEmpty())
+        return 0;
+
+    const QString bareJid = QXmppUtils::jidToBareJid(chat.with());
+    QHash<QString, QMap<QDateTime, QXmppArchiveCacheEntry> >::const_iterator it = collections.constFind(bareJid);
+    if (it == collections.constEnd())
+        return 0;
+    QMap<QDateTime, QXmppArchiveCacheEntry>::const_iterator jt = it.value().constFind(chat.start());
+    if (jt == it.value().constEnd() || jt.value().chat.version() != chat.version())
+        return 0;
+
+    // without a version, only the newest collection with a contact can
+    // still receive messages, so it is always retrieved again
+    if (!chat.version()) {
+        const QDateTime newest = stream->newest.value(bareJid);
+        if (!newest.isValid() || chat.start() >= newest)
+            return 0;
+    }
+    return &jt.value();
+}
+
+static void writeIndexRecord(QDataStream &stream, const QXmppArchiveCacheEntry &entry)
+{
+    stream << entry.chat.with() << entry.chat.start() << entry.chat.subject()
+           << entry.chat.thread() << qint32(entry.chat.version()) << entry.count
+           << entry.pages;
+}
+
+/// Appends the record of a collection to the index, superseding any
+/// previous record of the same collection.
+
+bool QXmppArchiveManagerPrivate::appendIndex(const QXmppArchiveCacheEntry &entry)
+{
+    QFile file(indexPath());
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append))
+        return false;
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_4_6);
+    if (!file.size())
+        stream << indexMagic << cacheFormat;
+    writeIndexRecord(stream, entry);
+    return stream.status() == QDataStream::Ok;
+}
+
+/// Replaces the collections with the records of the index.
+
+bool QXmppArchiveManagerPrivate::loadIndex()
+{
+    QFile file(indexPath());
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_4_6);
+    quint32 magic, format;
+    stream >> magic >> format;
+    if (magic != indexMagic || format != cacheFormat)
+        return false;
+
+    QHash<QString, QMap<QDateTime, QXmppArchiveCacheEntry> > indexCollections;
+    int stale = 0;
+    while (!stream.atEnd() && stream.status() == QDataStream::Ok) {
+        QString with, subject, thread;
+        QDateTime start;
+        qint32 version;
+        QXmppArchiveCacheEntry entry;
+        stream >> with >> start >> subject >> thread >> version >> entry.count
+               >> entry.pages;
+        if (stream.status() != QDataStream::Ok)
+            break;
+
+        entry.chat.setWith(with);
+        entry.chat.setStart(start);
+        entry.chat.setSubject(subject);
+        entry.chat.setThread(thread);
+        entry.chat.setVersion(version);
+        QMap<QDateTime, QXmppArchiveCacheEntry> &chats = indexCollections[QXmppUtils::jidToBareJid(with)];
+        if (chats.contains(start))
+            stale++;
+        chats.insert(start, entry);
+    }
+    if (stream.status() != QDataStream::Ok)
+        return false;
+
+    collections = indexCollections;
+    staleRecords = stale;
+    return true;
+}
+
+/// Rewrites the index without the superseded records.
+
+bool QXmppArchiveManagerPrivate::saveIndex()
+{
+    const QString path = indexPath();
+    QFile file(path + ".tmp");
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_4_6);
+    stream << indexMagic << cacheFormat;
+    foreach (const QMap<QDateTime, QXmppArchiveCacheEntry> &chats, collections) {
+        foreach (const QXmppArchiveCacheEntry &entry, chats)
+            writeIndexRecord(stream, entry);
+    }
+    file.close();
+    if (file.error() != QFile::NoError) {
+        QFile::remove(path + ".tmp");
+        return false;
+    }
+    QFile::remove(path);
+    if (!QFile::rename(path + ".tmp", path))
+        return false;
+    staleRecords = 0;
+    return true;
+}
+
+/// Starts writing the messages of the collection being retrieved by a
+/// stream, if the cache is enabled.
+
+void QXmppArchiveManagerPrivate::startCollection(QXmppArchiveStream *stream, const QString &streamId)
+{
+    delete stream->file;
+    stream->file = 0;
+    stream->count = 0;
+    stream->pages.clear();
+    if (cachePath.isEmpty())
+        return;
+
+    const QString path = collectionPath(QXmppUtils::jidToBareJid(stream->chat.with()), stream->chat.start());
+    stream->file = new QFile(path + "." + streamId);
+    if (!stream->file->open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        delete stream->file;
+        stream->file = 0;
+        return;
+    }
+    QDataStream out(stream->file);
+    out.setVersion(QDataStream::Qt_4_6);
+    out << collectionMagic << cacheFormat;
+}
+
+/// Moves the completely retrieved collection of a stream into the cache.
+
+bool QXmppArchiveManagerPrivate::finishCollection(QXmppArchiveStream *stream)
+{
+    QFile *file = stream->file;
+    stream->file = 0;
+    file->close();
+    if (file->error() != QFile::NoError) {
+        file->remove();
+        delete file;
+        return false;
+    }
+
+    const QString bareJid = QXmppUtils::jidToBareJid(stream->chat.with());
+    const QString path = collectionPath(bareJid, stream->chat.start());
+    QFile::remove(path);
+    const bool renamed = file->rename(path);
+    if (!renamed)
+        file->remove();
+    delete file;
+    if (!renamed)
+        return false;
+
+    QXmppArchiveCacheEntry entry;
+    entry.chat = stream->chat;
+    entry.chat.setMessages(QList<QXmppArchiveMessage>());
+    entry.count = stream->count;
+    entry.pages = stream->pages;
+    QMap<QDateTime, QXmppArchiveCacheEntry> &chats = collections[bareJid];
+    if (chats.contains(entry.chat.start()))
+        staleRecords++;
+    chats.insert(entry.chat.start(), entry);
+    return appendIndex(entry);
+}
+
+/// Opens the file holding the messages of a collection.
+
+static bool openCollection(QFile &file, QDataStream &stream)
+{
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    stream.setDevice(&file);
+    stream.setVersion(QDataStream::Qt_4_6);
+    quint32 magic, format;
+    stream >> magic >> format;
+    return stream.status() == QDataStream::Ok && magic == collectionMagic && format == cacheFormat;
+}
+
+/// Reads up to \a max messages of a collection, or all the remaining
+/// messages if \a max is negative.
+
+static QList<QXmppArchiveMessage> readMessages(QDataStream &stream, int max)
+{
+    QList<QXmppArchiveMessage> messages;
+    while ((max < 0 || messages.size() < max) && !stream.atEnd()) {
+        QString body;
+        QDateTime date;
+        bool received;
+        stream >> body >> date >> received;
+        if (stream.status() != QDataStream::Ok)
+            break;
+
+        QXmppArchiveMessage message;
+        message.setBody(body);
+        message.setDate(date);
+        message.setReceived(received);
+        messages << message;
+    }
+    return messages;
+}
+
+/// Returns true if a result set reply is followed by more items.
+
+static bool hasMorePages(const QXmppResultSetReply &rsm, int size, int pageSize)
+{
+    if (!size || rsm.last().isEmpty())
+        return false;
+    if (rsm.count() >= 0 && rsm.index() >= 0)
+        return rsm.index() + size < rsm.count();
+    return size >= pageSize;
+}
+
+QXmppArchiveManager::QXmppArchiveManager()
+    : d(new QXmppArchiveManagerPrivate)
+{
+}
+
+QXmppArchiveManager::~QXmppArchiveManager()
+{
+    qDeleteAll(d->streams);
+    delete d;
+}
 
 /// \cond
 QStringList QXmppArchiveManager::discoveryFeatures() const
@@ -65,6 +421,212 @@ bool QXmppArchiveManager::handleStanza(const QDomElement &element)
 
     return false;
 }
+
+void QXmppArchiveManager::_q_chatReceived(const QDomElement &element)
+{
+    if (element.attribute("type") != "result") {
+        warning(QString("Could not retrieve archived collection %1").arg(element.attribute("id")));
+        return;
+    }
+    QXmppArchiveChatIq archiveIq;
+    archiveIq.parse(element);
+    emit archiveChatReceived(archiveIq.chat(), archiveIq.resultSetReply());
+}
+
+void QXmppArchiveManager::_q_listReceived(const QDomElement &element)
+{
+    if (element.attribute("type") != "result") {
+        warning(QString("Could not list archived collections %1").arg(element.attribute("id")));
+        return;
+    }
+    QXmppArchiveListIq archiveIq;
+    archiveIq.parse(element);
+    emit archiveListReceived(archiveIq.chats(), archiveIq.resultSetReply());
+}
+
+void QXmppArchiveManager::_q_streamChatReceived(const QDomElement &element)
+{
+    const QString streamId = d->requests.take(element.attribute("id"));
+    QXmppArchiveStream *stream = d->streams.value(streamId);
+    if (!stream)
+        return;
+    stream->chatId.clear();
+
+    if (element.attribute("type") != "result") {
+        warning(QString("Could not retrieve archived collection %1").arg(element.attribute("id")));
+        finishStream(streamId);
+        return;
+    }
+    QXmppArchiveChatIq archiveIq;
+    archiveIq.parse(element);
+    const QList<QXmppArchiveMessage> messages = archiveIq.chat().messages();
+
+    QXmppArchiveChat page = stream->chat;
+    page.setMessages(messages);
+
+    // append the page to the cache
+    if (stream->file) {
+        if (!messages.isEmpty())
+            stream->pages.insert(stream->count, stream->file->pos());
+        QDataStream out(stream->file);
+        out.setVersion(QDataStream::Qt_4_6);
+        foreach (const QXmppArchiveMessage &message, messages)
+            out << message.body() << message.date() << message.isReceived();
+        stream->count += messages.size();
+    }
+
+    // request the next page before delivering this one
+    bool ok = true;
+    if (hasMorePages(archiveIq.resultSetReply(), messages.size(), stream->pageSize)) {
+        ok = requestStreamChat(streamId, archiveIq.resultSetReply().last());
+    } else {
+        if (stream->file && !d->finishCollection(stream))
+            warning(QString("Could not write archive cache %1").arg(d->cachePath));
+        if (!stream->pending.isEmpty() && !d->cacheEntry(stream->pending.first(), stream)) {
+            stream->chat = stream->pending.takeFirst();
+            d->startCollection(stream, streamId);
+            ok = requestStreamChat(streamId, QString());
+        }
+    }
+
+    emit archiveStreamReceived(streamId, page);
+    if (ok)
+        advanceStream(streamId);
+    else if (d->streams.contains(streamId))
+        finishStream(streamId);
+}
+
+void QXmppArchiveManager::_q_streamListReceived(const QDomElement &element)
+{
+    const QString streamId = d->requests.take(element.attribute("id"));
+    QXmppArchiveStream *stream = d->streams.value(streamId);
+    if (!stream)
+        return;
+    stream->listId.clear();
+
+    if (element.attribute("type") != "result") {
+        warning(QString("Could not list archived collections %1").arg(element.attribute("id")));
+        finishStream(streamId);
+        return;
+    }
+    QXmppArchiveListIq archiveIq;
+    archiveIq.parse(element);
+    const QList<QXmppArchiveChat> chats = archiveIq.chats();
+    stream->pending += chats;
+    foreach (const QXmppArchiveChat &chat, chats) {
+        QDateTime &newest = stream->newest[QXmppUtils::jidToBareJid(chat.with())];
+        if (!newest.isValid() || chat.start() > newest)
+            newest = chat.start();
+    }
+
+    // request the next page of the list while the collections are retrieved
+    if (hasMorePages(archiveIq.resultSetReply(), chats.size(), stream->pageSize) &&
+        !requestStreamList(streamId, archiveIq.resultSetReply().last())) {
+        finishStream(streamId);
+        return;
+    }
+    advanceStream(streamId);
+}
+
+/// Delivers the cached collection at the head of the stream, or requests
+/// the collection if it is not cached.
+///
+/// After a cached collection the stream resumes from the event loop, so
+/// that a long run of cached collections does not block the application.
+
+void QXmppArchiveManager::advanceStream(const QString &streamId)
+{
+    QXmppArchiveStream *stream = d->streams.value(streamId);
+    if (!stream || stream->advancePending)
+        return;
+
+    if (stream->chatId.isEmpty() && !stream->pending.isEmpty()) {
+        const QXmppArchiveChat chat = stream->pending.takeFirst();
+        const QXmppArchiveCacheEntry *entry = d->cacheEntry(chat, stream);
+        QFile file(entry ? d->collectionPath(QXmppUtils::jidToBareJid(chat.with()), chat.start()) : QString());
+        QDataStream in;
+        if (entry && openCollection(file, in)) {
+            // read the cached messages one page at a time
+            const QXmppArchiveChat header = entry->chat;
+            int remaining = entry->count;
+            do {
+                QXmppArchiveChat page = header;
+                page.setMessages(readMessages(in, stream->pageSize));
+                remaining -= stream->pageSize;
+                emit archiveStreamReceived(streamId, page);
+                stream = d->streams.value(streamId);
+            } while (stream && remaining > 0);
+
+            if (stream) {
+                stream->advancePending = true;
+                QMetaObject::invokeMethod(this, "_q_advanceStream", Qt::QueuedConnection,
+                                          Q_ARG(QString, streamId));
+            }
+            return;
+        }
+
+        stream->chat = chat;
+        d->startCollection(stream, streamId);
+        if (!requestStreamChat(streamId, QString())) {
+            finishStream(streamId);
+            return;
+        }
+    }
+    if (stream->chatId.isEmpty() && stream->listId.isEmpty())
+        finishStream(streamId);
+}
+
+void QXmppArchiveManager::_q_advanceStream(const QString &streamId)
+{
+    QXmppArchiveStream *stream = d->streams.value(streamId);
+    if (stream) {
+        stream->advancePending = false;
+        advanceStream(streamId);
+    }
+}
+
+void QXmppArchiveManager::finishStream(const QString &streamId)
+{
+    cancelStream(streamId);
+    emit archiveStreamFinished(streamId);
+}
+
+bool QXmppArchiveManager::requestStreamChat(const QString &streamId, const QString &after)
+{
+    QXmppArchiveStream *stream = d->streams.value(streamId);
+    QXmppResultSetQuery rsm;
+    rsm.setMax(stream->pageSize);
+    rsm.setAfter(after);
+
+    QXmppArchiveRetrieveIq packet;
+    packet.setResultSetQuery(rsm);
+    packet.setStart(stream->chat.start());
+    packet.setWith(stream->chat.with());
+    if (!client()->sendIq(packet, this, "_q_streamChatReceived"))
+        return false;
+    stream->chatId = packet.id();
+    d->requests.insert(packet.id(), streamId);
+    return true;
+}
+
+bool QXmppArchiveManager::requestStreamList(const QString &streamId, const QString &after)
+{
+    QXmppArchiveStream *stream = d->streams.value(streamId);
+    QXmppResultSetQuery rsm;
+    rsm.setMax(stream->pageSize);
+    rsm.setAfter(after);
+
+    QXmppArchiveListIq packet;
+    packet.setResultSetQuery(rsm);
+    packet.setWith(stream->jid);
+    packet.setStart(stream->start);
+    packet.setEnd(stream->end);
+    if (!client()->sendIq(packet, this, "_q_streamListReceived"))
+        return false;
+    stream->listId = packet.id();
+    d->requests.insert(packet.id(), streamId);
+    return true;
+}
 /// \endcond
 
 /// Retrieves the list of available collections. Once the results are
@@ -83,7 +645,7 @@ void QXmppArchiveManager::listCollections(const QString& jid, const QDateTime& s
     packet.setWith(jid);
     packet.setStart(start);
     packet.setEnd(end);
-    client()->sendPacket(packet);
+    client()->sendIq(packet, this, "_q_listReceived");
 }
 
 /// \overload
@@ -132,7 +694,7 @@ void QXmppArchiveManager::retrieveCollection(const QString &jid, const QDateTime
     packet.setResultSetQuery(rsm);
     packet.setStart(start);
     packet.setWith(jid);
-    client()->sendPacket(packet);
+    client()->sendIq(packet, this, "_q_chatReceived");
 }
 
 /// \overload
@@ -150,6 +712,164 @@ void QXmppArchiveManager::retrieveCollection(const QString &jid, const QDateTime
     retrieveCollection(jid, start, rsm);
 }
 
+/// Retrieves all the messages exchanged with \a jid between \a start and
+/// \a end, and returns the id of the stream or an empty string if the
+/// request could not be sent.
+///
+/// The collections are listed and their messages retrieved \a pageSize at
+/// a time. The request for a page is sent before the previous one is
+/// delivered with archiveStreamReceived(), so that the network and the
+/// application work in parallel. Once all the messages were delivered,
+/// archiveStreamFinished() is emitted.
+///
+/// If a cache directory is set, the retrieved collections are stored in it
+/// and the collections whose version did not change are delivered from the
+/// cache instead of being retrieved again.
+///
+/// \param jid JID you want conversations with.
+/// \param start Optional start time.
+/// \param end Optional end time.
+/// \param pageSize Maximum number of collections or messages per request.
+///
+QString QXmppArchiveManager::streamCollections(const QString &jid, const QDateTime &start, const QDateTime &end, int pageSize)
+{
+    QXmppArchiveStream *stream = new QXmppArchiveStream;
+    stream->jid = jid;
+    stream->start = start;
+    stream->end = end;
+    stream->pageSize = qMax(1, pageSize);
+
+    const QString streamId = QXmppUtils::generateStanzaHash();
+    d->streams.insert(streamId, stream);
+    if (!requestStreamList(streamId, QString())) {
+        d->streams.remove(streamId);
+        delete stream;
+        return QString();
+    }
+    return streamId;
+}
+
+/// Stops a stream started with streamCollections(). No further signals are
+/// emitted for it.
+///
+/// \param streamId
+
+void QXmppArchiveManager::cancelStream(const QString &streamId)
+{
+    QXmppArchiveStream *stream = d->streams.take(streamId);
+    if (!stream)
+        return;
+    d->requests.remove(stream->listId);
+    d->requests.remove(stream->chatId);
+    delete stream;
+}
+
+/// Returns the path of the directory archived collections are cached in.
+
+QString QXmppArchiveManager::cachePath() const
+{
+    return d->cachePath;
+}
+
+/// Sets the path of the directory archived collections are cached in, and
+/// loads the index of the collections it contains. The messages are read
+/// from the cache when they are needed.
+///
+/// An empty path disables the cache, which is the default.
+///
+/// \param path
+
+void QXmppArchiveManager::setCachePath(const QString &path)
+{
+    if (path == d->cachePath)
+        return;
+
+    d->cachePath = path;
+    d->collections.clear();
+    d->staleRecords = 0;
+    if (path.isEmpty())
+        return;
+
+    if (!QDir().mkpath(QDir(path).filePath("collections"))) {
+        warning(QString("Could not create archive cache %1").arg(path));
+    } else if (QFile::exists(d->indexPath())) {
+        // an unreadable index, for instance from an older version, is
+        // started afresh
+        if (!d->loadIndex()) {
+            warning(QString("Could not read archive cache %1").arg(path));
+            QFile::remove(d->indexPath());
+        }
+        else if (d->staleRecords > 100 && !d->saveIndex())
+            warning(QString("Could not write archive cache %1").arg(path));
+    }
+}
+
+/// Returns the cached collections with \a jid which start between
+/// \a start and \a end, ordered by start time.
+///
+/// The messages of the collections are not loaded, use cachedMessages()
+/// to read them.
+///
+/// \param jid The bare JID of the collections.
+/// \param start Optional start time.
+/// \param end Optional end time.
+
+QList<QXmppArchiveChat> QXmppArchiveManager::cachedCollections(const QString &jid, const QDateTime &start, const QDateTime &end) const
+{
+    QList<QXmppArchiveChat> chats;
+    QHash<QString, QMap<QDateTime, QXmppArchiveCacheEntry> >::const_iterator it = d->collections.constFind(jid);
+    if (it == d->collections.constEnd())
+        return chats;
+
+    QMap<QDateTime, QXmppArchiveCacheEntry>::const_iterator jt = start.isValid() ? it.value().lowerBound(start) : it.value().constBegin();
+    for ( ; jt != it.value().constEnd(); ++jt) {
+        if (end.isValid() && jt.key() > end)
+            break;
+        chats << jt.value().chat;
+    }
+    return chats;
+}
+
+/// Reads up to \a max messages of a cached collection from the cache,
+/// starting at \a index. A negative \a max reads all the remaining
+/// messages.
+///
+/// \param jid The bare JID of the collection.
+/// \param start The start time of the collection.
+/// \param index The index of the first message.
+/// \param max The maximum number of messages.
+
+QList<QXmppArchiveMessage> QXmppArchiveManager::cachedMessages(const QString &jid, const QDateTime &start, int index, int max) const
+{
+    if (d->cachePath.isEmpty())
+        return QList<QXmppArchiveMessage>();
+    QHash<QString, QMap<QDateTime, QXmppArchiveCacheEntry> >::const_iterator it = d->collections.constFind(jid);
+    if (it == d->collections.constEnd())
+        return QList<QXmppArchiveMessage>();
+    QMap<QDateTime, QXmppArchiveCacheEntry>::const_iterator jt = it.value().constFind(start);
+    if (jt == it.value().constEnd())
+        return QList<QXmppArchiveMessage>();
+
+    QFile file(d->collectionPath(jid, start));
+    QDataStream in;
+    if (!openCollection(file, in))
+        return QList<QXmppArchiveMessage>();
+
+    // seek to the page holding the first message, then skip the messages
+    // which precede it in the page
+    int skip = qMax(0, index);
+    QMap<quint32, qint64>::const_iterator page = jt.value().pages.upperBound(quint32(skip));
+    if (page != jt.value().pages.constBegin()) {
+        --page;
+        if (!file.seek(page.value()))
+            return QList<QXmppArchiveMessage>();
+        skip -= page.key();
+    }
+    if (skip > 0)
+        readMessages(in, skip);
+    return readMessages(in, max);
+}
+
 #if 0
 void QXmppArchiveManager::getPreferences()
 {
@@ -32,7 +32,9 @@
 class QXmppArchiveChat;
 class QXmppArchiveChatIq;
 class QXmppArchiveListIq;
+class QXmppArchiveMessage;
 class QXmppArchivePrefIq;
+class QXmppArchiveManagerPrivate;
 
 /// \brief The QXmppArchiveManager class makes it possible to access message
 /// archives as defined by XEP-0136: Message Archiving.
@@ -45,6 +47,16 @@ class QXmppArchivePrefIq;
 /// client->addExtension(manager);
 /// \endcode
 ///
+/// To load a long history without holding it in memory, use streamCollections()
+/// which pages through the collections and their messages in the background
+/// and delivers them with archiveStreamReceived(). If a cache directory is set
+/// with setCachePath(), the collections retrieved by a stream are stored in it,
+/// one file per collection, and later streams skip collections whose version
+/// did not change. Collections without a version are only skipped once a
+/// newer collection with the same contact exists. Only an index of the collections is kept in memory:
+/// cachedCollections() lists them and cachedMessages() reads their messages
+/// from disk a page at a time.
+///
 /// \note Few servers support message archiving. Check if the server in use supports
 /// this XEP.
 ///
@@ -55,6 +67,9 @@ class QXMPP_EXPORT QXmppArchiveManager : public QXmppClientExtension
     Q_OBJECT
 
 public:
+    QXmppArchiveManager();
+    ~QXmppArchiveManager();
+
     void listCollections(const QString &jid, const QDateTime &start = QDateTime(), const QDateTime &end = QDateTime(),
                          const QXmppResultSetQuery &rsm = QXmppResultSetQuery());
     void listCollections(const QString &jid, const QDateTime &start, const QDateTime &end, int max);
@@ -62,6 +77,14 @@ public:
     void retrieveCollection(const QString &jid, const QDateTime &start, const QXmppResultSetQuery &rsm = QXmppResultSetQuery());
     void retrieveCollection(const QString &jid, const QDateTime &start, int max);
 
+    QString streamCollections(const QString &jid, const QDateTime &start = QDateTime(), const QDateTime &end = QDateTime(), int pageSize = 100);
+    void cancelStream(const QString &streamId);
+
+    QString cachePath() const;
+    void setCachePath(const QString &path);
+    QList<QXmppArchiveChat> cachedCollections(const QString &jid, const QDateTime &start = QDateTime(), const QDateTime &end = QDateTime()) const;
+    QList<QXmppArchiveMessage> cachedMessages(const QString &jid, const QDateTime &start, int index = 0, int max = -1) const;
+
     /// \cond
     QStringList discoveryFeatures() const;
     bool handleStanza(const QDomElement &element);
@@ -75,6 +98,30 @@ signals:
     /// This signal is emitted when archive chat is received
     /// after calling retrieveCollection()
     void archiveChatReceived(const QXmppArchiveChat&, const QXmppResultSetReply &rsm = QXmppResultSetReply());
+
+    /// This signal is emitted for each page of messages of a stream started
+    /// with streamCollections(), in the order of the collections. The chat
+    /// carries the properties of its collection and the messages of the page.
+    void archiveStreamReceived(const QString &streamId, const QXmppArchiveChat &chat);
+
+    /// This signal is emitted when a stream started with streamCollections()
+    /// has delivered all its messages, or stopped because of an error.
+    void archiveStreamFinished(const QString &streamId);
+
+private slots:
+    void _q_chatReceived(const QDomElement &element);
+    void _q_listReceived(const QDomElement &element);
+    void _q_streamChatReceived(const QDomElement &element);
+    void _q_streamListReceived(const QDomElement &element);
+    void _q_advanceStream(const QString &streamId);
+
+private:
+    void advanceStream(const QString &streamId);
+    void finishStream(const QString &streamId);
+    bool requestStreamChat(const QString &streamId, const QString &after);
+    bool requestStreamList(const QString &streamId, const QString &after);
+
+    QXmppArchiveManagerPrivate *d;
 };
 
 #endif
@@ -21,6 +21,8 @@
  *
  */
 
+#include <QDomElement>
+#include <QPointer>
 #include <QSslSocket>
 #include <QTimer>
 #include <QUuid>
@@ -29,9 +31,11 @@
 #include "QXmppClient.h"
 #include "QXmppClientExtension.h"
 #include "QXmppConstants.h"
+#include "QXmppIq.h"
 #include "QXmppLogger.h"
 #include "QXmppOutgoingClient.h"
 #include "QXmppMessage.h"
+#include "QXmppStreamFeatures.h"
 #include "QXmppUtils.h"
 
 #include "QXmppVCardManager.h"
@@ -41,6 +45,15 @@
 #include "QXmppDiscoveryIq.h"
 #include "QXmppEntityTimeIq.h"
 
+class QXmppPendingIq
+{
+public:
+    QString to;
+    QPointer<QObject> receiver;
+    QByteArray member;
+    qint64 deadline;
+};
+
 class QXmppClientPrivate
 {
 public:
@@ -72,6 +85,15 @@ public:
     QElapsedTimer elapsedTime;
     QTimer timeRequestTimer;
 
+    // IQ requests waiting for a reply, by id, and their deadlines
+    QHash<QString, QXmppPendingIq> pendingIqs;
+    QMultiMap<qint64, QString> iqDeadlines;
+    QElapsedTimer iqClock;
+    QTimer *iqTimer;
+
+    void armIqTimer();
+    bool isReplyFrom(const QString &to, const QString &from) const;
+
 private:
     QXmppClient *q;
 };
@@ -89,8 +111,10 @@ QXmppClientPrivate::QXmppClientPrivate(QXmppClient *qq)
     , versionManager(0)
     , timeManager(0)
     , id(QUuid::createUuid().toString().mid(1, 8))
+    , iqTimer(0)
     , q(qq)
 {
+    iqClock.start();
 }
 
 void QXmppClientPrivate::addProperCapability(QXmppPresence& presence)
@@ -103,6 +127,59 @@ void QXmppClientPrivate::addProperCapability(QXmppPresence& presence)
     }
 }
 
+/// Builds the error reply delivered for a request which got no answer.
+
+static QDomElement iqErrorElement(const QString &id, const QString &from, const QString &condition)
+{
+    QDomDocument doc;
+    QDomElement iq = doc.createElementNS(ns_client, "iq");
+    iq.setAttribute("id", id);
+    if (!from.isEmpty())
+        iq.setAttribute("from", from);
+    iq.setAttribute("type", "error");
+
+    QDomElement error = doc.createElement("error");
+    error.setAttribute("type", "wait");
+    error.appendChild(doc.createElementNS(ns_stanza, condition));
+    iq.appendChild(error);
+    doc.appendChild(iq);
+    return iq;
+}
+
+/// Invokes the receiver of a request with its reply.
+
+static bool deliverIq(const QXmppPendingIq &pending, const QDomElement &element)
+{
+    if (!pending.receiver)
+        return true;
+    return QMetaObject::invokeMethod(pending.receiver, pending.member.constData(),
+                                     Qt::DirectConnection, Q_ARG(QDomElement, element));
+}
+
+/// Schedules the timer for the earliest deadline.
+
+void QXmppClientPrivate::armIqTimer()
+{
+    if (iqDeadlines.isEmpty())
+        iqTimer->stop();
+    else
+        iqTimer->start(int(qMax(qint64(0), iqDeadlines.constBegin().key() - iqClock.elapsed())));
+}
+
+/// Returns true if a reply from \a from can answer a request sent to \a to.
+
+bool QXmppClientPrivate::isReplyFrom(const QString &to, const QString &from) const
+{
+    if (from == to)
+        return true;
+
+    // requests to our own account may be answered by the server
+    const QXmppConfiguration &config = stream->configuration();
+    if (to.isEmpty() || to == config.jidBare())
+        return from.isEmpty() || from == config.jidBare() || from == config.jid() || from == config.domain();
+    return false;
+}
+
 int QXmppClientPrivate::getNextReconnectTime() const
 {
     if (reconnectionTries < 5)
@@ -213,6 +290,13 @@ QXmppClient::QXmppClient(QObject *parent)
             this, SLOT(_q_reconnect()));
     Q_ASSERT(check);
 
+    // IQ deadlines
+    d->iqTimer = new QTimer(this);
+    d->iqTimer->setSingleShot(true);
+    check = connect(d->iqTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_iqTimeout()));
+    Q_ASSERT(check);
+
     // logging
     setLogger(QXmppLogger::getLogger());
 
@@ -340,6 +424,62 @@ bool QXmppClient::sendPacket(const QXmppStanza& packet)
     return d->stream->sendPacket(packet);
 }
 
+/// Sends an IQ request and delivers its reply to a single \a receiver.
+///
+/// When the result or error with the request's id arrives from the
+/// entity the request was sent to, the \a member method of \a receiver
+/// is invoked with the reply as a const QDomElement& argument. The reply
+/// is then considered handled and is not passed to the extensions.
+///
+/// If no reply arrives within \a timeout milliseconds, or if the stream
+/// disconnects first, an error reply is delivered instead, with the
+/// condition remote-server-timeout or recipient-unavailable respectively.
+/// A \a timeout of 0 or less disables the deadline.
+///
+/// Returns true if the request was sent, in which case the receiver is
+/// guaranteed to be invoked exactly once, unless it was destroyed. A
+/// request whose ID is already awaiting a reply is not sent.
+///
+/// \code
+/// client.sendIq(request, this, "_q_replyReceived");
+/// \endcode
+///
+/// \param iq The request, of type get or set.
+/// \param receiver The object which handles the reply.
+/// \param member The name of a slot or invokable method of \a receiver.
+/// \param timeout The deadline in milliseconds.
+
+bool QXmppClient::sendIq(const QXmppIq &iq, QObject *receiver, const char *member, int timeout)
+{
+    Q_ASSERT(iq.type() == QXmppIq::Get || iq.type() == QXmppIq::Set);
+    if (d->pendingIqs.contains(iq.id())) {
+        warning(QString("Not sending IQ with duplicate id '%1'").arg(iq.id()));
+        return false;
+    }
+    if (!sendPacket(iq))
+        return false;
+
+    QXmppPendingIq pending;
+    pending.to = iq.to();
+    pending.receiver = receiver;
+    pending.member = member;
+    pending.deadline = timeout > 0 ? d->iqClock.elapsed() + timeout : -1;
+    d->pendingIqs.insert(iq.id(), pending);
+    if (timeout > 0) {
+        d->iqDeadlines.insert(pending.deadline, iq.id());
+        d->armIqTimer();
+    }
+    return true;
+}
+
+/// Returns the number of IQ requests sent with sendIq() which are
+/// waiting for a reply.
+
+int QXmppClient::pendingIqCount() const
+{
+    return d->pendingIqs.size();
+}
+
 /// Disconnects the client and the current presence of client changes to
 /// QXmppPresence::Unavailable and status text changes to "Logged out".
 ///
@@ -476,6 +616,14 @@ QXmppStanza::Error::Condition QXmppClient::xmppStreamError()
     return d->stream->xmppStreamError();
 }
 
+/// Returns the features advertised by the server once authenticated,
+/// for instance to check whether it supports roster versioning.
+
+QXmppStreamFeatures QXmppClient::streamFeatures() const
+{
+    return d->stream->streamFeatures();
+}
+
 /// Returns the reference to QXmppVCardManager, implementation of XEP-0054.
 /// http://xmpp.org/extensions/xep-0054.html
 ///
@@ -506,6 +654,27 @@ const QDateTime QXmppClient::currentServerTime() const
 
 void QXmppClient::_q_elementReceived(const QDomElement &element, bool &handled)
 {
+    // replies to tracked requests go straight to their receiver
+    if (!d->pendingIqs.isEmpty() && element.tagName() == "iq") {
+        const QString type = element.attribute("type");
+        if (type == "result" || type == "error") {
+            const QString id = element.attribute("id");
+            QHash<QString, QXmppPendingIq>::iterator it = d->pendingIqs.find(id);
+            if (it != d->pendingIqs.end() && d->isReplyFrom(it.value().to, element.attribute("from"))) {
+                const QXmppPendingIq pending = it.value();
+                d->pendingIqs.erase(it);
+                if (pending.deadline >= 0) {
+                    d->iqDeadlines.remove(pending.deadline, id);
+                    d->armIqTimer();
+                }
+                if (!deliverIq(pending, element))
+                    warning(QString("Could not deliver the reply to IQ %1").arg(id));
+                handled = true;
+                return;
+            }
+        }
+    }
+
     foreach (QXmppClientExtension *extension, d->extensions)
     {
         if (extension->handleStanza(element))
@@ -516,6 +685,23 @@ void QXmppClient::_q_elementReceived(const QDomElement &element, bool &handled)
     }
 }
 
+/// Fails the requests whose deadline has passed.
+
+void QXmppClient::_q_iqTimeout()
+{
+    const qint64 now = d->iqClock.elapsed();
+    while (!d->iqDeadlines.isEmpty() && d->iqDeadlines.constBegin().key() <= now) {
+        const QString id = d->iqDeadlines.constBegin().value();
+        d->iqDeadlines.erase(d->iqDeadlines.begin());
+        const QXmppPendingIq pending = d->pendingIqs.take(id);
+        warning(QString("IQ %1 to %2 timed out").arg(id, pending.to));
+        updateCounter("client.iq.timeout");
+        if (!deliverIq(pending, iqErrorElement(id, pending.to, "remote-server-timeout")))
+            warning(QString("Could not deliver the reply to IQ %1").arg(id));
+    }
+    d->armIqTimer();
+}
+
 void QXmppClient::_q_reconnect()
 {
     if (d->stream->configuration().autoReconnectionEnabled()) {
@@ -548,6 +734,18 @@ void QXmppClient::_q_streamDisconnected()
 {
     _q_serverTimeAbort();
 
+    // replies to pending requests will never arrive
+    while (!d->pendingIqs.isEmpty()) {
+        QHash<QString, QXmppPendingIq>::iterator it = d->pendingIqs.begin();
+        const QString id = it.key();
+        const QXmppPendingIq pending = it.value();
+        d->pendingIqs.erase(it);
+        d->iqDeadlines.remove(pending.deadline, id);
+        if (!deliverIq(pending, iqErrorElement(id, pending.to, "recipient-unavailable")))
+            warning(QString("Could not deliver the reply to IQ %1").arg(id));
+    }
+    d->armIqTimer();
+
     // notify managers
     emit disconnected();
     emit stateChanged(QXmppClient::DisconnectedState);
@@ -37,6 +37,7 @@ class QXmppPresence;
 class QXmppMessage;
 class QXmppIq;
 class QXmppStream;
+class QXmppStreamFeatures;
 class QXmppEntityTimeIq;
 
 // managers
@@ -149,6 +150,10 @@ public:
     QAbstractSocket::SocketError socketError();
     State state() const;
     QXmppStanza::Error::Condition xmppStreamError();
+    QXmppStreamFeatures streamFeatures() const;
+
+    bool sendIq(const QXmppIq &iq, QObject *receiver, const char *member, int timeout = 30000);
+    int pendingIqCount() const;
 
     QXmppVCardManager& vCardManager();
     QXmppVersionManager& versionManager();
@@ -223,6 +228,7 @@ public slots:
 
 private slots:
     void _q_elementReceived(const QDomElement &element, bool &handled);
+    void _q_iqTimeout();
     void _q_reconnect();
     void _q_socketStateChanged(QAbstractSocket::SocketState state);
     void _q_streamConnected();
@@ -63,6 +63,10 @@ public:
     int keepAliveInterval;
     // interval in seconds, if zero won't timeout
     int keepAliveTimeout;
+    QXmppConfiguration::KeepAliveMode keepAliveMode;
+    // interval in seconds up to which the keep alive interval can grow,
+    // if not larger than keepAliveInterval the interval is fixed
+    int keepAliveMaximumInterval;
     // will keep reconnecting if disconnected, default is true
     bool autoReconnectionEnabled;
     // which authentication systems to use (if any)
@@ -88,6 +92,8 @@ QXmppConfigurationPrivate::QXmppConfigurationPrivate()
     , sendRosterRequest(true)
     , keepAliveInterval(60)
     , keepAliveTimeout(20)
+    , keepAliveMode(QXmppConfiguration::KeepAlivePing)
+    , keepAliveMaximumInterval(0)
     , autoReconnectionEnabled(true)
     , useSASLAuthentication(true)
     , useNonSASLAuthentication(true)
@@ -567,6 +573,9 @@ QNetworkProxy QXmppConfiguration::networkProxy() const
 /// Specifies the interval in seconds at which keep alive (ping) packets
 /// will be sent to the server.
 ///
+/// Keep alive packets are only sent once the stream has carried no data
+/// in either direction for this long.
+///
 /// If set to zero, no keep alive packets will be sent.
 ///
 /// The default value is 60 seconds.
@@ -607,6 +616,49 @@ int QXmppConfiguration::keepAliveTimeout() const
     return d->keepAliveTimeout;
 }
 
+/// Returns the kind of keep alive packets sent to the server.
+///
+/// The default value is KeepAlivePing.
+
+QXmppConfiguration::KeepAliveMode QXmppConfiguration::keepAliveMode() const
+{
+    return d->keepAliveMode;
+}
+
+/// Specifies the kind of keep alive packets sent to the server.
+///
+/// Whitespace keep alives cost a single byte but get no reply, so the
+/// keep alive timeout does not apply to them.
+
+void QXmppConfiguration::setKeepAliveMode(QXmppConfiguration::KeepAliveMode mode)
+{
+    d->keepAliveMode = mode;
+}
+
+/// Returns the interval in seconds up to which the keep alive interval
+/// can grow.
+///
+/// The default value is 0, meaning the keep alive interval is fixed.
+
+int QXmppConfiguration::keepAliveMaximumInterval() const
+{
+    return d->keepAliveMaximumInterval;
+}
+
+/// Specifies the interval in seconds up to which the keep alive interval
+/// can grow.
+///
+/// If it is larger than the keep alive interval, each keep alive which
+/// succeeds after an idle period lengthens the interval by the keep alive
+/// interval, up to this maximum. When a keep alive fails, the interval
+/// is shortened again and is kept below the one which failed, so that it
+/// settles just below the timeout of NAT devices on the path.
+
+void QXmppConfiguration::setKeepAliveMaximumInterval(int secs)
+{
+    d->keepAliveMaximumInterval = secs;
+}
+
 /// Specifies a list of trusted CA certificates.
 
 void QXmppConfiguration::setCaCertificates(const QList<QSslCertificate> &caCertificates)
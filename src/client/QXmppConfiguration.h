@@ -68,6 +68,15 @@ public:
         NonSASLDigest    ///< Digest (default)
     };
 
+    /// An enumeration for the kind of keep alive packets sent to the server.
+    enum KeepAliveMode
+    {
+        KeepAlivePing = 0,  ///< XEP-0199: XMPP Ping requests, whose replies
+                            ///< are awaited (default)
+        KeepAliveWhitespace ///< A single whitespace character, which the
+                            ///< server does not reply to
+    };
+
     /// An enumeration for various SASL authentication mechanisms available.
     /// The server may or may not allow any particular mechanism. So depending
     /// upon the availability of mechanisms on the server the library will choose
@@ -152,6 +161,12 @@ public:
     int keepAliveTimeout() const;
     void setKeepAliveTimeout(int secs);
 
+    QXmppConfiguration::KeepAliveMode keepAliveMode() const;
+    void setKeepAliveMode(QXmppConfiguration::KeepAliveMode mode);
+
+    int keepAliveMaximumInterval() const;
+    void setKeepAliveMaximumInterval(int secs);
+
     QList<QSslCertificate> caCertificates() const;
     void setCaCertificates(const QList<QSslCertificate> &);
 
@@ -23,29 +23,181 @@
 
 #include "QXmppDiscoveryManager.h"
 
+#include <QDataStream>
+#include <QDomDocument>
 #include <QDomElement>
 #include <QCoreApplication>
+#include <QFile>
+#include <QSet>
+#include <QTimer>
+#include <QXmlStreamWriter>
 
 #include "QXmppClient.h"
 #include "QXmppConstants.h"
 #include "QXmppDataForm.h"
 #include "QXmppDiscoveryIq.h"
+#include "QXmppPresence.h"
 #include "QXmppStream.h"
 #include "QXmppGlobal.h"
 
+static const quint32 cacheMagic = 0x51434150;
+static const quint32 cacheFormat = 1;
+
+// delay before writing new capabilities to the cache
+static const int cacheSaveDelay = 5000;
+
+class QXmppDiscoveryCapabilities
+{
+public:
+    QXmppDiscoveryIq info;
+    QSet<QString> features;
+};
+
 class QXmppDiscoveryManagerPrivate
 {
 public:
+    QXmppDiscoveryManagerPrivate();
+    void addCapabilities(const QByteArray &ver, const QXmppDiscoveryIq &info);
+    bool loadCache();
+    bool saveCache();
+
     QString clientCapabilitiesNode;
     QString clientCategory;
     QString clientType;
     QString clientName;
     QXmppDataForm clientInfoForm;
+
+    // capabilities by verification string, and the verification string
+    // advertised by each available entity
+    QHash<QByteArray, QXmppDiscoveryCapabilities> capabilities;
+    QHash<QString, QByteArray> resources;
+
+    // entities and nodes advertising a verification string being queried,
+    // the first one is the one being asked
+    QHash<QByteArray, QList<QPair<QString, QString> > > waiting;
+    QHash<QString, QByteArray> requests;
+
+    QString cachePath;
+    QTimer *cacheTimer;
 };
 
+QXmppDiscoveryManagerPrivate::QXmppDiscoveryManagerPrivate()
+    : cacheTimer(0)
+{
+}
+
+void QXmppDiscoveryManagerPrivate::addCapabilities(const QByteArray &ver, const QXmppDiscoveryIq &info)
+{
+    QXmppDiscoveryCapabilities entry;
+    entry.info.setType(QXmppIq::Result);
+    entry.info.setQueryType(QXmppDiscoveryIq::InfoQuery);
+    entry.info.setIdentities(info.identities());
+    entry.info.setFeatures(info.features());
+    entry.info.setForm(info.form());
+    entry.features = info.features().toSet();
+    capabilities.insert(ver, entry);
+}
+
+/// Adds the capabilities stored in the cache file.
+
+bool QXmppDiscoveryManagerPrivate::loadCache()
+{
+    QFile file(cachePath);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_4_6);
+    quint32 magic, format, count;
+    stream >> magic >> format;
+    if (magic != cacheMagic || format != cacheFormat)
+        return false;
+    stream >> count;
+
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+        QByteArray ver, formXml;
+        QStringList identityFields, features;
+        stream >> ver >> identityFields >> features >> formXml;
+
+        QXmppDiscoveryIq info;
+        QList<QXmppDiscoveryIq::Identity> identities;
+        for (int j = 0; j + 3 < identityFields.size(); j += 4) {
+            QXmppDiscoveryIq::Identity identity;
+            identity.setCategory(identityFields.at(j));
+            identity.setType(identityFields.at(j + 1));
+            identity.setLanguage(identityFields.at(j + 2));
+            identity.setName(identityFields.at(j + 3));
+            identities << identity;
+        }
+        info.setIdentities(identities);
+        info.setFeatures(features);
+        if (!formXml.isEmpty()) {
+            QDomDocument doc;
+            QXmppDataForm form;
+            if (doc.setContent(formXml, true))
+                form.parse(doc.documentElement());
+            info.setForm(form);
+        }
+
+        // entries which no longer verify are dropped
+        if (stream.status() == QDataStream::Ok && info.verificationString() == ver)
+            addCapabilities(ver, info);
+    }
+    return stream.status() == QDataStream::Ok;
+}
+
+/// Writes the capabilities to the cache file, replacing it once complete.
+
+bool QXmppDiscoveryManagerPrivate::saveCache()
+{
+    cacheTimer->stop();
+    if (cachePath.isEmpty())
+        return true;
+
+    const QString tempPath = cachePath + ".tmp";
+    QFile file(tempPath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_4_6);
+    stream << cacheMagic << cacheFormat << quint32(capabilities.size());
+    QHash<QByteArray, QXmppDiscoveryCapabilities>::const_iterator it;
+    for (it = capabilities.constBegin(); it != capabilities.constEnd(); ++it) {
+        const QXmppDiscoveryIq &info = it.value().info;
+        QStringList identityFields;
+        foreach (const QXmppDiscoveryIq::Identity &identity, info.identities())
+            identityFields << identity.category() << identity.type() << identity.language() << identity.name();
+        QByteArray formXml;
+        if (!info.form().isNull()) {
+            QXmlStreamWriter writer(&formXml);
+            info.form().toXml(&writer);
+        }
+        stream << it.key() << identityFields << info.features() << formXml;
+    }
+    file.close();
+    if (file.error() != QFile::NoError) {
+        QFile::remove(tempPath);
+        return false;
+    }
+
+    QFile::remove(cachePath);
+    return QFile::rename(tempPath, cachePath);
+}
+
 QXmppDiscoveryManager::QXmppDiscoveryManager()
     : d(new QXmppDiscoveryManagerPrivate)
 {
+    bool check;
+    Q_UNUSED(check);
+
+    d->cacheTimer = new QTimer(this);
+    d->cacheTimer->setInterval(cacheSaveDelay);
+    d->cacheTimer->setSingleShot(true);
+    check = connect(d->cacheTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_saveCache()));
+    Q_ASSERT(check);
+
     d->clientCapabilitiesNode = "http://code.google.com/p/qxmpp";
     d->clientCategory = "client";
     d->clientType = "pc";
@@ -57,11 +209,16 @@ QXmppDiscoveryManager::QXmppDiscoveryManager()
 
 QXmppDiscoveryManager::~QXmppDiscoveryManager()
 {
+    if (d->cacheTimer->isActive())
+        _q_saveCache();
     delete d;
 }
 
 /// Requests information from the specified XMPP entity.
 ///
+/// The infoReceived() signal is emitted with the reply, or with an error
+/// if no reply arrives in time.
+///
 /// \param jid  The target entity's JID.
 /// \param node The target node (optional).
 
@@ -73,7 +230,7 @@ QString QXmppDiscoveryManager::requestInfo(const QString& jid, const QString& no
     request.setTo(jid);
     if(!node.isEmpty())
         request.setQueryNode(node);
-    if(client()->sendPacket(request))
+    if(client()->sendIq(request, this, "_q_infoReceived"))
         return request.id();
     else
         return QString();
@@ -81,6 +238,9 @@ QString QXmppDiscoveryManager::requestInfo(const QString& jid, const QString& no
 
 /// Requests items from the specified XMPP entity.
 ///
+/// The itemsReceived() signal is emitted with the reply, or with an error
+/// if no reply arrives in time.
+///
 /// \param jid  The target entity's JID.
 /// \param node The target node (optional).
 
@@ -92,7 +252,7 @@ QString QXmppDiscoveryManager::requestItems(const QString& jid, const QString& n
     request.setTo(jid);
     if(!node.isEmpty())
         request.setQueryNode(node);
-    if(client()->sendPacket(request))
+    if(client()->sendIq(request, this, "_q_itemsReceived"))
         return request.id();
     else
         return QString();
@@ -243,6 +403,80 @@ void QXmppDiscoveryManager::setClientInfoForm(const QXmppDataForm &form)
     d->clientInfoForm = form;
 }
 
+/// Returns the path of the file the capabilities of other entities are
+/// cached in.
+
+QString QXmppDiscoveryManager::cachePath() const
+{
+    return d->cachePath;
+}
+
+/// Sets the path of the file the capabilities of other entities are
+/// cached in, and loads the capabilities it contains.
+///
+/// An empty path keeps the cache in memory only, which is the default.
+///
+/// \param path
+
+void QXmppDiscoveryManager::setCachePath(const QString &path)
+{
+    if (path == d->cachePath)
+        return;
+    if (d->cacheTimer->isActive())
+        _q_saveCache();
+
+    d->cachePath = path;
+    if (!path.isEmpty() && QFile::exists(path) && !d->loadCache())
+        warning(QString("Could not read capabilities cache %1").arg(path));
+}
+
+/// Returns the information advertised by the given available entity
+/// through its capabilities, or an empty IQ if they are not known yet.
+///
+/// \param jid The entity's full JID.
+
+QXmppDiscoveryIq QXmppDiscoveryManager::cachedInfo(const QString &jid) const
+{
+    QHash<QString, QByteArray>::const_iterator it = d->resources.constFind(jid);
+    if (it == d->resources.constEnd())
+        return QXmppDiscoveryIq();
+    QXmppDiscoveryIq info = d->capabilities.value(it.value()).info;
+    info.setFrom(jid);
+    return info;
+}
+
+/// Returns true if the given available entity advertises \a feature
+/// through its capabilities.
+///
+/// \param jid The entity's full JID.
+/// \param feature
+
+bool QXmppDiscoveryManager::hasFeature(const QString &jid, const QString &feature) const
+{
+    QHash<QString, QByteArray>::const_iterator it = d->resources.constFind(jid);
+    if (it == d->resources.constEnd())
+        return false;
+    QHash<QByteArray, QXmppDiscoveryCapabilities>::const_iterator caps = d->capabilities.constFind(it.value());
+    return caps != d->capabilities.constEnd() && caps.value().features.contains(feature);
+}
+
+/// Queries the first entity advertising the verification string \a ver.
+
+void QXmppDiscoveryManager::requestCapabilities(const QByteArray &ver)
+{
+    const QPair<QString, QString> target = d->waiting.value(ver).first();
+
+    QXmppDiscoveryIq request;
+    request.setType(QXmppIq::Get);
+    request.setQueryType(QXmppDiscoveryIq::InfoQuery);
+    request.setTo(target.first);
+    request.setQueryNode(target.second + "#" + QString::fromLatin1(ver.toBase64()));
+    if (client()->sendIq(request, this, "_q_capabilitiesReceived"))
+        d->requests.insert(request.id(), ver);
+    else
+        d->waiting.remove(ver);
+}
+
 /// \cond
 QStringList QXmppDiscoveryManager::discoveryFeatures() const
 {
@@ -276,7 +510,7 @@ bool QXmppDiscoveryManager::handleStanza(const QDomElement &element)
 
         case QXmppIq::Result:
         case QXmppIq::Error:
-            // handle all replies
+            // handle replies to requests which were not sent by this manager
             if (receivedIq.queryType() == QXmppDiscoveryIq::InfoQuery) {
                 emit infoReceived(receivedIq);
             } else if (receivedIq.queryType() == QXmppDiscoveryIq::ItemsQuery) {
@@ -291,4 +525,117 @@ bool QXmppDiscoveryManager::handleStanza(const QDomElement &element)
     }
     return false;
 }
+
+void QXmppDiscoveryManager::setClient(QXmppClient *client)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    QXmppClientExtension::setClient(client);
+
+    check = connect(client, SIGNAL(presenceReceived(QXmppPresence)),
+                    this, SLOT(_q_presenceReceived(QXmppPresence)));
+    Q_ASSERT(check);
+
+    check = connect(client, SIGNAL(disconnected()),
+                    this, SLOT(_q_disconnected()));
+    Q_ASSERT(check);
+}
+
+void QXmppDiscoveryManager::_q_capabilitiesReceived(const QDomElement &element)
+{
+    const QByteArray ver = d->requests.take(element.attribute("id"));
+    if (!d->waiting.contains(ver))
+        return;
+
+    QList<QPair<QString, QString> > queue = d->waiting.take(ver);
+    const QString from = queue.takeFirst().first;
+    if (element.attribute("type") == "result") {
+        QXmppDiscoveryIq info;
+        info.parse(element);
+        if (info.verificationString() == ver) {
+            d->addCapabilities(ver, info);
+            if (!d->cachePath.isEmpty() && !d->cacheTimer->isActive())
+                d->cacheTimer->start();
+
+            if (d->resources.value(from) == ver)
+                emit capabilitiesChanged(from);
+            for (int i = 0; i < queue.size(); ++i) {
+                if (d->resources.value(queue.at(i).first) == ver)
+                    emit capabilitiesChanged(queue.at(i).first);
+            }
+            return;
+        }
+        warning(QString("Capabilities of %1 do not match their verification string").arg(from));
+    }
+
+    // ask the next entity advertising the same verification string
+    if (!queue.isEmpty()) {
+        d->waiting.insert(ver, queue);
+        requestCapabilities(ver);
+    }
+}
+
+void QXmppDiscoveryManager::_q_disconnected()
+{
+    d->resources.clear();
+}
+
+void QXmppDiscoveryManager::_q_presenceReceived(const QXmppPresence &presence)
+{
+    const QString jid = presence.from();
+    if (jid.isEmpty())
+        return;
+
+    if (presence.type() == QXmppPresence::Unavailable) {
+        d->resources.remove(jid);
+        return;
+    } else if (presence.type() != QXmppPresence::Available) {
+        return;
+    }
+
+    // only SHA-1 verification strings can be checked
+    const QByteArray ver = presence.capabilityVer();
+    if (presence.capabilityHash() != "sha-1" || ver.isEmpty()) {
+        d->resources.remove(jid);
+        return;
+    }
+
+    // most presence updates only change the status
+    QHash<QString, QByteArray>::iterator it = d->resources.find(jid);
+    if (it != d->resources.end() && it.value() == ver)
+        return;
+    d->resources.insert(jid, ver);
+
+    if (d->capabilities.contains(ver)) {
+        emit capabilitiesChanged(jid);
+        return;
+    }
+
+    // query each verification string once
+    QList<QPair<QString, QString> > &queue = d->waiting[ver];
+    queue << qMakePair(jid, presence.capabilityNode());
+    if (queue.size() == 1)
+        requestCapabilities(ver);
+}
+
+void QXmppDiscoveryManager::_q_saveCache()
+{
+    if (!d->saveCache())
+        warning(QString("Could not write capabilities cache %1").arg(d->cachePath));
+}
+
+void QXmppDiscoveryManager::_q_infoReceived(const QDomElement &element)
+{
+    QXmppDiscoveryIq iq;
+    iq.parse(element);
+    emit infoReceived(iq);
+}
+
+void QXmppDiscoveryManager::_q_itemsReceived(const QDomElement &element)
+{
+    QXmppDiscoveryIq iq;
+    iq.parse(element);
+    emit itemsReceived(iq);
+}
 /// \endcond
@@ -29,10 +29,17 @@
 class QXmppDataForm;
 class QXmppDiscoveryIq;
 class QXmppDiscoveryManagerPrivate;
+class QXmppPresence;
 
 /// \brief The QXmppDiscoveryManager class makes it possible to discover information
 /// about other entities as defined by XEP-0030: Service Discovery.
 ///
+/// It also caches the capabilities advertised in presence as defined by
+/// XEP-0115: Entity Capabilities. Each verification string is queried
+/// once, whichever number of entities advertise it, and the answer is
+/// only kept if it matches the string. The cache can be stored in a file
+/// with setCachePath() so that it survives restarts.
+///
 /// \ingroup Managers
 
 class QXMPP_EXPORT QXmppDiscoveryManager : public QXmppClientExtension
@@ -64,6 +71,12 @@ public:
     QXmppDataForm clientInfoForm() const;
     void setClientInfoForm(const QXmppDataForm &form);
 
+    QString cachePath() const;
+    void setCachePath(const QString &path);
+
+    QXmppDiscoveryIq cachedInfo(const QString &jid) const;
+    bool hasFeature(const QString &jid, const QString &feature) const;
+
     /// \cond
     QStringList discoveryFeatures() const;
     bool handleStanza(const QDomElement &element);
@@ -76,7 +89,26 @@ signals:
     /// This signal is emitted when an items response is received.
     void itemsReceived(const QXmppDiscoveryIq&);
 
+    /// This signal is emitted when the capabilities of an entity become
+    /// available from cachedInfo().
+    void capabilitiesChanged(const QString &jid);
+
+protected:
+    /// \cond
+    void setClient(QXmppClient* client);
+    /// \endcond
+
+private slots:
+    void _q_capabilitiesReceived(const QDomElement &element);
+    void _q_disconnected();
+    void _q_infoReceived(const QDomElement &element);
+    void _q_itemsReceived(const QDomElement &element);
+    void _q_presenceReceived(const QXmppPresence &presence);
+    void _q_saveCache();
+
 private:
+    void requestCapabilities(const QByteArray &ver);
+
     QXmppDiscoveryManagerPrivate *d;
 };
 
@@ -22,6 +22,7 @@
  */
 
 #include <QDomElement>
+#include <QHash>
 #include <QMap>
 #include <QSet>
 #include "QXmppClient.h"
@@ -41,13 +42,30 @@ public:
 class QXmppMucRoomPrivate
 {
 public:
+    QXmppMucRoomPrivate();
     QString ownJid() const { return jid + "/" + nickName; }
+    bool insertParticipant(const QString &jid, const QXmppPresence &presence);
+    void removeParticipant(const QString &jid);
+    QStringList takeParticipants();
+
     QXmppClient *client;
     QXmppDiscoveryManager *discoManager;
     QXmppMucRoom::Actions allowedActions;
     QString jid;
     QString name;
-    QMap<QString, QXmppPresence> participants;
+
+    // occupants by Occupant JID, and Occupant JIDs by role and affiliation
+    QHash<QString, QXmppPresence> participants;
+    QHash<int, QSet<QString> > roles;
+    QHash<int, QSet<QString> > affiliations;
+
+    // sorted Occupant JIDs, built when first requested after a change
+    mutable QStringList participantList;
+    mutable bool participantListValid;
+
+    // whether our own presence is awaited after join()
+    bool joining;
+
     QString password;
     QMap<QString, QXmppMucItem> permissions;
     QSet<QString> permissionsQueue;
@@ -55,6 +73,71 @@ public:
     QString subject;
 };
 
+QXmppMucRoomPrivate::QXmppMucRoomPrivate()
+    : participantListValid(false),
+    joining(false)
+{
+}
+
+static void indexRemove(QHash<int, QSet<QString> > &index, int key, const QString &jid)
+{
+    QHash<int, QSet<QString> >::iterator it = index.find(key);
+    if (it != index.end()) {
+        it.value().remove(jid);
+        if (it.value().isEmpty())
+            index.erase(it);
+    }
+}
+
+/// Stores the presence of an occupant, returning true if it is new.
+
+bool QXmppMucRoomPrivate::insertParticipant(const QString &jid, const QXmppPresence &presence)
+{
+    const QXmppMucItem item = presence.mucItem();
+    QHash<QString, QXmppPresence>::iterator it = participants.find(jid);
+    const bool added = (it == participants.end());
+    if (added) {
+        participants.insert(jid, presence);
+        participantListValid = false;
+    } else {
+        const QXmppMucItem oldItem = it.value().mucItem();
+        if (oldItem.role() != item.role())
+            indexRemove(roles, oldItem.role(), jid);
+        if (oldItem.affiliation() != item.affiliation())
+            indexRemove(affiliations, oldItem.affiliation(), jid);
+        it.value() = presence;
+    }
+    roles[item.role()].insert(jid);
+    affiliations[item.affiliation()].insert(jid);
+    return added;
+}
+
+void QXmppMucRoomPrivate::removeParticipant(const QString &jid)
+{
+    QHash<QString, QXmppPresence>::iterator it = participants.find(jid);
+    if (it == participants.end())
+        return;
+
+    const QXmppMucItem item = it.value().mucItem();
+    indexRemove(roles, item.role(), jid);
+    indexRemove(affiliations, item.affiliation(), jid);
+    participants.erase(it);
+    participantListValid = false;
+}
+
+/// Removes all the occupants, returning their Occupant JIDs.
+
+QStringList QXmppMucRoomPrivate::takeParticipants()
+{
+    const QStringList removed = participants.keys();
+    participants.clear();
+    roles.clear();
+    affiliations.clear();
+    participantList.clear();
+    participantListValid = false;
+    return removed;
+}
+
 /// Constructs a new QXmppMucManager.
 
 QXmppMucManager::QXmppMucManager()
@@ -285,7 +368,13 @@ bool QXmppMucRoom::join()
     packet.setType(QXmppPresence::Available);
     packet.setMucPassword(d->password);
     packet.setMucSupported(true);
-    return d->client->sendPacket(packet);
+    if (!d->client->sendPacket(packet))
+        return false;
+
+    // while we are an occupant under another nickname, the participants
+    // are already known and changes must not be held back
+    d->joining = d->participants.isEmpty();
+    return true;
 }
 
 /// Kicks the specified user from the chat room.
@@ -400,8 +489,9 @@ void QXmppMucRoom::setNickName(const QString &nickName)
 
 QString QXmppMucRoom::participantFullJid(const QString &jid) const
 {
-    if (d->participants.contains(jid))
-        return d->participants.value(jid).mucItem().jid();
+    QHash<QString, QXmppPresence>::const_iterator it = d->participants.constFind(jid);
+    if (it != d->participants.constEnd())
+        return it.value().mucItem().jid();
     else
         return QString();
 }
@@ -412,8 +502,9 @@ QString QXmppMucRoom::participantFullJid(const QString &jid) const
 
 QXmppPresence QXmppMucRoom::participantPresence(const QString &jid) const
 {
-    if (d->participants.contains(jid))
-        return d->participants.value(jid);
+    QHash<QString, QXmppPresence>::const_iterator it = d->participants.constFind(jid);
+    if (it != d->participants.constEnd())
+        return it.value();
 
     QXmppPresence presence;
     presence.setFrom(jid);
@@ -424,10 +515,43 @@ QXmppPresence QXmppMucRoom::participantPresence(const QString &jid) const
 /// Returns the list of participant JIDs.
 ///
 /// These JIDs are Occupant JIDs of the form "room@service/nick".
+///
+/// The list is only rebuilt after participants join or leave, other calls
+/// return a list which is implicitly shared with the room.
 
 QStringList QXmppMucRoom::participants() const
 {
-    return d->participants.keys();
+    if (!d->participantListValid) {
+        d->participantList = d->participants.keys();
+        qSort(d->participantList);
+        d->participantListValid = true;
+    }
+    return d->participantList;
+}
+
+/// Returns the presences of the participants, by Occupant JID.
+///
+/// The returned hash is implicitly shared with the room, so no data is
+/// copied.
+
+QHash<QString, QXmppPresence> QXmppMucRoom::participantPresences() const
+{
+    return d->participants;
+}
+
+/// Returns the Occupant JIDs of the participants with the given \a role.
+
+QStringList QXmppMucRoom::participantsWithRole(QXmppMucItem::Role role) const
+{
+    return d->roles.value(role).toList();
+}
+
+/// Returns the Occupant JIDs of the participants with the given
+/// \a affiliation.
+
+QStringList QXmppMucRoom::participantsWithAffiliation(QXmppMucItem::Affiliation affiliation) const
+{
+    return d->affiliations.value(affiliation).toList();
 }
 
 /// Returns the chat room password.
@@ -565,10 +689,10 @@ bool QXmppMucRoom::setPermissions(const QList<QXmppMucItem> &permissions)
 void QXmppMucRoom::_q_disconnected()
 {
     const bool wasJoined = isJoined();
+    d->joining = false;
 
     // clear chat room participants
-    const QStringList removed = d->participants.keys();
-    d->participants.clear();
+    const QStringList removed = d->takeParticipants();
     foreach (const QString &jid, removed)
         emit participantRemoved(jid);
     emit participantsChanged();
@@ -632,8 +756,7 @@ void QXmppMucRoom::_q_presenceReceived(const QXmppPresence &presence)
         return;
 
     if (presence.type() == QXmppPresence::Available) {
-        const bool added = !d->participants.contains(jid);
-        d->participants.insert(jid, presence);
+        const bool added = d->insertParticipant(jid, presence);
 
         // refresh allowed actions
         if (jid == d->ownJid()) {
@@ -659,25 +782,40 @@ void QXmppMucRoom::_q_presenceReceived(const QXmppPresence &presence)
 
         if (added) {
             emit participantAdded(jid);
-            emit participantsChanged();
             if (jid == d->ownJid()) {
+                // the occupants present when joining were received before
+                // our own presence, report them at once
+                d->joining = false;
+                emit participantsReceived(participants());
+                emit participantsChanged();
+
                 // request room information
                 if (d->discoManager)
                     d->discoManager->requestInfo(d->jid);
 
                 emit joined();
+            } else if (!d->joining) {
+                emit participantsChanged();
             }
         } else {
             emit participantChanged(jid);
+
+            // our own presence ends the join even if we were already in
+            // the room
+            if (jid == d->ownJid() && d->joining) {
+                d->joining = false;
+                emit participantsChanged();
+            }
         }
     }
     else if (presence.type() == QXmppPresence::Unavailable) {
         if (d->participants.contains(jid)) {
-            d->participants.insert(jid, presence);
+            d->insertParticipant(jid, presence);
 
             emit participantRemoved(jid);
-            d->participants.remove(jid);
-            emit participantsChanged();
+            d->removeParticipant(jid);
+            if (!d->joining)
+                emit participantsChanged();
 
             // check whether this was our own presence
             if (jid == d->ownJid()) {
@@ -690,8 +828,8 @@ void QXmppMucRoom::_q_presenceReceived(const QXmppPresence &presence)
                 }
 
                 // clear chat room participants
-                const QStringList removed = d->participants.keys();
-                d->participants.clear();
+                d->joining = false;
+                const QStringList removed = d->takeParticipants();
                 foreach (const QString &jid, removed)
                     emit participantRemoved(jid);
                 emit participantsChanged();
@@ -709,6 +847,8 @@ void QXmppMucRoom::_q_presenceReceived(const QXmppPresence &presence)
     }
     else if (presence.type() == QXmppPresence::Error) {
         if (presence.isMucSupported()) {
+            d->joining = false;
+
             // emit error
             emit error(presence.error());
 
@@ -24,6 +24,8 @@
 #ifndef QXMPPMUCMANAGER_H
 #define QXMPPMUCMANAGER_H
 
+#include <QHash>
+
 #include "QXmppClientExtension.h"
 #include "QXmppMucIq.h"
 #include "QXmppPresence.h"
@@ -96,6 +98,9 @@ private:
 /// \brief The QXmppMucRoom class represents a multi-user chat room
 /// as defined by XEP-0045: Multi-User Chat.
 ///
+/// The participants are indexed by Occupant JID, role and affiliation, so
+/// that looking them up does not depend on the size of the room.
+///
 /// \sa QXmppMucManager
 
 class QXMPP_EXPORT QXmppMucRoom : public QObject
@@ -135,7 +140,10 @@ public:
 
     Q_INVOKABLE QString participantFullJid(const QString &jid) const;
     QXmppPresence participantPresence(const QString &jid) const;
+    QHash<QString, QXmppPresence> participantPresences() const;
     QStringList participants() const;
+    QStringList participantsWithAffiliation(QXmppMucItem::Affiliation affiliation) const;
+    QStringList participantsWithRole(QXmppMucItem::Role role) const;
 
     QString password() const;
     void setPassword(const QString &password);
@@ -188,6 +196,13 @@ signals:
     void participantsChanged();
     /// \endcond
 
+    /// This signal is emitted when you join the room, with the Occupant JIDs
+    /// of all the participants, right before joined().
+    ///
+    /// In large rooms, it is cheaper to handle this signal than a
+    /// participantAdded() signal for each participant present when joining.
+    void participantsReceived(const QStringList &jids);
+
     /// This signal is emitted when the room's permissions are received.
     void permissionsReceived(const QList<QXmppMucItem> &permissions);
 
@@ -23,6 +23,8 @@
  */
 
 #include <QCryptographicHash>
+#include <QElapsedTimer>
+#include <QHostInfo>
 #include <QNetworkProxy>
 #include <QSslSocket>
 #include <QUrl>
@@ -39,6 +41,7 @@
 #include "QXmppMessage.h"
 #include "QXmppPresence.h"
 #include "QXmppOutgoingClient.h"
+#include "QXmppOutgoingClient_p.h"
 #include "QXmppStreamFeatures.h"
 #include "QXmppNonSASLAuth.h"
 #include "QXmppSasl_p.h"
@@ -56,13 +59,202 @@
 #include <QRegExp>
 #include <QHostAddress>
 #include <QXmlStreamWriter>
+#include <QTcpSocket>
 #include <QTimer>
 
+// delay between connection attempts, as recommended by RFC 6555
+static const int connectorAttemptDelay = 250;
+
+/// Constructs a connector.
+///
+/// \param parent
+
+QXmppConnector::QXmppConnector(QObject *parent)
+    : QXmppLoggable(parent)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    m_attemptTimer = new QTimer(this);
+    m_attemptTimer->setInterval(connectorAttemptDelay);
+    m_attemptTimer->setSingleShot(true);
+    check = connect(m_attemptTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_startNext()));
+    Q_ASSERT(check);
+}
+
+QXmppConnector::~QXmppConnector()
+{
+    abort();
+}
+
+/// Returns the delay in milliseconds before the next address is tried
+/// while previous attempts are still in progress.
+
+int QXmppConnector::attemptDelay() const
+{
+    return m_attemptTimer->interval();
+}
+
+/// Sets the delay in milliseconds before the next address is tried
+/// while previous attempts are still in progress.
+///
+/// \param delay
+
+void QXmppConnector::setAttemptDelay(int delay)
+{
+    m_attemptTimer->setInterval(delay);
+}
+
+/// Returns true if hosts are being resolved or connected to.
+
+bool QXmppConnector::isActive() const
+{
+    return !m_lookups.isEmpty() || !m_probes.isEmpty();
+}
+
+/// Starts resolving and connecting to the given hosts, in order of
+/// preference.
+///
+/// \param hosts
+
+void QXmppConnector::connectToHosts(const QList<QPair<QString, quint16> > &hosts)
+{
+    abort();
+    for (int i = 0; i < hosts.size(); ++i) {
+        m_candidates << QList<QPair<QHostAddress, quint16> >();
+        m_ports << hosts.at(i).second;
+        const int id = QHostInfo::lookupHost(hosts.at(i).first, this, SLOT(_q_hostFound(QHostInfo)));
+        m_lookups.insert(id, i);
+    }
+    if (hosts.isEmpty())
+        QTimer::singleShot(0, this, SIGNAL(failed()));
+}
+
+/// Cancels the host lookups and connection attempts.
+
+void QXmppConnector::abort()
+{
+    foreach (int id, m_lookups.keys())
+        QHostInfo::abortHostLookup(id);
+    m_lookups.clear();
+    foreach (QTcpSocket *probe, m_probes) {
+        probe->disconnect(this);
+        probe->abort();
+        probe->deleteLater();
+    }
+    m_probes.clear();
+    m_candidates.clear();
+    m_ports.clear();
+    m_attemptTimer->stop();
+}
+
+void QXmppConnector::checkFailed()
+{
+    if (m_lookups.isEmpty() && m_probes.isEmpty()) {
+        m_attemptTimer->stop();
+        emit failed();
+    }
+}
+
+void QXmppConnector::_q_hostFound(const QHostInfo &info)
+{
+    if (!m_lookups.contains(info.lookupId()))
+        return;
+    const int index = m_lookups.take(info.lookupId());
+
+    if (info.error() != QHostInfo::NoError) {
+        warning(QString("Lookup for host %1 failed: %2").arg(info.hostName(), info.errorString()));
+    } else {
+        // alternate between address families, so that a broken IPv6 path
+        // only delays the IPv4 addresses by one attempt
+        QList<QHostAddress> ipv4, ipv6;
+        foreach (const QHostAddress &address, info.addresses()) {
+            if (address.protocol() == QAbstractSocket::IPv6Protocol)
+                ipv6 << address;
+            else
+                ipv4 << address;
+        }
+        QList<QPair<QHostAddress, quint16> > &candidates = m_candidates[index];
+        while (!ipv6.isEmpty() || !ipv4.isEmpty()) {
+            if (!ipv6.isEmpty())
+                candidates << qMakePair(ipv6.takeFirst(), m_ports.at(index));
+            if (!ipv4.isEmpty())
+                candidates << qMakePair(ipv4.takeFirst(), m_ports.at(index));
+        }
+    }
+
+    // start an attempt unless one was started less than attemptDelay() ago
+    if (!m_attemptTimer->isActive())
+        _q_startNext();
+}
+
+void QXmppConnector::_q_probeConnected()
+{
+    QTcpSocket *probe = qobject_cast<QTcpSocket*>(sender());
+    if (!probe || !m_probes.contains(probe))
+        return;
+
+    const QHostAddress address = probe->peerAddress();
+    const quint16 port = probe->peerPort();
+    abort();
+    emit connected(address, port);
+}
+
+void QXmppConnector::_q_probeError()
+{
+    QTcpSocket *probe = qobject_cast<QTcpSocket*>(sender());
+    if (!probe || !m_probes.removeAll(probe))
+        return;
+
+    debug(QString("Could not connect to %1:%2: %3").arg(
+        probe->peerName(),
+        QString::number(probe->peerPort()),
+        probe->errorString()));
+    probe->disconnect(this);
+    probe->deleteLater();
+
+    // the next address need not wait for the delay to expire
+    _q_startNext();
+}
+
+void QXmppConnector::_q_startNext()
+{
+    bool check;
+    Q_UNUSED(check);
+
+    // take the first address of the most preferred host
+    for (int i = 0; i < m_candidates.size(); ++i) {
+        if (m_candidates[i].isEmpty())
+            continue;
+        const QPair<QHostAddress, quint16> candidate = m_candidates[i].takeFirst();
+
+        QTcpSocket *probe = new QTcpSocket(this);
+        probe->setProxy(QNetworkProxy::NoProxy);
+        check = connect(probe, SIGNAL(connected()),
+                        this, SLOT(_q_probeConnected()));
+        Q_ASSERT(check);
+        check = connect(probe, SIGNAL(error(QAbstractSocket::SocketError)),
+                        this, SLOT(_q_probeError()));
+        Q_ASSERT(check);
+        m_probes << probe;
+
+        debug(QString("Trying %1:%2").arg(candidate.first.toString(), QString::number(candidate.second)));
+        probe->connectToHost(candidate.first, candidate.second);
+        m_attemptTimer->start();
+        return;
+    }
+
+    checkFailed();
+}
+
 class QXmppOutgoingClientPrivate
 {
 public:
     QXmppOutgoingClientPrivate(QXmppOutgoingClient *q);
     void connectToHost(const QString &host, quint16 port);
+    void keepAliveFailed();
+    void keepAliveSucceeded();
 
     // This object provides the configuration
     // required for connecting to the XMPP server.
@@ -71,11 +263,14 @@ public:
 
     // DNS
     QDnsLookup dns;
+    QXmppConnector *connector;
+    QPair<QString, quint16> fallbackHost;
 
     // Stream
     QString streamId;
     QString streamFrom;
     QString streamVersion;
+    QXmppStreamFeatures streamFeatures;
 
     // Redirection
     QString redirectHost;
@@ -92,23 +287,73 @@ public:
     QString nonSASLAuthId;
     QXmppSaslClient *saslClient;
 
-    // Timers
+    // Keep alive
     QTimer *pingTimer;
     QTimer *timeoutTimer;
+    QElapsedTimer lastActivity;
+    QElapsedTimer pingClock;
+    QString pingId;
+    bool keepAlivePending;
+
+    // current keep alive interval and smallest one which failed, which
+    // are kept across connections
+    int keepAliveInterval;
+    int keepAliveFailedInterval;
 
 private:
     QXmppOutgoingClient *q;
 };
 
 QXmppOutgoingClientPrivate::QXmppOutgoingClientPrivate(QXmppOutgoingClient *qq)
-    : redirectPort(0)
+    : connector(0)
+    , redirectPort(0)
     , sessionAvailable(false)
     , isAuthenticated(false)
     , saslClient(0)
+    , keepAlivePending(false)
+    , keepAliveInterval(0)
+    , keepAliveFailedInterval(0)
     , q(qq)
 {
 }
 
+/// Shortens the keep alive interval after a keep alive failed.
+
+void QXmppOutgoingClientPrivate::keepAliveFailed()
+{
+    keepAlivePending = false;
+    q->updateCounter("client.keepalive.failure");
+
+    const int step = config.keepAliveInterval();
+    if (config.keepAliveMaximumInterval() > step && keepAliveInterval > 0) {
+        keepAliveFailedInterval = keepAliveInterval;
+        keepAliveInterval = qMax(step, keepAliveInterval - step);
+        q->setGauge("client.keepalive.interval", keepAliveInterval);
+    }
+}
+
+/// Lengthens the keep alive interval after a keep alive which followed an
+/// idle period succeeded.
+
+void QXmppOutgoingClientPrivate::keepAliveSucceeded()
+{
+    keepAlivePending = false;
+
+    const int step = config.keepAliveInterval();
+    const int maximum = config.keepAliveMaximumInterval();
+    if (maximum <= step)
+        return;
+
+    int interval = qMin(keepAliveInterval + step, maximum);
+    if (keepAliveFailedInterval > 0)
+        interval = qMin(interval, keepAliveFailedInterval - step);
+    interval = qMax(step, interval);
+    if (interval != keepAliveInterval) {
+        keepAliveInterval = interval;
+        q->setGauge("client.keepalive.interval", keepAliveInterval);
+    }
+}
+
 void QXmppOutgoingClientPrivate::connectToHost(const QString &host, quint16 port)
 {
     q->info(QString("Connecting to %1:%2").arg(host, QString::number(port)));
@@ -159,13 +404,36 @@ QXmppOutgoingClient::QXmppOutgoingClient(QObject *parent)
                     this, SLOT(socketError(QAbstractSocket::SocketError)));
     Q_ASSERT(check);
 
+    // keep alives are only sent on idle streams
+    check = connect(socket, SIGNAL(readyRead()),
+                    this, SLOT(_q_dataReceived()));
+    Q_ASSERT(check);
+
+    check = connect(socket, SIGNAL(bytesWritten(qint64)),
+                    this, SLOT(_q_dataSent()));
+    Q_ASSERT(check);
+
     // DNS lookups
     check = connect(&d->dns, SIGNAL(finished()),
                     this, SLOT(_q_dnsLookupFinished()));
     Q_ASSERT(check);
 
+    d->connector = new QXmppConnector(this);
+    check = connect(d->connector, SIGNAL(connected(QHostAddress,quint16)),
+                    this, SLOT(_q_connectorConnected(QHostAddress,quint16)));
+    Q_ASSERT(check);
+
+    check = connect(d->connector, SIGNAL(failed()),
+                    this, SLOT(_q_connectorFailed()));
+    Q_ASSERT(check);
+
+    check = connect(d->connector, SIGNAL(logMessage(QXmppLogger::MessageType,QString)),
+                    this, SIGNAL(logMessage(QXmppLogger::MessageType,QString)));
+    Q_ASSERT(check);
+
     // XEP-0199: XMPP Ping
     d->pingTimer = new QTimer(this);
+    d->pingTimer->setSingleShot(true);
     check = connect(d->pingTimer, SIGNAL(timeout()),
                     this, SLOT(pingSend()));
     Q_ASSERT(check);
@@ -199,6 +467,13 @@ QXmppConfiguration& QXmppOutgoingClient::configuration()
     return d->config;
 }
 
+/// Returns the features most recently advertised by the server.
+
+QXmppStreamFeatures QXmppOutgoingClient::streamFeatures() const
+{
+    return d->streamFeatures;
+}
+
 /// Attempts to connect to the XMPP server.
 
 void QXmppOutgoingClient::connectToHost()
@@ -217,20 +492,57 @@ void QXmppOutgoingClient::connectToHost()
     d->dns.lookup();
 }
 
+/// Disconnects from the server, and cancels any connection attempt.
+
+void QXmppOutgoingClient::disconnectFromHost()
+{
+    d->connector->abort();
+    d->keepAlivePending = false;
+    QXmppStream::disconnectFromHost();
+}
+
+void QXmppOutgoingClient::_q_connectorConnected(const QHostAddress &address, quint16 port)
+{
+    d->connectToHost(address.toString(), port);
+}
+
+void QXmppOutgoingClient::_q_connectorFailed()
+{
+    // report the error of the preferred host
+    d->connectToHost(d->fallbackHost.first, d->fallbackHost.second);
+}
+
 void QXmppOutgoingClient::_q_dnsLookupFinished()
 {
+    QList<QPair<QString, quint16> > hosts;
     if (d->dns.error() == QDnsLookup::NoError &&
         !d->dns.serviceRecords().isEmpty()) {
-        // take the first returned record
-        d->connectToHost(
-            d->dns.serviceRecords().first().target(),
-            d->dns.serviceRecords().first().port());
+        // records are sorted by priority and weight
+        foreach (const QDnsServiceRecord &record, d->dns.serviceRecords())
+            hosts << qMakePair(record.target(), record.port());
     } else {
         // as a fallback, use domain as the host name
         warning(QString("Lookup for domain %1 failed: %2")
                 .arg(d->dns.name(), d->dns.errorString()));
-        d->connectToHost(d->config.domain(), d->config.port());
+        hosts << qMakePair(d->config.domain(), d->config.port());
     }
+    d->fallbackHost = hosts.first();
+
+    // race the hosts and their addresses, unless a proxy makes the
+    // connection attempts meaningless or the certificate must be
+    // matched against the host name
+    QNetworkProxy::ProxyType proxyType = d->config.networkProxy().type();
+    if (proxyType == QNetworkProxy::DefaultProxy)
+        proxyType = QNetworkProxy::applicationProxy().type();
+#if (QT_VERSION >= QT_VERSION_CHECK(4, 8, 0))
+    if (proxyType == QNetworkProxy::NoProxy || proxyType == QNetworkProxy::DefaultProxy) {
+        d->connector->connectToHosts(hosts);
+        return;
+    }
+#else
+    Q_UNUSED(proxyType);
+#endif
+    d->connectToHost(d->fallbackHost.first, d->fallbackHost.second);
 }
 
 /// Returns true if authentication has succeeded.
@@ -247,10 +559,28 @@ bool QXmppOutgoingClient::isConnected() const
     return QXmppStream::isConnected() && d->sessionStarted;
 }
 
+void QXmppOutgoingClient::_q_dataReceived()
+{
+    d->lastActivity.restart();
+
+    // any data proves the stream is alive
+    d->timeoutTimer->stop();
+}
+
+void QXmppOutgoingClient::_q_dataSent()
+{
+    d->lastActivity.restart();
+}
+
 void QXmppOutgoingClient::_q_socketDisconnected()
 {
     debug("Socket disconnected");
     d->isAuthenticated = false;
+
+    // the stream was lost after a whitespace keep alive
+    if (d->keepAlivePending && d->config.keepAliveMode() == QXmppConfiguration::KeepAliveWhitespace)
+        d->keepAliveFailed();
+
     if (!d->redirectHost.isEmpty() && d->redirectPort > 0) {
         d->connectToHost(d->redirectHost, d->redirectPort);
         d->redirectHost = QString();
@@ -340,6 +670,7 @@ void QXmppOutgoingClient::handleStanza(const QDomElement &nodeRecv)
     {
         QXmppStreamFeatures features;
         features.parse(nodeRecv);
+        d->streamFeatures = features;
 
         if (!socket()->isEncrypted())
         {
@@ -434,6 +765,8 @@ void QXmppOutgoingClient::handleStanza(const QDomElement &nodeRecv)
                 disconnectFromHost();
                 return;
             }
+            // keep the credentials out of the traffic recorder
+            setTrafficRedacted(true);
             sendPacket(QXmppSaslAuth(d->saslClient->mechanism(), response));
             return;
         } else if(nonSaslAvailable && configuration().useNonSASLAuthentication()) {
@@ -550,6 +883,16 @@ void QXmppOutgoingClient::handleStanza(const QDomElement &nodeRecv)
             if(type.isEmpty())
                 warning("QXmppStream: iq type can't be empty");
 
+            // XEP-0199: XMPP Ping, any reply proves the stream is alive
+            if (!d->pingId.isEmpty() && id == d->pingId &&
+                (type == "result" || type == "error"))
+            {
+                d->pingId.clear();
+                d->timeoutTimer->stop();
+                setGauge("client.ping.rtt", d->pingClock.elapsed());
+                d->keepAliveSucceeded();
+            }
+
             if(id == d->sessionId)
             {
                 QXmppSessionIq session;
@@ -693,13 +1036,20 @@ void QXmppOutgoingClient::handleStanza(const QDomElement &nodeRecv)
 
 void QXmppOutgoingClient::pingStart()
 {
-    const int interval = configuration().keepAliveInterval();
+    const int step = configuration().keepAliveInterval();
+    if (step <= 0)
+        return;
+
+    // keep the interval learned on previous connections
+    const int maximum = qMax(step, configuration().keepAliveMaximumInterval());
+    if (d->keepAliveInterval < step || d->keepAliveInterval > maximum)
+        d->keepAliveInterval = step;
+    setGauge("client.keepalive.interval", d->keepAliveInterval);
+
     // start ping timer
-    if (interval > 0)
-    {
-        d->pingTimer->setInterval(interval * 1000);
-        d->pingTimer->start();
-    }
+    d->keepAlivePending = false;
+    d->lastActivity.start();
+    d->pingTimer->start(d->keepAliveInterval * 1000);
 }
 
 void QXmppOutgoingClient::pingStop()
@@ -707,27 +1057,52 @@ void QXmppOutgoingClient::pingStop()
     // stop all timers
     d->pingTimer->stop();
     d->timeoutTimer->stop();
+    d->pingId.clear();
+    d->keepAlivePending = false;
 }
 
 void QXmppOutgoingClient::pingSend()
 {
-    // send ping packet
-    QXmppPingIq ping;
-    ping.setTo(configuration().domain());
-    sendPacket(ping);
+    // the stream carried data since the timer was started
+    const qint64 interval = qint64(d->keepAliveInterval) * 1000;
+    const qint64 idle = d->lastActivity.elapsed();
+    if (idle < interval) {
+        d->pingTimer->start(interval - idle);
+        return;
+    }
 
-    // start timeout timer
-    const int timeout = configuration().keepAliveTimeout();
-    if (timeout > 0)
-    {
-        d->timeoutTimer->setInterval(timeout * 1000);
-        d->timeoutTimer->start();
+    // the stream survived the previous whitespace keep alive
+    const bool whitespace = configuration().keepAliveMode() == QXmppConfiguration::KeepAliveWhitespace;
+    if (d->keepAlivePending && whitespace)
+        d->keepAliveSucceeded();
+
+    if (whitespace) {
+        sendData(" ");
+    } else {
+        // send ping packet
+        QXmppPingIq ping;
+        ping.setTo(configuration().domain());
+        d->pingId = ping.id();
+        d->pingClock.start();
+        sendPacket(ping);
+
+        // start timeout timer
+        const int timeout = configuration().keepAliveTimeout();
+        if (timeout > 0)
+        {
+            d->timeoutTimer->setInterval(timeout * 1000);
+            d->timeoutTimer->start();
+        }
     }
+    d->keepAlivePending = true;
+    updateCounter("client.keepalive.sent");
+    d->pingTimer->start(d->keepAliveInterval * 1000);
 }
 
 void QXmppOutgoingClient::pingTimeout()
 {
     warning("Ping timeout");
+    d->keepAliveFailed();
     disconnectFromHost();
     emit error(QXmppClient::KeepAliveError);
 }
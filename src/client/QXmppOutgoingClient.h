@@ -31,12 +31,14 @@
 #include "QXmppStream.h"
 
 class QDomElement;
+class QHostAddress;
 class QSslError;
 
 class QXmppConfiguration;
 class QXmppPresence;
 class QXmppIq;
 class QXmppMessage;
+class QXmppStreamFeatures;
 
 class QXmppOutgoingClientPrivate;
 
@@ -53,6 +55,7 @@ public:
     ~QXmppOutgoingClient();
 
     void connectToHost();
+    void disconnectFromHost();
     bool isAuthenticated() const;
     bool isConnected() const;
 
@@ -60,6 +63,7 @@ public:
     QXmppStanza::Error::Condition xmppStreamError();
 
     QXmppConfiguration& configuration();
+    QXmppStreamFeatures streamFeatures() const;
 
 signals:
     /// This signal is emitted when an error is encountered.
@@ -86,6 +90,10 @@ protected:
     /// \endcond
 
 private slots:
+    void _q_connectorConnected(const QHostAddress &address, quint16 port);
+    void _q_connectorFailed();
+    void _q_dataReceived();
+    void _q_dataSent();
     void _q_dnsLookupFinished();
     void _q_socketDisconnected();
     void socketError(QAbstractSocket::SocketError);
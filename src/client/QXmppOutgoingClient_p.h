@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPOUTGOINGCLIENT_P_H
+#define QXMPPOUTGOINGCLIENT_P_H
+
+#include <QHash>
+#include <QHostAddress>
+#include <QPair>
+
+#include "QXmppLogger.h"
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QXmpp API.  It exists for the convenience
+// of the QXmppOutgoingClient class.  This header file may change from
+// version to version without notice, or even be removed.
+//
+// We mean it.
+//
+
+class QHostInfo;
+class QTcpSocket;
+class QTimer;
+
+/// \brief The QXmppConnector class finds the first reachable address of a
+/// list of hosts.
+///
+/// The hosts are resolved in parallel, and connection attempts to their
+/// addresses are started one after the other with a short delay, without
+/// waiting for the previous attempts to complete, as described in
+/// RFC 6555: Happy Eyeballs. The first attempt which succeeds wins and
+/// the others are cancelled.
+///
+
+class QXMPP_AUTOTEST_EXPORT QXmppConnector : public QXmppLoggable
+{
+    Q_OBJECT
+
+public:
+    QXmppConnector(QObject *parent = 0);
+    ~QXmppConnector();
+
+    int attemptDelay() const;
+    void setAttemptDelay(int delay);
+
+    bool isActive() const;
+
+    void connectToHosts(const QList<QPair<QString, quint16> > &hosts);
+    void abort();
+
+signals:
+    /// This signal is emitted when a connection to \a address and \a port
+    /// succeeded.
+    void connected(const QHostAddress &address, quint16 port);
+
+    /// This signal is emitted when none of the addresses could be reached.
+    void failed();
+
+private slots:
+    void _q_hostFound(const QHostInfo &info);
+    void _q_probeConnected();
+    void _q_probeError();
+    void _q_startNext();
+
+private:
+    void checkFailed();
+
+    // addresses which were not tried yet, by host
+    QList<QList<QPair<QHostAddress, quint16> > > m_candidates;
+    QList<quint16> m_ports;
+    QHash<int, int> m_lookups;
+    QList<QTcpSocket*> m_probes;
+    QTimer *m_attemptTimer;
+};
+
+#endif
@@ -22,14 +22,26 @@
  *
  */
 
+#include <QDataStream>
 #include <QDomElement>
+#include <QFile>
+#include <QSet>
+#include <QTimer>
 
 #include "QXmppClient.h"
 #include "QXmppPresence.h"
 #include "QXmppRosterIq.h"
 #include "QXmppRosterManager.h"
+#include "QXmppStreamFeatures.h"
 #include "QXmppUtils.h"
 
+static const quint32 cacheMagic = 0x51525354;
+static const quint32 cacheFormat = 1;
+
+// delay before writing changes to the cache, so that bursts of roster
+// pushes cause a single write
+static const int cacheSaveDelay = 5000;
+
 class QXmppRosterManagerPrivate
 {
 public:
@@ -38,24 +50,105 @@ public:
     // map of bareJid and its rosterEntry
     QMap<QString, QXmppRosterIq::Item> entries;
 
-    // map of resources of the jid and map of resources and presences
-    QMap<QString, QMap<QString, QXmppPresence> > presences;
+    // presences of the available resources, by bareJid and resource; the
+    // resources stay in a QMap so that they are listed in sorted order
+    QHash<QString, QMap<QString, QXmppPresence> > presences;
+
+    // bareJids whose presence changed since presencesChanged() was emitted
+    QSet<QString> changedPresences;
+    QTimer *changeTimer;
 
     // flag to store that the roster has been populated
     bool isRosterReceived;
 
-    // id of the initial roster request
-    QString rosterReqId;
+    // roster cache
+    QString cachePath;
+    QString version;
+    QTimer *cacheTimer;
+
+    bool loadCache();
+    bool saveCache();
 
 private:
     QXmppRosterManager *q;
 };
 
 QXmppRosterManagerPrivate::QXmppRosterManagerPrivate(QXmppRosterManager *qq)
-    : isRosterReceived(false),
+    : changeTimer(0),
+    isRosterReceived(false),
+    cacheTimer(0),
     q(qq)
 {
-    Q_UNUSED(q);
+}
+
+/// Replaces the roster with the contents of the cache file.
+
+bool QXmppRosterManagerPrivate::loadCache()
+{
+    QFile file(cachePath);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_4_6);
+    quint32 magic, format, count;
+    QString cacheVersion;
+    stream >> magic >> format;
+    if (magic != cacheMagic || format != cacheFormat)
+        return false;
+    stream >> cacheVersion >> count;
+
+    QMap<QString, QXmppRosterIq::Item> cacheEntries;
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+        QString bareJid, name, subscriptionStatus;
+        qint32 subscriptionType;
+        QStringList groups;
+        stream >> bareJid >> name >> subscriptionType >> subscriptionStatus >> groups;
+
+        QXmppRosterIq::Item item;
+        item.setBareJid(bareJid);
+        item.setName(name);
+        item.setSubscriptionType(QXmppRosterIq::Item::SubscriptionType(subscriptionType));
+        item.setSubscriptionStatus(subscriptionStatus);
+        item.setGroups(groups.toSet());
+        cacheEntries.insert(bareJid, item);
+    }
+    if (stream.status() != QDataStream::Ok)
+        return false;
+
+    entries = cacheEntries;
+    version = cacheVersion;
+    return true;
+}
+
+/// Writes the roster to the cache file, replacing it once complete.
+
+bool QXmppRosterManagerPrivate::saveCache()
+{
+    cacheTimer->stop();
+    if (cachePath.isEmpty())
+        return true;
+
+    const QString tempPath = cachePath + ".tmp";
+    QFile file(tempPath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_4_6);
+    stream << cacheMagic << cacheFormat << version << quint32(entries.size());
+    foreach (const QXmppRosterIq::Item &item, entries) {
+        stream << item.bareJid() << item.name() << qint32(item.subscriptionType())
+               << item.subscriptionStatus() << QStringList(item.groups().toList());
+    }
+    file.close();
+    if (file.error() != QFile::NoError) {
+        QFile::remove(tempPath);
+        return false;
+    }
+
+    QFile::remove(cachePath);
+    return QFile::rename(tempPath, cachePath);
 }
 
 /// Constructs a roster manager.
@@ -67,6 +160,21 @@ QXmppRosterManager::QXmppRosterManager(QXmppClient* client)
 
     d = new QXmppRosterManagerPrivate(this);
 
+    d->cacheTimer = new QTimer(this);
+    d->cacheTimer->setInterval(cacheSaveDelay);
+    d->cacheTimer->setSingleShot(true);
+    check = connect(d->cacheTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_saveCache()));
+    Q_ASSERT(check);
+
+    // presence changes are reported once per pass of the event loop
+    d->changeTimer = new QTimer(this);
+    d->changeTimer->setInterval(0);
+    d->changeTimer->setSingleShot(true);
+    check = connect(d->changeTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_emitPresencesChanged()));
+    Q_ASSERT(check);
+
     check = connect(client, SIGNAL(connected()),
                     this, SLOT(_q_connected()));
     Q_ASSERT(check);
@@ -82,6 +190,8 @@ QXmppRosterManager::QXmppRosterManager(QXmppClient* client)
 
 QXmppRosterManager::~QXmppRosterManager()
 {
+    if (d->cacheTimer->isActive())
+        _q_saveCache();
     delete d;
 }
 
@@ -98,25 +208,75 @@ bool QXmppRosterManager::acceptSubscription(const QString &bareJid, const QStrin
     return client()->sendPacket(presence);
 }
 
-/// Upon XMPP connection, request the roster.
+/// Upon XMPP connection, request the roster, or only the changes since
+/// the cached version if the server supports roster versioning.
 ///
 void QXmppRosterManager::_q_connected()
 {
     QXmppRosterIq roster;
     roster.setType(QXmppIq::Get);
     roster.setFrom(client()->configuration().jid());
-    d->rosterReqId = roster.id();
+    if (!d->cachePath.isEmpty() &&
+        client()->streamFeatures().rosterVersionMode() != QXmppStreamFeatures::Disabled)
+        roster.setVersion(d->version.isNull() ? QLatin1String("") : d->version);
+
+    // large rosters can take a while, do not set a deadline
     if (client()->isAuthenticated())
-        client()->sendPacket(roster);
+        client()->sendIq(roster, this, "_q_rosterReceived", 0);
 }
 
 void QXmppRosterManager::_q_disconnected()
 {
-    d->entries.clear();
+    // the cached roster is kept to be updated on the next connection
+    if (d->cachePath.isEmpty())
+        d->entries.clear();
+    else if (d->cacheTimer->isActive())
+        _q_saveCache();
     d->presences.clear();
     d->isRosterReceived = false;
 }
 
+void QXmppRosterManager::_q_emitPresencesChanged()
+{
+    if (d->changedPresences.isEmpty())
+        return;
+
+    const QStringList bareJids = d->changedPresences.toList();
+    d->changedPresences.clear();
+    emit presencesChanged(bareJids);
+}
+
+void QXmppRosterManager::_q_rosterReceived(const QDomElement &element)
+{
+    if (element.attribute("type") != "result") {
+        warning("Could not retrieve the roster");
+        return;
+    }
+
+    // an empty result means the cached roster is current and changes
+    // follow as roster pushes
+    if (QXmppRosterIq::isRosterIq(element)) {
+        QXmppRosterIq rosterIq;
+        rosterIq.parse(element);
+
+        d->entries.clear();
+        foreach (const QXmppRosterIq::Item &item, rosterIq.items())
+            d->entries.insert(item.bareJid(), item);
+        d->version = rosterIq.version();
+        if (!d->cachePath.isEmpty())
+            d->cacheTimer->start();
+    }
+
+    d->isRosterReceived = true;
+    emit rosterReceived();
+}
+
+void QXmppRosterManager::_q_saveCache()
+{
+    if (!d->saveCache())
+        warning(QString("Could not write roster cache %1").arg(d->cachePath));
+}
+
 /// \cond
 bool QXmppRosterManager::handleStanza(const QDomElement &element)
 {
@@ -132,7 +292,6 @@ bool QXmppRosterManager::handleStanza(const QDomElement &element)
     QXmppRosterIq rosterIq;
     rosterIq.parse(element);
 
-    bool isInitial = (d->rosterReqId == rosterIq.id());
     switch(rosterIq.type())
     {
     case QXmppIq::Set:
@@ -163,6 +322,12 @@ bool QXmppRosterManager::handleStanza(const QDomElement &element)
                     }
                 }
             }
+
+            // remember the version of the last change
+            if (!rosterIq.version().isNull())
+                d->version = rosterIq.version();
+            if (!d->cachePath.isEmpty() && !d->cacheTimer->isActive())
+                d->cacheTimer->start();
         }
         break;
     case QXmppIq::Result:
@@ -172,11 +337,6 @@ bool QXmppRosterManager::handleStanza(const QDomElement &element)
                 const QString bareJid = item.bareJid();
                 d->entries.insert(bareJid, item);
             }
-            if (isInitial)
-            {
-                d->isRosterReceived = true;
-                emit rosterReceived();
-            }
             break;
         }
     default:
@@ -199,12 +359,25 @@ void QXmppRosterManager::_q_presenceReceived(const QXmppPresence& presence)
     switch(presence.type())
     {
     case QXmppPresence::Available:
-        d->presences[bareJid][resource] = presence;
+        d->presences[bareJid].insert(resource, presence);
+        d->changedPresences.insert(bareJid);
+        if (!d->changeTimer->isActive())
+            d->changeTimer->start();
         emit presenceChanged(bareJid, resource);
         break;
     case QXmppPresence::Unavailable:
-        d->presences[bareJid].remove(resource);
-        emit presenceChanged(bareJid, resource);
+        {
+            QHash<QString, QMap<QString, QXmppPresence> >::iterator it = d->presences.find(bareJid);
+            if (it != d->presences.end()) {
+                it.value().remove(resource);
+                if (it.value().isEmpty())
+                    d->presences.erase(it);
+            }
+            d->changedPresences.insert(bareJid);
+            if (!d->changeTimer->isActive())
+                d->changeTimer->start();
+            emit presenceChanged(bareJid, resource);
+        }
         break;
     case QXmppPresence::Subscribe:
         if (client()->configuration().autoAcceptSubscriptions())
@@ -354,6 +527,16 @@ QXmppRosterIq::Item QXmppRosterManager::getRosterEntry(
         return QXmppRosterIq::Item();
 }
 
+/// Returns all the roster entries, by bareJid.
+///
+/// Unlike getRosterBareJids(), this does not build a new container: the
+/// returned map is implicitly shared with the manager.
+
+QMap<QString, QXmppRosterIq::Item> QXmppRosterManager::rosterEntries() const
+{
+    return d->entries;
+}
+
 /// Get all the associated resources with the given bareJid.
 ///
 /// \param bareJid as a QString
@@ -362,10 +545,7 @@ QXmppRosterIq::Item QXmppRosterManager::getRosterEntry(
 
 QStringList QXmppRosterManager::getResources(const QString& bareJid) const
 {
-    if(d->presences.contains(bareJid))
-        return d->presences[bareJid].keys();
-    else
-        return QStringList();
+    return d->presences.value(bareJid).keys();
 }
 
 /// Get all the presences of all the resources of the given bareJid. A bareJid
@@ -375,14 +555,14 @@ QStringList QXmppRosterManager::getResources(const QString& bareJid) const
 /// \param bareJid as a QString
 /// \return Map of resource and its respective presence QMap<QString, QXmppPresence>
 ///
+/// The returned map is implicitly shared with the manager, so it is not
+/// copied.
+///
 
 QMap<QString, QXmppPresence> QXmppRosterManager::getAllPresencesForBareJid(
         const QString& bareJid) const
 {
-    if(d->presences.contains(bareJid))
-        return d->presences[bareJid];
-    else
-        return QMap<QString, QXmppPresence>();
+    return d->presences.value(bareJid);
 }
 
 /// Get the presence of the given resource of the given bareJid.
@@ -395,14 +575,16 @@ QMap<QString, QXmppPresence> QXmppRosterManager::getAllPresencesForBareJid(
 QXmppPresence QXmppRosterManager::getPresence(const QString& bareJid,
                                        const QString& resource) const
 {
-    if(d->presences.contains(bareJid) && d->presences[bareJid].contains(resource))
-        return d->presences[bareJid][resource];
-    else
-    {
-        QXmppPresence presence;
-        presence.setType(QXmppPresence::Unavailable);
-        return presence;
+    QHash<QString, QMap<QString, QXmppPresence> >::const_iterator it = d->presences.constFind(bareJid);
+    if (it != d->presences.constEnd()) {
+        QMap<QString, QXmppPresence>::const_iterator presence = it.value().constFind(resource);
+        if (presence != it.value().constEnd())
+            return presence.value();
     }
+
+    QXmppPresence presence;
+    presence.setType(QXmppPresence::Unavailable);
+    return presence;
 }
 
 /// Function to check whether the roster has been received or not.
@@ -413,3 +595,41 @@ bool QXmppRosterManager::isRosterReceived() const
 {
     return d->isRosterReceived;
 }
+
+/// Returns the path of the file the roster is cached in.
+
+QString QXmppRosterManager::cachePath() const
+{
+    return d->cachePath;
+}
+
+/// Sets the path of the file the roster is cached in, and loads the
+/// roster from it if it exists.
+///
+/// The cached entries are available straight away, although
+/// isRosterReceived() only returns true once the server has confirmed
+/// them or sent a newer roster. An empty path disables the cache, which
+/// is the default.
+///
+/// \param path
+
+void QXmppRosterManager::setCachePath(const QString &path)
+{
+    if (path == d->cachePath)
+        return;
+    if (d->cacheTimer->isActive())
+        _q_saveCache();
+
+    d->cachePath = path;
+    d->version = QString();
+    if (!path.isEmpty() && QFile::exists(path) && !d->loadCache())
+        warning(QString("Could not read roster cache %1").arg(path));
+}
+
+/// Returns the version of the roster, as defined by XEP-0237: Roster
+/// Versioning, or a null string if the server did not provide one.
+
+QString QXmppRosterManager::rosterVersion() const
+{
+    return d->version;
+}
@@ -54,10 +54,18 @@ class QXmppRosterManagerPrivate;
 /// Function QXmppRosterManager::isRosterReceived() tells whether the roster has been
 /// received or not.
 ///
+/// If a cache file is set with setCachePath(), the roster is loaded from it
+/// straight away and kept up to date. When the server supports XEP-0237:
+/// Roster Versioning, only the changes since the cached version are then
+/// requested on connection.
+///
 /// The itemAdded(), itemChanged() and itemRemoved() signals are emitted whenever roster
 /// entries are added, changed or removed.
 ///
 /// The presenceChanged() signal is emitted whenever the presence for a roster item changes.
+/// For large rosters, the presencesChanged() signal reports all the changes
+/// received during a pass of the event loop at once, and rosterEntries() and
+/// getAllPresencesForBareJid() give access to the roster without copying it.
 ///
 /// \ingroup Managers
 
@@ -70,8 +78,14 @@ public:
     ~QXmppRosterManager();
 
     bool isRosterReceived() const;
+
+    QString cachePath() const;
+    void setCachePath(const QString &path);
+    QString rosterVersion() const;
+
     QStringList getRosterBareJids() const;
     QXmppRosterIq::Item getRosterEntry(const QString& bareJid) const;
+    QMap<QString, QXmppRosterIq::Item> rosterEntries() const;
 
     QStringList getResources(const QString& bareJid) const;
     QMap<QString, QXmppPresence> getAllPresencesForBareJid(
@@ -102,6 +116,10 @@ signals:
     /// This signal is emitted when the presence of a particular bareJid and resource changes.
     void presenceChanged(const QString& bareJid, const QString& resource);
 
+    /// This signal is emitted once per pass of the event loop with the
+    /// bareJids whose presence changed, each listed once.
+    void presencesChanged(const QStringList &bareJids);
+
     /// This signal is emitted when a contact asks to subscribe to your presence.
     ///
     /// You can either accept the request by calling acceptSubscription() or refuse it
@@ -126,7 +144,10 @@ signals:
 private slots:
     void _q_connected();
     void _q_disconnected();
+    void _q_emitPresencesChanged();
     void _q_presenceReceived(const QXmppPresence&);
+    void _q_rosterReceived(const QDomElement &element);
+    void _q_saveCache();
 
 private:
     QXmppRosterManagerPrivate *d;
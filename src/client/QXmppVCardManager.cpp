@@ -22,42 +22,305 @@
  */
 
 
+#include <QBuffer>
+#include <QCache>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
+#include <QDomDocument>
+#include <QFile>
+#include <QSet>
+#include <QTimer>
+#include <QXmlStreamWriter>
+
 #include "QXmppClient.h"
 #include "QXmppConstants.h"
+#include "QXmppPresence.h"
 #include "QXmppUtils.h"
 #include "QXmppVCardIq.h"
 #include "QXmppVCardManager.h"
 
+static const quint32 cacheMagic = 0x51564346;
+static const quint32 cacheFormat = 1;
+
+// delay before writing the index of the cache
+static const int cacheSaveDelay = 5000;
+
+// number of bytes of photos kept in memory
+static const int photoCacheSize = 4 * 1024 * 1024;
+
+class QXmppVCardCacheEntry
+{
+public:
+    // the vCard without its photo, which is stored separately
+    QByteArray xml;
+    QByteArray photoHash;
+    QString photoType;
+};
+
 class QXmppVCardManagerPrivate
 {
 public:
+    QXmppVCardManagerPrivate();
+    QString indexPath() const;
+    QString photoPath(const QByteArray &hash) const;
+    void addVCard(const QString &bareJid, const QXmppVCardIq &vCard);
+    bool loadCache();
+    bool saveCache();
+
     QXmppVCardIq clientVCard;
     bool isClientVCardReceived;
+
+    // ids of the requests being sent, by JID
+    QHash<QString, QString> requests;
+
+    QString cachePath;
+    QTimer *cacheTimer;
+    QHash<QString, QXmppVCardCacheEntry> vCards;
+
+    // recently used photos, by SHA-1 hash
+    QCache<QByteArray, QByteArray> photos;
 };
 
+QXmppVCardManagerPrivate::QXmppVCardManagerPrivate()
+    : isClientVCardReceived(false),
+    cacheTimer(0),
+    photos(photoCacheSize)
+{
+}
+
+QString QXmppVCardManagerPrivate::indexPath() const
+{
+    return QDir(cachePath).filePath("vcards.dat");
+}
+
+QString QXmppVCardManagerPrivate::photoPath(const QByteArray &hash) const
+{
+    return QDir(cachePath).filePath("photos/" + QString::fromLatin1(hash.toHex()));
+}
+
+/// Stores a received vCard, writing its photo unless it is already known.
+
+void QXmppVCardManagerPrivate::addVCard(const QString &bareJid, const QXmppVCardIq &vCard)
+{
+    QXmppVCardCacheEntry entry;
+    const QByteArray photo = vCard.photo();
+    if (!photo.isEmpty()) {
+        entry.photoHash = QCryptographicHash::hash(photo, QCryptographicHash::Sha1);
+        entry.photoType = vCard.photoType();
+        if (!photos.contains(entry.photoHash)) {
+            const QString path = photoPath(entry.photoHash);
+            if (!QFile::exists(path)) {
+                QFile file(path + ".tmp");
+                if (file.open(QIODevice::WriteOnly) && file.write(photo) == photo.size()) {
+                    file.close();
+                    QFile::rename(path + ".tmp", path);
+                }
+            }
+            photos.insert(entry.photoHash, new QByteArray(photo), photo.size());
+        }
+    }
+
+    QXmppVCardIq stripped(vCard);
+    stripped.setId(QString());
+    stripped.setTo(QString());
+    stripped.setFrom(QString());
+    stripped.setPhoto(QByteArray());
+    QBuffer buffer(&entry.xml);
+    buffer.open(QIODevice::WriteOnly);
+    QXmlStreamWriter writer(&buffer);
+    stripped.toXml(&writer);
+
+    vCards.insert(bareJid, entry);
+    if (!cacheTimer->isActive())
+        cacheTimer->start();
+}
+
+/// Replaces the vCards with the contents of the cache index.
+
+bool QXmppVCardManagerPrivate::loadCache()
+{
+    QFile file(indexPath());
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_4_6);
+    quint32 magic, format, count;
+    stream >> magic >> format;
+    if (magic != cacheMagic || format != cacheFormat)
+        return false;
+    stream >> count;
+
+    QHash<QString, QXmppVCardCacheEntry> cacheEntries;
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+        QString bareJid;
+        QXmppVCardCacheEntry entry;
+        stream >> bareJid >> entry.photoHash >> entry.photoType >> entry.xml;
+        cacheEntries.insert(bareJid, entry);
+    }
+    if (stream.status() != QDataStream::Ok)
+        return false;
+
+    vCards = cacheEntries;
+    return true;
+}
+
+/// Writes the cache index, and removes the photos no vCard refers to.
+
+bool QXmppVCardManagerPrivate::saveCache()
+{
+    cacheTimer->stop();
+    if (cachePath.isEmpty())
+        return true;
+
+    const QString path = indexPath();
+    QFile file(path + ".tmp");
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+
+    QSet<QString> usedPhotos;
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_4_6);
+    stream << cacheMagic << cacheFormat << quint32(vCards.size());
+    QHash<QString, QXmppVCardCacheEntry>::const_iterator it;
+    for (it = vCards.constBegin(); it != vCards.constEnd(); ++it) {
+        const QXmppVCardCacheEntry &entry = it.value();
+        stream << it.key() << entry.photoHash << entry.photoType << entry.xml;
+        if (!entry.photoHash.isEmpty())
+            usedPhotos << QString::fromLatin1(entry.photoHash.toHex());
+    }
+    file.close();
+    if (file.error() != QFile::NoError) {
+        QFile::remove(path + ".tmp");
+        return false;
+    }
+    QFile::remove(path);
+    if (!QFile::rename(path + ".tmp", path))
+        return false;
+
+    QDir photoDir(QDir(cachePath).filePath("photos"));
+    foreach (const QString &name, photoDir.entryList(QDir::Files)) {
+        if (!usedPhotos.contains(name)) {
+            photoDir.remove(name);
+            photos.remove(QByteArray::fromHex(name.toLatin1()));
+        }
+    }
+    return true;
+}
+
 QXmppVCardManager::QXmppVCardManager()
     : d(new QXmppVCardManagerPrivate)
 {
-    d->isClientVCardReceived = false;
+    bool check;
+    Q_UNUSED(check);
+
+    d->cacheTimer = new QTimer(this);
+    d->cacheTimer->setInterval(cacheSaveDelay);
+    d->cacheTimer->setSingleShot(true);
+    check = connect(d->cacheTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_saveCache()));
+    Q_ASSERT(check);
 }
 
 QXmppVCardManager::~QXmppVCardManager()
 {
+    if (d->cacheTimer->isActive())
+        _q_saveCache();
     delete d;
 }
 
 /// This function requests the server for vCard of the specified jid.
-/// Once received the signal vCardReceived() is emitted.
+/// Once received the signal vCardReceived() is emitted. If the request
+/// fails or times out, the signal is emitted with an IQ of type error.
+///
+/// If a request for the same vCard is already being sent, its id is
+/// returned and no new request is sent.
 ///
 /// \param jid Jid of the specific entry in the roster
 ///
 QString QXmppVCardManager::requestVCard(const QString& jid)
 {
+    const QString pendingId = d->requests.value(jid);
+    if (!pendingId.isEmpty())
+        return pendingId;
+
     QXmppVCardIq request(jid);
-    if(client()->sendPacket(request))
+    if(client()->sendIq(request, this, "_q_vCardReceived")) {
+        d->requests.insert(jid, request.id());
         return request.id();
-    else
+    } else {
         return QString();
+    }
+}
+
+/// Returns the path of the directory vCards are cached in.
+
+QString QXmppVCardManager::cachePath() const
+{
+    return d->cachePath;
+}
+
+/// Sets the path of the directory vCards are cached in, and loads the
+/// vCards it contains.
+///
+/// An empty path disables the cache, which is the default.
+///
+/// \param path
+
+void QXmppVCardManager::setCachePath(const QString &path)
+{
+    if (path == d->cachePath)
+        return;
+    if (d->cacheTimer->isActive())
+        _q_saveCache();
+
+    d->cachePath = path;
+    d->vCards.clear();
+    d->photos.clear();
+    if (path.isEmpty())
+        return;
+
+    if (!QDir().mkpath(QDir(path).filePath("photos")))
+        warning(QString("Could not create vCard cache %1").arg(path));
+    else if (QFile::exists(d->indexPath()) && !d->loadCache())
+        warning(QString("Could not read vCard cache %1").arg(path));
+}
+
+/// Returns the cached vCard of the given contact, or an empty vCard if
+/// it is not cached.
+///
+/// \param bareJid
+
+QXmppVCardIq QXmppVCardManager::cachedVCard(const QString &bareJid) const
+{
+    QXmppVCardIq vCard;
+    QHash<QString, QXmppVCardCacheEntry>::const_iterator it = d->vCards.constFind(bareJid);
+    if (it == d->vCards.constEnd())
+        return vCard;
+
+    QDomDocument doc;
+    doc.setContent(it.value().xml, true);
+    vCard.parse(doc.documentElement());
+    vCard.setFrom(bareJid);
+
+    const QByteArray &hash = it.value().photoHash;
+    if (!hash.isEmpty()) {
+        QByteArray *cachedPhoto = d->photos.object(hash);
+        QByteArray photo = cachedPhoto ? *cachedPhoto : QByteArray();
+        if (photo.isEmpty()) {
+            QFile file(d->photoPath(hash));
+            if (file.open(QIODevice::ReadOnly))
+                photo = file.readAll();
+            if (QCryptographicHash::hash(photo, QCryptographicHash::Sha1) != hash)
+                photo.clear();
+            else
+                d->photos.insert(hash, new QByteArray(photo), photo.size());
+        }
+        vCard.setPhoto(photo);
+        vCard.setPhotoType(it.value().photoType);
+    }
+    return vCard;
 }
 
 /// Returns the vCard of the connected client.
@@ -107,24 +370,91 @@ QStringList QXmppVCardManager::discoveryFeatures() const
     return QStringList() << ns_vcard;
 }
 
+void QXmppVCardManager::setClient(QXmppClient *client)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    QXmppClientExtension::setClient(client);
+
+    check = connect(client, SIGNAL(presenceReceived(QXmppPresence)),
+                    this, SLOT(_q_presenceReceived(QXmppPresence)));
+    Q_ASSERT(check);
+}
+
 bool QXmppVCardManager::handleStanza(const QDomElement &element)
 {
     if(element.tagName() == "iq" && QXmppVCardIq::isVCard(element))
     {
-        QXmppVCardIq vCardIq;
-        vCardIq.parse(element);
+        _q_vCardReceived(element);
+        return true;
+    }
+
+    return false;
+}
+
+void QXmppVCardManager::_q_presenceReceived(const QXmppPresence &presence)
+{
+    if (d->cachePath.isEmpty() || presence.type() != QXmppPresence::Available)
+        return;
+
+    // the bare JID of a room occupant is the room itself
+    if (!presence.mucItem().isNull() || !presence.mucStatusCodes().isEmpty())
+        return;
 
-        if (vCardIq.from().isEmpty()) {
-            d->clientVCard = vCardIq;
-            d->isClientVCardReceived = true;
-            emit clientVCardReceived();
+    // only refresh cached vCards whose photo changed, other vCards are
+    // requested when they are needed
+    const QString bareJid = QXmppUtils::jidToBareJid(presence.from());
+    QHash<QString, QXmppVCardCacheEntry>::const_iterator it = d->vCards.constFind(bareJid);
+    if (it == d->vCards.constEnd())
+        return;
+    switch (presence.vCardUpdateType()) {
+    case QXmppPresence::VCardUpdateValidPhoto:
+        if (it.value().photoHash != presence.photoHash())
+            requestVCard(bareJid);
+        break;
+    case QXmppPresence::VCardUpdateNoPhoto:
+        if (!it.value().photoHash.isEmpty())
+            requestVCard(bareJid);
+        break;
+    default:
+        break;
+    }
+}
+
+void QXmppVCardManager::_q_saveCache()
+{
+    if (!d->saveCache())
+        warning(QString("Could not write vCard cache %1").arg(d->cachePath));
+}
+
+void QXmppVCardManager::_q_vCardReceived(const QDomElement &element)
+{
+    QXmppVCardIq vCardIq;
+    vCardIq.parse(element);
+
+    const QString id = vCardIq.id();
+    QMutableHashIterator<QString, QString> it(d->requests);
+    while (it.hasNext()) {
+        if (it.next().value() == id) {
+            it.remove();
+            break;
         }
+    }
 
-        emit vCardReceived(vCardIq);
+    if (!d->cachePath.isEmpty() && vCardIq.type() == QXmppIq::Result) {
+        const QString bareJid = vCardIq.from().isEmpty() ?
+            client()->configuration().jidBare() :
+            QXmppUtils::jidToBareJid(vCardIq.from());
+        d->addVCard(bareJid, vCardIq);
+    }
 
-        return true;
+    if (vCardIq.from().isEmpty() && vCardIq.type() == QXmppIq::Result) {
+        d->clientVCard = vCardIq;
+        d->isClientVCardReceived = true;
+        emit clientVCardReceived();
     }
 
-    return false;
+    emit vCardReceived(vCardIq);
 }
 /// \endcond
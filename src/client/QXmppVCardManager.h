@@ -27,6 +27,7 @@
 
 #include "QXmppClientExtension.h"
 
+class QXmppPresence;
 class QXmppVCardIq;
 class QXmppVCardManagerPrivate;
 
@@ -49,6 +50,18 @@ class QXmppVCardManagerPrivate;
 /// <B>Setting vCard of the client:</B><BR>
 /// Using setClientVCard() client can set its vCard.
 ///
+/// <B>Caching vCards:</B><BR>
+/// If a cache directory is set with setCachePath(), received vCards are
+/// stored in it and can be read back with cachedVCard(). Photos are stored
+/// once per SHA-1 hash, whichever number of contacts use them, and only the
+/// recently used ones are kept in memory. When a contact's presence
+/// advertises a photo hash as defined by XEP-0153: vCard-Based Avatars, its
+/// cached vCard is requested again if the hash differs from the cached one.
+/// vCards which are not cached are only requested by requestVCard(), and
+/// presence from chat room occupants is ignored.
+///
+/// Concurrent requests for the same vCard are sent once.
+///
 /// \note Client can't set/change vCards of roster entries.
 ///
 /// \ingroup Managers
@@ -63,6 +76,10 @@ public:
 
     QString requestVCard(const QString& bareJid = "");
 
+    QString cachePath() const;
+    void setCachePath(const QString &path);
+    QXmppVCardIq cachedVCard(const QString &bareJid) const;
+
     const QXmppVCardIq& clientVCard() const;
     void setClientVCard(const QXmppVCardIq&);
 
@@ -74,6 +91,11 @@ public:
     bool handleStanza(const QDomElement &element);
     /// \endcond
 
+protected:
+    /// \cond
+    void setClient(QXmppClient* client);
+    /// \endcond
+
 signals:
     /// This signal is emitted when the requested vCard is received
     /// after calling the requestVCard() function.
@@ -83,6 +105,11 @@ signals:
     /// after calling the requestClientVCard() function.
     void clientVCardReceived();
 
+private slots:
+    void _q_presenceReceived(const QXmppPresence &presence);
+    void _q_saveCache();
+    void _q_vCardReceived(const QDomElement &element);
+
 private:
     QXmppVCardManagerPrivate *d;
 };
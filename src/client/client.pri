@@ -12,6 +12,7 @@ INSTALL_HEADERS += \
     client/QXmppMessageReceiptManager.h \
     client/QXmppMucManager.h \
     client/QXmppOutgoingClient.h \
+    client/QXmppOutgoingClient_p.h \
     client/QXmppRemoteMethod.h \
     client/QXmppRosterManager.h \
     client/QXmppRpcManager.h \
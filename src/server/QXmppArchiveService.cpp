@@ -0,0 +1,792 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QCache>
+#include <QDataStream>
+#include <QDir>
+#include <QDomElement>
+#include <QFile>
+#include <QSet>
+#include <QStringList>
+#include <QTimer>
+
+#include "QXmppArchiveIq.h"
+#include "QXmppArchiveService.h"
+#include "QXmppConstants.h"
+#include "QXmppPasswordChecker.h"
+#include "QXmppRosterService.h"
+#include "QXmppServer.h"
+#include "QXmppUtils.h"
+
+// index record sizes, in bytes
+static const int collectionRecordSize = 12;   // start, contact
+static const int chatRecordSize = 8;          // start
+static const int messageRecordSize = 24;      // date, start, segment, offset
+
+// appends are buffered and written out at this interval, in milliseconds
+static const int flushInterval = 1000;
+
+/// Reads the 64-bit key at the given offset of a fixed-size record.
+
+static qint64 readKey(QFile &file, qint64 index, int recordSize, int keyOffset)
+{
+    qint64 key = 0;
+    if (file.seek(index * recordSize + keyOffset)) {
+        QDataStream stream(&file);
+        stream >> key;
+    }
+    return key;
+}
+
+/// Returns the index of the first record whose key is not less than
+/// \a key, using a binary search over the sorted index file.
+
+static qint64 lowerBound(QFile &file, int recordSize, int keyOffset, qint64 key)
+{
+    qint64 lo = 0;
+    qint64 hi = file.size() / recordSize;
+    while (lo < hi) {
+        const qint64 mid = (lo + hi) / 2;
+        if (readKey(file, mid, recordSize, keyOffset) < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/// Computes the page of [lo, hi) requested by a result set query.
+
+static QXmppResultSetReply pageRange(const QXmppResultSetQuery &rsm, qint64 lo, qint64 hi, qint64 &first, qint64 &last)
+{
+    // an empty <before/> requests the last page
+    last = hi;
+    if (!rsm.before().isEmpty())
+        last = qBound(lo, rsm.before().toLongLong(), hi);
+
+    first = lo;
+    if (rsm.index() >= 0)
+        first = lo + rsm.index();
+    else if (!rsm.after().isEmpty())
+        first = rsm.after().toLongLong() + 1;
+    else if (!rsm.before().isNull() && rsm.max() >= 0)
+        first = last - rsm.max();
+    first = qBound(lo, first, hi);
+
+    last = qMax(first, last);
+    if (rsm.max() >= 0)
+        last = qMin(last, first + rsm.max());
+
+    QXmppResultSetReply reply;
+    reply.setCount(int(hi - lo));
+    if (last > first) {
+        reply.setIndex(int(first - lo));
+        reply.setFirst(QString::number(first));
+        reply.setLast(QString::number(last - 1));
+    }
+    return reply;
+}
+
+class QXmppArchiveServiceChat
+{
+public:
+    qint64 start;
+    qint64 last;
+};
+
+class QXmppArchiveServiceUser
+{
+public:
+    QString path;
+    QStringList contacts;
+    QHash<QString, int> contactIds;
+
+    // date of the last archived message, dates never go back so that
+    // the indexes stay sorted even if the clock does
+    qint64 lastDate;
+
+    // ongoing conversations by contact
+    QHash<int, QXmppArchiveServiceChat> chats;
+};
+
+class QXmppArchiveServicePrivate
+{
+public:
+    QXmppArchiveServicePrivate(QXmppArchiveService *qq);
+
+    bool isArchived(const QString &owner);
+    void archive(const QString &owner, const QString &with, const QString &body, bool received);
+    QXmppArchiveServiceUser *user(const QString &owner);
+    int contactId(QXmppArchiveServiceUser *user, const QString &with, bool create);
+    bool appendRecord(const QString &path, const QByteArray &record);
+    void flushFile(const QString &path);
+    void flush();
+    bool writeSegment(const QByteArray &record, quint32 &segment, quint32 &offset);
+    bool readSegment(quint32 segment, quint32 offset, QXmppArchiveMessage &message);
+
+    void handleAuto(const QDomElement &element);
+    void handleList(const QDomElement &element);
+    void handleRetrieve(const QDomElement &element);
+    void sendError(const QDomElement &element, QXmppStanza::Error::Type type, QXmppStanza::Error::Condition condition);
+
+    int chatTimeout;
+    QString storagePath;
+
+    QCache<QString, QXmppArchiveServiceUser> users;
+
+    // index files open for appending, and those with unwritten data
+    QCache<QString, QFile> files;
+    QSet<QString> dirtyFiles;
+    QFile *segment;
+    quint32 segmentId;
+    qint64 segmentSize;
+    bool segmentDirty;
+    QTimer *flushTimer;
+
+    // users who enabled automatic archiving for all their sessions, and
+    // the resources which enabled it for their own session
+    QSet<QString> autoUsers;
+    QHash<QString, QSet<QString> > autoSessions;
+
+private:
+    QXmppArchiveService *q;
+};
+
+QXmppArchiveServicePrivate::QXmppArchiveServicePrivate(QXmppArchiveService *qq)
+    : chatTimeout(1800),
+    segment(0),
+    segmentId(0),
+    segmentSize(0),
+    segmentDirty(false),
+    q(qq)
+{
+    users.setMaxCost(1000);
+    files.setMaxCost(256);
+
+    flushTimer = new QTimer(qq);
+    flushTimer->setInterval(flushInterval);
+    flushTimer->setSingleShot(true);
+}
+
+/// Returns true if messages of the given local user are archived, that
+/// is if the account exists and the user enabled automatic archiving.
+
+bool QXmppArchiveServicePrivate::isArchived(const QString &owner)
+{
+    if (!autoUsers.contains(owner) && !autoSessions.contains(owner))
+        return false;
+
+    QXmppServer *server = q->server();
+    const QString domain = QXmppUtils::jidToDomain(owner);
+    QXmppPasswordChecker *checker = server->passwordChecker(domain);
+    if (checker && checker->hasGetPassword()) {
+        QXmppPasswordRequest request;
+        request.setDomain(domain);
+        request.setUsername(QXmppUtils::jidToUser(owner));
+        QString password;
+        if (checker->getPassword(request, password) == QXmppPasswordReply::NoError)
+            return true;
+    }
+    foreach (QXmppServerExtension *extension, server->extensions()) {
+        QXmppRosterService *roster = qobject_cast<QXmppRosterService*>(extension);
+        if (roster && !roster->items(owner).isEmpty())
+            return true;
+    }
+    return false;
+}
+
+/// Archives a message in the given user's conversation with a contact.
+
+void QXmppArchiveServicePrivate::archive(const QString &owner, const QString &with, const QString &body, bool received)
+{
+    QXmppArchiveServiceUser *user = this->user(owner);
+    const int contact = contactId(user, with, true);
+    if (contact < 0)
+        return;
+    const QString prefix = user->path + "/" + QString::number(contact);
+
+    // find the ongoing conversation, if any
+    QHash<int, QXmppArchiveServiceChat>::iterator it = user->chats.find(contact);
+    if (it == user->chats.end()) {
+        flushFile(prefix + ".msgs");
+        QFile messages(prefix + ".msgs");
+        const qint64 count = messages.size() / messageRecordSize;
+        if (count > 0 && messages.open(QIODevice::ReadOnly)) {
+            QXmppArchiveServiceChat chat;
+            chat.last = readKey(messages, count - 1, messageRecordSize, 0);
+            chat.start = readKey(messages, count - 1, messageRecordSize, 8);
+            it = user->chats.insert(contact, chat);
+            user->lastDate = qMax(user->lastDate, chat.last);
+        }
+    }
+    qint64 date = qMax(QDateTime::currentDateTime().toMSecsSinceEpoch(), user->lastDate);
+
+    // start a new conversation after a period of silence
+    if (it == user->chats.end() || date - it.value().last > qint64(chatTimeout) * 1000) {
+        QXmppArchiveServiceChat chat;
+        chat.start = (date / 1000) * 1000;
+        if (it != user->chats.end())
+            chat.start = qMax(chat.start, it.value().start + 1000);
+        date = qMax(date, chat.start);
+        chat.last = date;
+        it = user->chats.insert(contact, chat);
+
+        QByteArray collection;
+        QDataStream collectionStream(&collection, QIODevice::WriteOnly);
+        collectionStream << chat.start << quint32(contact);
+        QByteArray start;
+        QDataStream startStream(&start, QIODevice::WriteOnly);
+        startStream << chat.start;
+        if (!appendRecord(user->path + "/collections.idx", collection) ||
+            !appendRecord(prefix + ".chats", start)) {
+            q->warning(QString("Could not write archive index for %1").arg(owner));
+            return;
+        }
+    }
+    it.value().last = date;
+    user->lastDate = date;
+
+    // append the message to the segment, then index it
+    QByteArray record;
+    QDataStream recordStream(&record, QIODevice::WriteOnly);
+    recordStream.setVersion(QDataStream::Qt_4_6);
+    recordStream << owner << with << date << received << body;
+    quint32 segment, offset;
+    if (!writeSegment(record, segment, offset)) {
+        q->warning("Could not write archive segment");
+        return;
+    }
+
+    QByteArray index;
+    QDataStream indexStream(&index, QIODevice::WriteOnly);
+    indexStream << date << it.value().start << segment << offset;
+    if (!appendRecord(prefix + ".msgs", index))
+        q->warning(QString("Could not write archive index for %1").arg(owner));
+}
+
+QXmppArchiveServiceUser *QXmppArchiveServicePrivate::user(const QString &owner)
+{
+    QXmppArchiveServiceUser *user = users.object(owner);
+    if (!user) {
+        user = new QXmppArchiveServiceUser;
+        user->path = storagePath + "/users/" + owner;
+        user->lastDate = 0;
+        QDir().mkpath(user->path);
+
+        flushFile(user->path + "/contacts.lst");
+        QFile file(user->path + "/contacts.lst");
+        if (file.open(QIODevice::ReadOnly)) {
+            foreach (const QByteArray &line, file.readAll().split('\n')) {
+                if (line.isEmpty())
+                    continue;
+                user->contactIds.insert(QString::fromUtf8(line), user->contacts.size());
+                user->contacts << QString::fromUtf8(line);
+            }
+        }
+
+        // resume from the start of the last conversation
+        flushFile(user->path + "/collections.idx");
+        QFile collections(user->path + "/collections.idx");
+        const qint64 count = collections.size() / collectionRecordSize;
+        if (count > 0 && collections.open(QIODevice::ReadOnly))
+            user->lastDate = readKey(collections, count - 1, collectionRecordSize, 0);
+        users.insert(owner, user);
+    }
+    return user;
+}
+
+/// Returns the identifier of a user's contact, or -1 if it is unknown.
+
+int QXmppArchiveServicePrivate::contactId(QXmppArchiveServiceUser *user, const QString &with, bool create)
+{
+    QHash<QString, int>::const_iterator it = user->contactIds.constFind(with);
+    if (it != user->contactIds.constEnd())
+        return it.value();
+    if (!create || !appendRecord(user->path + "/contacts.lst", with.toUtf8() + "\n"))
+        return -1;
+
+    const int id = user->contacts.size();
+    user->contacts << with;
+    user->contactIds.insert(with, id);
+    return id;
+}
+
+/// Appends a record to the given file.
+///
+/// The file is kept open and the record is buffered until the next flush.
+
+bool QXmppArchiveServicePrivate::appendRecord(const QString &path, const QByteArray &record)
+{
+    QFile *file = files.object(path);
+    if (!file) {
+        file = new QFile(path);
+        if (!file->open(QIODevice::WriteOnly | QIODevice::Append)) {
+            delete file;
+            return false;
+        }
+        files.insert(path, file);
+    }
+    if (file->write(record) != record.size())
+        return false;
+
+    dirtyFiles << path;
+    if (!flushTimer->isActive())
+        flushTimer->start();
+    return true;
+}
+
+/// Writes out the buffered records of the given file, before it is read.
+
+void QXmppArchiveServicePrivate::flushFile(const QString &path)
+{
+    if (dirtyFiles.remove(path)) {
+        QFile *file = files.object(path);
+        if (file)
+            file->flush();
+    }
+}
+
+/// Writes out all the buffered records.
+
+void QXmppArchiveServicePrivate::flush()
+{
+    foreach (const QString &path, dirtyFiles) {
+        QFile *file = files.object(path);
+        if (file)
+            file->flush();
+    }
+    dirtyFiles.clear();
+
+    if (segment && segmentDirty)
+        segment->flush();
+    segmentDirty = false;
+}
+
+/// Appends a record to the current day's segment.
+
+bool QXmppArchiveServicePrivate::writeSegment(const QByteArray &record, quint32 &segmentOut, quint32 &offset)
+{
+    const quint32 today = QDate::currentDate().toString("yyyyMMdd").toUInt();
+    if (!segment || segmentId != today) {
+        delete segment;
+        segment = new QFile(QString("%1/segments/%2.seg").arg(storagePath, QString::number(today)));
+        segmentId = today;
+        segmentDirty = false;
+        if (!segment->open(QIODevice::WriteOnly | QIODevice::Append)) {
+            delete segment;
+            segment = 0;
+            return false;
+        }
+        segmentSize = segment->size();
+    }
+
+    segmentOut = segmentId;
+    offset = segmentSize;
+    if (segment->write(record) != record.size())
+        return false;
+    segmentSize += record.size();
+
+    segmentDirty = true;
+    if (!flushTimer->isActive())
+        flushTimer->start();
+    return true;
+}
+
+bool QXmppArchiveServicePrivate::readSegment(quint32 segmentId, quint32 offset, QXmppArchiveMessage &message)
+{
+    if (segment && segmentDirty && segmentId == this->segmentId) {
+        segment->flush();
+        segmentDirty = false;
+    }
+
+    QFile file(QString("%1/segments/%2.seg").arg(storagePath, QString::number(segmentId)));
+    if (!file.open(QIODevice::ReadOnly) || !file.seek(offset))
+        return false;
+
+    QString owner, with, body;
+    qint64 date;
+    bool received;
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_4_6);
+    stream >> owner >> with >> date >> received >> body;
+    if (stream.status() != QDataStream::Ok)
+        return false;
+
+    message.setBody(body);
+    message.setDate(QDateTime::fromMSecsSinceEpoch(date).toUTC());
+    message.setReceived(received);
+    return true;
+}
+
+/// Enables or disables automatic archiving for a user's session, or for
+/// all of the user's sessions.
+
+void QXmppArchiveServicePrivate::handleAuto(const QDomElement &element)
+{
+    const QString jid = element.attribute("from");
+    const QString owner = QXmppUtils::jidToBareJid(jid);
+    const QDomElement autoElement = element.firstChildElement("auto");
+    const QString save = autoElement.attribute("save");
+    const bool enabled = (save == QLatin1String("true") || save == QLatin1String("1"));
+    if (!enabled && save != QLatin1String("false") && save != QLatin1String("0")) {
+        sendError(element, QXmppStanza::Error::Modify, QXmppStanza::Error::BadRequest);
+        return;
+    }
+
+    if (autoElement.attribute("scope") == QLatin1String("global")) {
+        // the setting is kept in the user's directory
+        const QString path = storagePath + "/users/" + owner;
+        if (enabled) {
+            QFile file(path + "/auto");
+            if (!QDir().mkpath(path) || !file.open(QIODevice::WriteOnly)) {
+                q->warning(QString("Could not enable archiving for %1").arg(owner));
+                sendError(element, QXmppStanza::Error::Wait, QXmppStanza::Error::InternalServerError);
+                return;
+            }
+            autoUsers << owner;
+        } else {
+            QFile::remove(path + "/auto");
+            autoUsers.remove(owner);
+        }
+    } else {
+        QHash<QString, QSet<QString> >::iterator it = autoSessions.find(owner);
+        if (enabled) {
+            autoSessions[owner] << jid;
+        } else if (it != autoSessions.end()) {
+            it.value().remove(jid);
+            if (it.value().isEmpty())
+                autoSessions.erase(it);
+        }
+    }
+
+    QXmppIq response(QXmppIq::Result);
+    response.setId(element.attribute("id"));
+    response.setFrom(element.attribute("to"));
+    response.setTo(jid);
+    q->server()->sendPacket(response);
+}
+
+void QXmppArchiveServicePrivate::handleList(const QDomElement &element)
+{
+    QXmppArchiveListIq request;
+    request.parse(element);
+
+    QXmppArchiveServiceUser *user = this->user(QXmppUtils::jidToBareJid(request.from()));
+    const qint64 start = request.start().isValid() ? request.start().toMSecsSinceEpoch() : 0;
+    const qint64 end = request.end().isValid() ? request.end().toMSecsSinceEpoch() : -1;
+
+    // with a contact, use its own conversation index
+    int contact = -1;
+    QFile file;
+    int recordSize;
+    if (!request.with().isEmpty()) {
+        contact = contactId(user, request.with(), false);
+        file.setFileName(user->path + "/" + QString::number(contact) + ".chats");
+        recordSize = chatRecordSize;
+    } else {
+        file.setFileName(user->path + "/collections.idx");
+        recordSize = collectionRecordSize;
+    }
+
+    QList<QXmppArchiveChat> chats;
+    QXmppResultSetReply rsm;
+    flushFile(file.fileName());
+    if ((request.with().isEmpty() || contact >= 0) && file.open(QIODevice::ReadOnly)) {
+        const qint64 lo = lowerBound(file, recordSize, 0, start);
+        const qint64 hi = end >= 0 ? lowerBound(file, recordSize, 0, end) : file.size() / recordSize;
+        qint64 first, last;
+        rsm = pageRange(request.resultSetQuery(), lo, hi, first, last);
+
+        // read the page in one go
+        file.seek(first * recordSize);
+        QDataStream stream(&file);
+        for (qint64 i = first; i < last; ++i) {
+            qint64 chatStart;
+            quint32 chatContact = contact;
+            stream >> chatStart;
+            if (contact < 0)
+                stream >> chatContact;
+
+            QXmppArchiveChat chat;
+            chat.setStart(QDateTime::fromMSecsSinceEpoch(chatStart).toUTC());
+            chat.setWith(user->contacts.value(chatContact));
+            chats << chat;
+        }
+    } else {
+        rsm.setCount(0);
+    }
+
+    QXmppArchiveListIq response;
+    response.setType(QXmppIq::Result);
+    response.setId(request.id());
+    response.setFrom(request.to());
+    response.setTo(request.from());
+    response.setChats(chats);
+    response.setResultSetReply(rsm);
+    q->server()->sendPacket(response);
+}
+
+void QXmppArchiveServicePrivate::handleRetrieve(const QDomElement &element)
+{
+    QXmppArchiveRetrieveIq request;
+    request.parse(element);
+
+    QXmppArchiveServiceUser *user = this->user(QXmppUtils::jidToBareJid(request.from()));
+    const int contact = contactId(user, request.with(), false);
+    QFile file(user->path + "/" + QString::number(contact) + ".msgs");
+    flushFile(file.fileName());
+    if (contact < 0 || !request.start().isValid() || !file.open(QIODevice::ReadOnly)) {
+        sendError(element, QXmppStanza::Error::Cancel, QXmppStanza::Error::ItemNotFound);
+        return;
+    }
+
+    // locate the conversation's messages
+    const qint64 start = request.start().toMSecsSinceEpoch();
+    const qint64 lo = lowerBound(file, messageRecordSize, 8, start);
+    const qint64 hi = lowerBound(file, messageRecordSize, 8, start + 1);
+    if (lo == hi) {
+        sendError(element, QXmppStanza::Error::Cancel, QXmppStanza::Error::ItemNotFound);
+        return;
+    }
+    qint64 first, last;
+    const QXmppResultSetReply rsm = pageRange(request.resultSetQuery(), lo, hi, first, last);
+
+    // read the page
+    QList<QXmppArchiveMessage> messages;
+    file.seek(first * messageRecordSize);
+    const QByteArray records = file.read((last - first) * messageRecordSize);
+    QDataStream stream(records);
+    for (qint64 i = first; i < last; ++i) {
+        qint64 date, chatStart;
+        quint32 segment, offset;
+        stream >> date >> chatStart >> segment >> offset;
+
+        QXmppArchiveMessage message;
+        if (readSegment(segment, offset, message))
+            messages << message;
+    }
+
+    QXmppArchiveChat chat;
+    chat.setWith(request.with());
+    chat.setStart(QDateTime::fromMSecsSinceEpoch(start).toUTC());
+    chat.setMessages(messages);
+
+    QXmppArchiveChatIq response;
+    response.setType(QXmppIq::Result);
+    response.setId(request.id());
+    response.setFrom(request.to());
+    response.setTo(request.from());
+    response.setChat(chat);
+    response.setResultSetReply(rsm);
+    q->server()->sendPacket(response);
+}
+
+void QXmppArchiveServicePrivate::sendError(const QDomElement &element, QXmppStanza::Error::Type type, QXmppStanza::Error::Condition condition)
+{
+    QXmppIq response(QXmppIq::Error);
+    response.setId(element.attribute("id"));
+    response.setFrom(element.attribute("to"));
+    response.setTo(element.attribute("from"));
+    response.setError(QXmppStanza::Error(type, condition));
+    q->server()->sendPacket(response);
+}
+
+/// Constructs a new message archiving service.
+
+QXmppArchiveService::QXmppArchiveService()
+{
+    bool check;
+    Q_UNUSED(check);
+
+    d = new QXmppArchiveServicePrivate(this);
+
+    check = connect(d->flushTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_flush()));
+    Q_ASSERT(check);
+}
+
+/// Destroys a message archiving service.
+
+QXmppArchiveService::~QXmppArchiveService()
+{
+    delete d->segment;
+    delete d;
+}
+
+/// Returns the number of seconds of silence after which a new
+/// conversation is started.
+
+int QXmppArchiveService::chatTimeout() const
+{
+    return d->chatTimeout;
+}
+
+/// Sets the number of seconds of silence after which messages exchanged
+/// with a contact are archived in a new conversation.
+///
+/// The default is 1800.
+///
+/// \param secs
+
+void QXmppArchiveService::setChatTimeout(int secs)
+{
+    d->chatTimeout = qMax(0, secs);
+}
+
+/// Returns the directory holding the archives.
+
+QString QXmppArchiveService::storagePath() const
+{
+    return d->storagePath;
+}
+
+/// Sets the directory holding the archives.
+///
+/// No messages are archived until a path is set.
+///
+/// \param path
+
+void QXmppArchiveService::setStoragePath(const QString &path)
+{
+    d->storagePath = path;
+}
+
+QStringList QXmppArchiveService::discoveryFeatures() const
+{
+    return QStringList() << ns_archive
+        << QString(ns_archive) + ":auto";
+}
+
+bool QXmppArchiveService::handleStanza(const QDomElement &element)
+{
+    if (d->storagePath.isEmpty())
+        return false;
+
+    const QString from = QXmppUtils::jidToBareJid(element.attribute("from"));
+    const QString to = QXmppUtils::jidToBareJid(element.attribute("to"));
+    const QStringList domains = server()->domains();
+
+    if (element.tagName() == QLatin1String("message")) {
+        // archive one-to-one messages, but let them be delivered
+        const QString type = element.attribute("type");
+        const QString body = element.firstChildElement("body").text();
+        if (body.isEmpty() || type == QLatin1String("groupchat") || type == QLatin1String("error") || type == QLatin1String("headline"))
+            return false;
+        if (QXmppUtils::jidToUser(from).isEmpty() || QXmppUtils::jidToUser(to).isEmpty())
+            return false;
+
+        if (domains.contains(QXmppUtils::jidToDomain(from)) && d->isArchived(from))
+            d->archive(from, to, body, false);
+        if (domains.contains(QXmppUtils::jidToDomain(to)) && d->isArchived(to))
+            d->archive(to, from, body, true);
+        return false;
+
+    } else if (element.tagName() == QLatin1String("iq")) {
+        // only answer users about their own archive
+        if (!domains.contains(QXmppUtils::jidToDomain(from)) || (to != from && !domains.contains(to)))
+            return false;
+
+        const QString type = element.attribute("type");
+        if (type == QLatin1String("get") && QXmppArchiveListIq::isArchiveListIq(element)) {
+            d->handleList(element);
+            return true;
+        } else if (type == QLatin1String("get") && QXmppArchiveRetrieveIq::isArchiveRetrieveIq(element)) {
+            d->handleRetrieve(element);
+            return true;
+        } else if ((type == QLatin1String("get") || type == QLatin1String("set")) &&
+                   element.firstChildElement().namespaceURI() == ns_archive) {
+            // removal and preferences are not supported
+            if (type == QLatin1String("set") && element.firstChildElement().tagName() == QLatin1String("auto"))
+                d->handleAuto(element);
+            else
+                d->sendError(element, QXmppStanza::Error::Cancel, QXmppStanza::Error::FeatureNotImplemented);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool QXmppArchiveService::start()
+{
+    bool check;
+    Q_UNUSED(check);
+
+    if (d->storagePath.isEmpty()) {
+        warning("No storage path was set, messages will not be archived");
+        return false;
+    }
+    if (!QDir().mkpath(d->storagePath + "/segments") || !QDir().mkpath(d->storagePath + "/users")) {
+        warning(QString("Could not create archive directory %1").arg(d->storagePath));
+        return false;
+    }
+
+    // load the users who enabled archiving for all their sessions
+    QDir users(d->storagePath + "/users");
+    foreach (const QString &owner, users.entryList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+        if (QFile::exists(users.filePath(owner + "/auto")))
+            d->autoUsers << owner;
+    }
+
+    check = connect(server(), SIGNAL(clientDisconnected(QString)),
+                    this, SLOT(_q_clientDisconnected(QString)));
+    Q_ASSERT(check);
+    return true;
+}
+
+void QXmppArchiveService::stop()
+{
+    disconnect(server(), SIGNAL(clientDisconnected(QString)),
+               this, SLOT(_q_clientDisconnected(QString)));
+
+    d->flushTimer->stop();
+    d->flush();
+    d->files.clear();
+    d->dirtyFiles.clear();
+    delete d->segment;
+    d->segment = 0;
+    d->users.clear();
+    d->autoUsers.clear();
+    d->autoSessions.clear();
+}
+
+/// Disables automatic archiving for a session once its client disconnects.
+///
+/// \param jid
+
+void QXmppArchiveService::_q_clientDisconnected(const QString &jid)
+{
+    const QString owner = QXmppUtils::jidToBareJid(jid);
+    QHash<QString, QSet<QString> >::iterator it = d->autoSessions.find(owner);
+    if (it != d->autoSessions.end()) {
+        it.value().remove(jid);
+        if (it.value().isEmpty())
+            d->autoSessions.erase(it);
+    }
+}
+
+/// Writes out the buffered archive records.
+
+void QXmppArchiveService::_q_flush()
+{
+    d->flush();
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPARCHIVESERVICE_H
+#define QXMPPARCHIVESERVICE_H
+
+#include "QXmppServerExtension.h"
+
+class QXmppArchiveServicePrivate;
+
+/// \brief The QXmppArchiveService class is a server extension which
+/// archives the conversations of local users and answers their queries
+/// as defined by XEP-0136: Message Archiving.
+///
+/// Only the messages of existing local accounts which enabled automatic
+/// archiving, for their session or for all of them, are archived.
+///
+/// Messages are appended to one segment file per day. For each user and
+/// contact, fixed-size index records locate the conversations and their
+/// messages, so that list and retrieve requests using result set
+/// management seek straight to the requested page. Files stay open and
+/// appends are written out in batches.
+///
+/// \ingroup Core
+
+class QXMPP_EXPORT QXmppArchiveService : public QXmppServerExtension
+{
+    Q_OBJECT
+    Q_CLASSINFO("ExtensionName", "archive");
+
+public:
+    QXmppArchiveService();
+    ~QXmppArchiveService();
+
+    int chatTimeout() const;
+    void setChatTimeout(int secs);
+
+    QString storagePath() const;
+    void setStoragePath(const QString &path);
+
+    /// \cond
+    QStringList discoveryFeatures() const;
+    bool handleStanza(const QDomElement &element);
+    bool start();
+    void stop();
+    /// \endcond
+
+private slots:
+    void _q_clientDisconnected(const QString &jid);
+    void _q_flush();
+
+private:
+    friend class QXmppArchiveServicePrivate;
+    QXmppArchiveServicePrivate *d;
+};
+
+#endif
@@ -0,0 +1,680 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QSet>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTimer>
+#include <QtEndian>
+
+#include "QXmppCluster.h"
+#include "QXmppUtils.h"
+
+// Frames exchanged between nodes are a 32-bit big-endian length followed
+// by a QDataStream-encoded type, string and byte array.
+//
+// Each side of a link starts by sending a challenge holding a random
+// nonce. The other side answers with a hello holding its node name and
+// an HMAC over both nonces keyed with the cluster secret. Other frames
+// are only accepted once the hello was verified.
+enum FrameType {
+    HelloFrame = 0,
+    SessionAddedFrame,
+    SessionRemovedFrame,
+    DataFrame,
+    ChallengeFrame
+};
+
+static const int nonceSize = 16;
+static const quint32 maxHandshakeFrameSize = 1024;
+static const quint32 maxFrameSize = 16 * 1024 * 1024;
+
+class QXmppClusterLink
+{
+public:
+    QXmppClusterLink() : device(0), peer(-1) {}
+
+    QByteArray buffer;
+    QIODevice *device;
+    QByteArray localNonce;
+    QByteArray remoteNonce;
+    QString node;
+    int peer;
+};
+
+class QXmppClusterPeer
+{
+public:
+    QXmppClusterPeer() : port(0), link(0) {}
+
+    QString path;
+    QHostAddress address;
+    quint16 port;
+    QXmppClusterLink *link;
+};
+
+class QXmppClusterPrivate
+{
+public:
+    QXmppClusterPrivate(QXmppCluster *qq);
+    QXmppClusterLink *addLink(QIODevice *device, int peer);
+    void handleFrame(QXmppClusterLink *link, const QByteArray &frame);
+    QByteArray linkProof(bool connecting, const QByteArray &verifierNonce, const QByteArray &senderNonce, const QString &node) const;
+    void removeLink(QXmppClusterLink *link);
+    void removeSession(const QString &jid, const QString &node);
+    void replaceSession(const QString &jid, const QString &node, qint64 stamp);
+    void sendChallenge(QXmppClusterLink *link);
+    void sendFrame(QXmppClusterLink *link, FrameType type, const QString &text, const QByteArray &data = QByteArray());
+    void sendSessions(QXmppClusterLink *link);
+
+    QString nodeName;
+    QByteArray secret;
+    QLocalServer *localServer;
+    QTcpServer *tcpServer;
+    QTimer *connectTimer;
+
+    QList<QXmppClusterPeer> peers;
+    QHash<QIODevice*, QXmppClusterLink*> links;
+    QHash<QString, QXmppClusterLink*> linksByNode;
+
+    // session directory, with the time at which each session was bound
+    QHash<QString, qint64> localSessions;
+    QHash<QString, QString> sessionNodes;
+    QHash<QString, qint64> sessionStamps;
+    QHash<QString, QSet<QString> > sessionsByBareJid;
+
+private:
+    QXmppCluster *q;
+};
+
+/// Returns true if a session bound at \a stamp on \a node replaces one
+/// bound at \a otherStamp on \a otherNode. Every node takes the same
+/// decision, as ties are broken by node name.
+
+static bool isNewerSession(qint64 stamp, const QString &node, qint64 otherStamp, const QString &otherNode)
+{
+    return stamp > otherStamp || (stamp == otherStamp && node > otherNode);
+}
+
+/// Compares two digests in constant time.
+
+static bool isEqualDigest(const QByteArray &a, const QByteArray &b)
+{
+    if (a.size() != b.size())
+        return false;
+    char diff = 0;
+    for (int i = 0; i < a.size(); ++i)
+        diff |= a[i] ^ b[i];
+    return diff == 0;
+}
+
+static bool isUnconnected(QIODevice *device)
+{
+    QAbstractSocket *socket = qobject_cast<QAbstractSocket*>(device);
+    if (socket)
+        return socket->state() == QAbstractSocket::UnconnectedState;
+    QLocalSocket *localSocket = qobject_cast<QLocalSocket*>(device);
+    if (localSocket)
+        return localSocket->state() == QLocalSocket::UnconnectedState;
+    return !device->isOpen();
+}
+
+QXmppClusterPrivate::QXmppClusterPrivate(QXmppCluster *qq)
+    : localServer(0)
+    , tcpServer(0)
+    , connectTimer(0)
+    , q(qq)
+{
+}
+
+/// Registers a new link over \a device and starts the handshake.
+///
+/// \param device
+/// \param peer the index of the configured peer, or -1 for incoming links
+
+QXmppClusterLink *QXmppClusterPrivate::addLink(QIODevice *device, int peer)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    QXmppClusterLink *link = new QXmppClusterLink;
+    link->device = device;
+    link->localNonce = QXmppUtils::generateRandomBytes(nonceSize);
+    link->peer = peer;
+    links.insert(device, link);
+    if (peer >= 0)
+        peers[peer].link = link;
+
+    check = QObject::connect(device, SIGNAL(disconnected()),
+                             q, SLOT(_q_linkDisconnected()));
+    Q_ASSERT(check);
+
+    check = QObject::connect(device, SIGNAL(readyRead()),
+                             q, SLOT(_q_linkReadyRead()));
+    Q_ASSERT(check);
+
+    return link;
+}
+
+/// Handles a complete frame received on \a link.
+
+void QXmppClusterPrivate::handleFrame(QXmppClusterLink *link, const QByteArray &frame)
+{
+    quint8 type;
+    QString text;
+    QByteArray data;
+    QDataStream stream(frame);
+    stream.setVersion(QDataStream::Qt_4_6);
+    stream >> type >> text >> data;
+    if (stream.status() != QDataStream::Ok) {
+        q->warning("Received an invalid cluster frame");
+        return;
+    }
+
+    if (type == ChallengeFrame) {
+        if (!link->remoteNonce.isEmpty() || data.size() != nonceSize) {
+            q->warning("Refusing cluster link with an invalid challenge");
+            link->device->close();
+            return;
+        }
+
+        // prove we know the secret
+        link->remoteNonce = data;
+        sendFrame(link, HelloFrame, nodeName, linkProof(link->peer >= 0, link->remoteNonce, link->localNonce, nodeName));
+    } else if (type == HelloFrame) {
+        if (text.isEmpty() || text == nodeName || !link->node.isEmpty()) {
+            q->warning(QString("Refusing cluster link with invalid node name '%1'").arg(text));
+            link->device->close();
+            return;
+        }
+        if (secret.isEmpty() || link->remoteNonce.isEmpty() ||
+            !isEqualDigest(data, linkProof(link->peer < 0, link->localNonce, link->remoteNonce, text))) {
+            q->warning(QString("Refusing cluster link from node '%1' which failed authentication").arg(text));
+            link->device->close();
+            return;
+        }
+        link->node = text;
+        const bool isNew = !linksByNode.contains(text);
+        linksByNode.insert(text, link);
+        if (isNew) {
+            q->info(QString("Cluster node %1 connected").arg(text));
+            emit q->nodeConnected(text);
+        }
+        sendSessions(link);
+    } else if (link->node.isEmpty()) {
+        q->warning("Refusing cluster link which sent a frame before the handshake");
+        link->device->close();
+    } else if (type == SessionAddedFrame) {
+        replaceSession(text, link->node, data.toLongLong());
+    } else if (type == SessionRemovedFrame) {
+        removeSession(text, link->node);
+    } else if (type == DataFrame) {
+        emit q->dataReceived(text, data);
+    }
+}
+
+/// Returns the proof that the node named \a node knows the cluster
+/// secret, for the nonces of both sides of a link. The side which
+/// initiated the link signs differently from the side which accepted it,
+/// so a proof cannot be reflected back over another link.
+///
+/// \param connecting whether the sender initiated the link
+/// \param verifierNonce the nonce sent by the verifying side
+/// \param senderNonce the nonce sent by the proving side
+/// \param node the name of the proving node
+
+QByteArray QXmppClusterPrivate::linkProof(bool connecting, const QByteArray &verifierNonce, const QByteArray &senderNonce, const QString &node) const
+{
+    QByteArray text(connecting ? "connect" : "accept");
+    text += '\0';
+    text += verifierNonce;
+    text += senderNonce;
+    text += node.toUtf8();
+    return QXmppUtils::generateHmacSha1(secret, text);
+}
+
+/// Forgets about \a link, and about the sessions of its node if it was
+/// the last link to that node.
+
+void QXmppClusterPrivate::removeLink(QXmppClusterLink *link)
+{
+    links.remove(link->device);
+    if (link->peer >= 0 && peers[link->peer].link == link)
+        peers[link->peer].link = 0;
+    link->device->deleteLater();
+
+    const QString node = link->node;
+    if (!node.isEmpty() && linksByNode.value(node) == link) {
+        linksByNode.remove(node);
+
+        // fall back to another link to the same node
+        foreach (QXmppClusterLink *other, links) {
+            if (other->node == node) {
+                linksByNode.insert(node, other);
+                break;
+            }
+        }
+
+        if (!linksByNode.contains(node)) {
+            foreach (const QString &jid, sessionNodes.keys(node))
+                removeSession(jid, node);
+            q->info(QString("Cluster node %1 disconnected").arg(node));
+            emit q->nodeDisconnected(node);
+        }
+    }
+    delete link;
+}
+
+/// Removes a remote session from the directory if it belongs to \a node.
+
+void QXmppClusterPrivate::removeSession(const QString &jid, const QString &node)
+{
+    if (sessionNodes.value(jid) != node)
+        return;
+    sessionNodes.remove(jid);
+    sessionStamps.remove(jid);
+
+    const QString bareJid = QXmppUtils::jidToBareJid(jid);
+    if (sessionsByBareJid.contains(bareJid)) {
+        sessionsByBareJid[bareJid].remove(jid);
+        if (sessionsByBareJid[bareJid].isEmpty())
+            sessionsByBareJid.remove(bareJid);
+    }
+}
+
+/// Records a session bound on another node. If the same full JID is
+/// bound elsewhere, only the newest session is kept and the node holding
+/// an older one drops it.
+
+void QXmppClusterPrivate::replaceSession(const QString &jid, const QString &node, qint64 stamp)
+{
+    if (localSessions.contains(jid)) {
+        if (!isNewerSession(stamp, node, localSessions.value(jid), nodeName))
+            return;
+        localSessions.remove(jid);
+        q->info(QString("Cluster session %1 was replaced on node %2").arg(jid, node));
+        emit q->sessionReplaced(jid);
+    } else if (sessionNodes.contains(jid) &&
+               !isNewerSession(stamp, node, sessionStamps.value(jid), sessionNodes.value(jid))) {
+        return;
+    }
+
+    sessionNodes.insert(jid, node);
+    sessionStamps.insert(jid, stamp);
+    sessionsByBareJid[QXmppUtils::jidToBareJid(jid)].insert(jid);
+}
+
+/// Sends our nonce over a new link to start the handshake.
+
+void QXmppClusterPrivate::sendChallenge(QXmppClusterLink *link)
+{
+    sendFrame(link, ChallengeFrame, QString(), link->localNonce);
+}
+
+void QXmppClusterPrivate::sendFrame(QXmppClusterLink *link, FrameType type, const QString &text, const QByteArray &data)
+{
+    QByteArray frame;
+    QDataStream stream(&frame, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_4_6);
+    stream << quint32(0) << quint8(type) << text << data;
+    qToBigEndian<quint32>(frame.size() - 4, reinterpret_cast<uchar*>(frame.data()));
+    link->device->write(frame);
+}
+
+/// Sends the sessions we hold over a newly authenticated link.
+
+void QXmppClusterPrivate::sendSessions(QXmppClusterLink *link)
+{
+    for (QHash<QString, qint64>::const_iterator it = localSessions.constBegin(); it != localSessions.constEnd(); ++it)
+        sendFrame(link, SessionAddedFrame, it.key(), QByteArray::number(it.value()));
+}
+
+/// Constructs a new cluster node.
+///
+/// \param nodeName The unique name of this node in the cluster.
+/// \param parent
+
+QXmppCluster::QXmppCluster(const QString &nodeName, QObject *parent)
+    : QXmppLoggable(parent)
+    , d(new QXmppClusterPrivate(this))
+{
+    bool check;
+    Q_UNUSED(check);
+
+    d->nodeName = nodeName;
+
+    // keep links to the other nodes up
+    d->connectTimer = new QTimer(this);
+    d->connectTimer->setInterval(5000);
+    check = connect(d->connectTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_connectNodes()));
+    Q_ASSERT(check);
+}
+
+/// Destroys the cluster node.
+
+QXmppCluster::~QXmppCluster()
+{
+    qDeleteAll(d->links);
+    delete d;
+}
+
+/// Returns the name of this node.
+
+QString QXmppCluster::nodeName() const
+{
+    return d->nodeName;
+}
+
+/// Returns the secret shared by the nodes of the cluster.
+
+QByteArray QXmppCluster::secret() const
+{
+    return d->secret;
+}
+
+/// Sets the secret shared by the nodes of the cluster.
+///
+/// Links are authenticated by proving knowledge of the secret before any
+/// session or stanza is exchanged, and no link is accepted until a
+/// secret is set.
+///
+/// \param secret
+
+void QXmppCluster::setSecret(const QByteArray &secret)
+{
+    d->secret = secret;
+}
+
+/// Returns the names of the nodes this node is linked to.
+
+QStringList QXmppCluster::nodes() const
+{
+    return d->linksByNode.keys();
+}
+
+/// Listens for links from other nodes on the Unix-domain socket at the
+/// given \a path.
+///
+/// \param path
+
+bool QXmppCluster::listen(const QString &path)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    if (!d->localServer) {
+        d->localServer = new QLocalServer(this);
+        check = connect(d->localServer, SIGNAL(newConnection()),
+                        this, SLOT(_q_localConnection()));
+        Q_ASSERT(check);
+    }
+
+    // remove any stale socket left by a previous run
+    QLocalServer::removeServer(path);
+    if (!d->localServer->listen(path)) {
+        warning(QString("Could not start listening for cluster nodes on %1").arg(path));
+        return false;
+    }
+    return true;
+}
+
+/// Listens for links from other nodes over TCP.
+///
+/// \param address
+/// \param port
+
+bool QXmppCluster::listen(const QHostAddress &address, quint16 port)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    if (!d->tcpServer) {
+        d->tcpServer = new QTcpServer(this);
+        check = connect(d->tcpServer, SIGNAL(newConnection()),
+                        this, SLOT(_q_tcpConnection()));
+        Q_ASSERT(check);
+    }
+
+    if (!d->tcpServer->listen(address, port)) {
+        warning(QString("Could not start listening for cluster nodes on %1 %2").arg(address.toString(), QString::number(port)));
+        return false;
+    }
+    return true;
+}
+
+/// Stops listening and closes all links to other nodes.
+
+void QXmppCluster::close()
+{
+    d->connectTimer->stop();
+    if (d->localServer)
+        d->localServer->close();
+    if (d->tcpServer)
+        d->tcpServer->close();
+    foreach (QXmppClusterLink *link, d->links.values())
+        d->removeLink(link);
+    d->peers.clear();
+}
+
+/// Adds a node reachable over the Unix-domain socket at the given
+/// \a path. The link is re-established if it goes down.
+///
+/// \param path
+
+void QXmppCluster::addNode(const QString &path)
+{
+    QXmppClusterPeer peer;
+    peer.path = path;
+    d->peers << peer;
+    d->connectTimer->start();
+    _q_connectNodes();
+}
+
+/// Adds a node reachable over TCP. The link is re-established if it
+/// goes down.
+///
+/// \param address
+/// \param port
+
+void QXmppCluster::addNode(const QHostAddress &address, quint16 port)
+{
+    QXmppClusterPeer peer;
+    peer.address = address;
+    peer.port = port;
+    d->peers << peer;
+    d->connectTimer->start();
+    _q_connectNodes();
+}
+
+/// Advertises a session held by this node to the other nodes.
+///
+/// If another node holds a session for the same full JID, the older
+/// session is dropped by its node and sessionReplaced() is emitted there.
+///
+/// \param jid The full JID of the session.
+
+void QXmppCluster::addSession(const QString &jid)
+{
+    if (jid.isEmpty())
+        return;
+
+    const qint64 stamp = QDateTime::currentMSecsSinceEpoch();
+    const QString node = d->sessionNodes.value(jid);
+    if (!node.isEmpty()) {
+        if (!isNewerSession(stamp, d->nodeName, d->sessionStamps.value(jid), node)) {
+            // the other session is newer, as happens with skewed clocks
+            QMetaObject::invokeMethod(this, "sessionReplaced", Qt::QueuedConnection, Q_ARG(QString, jid));
+            return;
+        }
+        d->removeSession(jid, node);
+    }
+
+    d->localSessions.insert(jid, stamp);
+    foreach (QXmppClusterLink *link, d->linksByNode)
+        d->sendFrame(link, SessionAddedFrame, jid, QByteArray::number(stamp));
+}
+
+/// Withdraws a session held by this node.
+///
+/// \param jid The full JID of the session.
+
+void QXmppCluster::removeSession(const QString &jid)
+{
+    if (!d->localSessions.remove(jid))
+        return;
+    foreach (QXmppClusterLink *link, d->linksByNode)
+        d->sendFrame(link, SessionRemovedFrame, jid);
+}
+
+/// Returns the node which holds the session for the given full JID,
+/// or an empty string if no other node holds it.
+///
+/// \param jid
+
+QString QXmppCluster::sessionNode(const QString &jid) const
+{
+    return d->sessionNodes.value(jid);
+}
+
+/// Forwards data to the nodes holding sessions for \a to.
+///
+/// If \a to is a bare JID, the data is forwarded once to each node which
+/// holds a session for it. Returns true if the data was forwarded.
+///
+/// \param to
+/// \param data
+
+bool QXmppCluster::sendData(const QString &to, const QByteArray &data)
+{
+    QSet<QString> nodes;
+    if (QXmppUtils::jidToResource(to).isEmpty()) {
+        foreach (const QString &jid, d->sessionsByBareJid.value(to))
+            nodes.insert(d->sessionNodes.value(jid));
+    } else if (d->sessionNodes.contains(to)) {
+        nodes.insert(d->sessionNodes.value(to));
+    }
+
+    bool sent = false;
+    foreach (const QString &node, nodes) {
+        QXmppClusterLink *link = d->linksByNode.value(node);
+        if (link) {
+            d->sendFrame(link, DataFrame, to, data);
+            sent = true;
+        }
+    }
+    return sent;
+}
+
+void QXmppCluster::_q_connectNodes()
+{
+    bool check;
+    Q_UNUSED(check);
+
+    for (int i = 0; i < d->peers.size(); ++i) {
+        QXmppClusterLink *link = d->peers[i].link;
+        if (link && isUnconnected(link->device))
+            d->removeLink(link);
+        else if (link)
+            continue;
+
+        if (!d->peers[i].path.isEmpty()) {
+            QLocalSocket *socket = new QLocalSocket(this);
+            d->addLink(socket, i);
+            check = connect(socket, SIGNAL(connected()),
+                            this, SLOT(_q_linkConnected()));
+            Q_ASSERT(check);
+            socket->connectToServer(d->peers[i].path);
+        } else {
+            QTcpSocket *socket = new QTcpSocket(this);
+            d->addLink(socket, i);
+            check = connect(socket, SIGNAL(connected()),
+                            this, SLOT(_q_linkConnected()));
+            Q_ASSERT(check);
+            socket->connectToHost(d->peers[i].address, d->peers[i].port);
+        }
+    }
+}
+
+void QXmppCluster::_q_linkConnected()
+{
+    QXmppClusterLink *link = d->links.value(qobject_cast<QIODevice*>(sender()));
+    if (link)
+        d->sendChallenge(link);
+}
+
+void QXmppCluster::_q_linkDisconnected()
+{
+    QXmppClusterLink *link = d->links.value(qobject_cast<QIODevice*>(sender()));
+    if (link)
+        d->removeLink(link);
+}
+
+void QXmppCluster::_q_linkReadyRead()
+{
+    QIODevice *device = qobject_cast<QIODevice*>(sender());
+    QXmppClusterLink *link = d->links.value(device);
+    if (!link)
+        return;
+
+    link->buffer.append(device->readAll());
+    while (link->buffer.size() >= 4) {
+        const quint32 length = qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(link->buffer.constData()));
+        if (length > (link->node.isEmpty() ? maxHandshakeFrameSize : maxFrameSize)) {
+            warning(QString("Refusing cluster link which sent a frame of %1 bytes").arg(QString::number(length)));
+            device->close();
+            return;
+        }
+        if (quint32(link->buffer.size() - 4) < length)
+            break;
+        const QByteArray frame = link->buffer.mid(4, length);
+        link->buffer.remove(0, 4 + length);
+        d->handleFrame(link, frame);
+
+        // the link may have been closed while handling the frame
+        if (d->links.value(device) != link || !device->isOpen())
+            break;
+    }
+}
+
+void QXmppCluster::_q_localConnection()
+{
+    while (d->localServer->hasPendingConnections()) {
+        QLocalSocket *socket = d->localServer->nextPendingConnection();
+        socket->setParent(this);
+        d->sendChallenge(d->addLink(socket, -1));
+    }
+}
+
+void QXmppCluster::_q_tcpConnection()
+{
+    while (d->tcpServer->hasPendingConnections()) {
+        QTcpSocket *socket = d->tcpServer->nextPendingConnection();
+        socket->setParent(this);
+        d->sendChallenge(d->addLink(socket, -1));
+    }
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPCLUSTER_H
+#define QXMPPCLUSTER_H
+
+#include <QHostAddress>
+#include <QStringList>
+
+#include "QXmppLogger.h"
+
+class QXmppClusterPrivate;
+
+/// \brief The QXmppCluster class connects a QXmppServer to the other
+/// nodes of a cluster.
+///
+/// Each node keeps a replica of the session directory, which maps the
+/// JIDs of connected clients to the node they are connected to. If the
+/// same full JID is bound on two nodes, the older session is closed. Nodes
+/// advertise their sessions and forward stanzas for sessions they do not
+/// hold over persistent inter-node links, which can use either a
+/// Unix-domain socket or TCP.
+///
+/// Links are authenticated with a secret shared by all the nodes, and
+/// carry no other protection: use them on a trusted network.
+///
+/// To use a cluster, create one QXmppCluster per node with a unique node
+/// name, set the cluster secret, make it listen for other nodes, add the
+/// other nodes and pass it to QXmppServer::setCluster().
+///
+/// \ingroup Core
+
+class QXMPP_EXPORT QXmppCluster : public QXmppLoggable
+{
+    Q_OBJECT
+
+public:
+    QXmppCluster(const QString &nodeName, QObject *parent = 0);
+    ~QXmppCluster();
+
+    QString nodeName() const;
+    QStringList nodes() const;
+
+    QByteArray secret() const;
+    void setSecret(const QByteArray &secret);
+
+    bool listen(const QString &path);
+    bool listen(const QHostAddress &address, quint16 port);
+    void close();
+
+    void addNode(const QString &path);
+    void addNode(const QHostAddress &address, quint16 port);
+
+    void addSession(const QString &jid);
+    void removeSession(const QString &jid);
+    QString sessionNode(const QString &jid) const;
+
+    bool sendData(const QString &to, const QByteArray &data);
+
+signals:
+    /// This signal is emitted when another node forwards data for a
+    /// local session.
+    void dataReceived(const QString &to, const QByteArray &data);
+
+    /// This signal is emitted when a session held by this node is replaced
+    /// by a newer session for the same full JID on another node. The
+    /// local session should be closed.
+    void sessionReplaced(const QString &jid);
+
+    /// This signal is emitted when a link to another node is established.
+    void nodeConnected(const QString &node);
+
+    /// This signal is emitted when the last link to another node is lost.
+    void nodeDisconnected(const QString &node);
+
+private slots:
+    void _q_connectNodes();
+    void _q_linkConnected();
+    void _q_linkDisconnected();
+    void _q_linkReadyRead();
+    void _q_localConnection();
+    void _q_tcpConnection();
+
+private:
+    QXmppClusterPrivate * const d;
+    friend class QXmppClusterPrivate;
+};
+
+#endif
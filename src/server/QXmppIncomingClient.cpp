@@ -21,11 +21,13 @@
  *
  */
 
+#include <QBasicTimer>
 #include <QDomElement>
 #include <QHostAddress>
 #include <QSslKey>
 #include <QSslSocket>
 #include <QTimer>
+#include <QTimerEvent>
 
 #include "QXmppBindIq.h"
 #include "QXmppConstants.h"
@@ -42,13 +44,18 @@ class QXmppIncomingClientPrivate
 {
 public:
     QXmppIncomingClientPrivate(QXmppIncomingClient *qq);
-    QTimer *idleTimer;
+    void restartIdleTimer();
+
+    // a QBasicTimer avoids carrying a QObject per connection
+    QBasicTimer idleTimer;
+    int idleTimeout;
 
     QString domain;
     QString jid;
     QString resource;
     QXmppPasswordChecker *passwordChecker;
     QXmppSaslServer *saslServer;
+    bool rosterVersioning;
 
     void checkCredentials(const QByteArray &response);
     QString origin() const;
@@ -58,9 +65,10 @@ private:
 };
 
 QXmppIncomingClientPrivate::QXmppIncomingClientPrivate(QXmppIncomingClient *qq)
-    : idleTimer(0)
+    : idleTimeout(0)
     , passwordChecker(0)
     , saslServer(0)
+    , rosterVersioning(false)
     , q(qq)
 {
 }
@@ -88,6 +96,12 @@ void QXmppIncomingClientPrivate::checkCredentials(const QByteArray &response)
     }
 }
 
+void QXmppIncomingClientPrivate::restartIdleTimer()
+{
+    if (idleTimeout > 0)
+        idleTimer.start(idleTimeout, q);
+}
+
 QString QXmppIncomingClientPrivate::origin() const
 {
     QSslSocket *socket = q->socket();
@@ -122,13 +136,6 @@ QXmppIncomingClient::QXmppIncomingClient(QSslSocket *socket, const QString &doma
     }
 
     info(QString("Incoming client connection from %1").arg(d->origin()));
-
-    // create inactivity timer
-    d->idleTimer = new QTimer(this);
-    d->idleTimer->setSingleShot(true);
-    check = connect(d->idleTimer, SIGNAL(timeout()),
-                    this, SLOT(onTimeout()));
-    Q_ASSERT(check);
 }
 
 /// Destroys the current stream.
@@ -158,15 +165,34 @@ QString QXmppIncomingClient::jid() const
     return d->jid;
 }
 
+/// Returns the local domain served by the stream.
+///
+
+QString QXmppIncomingClient::domain() const
+{
+    return d->domain;
+}
+
+/// Sets the local domain served by the stream.
+///
+/// This can only be changed before the client authenticates.
+///
+/// \param domain
+
+void QXmppIncomingClient::setDomain(const QString &domain)
+{
+    if (d->jid.isEmpty())
+        d->domain = domain;
+}
+
 /// Sets the number of seconds after which a client will be disconnected
 /// for inactivity.
 
 void QXmppIncomingClient::setInactivityTimeout(int secs)
 {
-    d->idleTimer->stop();
-    d->idleTimer->setInterval(secs * 1000);
-    if (d->idleTimer->interval())
-        d->idleTimer->start();
+    d->idleTimer.stop();
+    d->idleTimeout = secs * 1000;
+    d->restartIdleTimer();
 }
 
 /// Sets the password checker used to verify client credentials.
@@ -179,36 +205,86 @@ void QXmppIncomingClient::setPasswordChecker(QXmppPasswordChecker *checker)
     d->passwordChecker = checker;
 }
 
+/// Sets whether XEP-0237: Roster Versioning is advertised to the client
+/// once it has authenticated.
+///
+/// \param enabled
+///
+
+void QXmppIncomingClient::setRosterVersioning(bool enabled)
+{
+    d->rosterVersioning = enabled;
+}
+
+/// Sets the local certificate presented to the client when it starts
+/// encryption.
+///
+/// \param certificate
+
+void QXmppIncomingClient::setLocalCertificate(const QSslCertificate &certificate)
+{
+    if (socket() && !socket()->isEncrypted())
+        socket()->setLocalCertificate(certificate);
+}
+
+/// Sets the local private key used when the client starts encryption.
+///
+/// \param key
+
+void QXmppIncomingClient::setPrivateKey(const QSslKey &key)
+{
+    if (socket() && !socket()->isEncrypted())
+        socket()->setPrivateKey(key);
+}
+
 /// \cond
+void QXmppIncomingClient::handlePing()
+{
+    d->restartIdleTimer();
+}
+
 void QXmppIncomingClient::handleStream(const QDomElement &streamElement)
 {
-    if (d->idleTimer->interval())
-        d->idleTimer->start();
+    d->restartIdleTimer();
     if (d->saslServer != 0) {
         delete d->saslServer;
         d->saslServer = 0;
     }
 
+    // give a chance to switch to another hosted domain
+    const QString to = streamElement.attribute("to");
+    if (to != d->domain && d->jid.isEmpty())
+        emit domainRequested(to);
+
     // start stream
     const QByteArray sessionId = QXmppUtils::generateStanzaHash().toLatin1();
-    QString response = QString("<?xml version='1.0'?><stream:stream"
-        " xmlns=\"%1\" xmlns:stream=\"%2\""
-        " id=\"%3\" from=\"%4\" version=\"1.0\" xml:lang=\"en\">").arg(
-        ns_client,
-        ns_stream,
-        sessionId,
-        d->domain.toLatin1());
+    QString response;
+    if (isWebSocket()) {
+        response = QString("<open xmlns=\"%1\""
+            " id=\"%2\" from=\"%3\" version=\"1.0\" xml:lang=\"en\"/>").arg(
+            ns_framing,
+            sessionId,
+            d->domain);
+    } else {
+        response = QString("<?xml version='1.0'?><stream:stream"
+            " xmlns=\"%1\" xmlns:stream=\"%2\""
+            " id=\"%3\" from=\"%4\" version=\"1.0\" xml:lang=\"en\">").arg(
+            ns_client,
+            ns_stream,
+            sessionId,
+            d->domain.toLatin1());
+    }
     sendData(response.toUtf8());
 
     // check requested domain
-    if (streamElement.attribute("to") != d->domain)
+    if (to != d->domain)
     {
         QString response = QString("<stream:error>"
             "<host-unknown xmlns=\"urn:ietf:params:xml:ns:xmpp-streams\"/>"
             "<text xmlns=\"urn:ietf:params:xml:ns:xmpp-streams\">"
                 "This server does not serve %1"
             "</text>"
-            "</stream:error>").arg(streamElement.attribute("to"));
+            "</stream:error>").arg(to);
         sendData(response.toUtf8());
         disconnectFromHost();
         return;
@@ -216,12 +292,14 @@ void QXmppIncomingClient::handleStream(const QDomElement &streamElement)
 
     // send stream features
     QXmppStreamFeatures features;
-    if (socket() && !socket()->isEncrypted() && !socket()->localCertificate().isNull() && !socket()->privateKey().isNull())
+    if (socket() && !isWebSocket() && !socket()->isEncrypted() && !socket()->localCertificate().isNull() && !socket()->privateKey().isNull())
         features.setTlsMode(QXmppStreamFeatures::Enabled);
     if (!d->jid.isEmpty())
     {
         features.setBindMode(QXmppStreamFeatures::Required);
         features.setSessionMode(QXmppStreamFeatures::Enabled);
+        if (d->rosterVersioning)
+            features.setRosterVersionMode(QXmppStreamFeatures::Enabled);
     }
     else if (d->passwordChecker)
     {
@@ -232,16 +310,19 @@ void QXmppIncomingClient::handleStream(const QDomElement &streamElement)
         features.setAuthMechanisms(mechanisms);
     }
     sendPacket(features);
+
+    // keep the credentials out of the traffic recorder
+    if (!features.authMechanisms().isEmpty())
+        setTrafficRedacted(true);
 }
 
 void QXmppIncomingClient::handleStanza(const QDomElement &nodeRecv)
 {
     const QString ns = nodeRecv.namespaceURI();
 
-    if (d->idleTimer->interval())
-        d->idleTimer->start();
+    d->restartIdleTimer();
 
-    if (ns == ns_tls && nodeRecv.tagName() == QLatin1String("starttls"))
+    if (ns == ns_tls && nodeRecv.tagName() == QLatin1String("starttls") && !isWebSocket())
     {
         sendData("<proceed xmlns='urn:ietf:params:xml:ns:xmpp-tls'/>");
         socket()->flush();
@@ -389,6 +470,16 @@ void QXmppIncomingClient::handleStanza(const QDomElement &nodeRecv)
         }
     }
 }
+
+void QXmppIncomingClient::timerEvent(QTimerEvent *event)
+{
+    if (event->timerId() == d->idleTimer.timerId()) {
+        d->idleTimer.stop();
+        onTimeout();
+    } else {
+        QXmppStream::timerEvent(event);
+    }
+}
 /// \endcond
 
 void QXmppIncomingClient::onDigestReply()
@@ -26,6 +26,8 @@
 
 #include "QXmppStream.h"
 
+class QSslCertificate;
+class QSslKey;
 class QXmppIncomingClientPrivate;
 class QXmppPasswordChecker;
 
@@ -47,17 +49,31 @@ public:
     bool isConnected() const;
     QString jid() const;
 
+    QString domain() const;
+    void setDomain(const QString &domain);
+
     void setInactivityTimeout(int secs);
     void setPasswordChecker(QXmppPasswordChecker *checker);
+    void setRosterVersioning(bool enabled);
+
+    void setLocalCertificate(const QSslCertificate &certificate);
+    void setPrivateKey(const QSslKey &key);
 
 signals:
+    /// This signal is emitted when the client opens a stream for a domain
+    /// other than domain(). Connected slots can call setDomain() and
+    /// adjust the stream's settings before the stream is answered.
+    void domainRequested(const QString &domain);
+
     /// This signal is emitted when an element is received.
     void elementReceived(const QDomElement &element);
 
 protected:
     /// \cond
+    void handlePing();
     void handleStream(const QDomElement &element);
     void handleStanza(const QDomElement &element);
+    void timerEvent(QTimerEvent *event);
     /// \endcond
 
 private slots:
@@ -0,0 +1,202 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QCryptographicHash>
+#include <QDomElement>
+#include <QHostAddress>
+#include <QSslSocket>
+
+#include "QXmppConstants.h"
+#include "QXmppIncomingComponent.h"
+#include "QXmppUtils.h"
+
+/// Compares two digests in a time which does not depend on their contents.
+
+static bool isEqualDigest(const QByteArray &a, const QByteArray &b)
+{
+    if (a.size() != b.size())
+        return false;
+    char diff = 0;
+    for (int i = 0; i < a.size(); ++i)
+        diff |= a[i] ^ b[i];
+    return diff == 0;
+}
+
+class QXmppIncomingComponentPrivate
+{
+public:
+    QXmppIncomingComponentPrivate(QXmppIncomingComponent *qq);
+    bool isComponentDomain(const QString &other) const;
+    QString origin() const;
+    void streamError(const QString &condition);
+
+    bool authenticated;
+    QString domain;
+    QString localStreamId;
+    QHash<QString, QString> secrets;
+
+private:
+    QXmppIncomingComponent *q;
+};
+
+QXmppIncomingComponentPrivate::QXmppIncomingComponentPrivate(QXmppIncomingComponent *qq)
+    : authenticated(false),
+    q(qq)
+{
+}
+
+/// Returns true if \a other is the component's domain or one of its
+/// sub-domains.
+
+bool QXmppIncomingComponentPrivate::isComponentDomain(const QString &other) const
+{
+    return other == domain || other.endsWith(QLatin1Char('.') + domain);
+}
+
+QString QXmppIncomingComponentPrivate::origin() const
+{
+    QSslSocket *socket = q->socket();
+    if (socket)
+        return socket->peerAddress().toString() + " " + QString::number(socket->peerPort());
+    else
+        return "<unknown>";
+}
+
+void QXmppIncomingComponentPrivate::streamError(const QString &condition)
+{
+    q->sendData(QString("<stream:error><%1 xmlns='urn:ietf:params:xml:ns:xmpp-streams'/></stream:error>").arg(condition).toUtf8());
+    q->disconnectFromHost();
+}
+
+/// Constructs a new incoming component stream.
+///
+/// \param socket The socket for the XMPP stream.
+/// \param parent The parent QObject for the stream (optional).
+///
+
+QXmppIncomingComponent::QXmppIncomingComponent(QSslSocket *socket, QObject *parent)
+    : QXmppStream(parent)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    d = new QXmppIncomingComponentPrivate(this);
+
+    if (socket) {
+        check = connect(socket, SIGNAL(disconnected()),
+                        this, SLOT(_q_socketDisconnected()));
+        Q_ASSERT(check);
+
+        setSocket(socket);
+    }
+
+    info(QString("Incoming component connection from %1").arg(d->origin()));
+}
+
+/// Destroys the current stream.
+
+QXmppIncomingComponent::~QXmppIncomingComponent()
+{
+    delete d;
+}
+
+/// Returns true if the socket is connected and the component is
+/// authenticated.
+
+bool QXmppIncomingComponent::isConnected() const
+{
+    return QXmppStream::isConnected() && d->authenticated;
+}
+
+/// Returns the domain requested by the component.
+
+QString QXmppIncomingComponent::domain() const
+{
+    return d->domain;
+}
+
+/// Sets the secrets shared with the components, keyed by domain.
+///
+/// \param secrets
+
+void QXmppIncomingComponent::setSecrets(const QHash<QString, QString> &secrets)
+{
+    d->secrets = secrets;
+}
+
+/// \cond
+void QXmppIncomingComponent::handleStream(const QDomElement &streamElement)
+{
+    d->domain = streamElement.attribute("to");
+
+    // start stream
+    d->localStreamId = QXmppUtils::generateStanzaHash();
+    const QString data = QString("<?xml version='1.0'?><stream:stream"
+        " xmlns='%1' xmlns:stream='%2' from='%3' id='%4'>").arg(
+            ns_component,
+            ns_stream,
+            d->domain,
+            d->localStreamId);
+    sendData(data.toUtf8());
+
+    if (!d->secrets.contains(d->domain)) {
+        warning(QString("Unknown component domain '%1' on %2").arg(d->domain, d->origin()));
+        d->streamError("host-unknown");
+    }
+}
+
+void QXmppIncomingComponent::handleStanza(const QDomElement &element)
+{
+    if (d->authenticated) {
+        // components may only send stanzas from their own domains
+        if (!d->isComponentDomain(QXmppUtils::jidToDomain(element.attribute("from")))) {
+            warning(QString("Received an element from invalid domain '%1' on %2").arg(QXmppUtils::jidToDomain(element.attribute("from")), d->origin()));
+            d->streamError("invalid-from");
+            return;
+        }
+        emit elementReceived(element);
+    } else if (element.tagName() == QLatin1String("handshake")) {
+        const QByteArray expected = QCryptographicHash::hash(
+            d->localStreamId.toUtf8() + d->secrets.value(d->domain).toUtf8(),
+            QCryptographicHash::Sha1).toHex();
+        if (!isEqualDigest(element.text().toLower().toLatin1(), expected)) {
+            warning(QString("Failed to authenticate component '%1' on %2").arg(d->domain, d->origin()));
+            d->streamError("not-authorized");
+            return;
+        }
+
+        info(QString("Authenticated component '%1' on %2").arg(d->domain, d->origin()));
+        d->authenticated = true;
+        sendData("<handshake/>");
+        emit connected();
+    } else {
+        d->streamError("not-authorized");
+    }
+}
+/// \endcond
+
+void QXmppIncomingComponent::_q_socketDisconnected()
+{
+    info(QString("Socket disconnected from %1").arg(d->origin()));
+    emit disconnected();
+}
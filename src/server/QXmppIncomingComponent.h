@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPINCOMINGCOMPONENT_H
+#define QXMPPINCOMINGCOMPONENT_H
+
+#include "QXmppStream.h"
+
+class QXmppIncomingComponentPrivate;
+
+/// \brief The QXmppIncomingComponent class represents an incoming XMPP
+/// stream from an external component, as defined by XEP-0114: Jabber
+/// Component Protocol.
+///
+/// The component authenticates using a secret shared with the server,
+/// after which it owns its domain and all the sub-domains of it.
+///
+
+class QXMPP_EXPORT QXmppIncomingComponent : public QXmppStream
+{
+    Q_OBJECT
+
+public:
+    QXmppIncomingComponent(QSslSocket *socket, QObject *parent);
+    ~QXmppIncomingComponent();
+
+    bool isConnected() const;
+    QString domain() const;
+
+    void setSecrets(const QHash<QString, QString> &secrets);
+
+signals:
+    /// This signal is emitted when an element is received.
+    void elementReceived(const QDomElement &element);
+
+protected:
+    /// \cond
+    void handleStanza(const QDomElement &element);
+    void handleStream(const QDomElement &element);
+    /// \endcond
+
+private slots:
+    void _q_socketDisconnected();
+
+private:
+    Q_DISABLE_COPY(QXmppIncomingComponent)
+    QXmppIncomingComponentPrivate* d;
+    friend class QXmppIncomingComponentPrivate;
+};
+
+#endif
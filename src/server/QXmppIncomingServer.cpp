@@ -37,10 +37,12 @@ class QXmppIncomingServerPrivate
 {
 public:
     QXmppIncomingServerPrivate(QXmppIncomingServer *qq);
+    bool isLocalDomain(const QString &domain) const;
     QString origin() const;
 
     QSet<QString> authenticated;
     QString domain;
+    QSet<QString> localDomains;
     QString localStreamId;
 
 private:
@@ -52,6 +54,14 @@ QXmppIncomingServerPrivate::QXmppIncomingServerPrivate(QXmppIncomingServer *qq)
 {
 }
 
+/// Returns true if \a other is one of the configured local domains,
+/// which may be authorized using dialback piggybacking.
+
+bool QXmppIncomingServerPrivate::isLocalDomain(const QString &other) const
+{
+    return other == domain || localDomains.contains(other);
+}
+
 QString QXmppIncomingServerPrivate::origin() const
 {
     QSslSocket *socket = q->socket();
@@ -103,6 +113,24 @@ QString QXmppIncomingServer::localStreamId() const
     return d->localStreamId;
 }
 
+/// Returns the remote domains which were verified on this stream.
+
+QStringList QXmppIncomingServer::remoteDomains() const
+{
+    return d->authenticated.toList();
+}
+
+/// Sets the additional local domains for which the remote server may
+/// request dialback on this stream. Sub-domains which are not listed
+/// are refused.
+///
+/// \param domains
+
+void QXmppIncomingServer::setLocalDomains(const QStringList &domains)
+{
+    d->localDomains = domains.toSet();
+}
+
 /// \cond
 void QXmppIncomingServer::handleStream(const QDomElement &streamElement)
 {
@@ -146,7 +174,7 @@ void QXmppIncomingServer::handleStanza(const QDomElement &stanza)
         // check the request is valid
         if (!request.type().isEmpty() ||
             request.from().isEmpty() ||
-            request.to() != d->domain ||
+            !d->isLocalDomain(request.to()) ||
             request.key().isEmpty())
         {
             warning(QString("Invalid dialback received on %1").arg(d->origin()));
@@ -159,7 +187,7 @@ void QXmppIncomingServer::handleStanza(const QDomElement &stanza)
             debug(QString("Received a dialback result from '%1' on %2").arg(domain, d->origin()));
 
             // establish dialback connection
-            QXmppOutgoingServer *stream = new QXmppOutgoingServer(d->domain, this);
+            QXmppOutgoingServer *stream = new QXmppOutgoingServer(request.to(), this);
             bool check = connect(stream, SIGNAL(dialbackResponseReceived(QXmppDialback)),
                                  this, SLOT(slotDialbackResponseReceived(QXmppDialback)));
             Q_ASSERT(check);
@@ -212,21 +240,27 @@ void QXmppIncomingServer::slotDialbackResponseReceived(const QXmppDialback &dial
     QXmppDialback response;
     response.setCommand(QXmppDialback::Result);
     response.setTo(dialback.from());
-    response.setFrom(d->domain);
+    response.setFrom(dialback.to());
     response.setType(dialback.type());
     sendPacket(response);
 
     // check for success
+    const bool wasConnected = !d->authenticated.isEmpty();
     if (response.type() == QLatin1String("valid"))
     {
-        info(QString("Verified incoming domain '%1' on %2").arg(dialback.from(), d->origin()));
-        const bool wasConnected = !d->authenticated.isEmpty();
+        if (!wasConnected)
+            info(QString("Verified incoming domain '%1' on %2").arg(dialback.from(), d->origin()));
+        else
+            info(QString("Verified incoming domain '%1' on %2 (piggybacked)").arg(dialback.from(), d->origin()));
         d->authenticated.insert(dialback.from());
         if (!wasConnected)
             emit connected();
     } else {
         warning(QString("Failed to verify incoming domain '%1' on %2").arg(dialback.from(), d->origin()));
-        disconnectFromHost();
+
+        // a refused piggybacked domain does not affect the others
+        if (!wasConnected)
+            disconnectFromHost();
     }
 
     // disconnect dialback
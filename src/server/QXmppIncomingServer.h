@@ -44,6 +44,9 @@ public:
 
     bool isConnected() const;
     QString localStreamId() const;
+    QStringList remoteDomains() const;
+
+    void setLocalDomains(const QStringList &domains);
 
 signals:
     /// This signal is emitted when a dialback verify request is received.
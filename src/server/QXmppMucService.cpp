@@ -0,0 +1,767 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QDateTime>
+#include <QDomElement>
+#include <QStringList>
+#include <QTimer>
+#include <QVector>
+#include <QXmlStreamWriter>
+
+#include "QXmppConstants.h"
+#include "QXmppDiscoveryIq.h"
+#include "QXmppMessage.h"
+#include "QXmppMucService.h"
+#include "QXmppPresence.h"
+#include "QXmppServer.h"
+#include "QXmppUtils.h"
+
+/// Serializes a stanza, which is expected to have no recipient.
+
+static QByteArray serializeStanza(const QXmppStanza &stanza)
+{
+    QByteArray data;
+    QXmlStreamWriter writer(&data);
+    stanza.toXml(&writer);
+    return data;
+}
+
+/// Returns a copy of the serialized stanza with a "to" attribute
+/// spliced in after the element name.
+
+static QByteArray addressStanza(const QByteArray &data, const QString &to)
+{
+    int pos = 1;
+    while (pos < data.size() && data.at(pos) != ' ' && data.at(pos) != '/' && data.at(pos) != '>')
+        ++pos;
+
+    QByteArray jid = to.toUtf8();
+    if (jid.contains('&') || jid.contains('<') || jid.contains('"'))
+        jid.replace('&', "&amp;").replace('<', "&lt;").replace('"', "&quot;");
+
+    QByteArray addressed;
+    addressed.reserve(data.size() + jid.size() + 6);
+    addressed.append(data.constData(), pos);
+    addressed.append(" to=\"");
+    addressed.append(jid);
+    addressed.append('"');
+    addressed.append(data.constData() + pos, data.size() - pos);
+    return addressed;
+}
+
+/// Returns a copy of the serialized message marked as delayed.
+
+static QByteArray delayStanza(const QByteArray &data, const QDateTime &stamp, const QString &from)
+{
+    const int pos = data.lastIndexOf("</message>");
+    if (pos < 0)
+        return data;
+
+    QByteArray delayed(data);
+    delayed.insert(pos, QString("<delay xmlns=\"%1\" stamp=\"%2\" from=\"%3\"/>").arg(
+        ns_delayed_delivery,
+        QXmppUtils::datetimeToString(stamp),
+        from).toUtf8());
+    return delayed;
+}
+
+class QXmppMucServiceOccupant
+{
+public:
+    QString jid;
+    QString nick;
+    QXmppMucItem::Affiliation affiliation;
+    QXmppMucItem::Role role;
+
+    // the occupant's presence as seen by participants and by moderators
+    QByteArray presenceData;
+    QByteArray moderatorPresenceData;
+};
+
+class QXmppMucServiceHistory
+{
+public:
+    QByteArray data;
+    QDateTime stamp;
+};
+
+class QXmppMucServiceRoom
+{
+public:
+    QXmppMucServiceRoom(const QString &jid);
+    ~QXmppMucServiceRoom();
+    void addHistory(const QByteArray &data, int size);
+
+    QString jid;
+    QString owner;
+    QByteArray subjectData;
+
+    // occupant index
+    QHash<QString, QXmppMucServiceOccupant*> occupantsByJid;
+    QHash<QString, QXmppMucServiceOccupant*> occupantsByNick;
+    QSet<QXmppMucServiceOccupant*> pendingPresences;
+
+    // history ring buffer
+    QVector<QXmppMucServiceHistory> history;
+    int historyStart;
+};
+
+QXmppMucServiceRoom::QXmppMucServiceRoom(const QString &jid)
+    : jid(jid),
+    historyStart(0)
+{
+}
+
+QXmppMucServiceRoom::~QXmppMucServiceRoom()
+{
+    qDeleteAll(occupantsByJid);
+}
+
+/// Stores a message in the history, overwriting the oldest one once
+/// the history holds \a size messages.
+
+void QXmppMucServiceRoom::addHistory(const QByteArray &data, int size)
+{
+    if (size <= 0)
+        return;
+
+    QXmppMucServiceHistory entry;
+    entry.data = data;
+    entry.stamp = QDateTime::currentDateTime().toUTC();
+    if (history.size() < size) {
+        history.append(entry);
+    } else {
+        history[historyStart] = entry;
+        historyStart = (historyStart + 1) % history.size();
+    }
+}
+
+class QXmppMucServicePrivate
+{
+public:
+    QXmppMucServicePrivate(QXmppMucService *qq);
+
+    void broadcast(QXmppMucServiceRoom *room, const QByteArray &data, const QByteArray &moderatorData, const QString &from, QXmppMucServiceOccupant *except = 0);
+    void handleMessage(const QDomElement &element);
+    void handlePresence(const QDomElement &element);
+    bool handleIq(const QDomElement &element);
+    void join(const QString &roomJid, const QString &nick, const QXmppPresence &presence);
+    void leave(QXmppMucServiceRoom *room, QXmppMucServiceOccupant *occupant, const QXmppPresence &presence);
+    void update(QXmppMucServiceRoom *room, QXmppMucServiceOccupant *occupant, const QXmppPresence &presence);
+    void sendError(const QDomElement &element, QXmppStanza::Error::Type type, QXmppStanza::Error::Condition condition);
+    void sendSelfPresence(QXmppMucServiceRoom *room, QXmppMucServiceOccupant *occupant, const QXmppPresence &presence, const QList<int> &codes);
+    QXmppPresence setPresence(QXmppMucServiceRoom *room, QXmppMucServiceOccupant *occupant, const QXmppPresence &presence);
+
+    QString jid;
+    int historySize;
+    int coalesceThreshold;
+    bool subjectChangeAllowed;
+    QTimer *coalesceTimer;
+
+    QHash<QString, QXmppMucServiceRoom*> rooms;
+    QHash<QString, QSet<QXmppMucServiceRoom*> > roomsByJid;
+    QSet<QXmppMucServiceRoom*> pendingRooms;
+
+private:
+    QXmppMucService *q;
+};
+
+QXmppMucServicePrivate::QXmppMucServicePrivate(QXmppMucService *qq)
+    : historySize(20),
+    coalesceThreshold(100),
+    subjectChangeAllowed(false),
+    coalesceTimer(0),
+    q(qq)
+{
+}
+
+/// Sends serialized data to all the occupants of a room, splicing in
+/// each occupant's address. \a from is the address of the room or of one
+/// of its occupants, which the stanza is sent from.
+
+void QXmppMucServicePrivate::broadcast(QXmppMucServiceRoom *room, const QByteArray &data, const QByteArray &moderatorData, const QString &from, QXmppMucServiceOccupant *except)
+{
+    QXmppServer *server = q->server();
+    QHash<QString, QXmppMucServiceOccupant*>::const_iterator it;
+    for (it = room->occupantsByJid.constBegin(); it != room->occupantsByJid.constEnd(); ++it) {
+        QXmppMucServiceOccupant *occupant = it.value();
+        if (occupant == except)
+            continue;
+        const QByteArray &payload = (occupant->role == QXmppMucItem::ModeratorRole) ? moderatorData : data;
+        server->sendData(occupant->jid, addressStanza(payload, occupant->jid), from);
+    }
+}
+
+void QXmppMucServicePrivate::handleMessage(const QDomElement &element)
+{
+    QXmppMessage message;
+    message.parse(element);
+    if (message.type() == QXmppMessage::Error)
+        return;
+
+    const QString from = message.from();
+    const QString nick = QXmppUtils::jidToResource(message.to());
+    QXmppMucServiceRoom *room = rooms.value(QXmppUtils::jidToBareJid(message.to()));
+    if (!room) {
+        sendError(element, QXmppStanza::Error::Cancel, QXmppStanza::Error::ItemNotFound);
+        return;
+    }
+    QXmppMucServiceOccupant *occupant = room->occupantsByJid.value(from);
+    if (!occupant) {
+        sendError(element, QXmppStanza::Error::Modify, QXmppStanza::Error::NotAcceptable);
+        return;
+    }
+    message.setFrom(room->jid + "/" + occupant->nick);
+
+    if (nick.isEmpty()) {
+        if (message.type() != QXmppMessage::GroupChat)
+            return;
+
+        // only moderators change the subject, unless the room allows it
+        if (!message.subject().isEmpty() &&
+            occupant->role != QXmppMucItem::ModeratorRole &&
+            !(subjectChangeAllowed && occupant->role == QXmppMucItem::ParticipantRole)) {
+            sendError(element, QXmppStanza::Error::Auth, QXmppStanza::Error::Forbidden);
+            return;
+        }
+
+        // serialize the message once for all occupants
+        message.setTo(QString());
+        const QByteArray data = serializeStanza(message);
+        if (!message.subject().isEmpty())
+            room->subjectData = data;
+        else if (!message.body().isEmpty())
+            room->addHistory(data, historySize);
+        broadcast(room, data, data, message.from());
+    } else {
+        // private message
+        QXmppMucServiceOccupant *target = room->occupantsByNick.value(nick);
+        if (!target) {
+            sendError(element, QXmppStanza::Error::Cancel, QXmppStanza::Error::ItemNotFound);
+            return;
+        } else if (message.type() == QXmppMessage::GroupChat) {
+            sendError(element, QXmppStanza::Error::Modify, QXmppStanza::Error::BadRequest);
+            return;
+        }
+        message.setTo(target->jid);
+        q->server()->sendPacket(message);
+    }
+}
+
+void QXmppMucServicePrivate::handlePresence(const QDomElement &element)
+{
+    QXmppPresence presence;
+    presence.parse(element);
+
+    const QString from = presence.from();
+    const QString roomJid = QXmppUtils::jidToBareJid(presence.to());
+    const QString nick = QXmppUtils::jidToResource(presence.to());
+    QXmppMucServiceRoom *room = rooms.value(roomJid);
+    QXmppMucServiceOccupant *occupant = room ? room->occupantsByJid.value(from) : 0;
+
+    if (presence.type() == QXmppPresence::Available) {
+        if (nick.isEmpty()) {
+            sendError(element, QXmppStanza::Error::Modify, QXmppStanza::Error::JidMalformed);
+        } else if (!occupant) {
+            join(roomJid, nick, presence);
+        } else if (nick != occupant->nick) {
+            // nickname changes are not supported
+            sendError(element, QXmppStanza::Error::Modify, QXmppStanza::Error::NotAcceptable);
+        } else {
+            update(room, occupant, presence);
+        }
+    } else if (presence.type() == QXmppPresence::Unavailable) {
+        if (occupant)
+            leave(room, occupant, presence);
+    }
+}
+
+bool QXmppMucServicePrivate::handleIq(const QDomElement &element)
+{
+    if (!QXmppDiscoveryIq::isDiscoveryIq(element))
+        return false;
+
+    QXmppDiscoveryIq request;
+    request.parse(element);
+    if (request.type() != QXmppIq::Get)
+        return false;
+
+    const QString to = request.to();
+    QXmppMucServiceRoom *room = rooms.value(to);
+    if (to != jid && !room) {
+        sendError(element, QXmppStanza::Error::Cancel, QXmppStanza::Error::ItemNotFound);
+        return true;
+    }
+
+    QXmppDiscoveryIq response;
+    response.setType(QXmppIq::Result);
+    response.setId(request.id());
+    response.setFrom(to);
+    response.setTo(request.from());
+    response.setQueryType(request.queryType());
+    if (request.queryType() == QXmppDiscoveryIq::InfoQuery) {
+        QXmppDiscoveryIq::Identity identity;
+        identity.setCategory("conference");
+        identity.setType("text");
+        QStringList features;
+        features << ns_disco_info << ns_muc;
+        if (room) {
+            identity.setName(QXmppUtils::jidToUser(to));
+            features << "muc_public" << "muc_open" << "muc_temporary" << "muc_semianonymous";
+        } else {
+            identity.setName("Chatrooms");
+            features << ns_disco_items;
+        }
+        response.setIdentities(QList<QXmppDiscoveryIq::Identity>() << identity);
+        response.setFeatures(features);
+    } else if (!room) {
+        QList<QXmppDiscoveryIq::Item> items;
+        foreach (const QString &roomJid, rooms.keys()) {
+            QXmppDiscoveryIq::Item item;
+            item.setJid(roomJid);
+            item.setName(QXmppUtils::jidToUser(roomJid));
+            items << item;
+        }
+        response.setItems(items);
+    }
+    q->server()->sendPacket(response);
+    return true;
+}
+
+void QXmppMucServicePrivate::join(const QString &roomJid, const QString &nick, const QXmppPresence &presence)
+{
+    QXmppServer *server = q->server();
+    const QString from = presence.from();
+
+    // the first occupant creates the room and owns it
+    QXmppMucServiceRoom *room = rooms.value(roomJid);
+    QList<int> codes;
+    codes << 110;
+    if (!room) {
+        room = new QXmppMucServiceRoom(roomJid);
+        room->owner = QXmppUtils::jidToBareJid(from);
+        rooms.insert(roomJid, room);
+        q->setGauge("muc.room.count", rooms.size());
+        codes << 201;
+    } else if (room->occupantsByNick.contains(nick)) {
+        QXmppPresence error;
+        error.setType(QXmppPresence::Error);
+        error.setFrom(presence.to());
+        error.setTo(from);
+        error.setError(QXmppStanza::Error(QXmppStanza::Error::Cancel, QXmppStanza::Error::Conflict));
+        server->sendPacket(error);
+        return;
+    }
+
+    QXmppMucServiceOccupant *occupant = new QXmppMucServiceOccupant;
+    occupant->jid = from;
+    occupant->nick = nick;
+    if (room->owner == QXmppUtils::jidToBareJid(from)) {
+        occupant->affiliation = QXmppMucItem::OwnerAffiliation;
+        occupant->role = QXmppMucItem::ModeratorRole;
+    } else {
+        occupant->affiliation = QXmppMucItem::NoAffiliation;
+        occupant->role = QXmppMucItem::ParticipantRole;
+    }
+
+    // send the presence of existing occupants to the new one
+    const bool moderator = occupant->role == QXmppMucItem::ModeratorRole;
+    foreach (QXmppMucServiceOccupant *other, room->occupantsByJid) {
+        server->sendData(from, addressStanza(moderator ? other->moderatorPresenceData : other->presenceData, from),
+                         roomJid + "/" + other->nick);
+    }
+
+    // add the occupant and announce it
+    room->occupantsByJid.insert(from, occupant);
+    room->occupantsByNick.insert(nick, occupant);
+    roomsByJid[from].insert(room);
+    const QXmppPresence occupantPresence = setPresence(room, occupant, presence);
+    broadcast(room, occupant->presenceData, occupant->moderatorPresenceData, roomJid + "/" + nick, occupant);
+    sendSelfPresence(room, occupant, occupantPresence, codes);
+
+    // replay history and subject
+    for (int i = 0; i < room->history.size(); ++i) {
+        const QXmppMucServiceHistory &entry = room->history.at((room->historyStart + i) % room->history.size());
+        server->sendData(from, addressStanza(delayStanza(entry.data, entry.stamp, roomJid), from), roomJid);
+    }
+    if (!room->subjectData.isEmpty())
+        server->sendData(from, addressStanza(room->subjectData, from), roomJid);
+}
+
+void QXmppMucServicePrivate::leave(QXmppMucServiceRoom *room, QXmppMucServiceOccupant *occupant, const QXmppPresence &presence)
+{
+    const QString from = occupant->jid;
+
+    // announce the departure
+    occupant->role = QXmppMucItem::NoRole;
+    const QXmppPresence occupantPresence = setPresence(room, occupant, presence);
+    broadcast(room, occupant->presenceData, occupant->moderatorPresenceData, room->jid + "/" + occupant->nick, occupant);
+    sendSelfPresence(room, occupant, occupantPresence, QList<int>() << 110);
+
+    // remove the occupant
+    room->occupantsByJid.remove(from);
+    room->occupantsByNick.remove(occupant->nick);
+    room->pendingPresences.remove(occupant);
+    QHash<QString, QSet<QXmppMucServiceRoom*> >::iterator it = roomsByJid.find(from);
+    if (it != roomsByJid.end()) {
+        it.value().remove(room);
+        if (it.value().isEmpty())
+            roomsByJid.erase(it);
+    }
+    delete occupant;
+
+    // temporary rooms are destroyed when the last occupant leaves
+    if (room->occupantsByJid.isEmpty()) {
+        rooms.remove(room->jid);
+        pendingRooms.remove(room);
+        delete room;
+        q->setGauge("muc.room.count", rooms.size());
+    }
+}
+
+void QXmppMucServicePrivate::update(QXmppMucServiceRoom *room, QXmppMucServiceOccupant *occupant, const QXmppPresence &presence)
+{
+    const QXmppPresence occupantPresence = setPresence(room, occupant, presence);
+    sendSelfPresence(room, occupant, occupantPresence, QList<int>() << 110);
+
+    // in large rooms, only the latest presence of each occupant is
+    // broadcast once per coalescing interval
+    if (coalesceThreshold > 0 && room->occupantsByJid.size() >= coalesceThreshold && coalesceTimer->interval() > 0) {
+        room->pendingPresences.insert(occupant);
+        pendingRooms.insert(room);
+        if (!coalesceTimer->isActive())
+            coalesceTimer->start();
+    } else {
+        broadcast(room, occupant->presenceData, occupant->moderatorPresenceData, room->jid + "/" + occupant->nick, occupant);
+    }
+}
+
+void QXmppMucServicePrivate::sendError(const QDomElement &element, QXmppStanza::Error::Type type, QXmppStanza::Error::Condition condition)
+{
+    const QXmppStanza::Error error(type, condition);
+    if (element.tagName() == QLatin1String("presence")) {
+        QXmppPresence response;
+        response.setType(QXmppPresence::Error);
+        response.setFrom(element.attribute("to"));
+        response.setTo(element.attribute("from"));
+        response.setError(error);
+        q->server()->sendPacket(response);
+    } else if (element.tagName() == QLatin1String("message")) {
+        QXmppMessage response;
+        response.setType(QXmppMessage::Error);
+        response.setFrom(element.attribute("to"));
+        response.setTo(element.attribute("from"));
+        response.setError(error);
+        q->server()->sendPacket(response);
+    } else {
+        QXmppIq response(QXmppIq::Error);
+        response.setId(element.attribute("id"));
+        response.setFrom(element.attribute("to"));
+        response.setTo(element.attribute("from"));
+        response.setError(error);
+        q->server()->sendPacket(response);
+    }
+}
+
+void QXmppMucServicePrivate::sendSelfPresence(QXmppMucServiceRoom *room, QXmppMucServiceOccupant *occupant, const QXmppPresence &presence, const QList<int> &codes)
+{
+    Q_UNUSED(room);
+
+    QXmppPresence self(presence);
+    QXmppMucItem item = self.mucItem();
+    item.setJid(occupant->jid);
+    self.setMucItem(item);
+    self.setMucStatusCodes(codes);
+    self.setTo(occupant->jid);
+    q->server()->sendPacket(self);
+}
+
+/// Stores the occupant's presence, serialized as it will be broadcast.
+///
+/// Returns the presence as seen by the other occupants, without a recipient.
+
+QXmppPresence QXmppMucServicePrivate::setPresence(QXmppMucServiceRoom *room, QXmppMucServiceOccupant *occupant, const QXmppPresence &presence)
+{
+    QXmppPresence copy(presence);
+    copy.setId(QString());
+    copy.setFrom(room->jid + "/" + occupant->nick);
+    copy.setTo(QString());
+    copy.setMucSupported(false);
+    copy.setMucPassword(QString());
+    copy.setMucStatusCodes(QList<int>());
+
+    QXmppMucItem item;
+    item.setAffiliation(occupant->affiliation);
+    item.setRole(occupant->role);
+    copy.setMucItem(item);
+    occupant->presenceData = serializeStanza(copy);
+
+    QXmppPresence moderatorCopy(copy);
+    item.setJid(occupant->jid);
+    moderatorCopy.setMucItem(item);
+    occupant->moderatorPresenceData = serializeStanza(moderatorCopy);
+
+    return copy;
+}
+
+/// Constructs a new multi-user chat service.
+
+QXmppMucService::QXmppMucService()
+{
+    bool check;
+    Q_UNUSED(check);
+
+    d = new QXmppMucServicePrivate(this);
+    d->coalesceTimer = new QTimer(this);
+    d->coalesceTimer->setInterval(1000);
+    d->coalesceTimer->setSingleShot(true);
+    check = connect(d->coalesceTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_flushPresences()));
+    Q_ASSERT(check);
+}
+
+/// Destroys a multi-user chat service.
+
+QXmppMucService::~QXmppMucService()
+{
+    qDeleteAll(d->rooms);
+    delete d;
+}
+
+/// Returns the JID of the service, for instance "conference.example.com".
+
+QString QXmppMucService::jid() const
+{
+    return d->jid;
+}
+
+/// Sets the JID of the service.
+///
+/// If no JID is set, "conference." followed by the server's domain is
+/// used when the service starts.
+///
+/// \param jid
+
+void QXmppMucService::setJid(const QString &jid)
+{
+    d->jid = jid;
+}
+
+/// Returns the number of messages kept in each room's history.
+
+int QXmppMucService::historySize() const
+{
+    return d->historySize;
+}
+
+/// Sets the number of messages kept in each room's history and sent to
+/// new occupants.
+///
+/// The default is 20, a value of 0 disables history.
+///
+/// \param size
+
+void QXmppMucService::setHistorySize(int size)
+{
+    d->historySize = qMax(0, size);
+}
+
+/// Returns the number of occupants from which presence updates are
+/// coalesced.
+
+int QXmppMucService::coalesceThreshold() const
+{
+    return d->coalesceThreshold;
+}
+
+/// Sets the number of occupants from which a room coalesces presence
+/// updates, so that only the latest presence of each occupant is
+/// broadcast once per coalesceInterval().
+///
+/// Occupants joining or leaving are always announced immediately. The
+/// default is 100, a value of 0 disables coalescing.
+///
+/// \param occupants
+
+void QXmppMucService::setCoalesceThreshold(int occupants)
+{
+    d->coalesceThreshold = qMax(0, occupants);
+}
+
+/// Returns the interval in milliseconds at which coalesced presence
+/// updates are broadcast.
+
+int QXmppMucService::coalesceInterval() const
+{
+    return d->coalesceTimer->interval();
+}
+
+/// Sets the interval in milliseconds at which coalesced presence updates
+/// are broadcast.
+///
+/// The default is 1000.
+///
+/// \param msecs
+
+void QXmppMucService::setCoalesceInterval(int msecs)
+{
+    d->coalesceTimer->setInterval(qMax(0, msecs));
+}
+
+/// Returns true if participants which are not moderators may change
+/// the subject of the rooms.
+
+bool QXmppMucService::isSubjectChangeAllowed() const
+{
+    return d->subjectChangeAllowed;
+}
+
+/// Sets whether participants which are not moderators may change the
+/// subject of the rooms. Visitors may never change it.
+///
+/// The default is false.
+///
+/// \param allowed
+
+void QXmppMucService::setSubjectChangeAllowed(bool allowed)
+{
+    d->subjectChangeAllowed = allowed;
+}
+
+/// Returns the JIDs of the rooms.
+
+QStringList QXmppMucService::rooms() const
+{
+    return d->rooms.keys();
+}
+
+/// Returns the room JIDs of the given room's occupants.
+///
+/// \param roomJid
+
+QStringList QXmppMucService::occupants(const QString &roomJid) const
+{
+    QStringList jids;
+    QXmppMucServiceRoom *room = d->rooms.value(roomJid);
+    if (room) {
+        foreach (const QString &nick, room->occupantsByNick.keys())
+            jids << roomJid + "/" + nick;
+    }
+    return jids;
+}
+
+QStringList QXmppMucService::discoveryItems() const
+{
+    return QStringList() << d->jid;
+}
+
+bool QXmppMucService::handleStanza(const QDomElement &element)
+{
+    if (d->jid.isEmpty() || QXmppUtils::jidToDomain(element.attribute("to")) != d->jid)
+        return false;
+
+    if (element.tagName() == QLatin1String("presence")) {
+        d->handlePresence(element);
+        return true;
+    } else if (element.tagName() == QLatin1String("message")) {
+        d->handleMessage(element);
+        return true;
+    } else if (element.tagName() == QLatin1String("iq")) {
+        return d->handleIq(element);
+    }
+    return false;
+}
+
+bool QXmppMucService::start()
+{
+    bool check;
+    Q_UNUSED(check);
+
+    if (d->jid.isEmpty())
+        d->jid = "conference." + server()->domain();
+
+    check = connect(server(), SIGNAL(clientDisconnected(QString)),
+                    this, SLOT(_q_clientDisconnected(QString)));
+    Q_ASSERT(check);
+
+    check = connect(server(), SIGNAL(serverDisconnected(QString)),
+                    this, SLOT(_q_serverDisconnected(QString)));
+    Q_ASSERT(check);
+    return true;
+}
+
+void QXmppMucService::stop()
+{
+    disconnect(server(), SIGNAL(clientDisconnected(QString)),
+               this, SLOT(_q_clientDisconnected(QString)));
+    disconnect(server(), SIGNAL(serverDisconnected(QString)),
+               this, SLOT(_q_serverDisconnected(QString)));
+
+    d->coalesceTimer->stop();
+    d->pendingRooms.clear();
+    d->roomsByJid.clear();
+    qDeleteAll(d->rooms);
+    d->rooms.clear();
+}
+
+/// Removes a disconnected client from the rooms it occupied.
+///
+/// \param jid
+
+void QXmppMucService::_q_clientDisconnected(const QString &jid)
+{
+    const QSet<QXmppMucServiceRoom*> rooms = d->roomsByJid.value(jid);
+    foreach (QXmppMucServiceRoom *room, rooms) {
+        QXmppMucServiceOccupant *occupant = room->occupantsByJid.value(jid);
+        if (occupant) {
+            QXmppPresence presence(QXmppPresence::Unavailable);
+            presence.setFrom(jid);
+            d->leave(room, occupant, presence);
+        }
+    }
+}
+
+/// Removes the occupants from a remote domain from the rooms they
+/// occupied once a stream with their server is closed.
+///
+/// \param domain
+
+void QXmppMucService::_q_serverDisconnected(const QString &domain)
+{
+    foreach (const QString &jid, d->roomsByJid.keys()) {
+        if (QXmppUtils::jidToDomain(jid) == domain)
+            _q_clientDisconnected(jid);
+    }
+}
+
+/// Broadcasts the coalesced presence updates.
+
+void QXmppMucService::_q_flushPresences()
+{
+    foreach (QXmppMucServiceRoom *room, d->pendingRooms) {
+        foreach (QXmppMucServiceOccupant *occupant, room->pendingPresences)
+            d->broadcast(room, occupant->presenceData, occupant->moderatorPresenceData, room->jid + "/" + occupant->nick, occupant);
+        room->pendingPresences.clear();
+    }
+    d->pendingRooms.clear();
+}
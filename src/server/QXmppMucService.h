@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPMUCSERVICE_H
+#define QXMPPMUCSERVICE_H
+
+#include "QXmppServerExtension.h"
+
+class QXmppMucServicePrivate;
+
+/// \brief The QXmppMucService class is a server extension providing a
+/// multi-user chat service, as defined by XEP-0045: Multi-User Chat.
+///
+/// Rooms are created when their first occupant joins and destroyed when
+/// the last occupant leaves. Each room keeps an index of its occupants,
+/// serializes a broadcast stanza only once and keeps the most recent
+/// messages in a history ring buffer which is replayed to new occupants.
+///
+/// \ingroup Core
+
+class QXMPP_EXPORT QXmppMucService : public QXmppServerExtension
+{
+    Q_OBJECT
+    Q_CLASSINFO("ExtensionName", "muc");
+
+public:
+    QXmppMucService();
+    ~QXmppMucService();
+
+    QString jid() const;
+    void setJid(const QString &jid);
+
+    int historySize() const;
+    void setHistorySize(int size);
+
+    int coalesceThreshold() const;
+    void setCoalesceThreshold(int occupants);
+
+    int coalesceInterval() const;
+    void setCoalesceInterval(int msecs);
+
+    bool isSubjectChangeAllowed() const;
+    void setSubjectChangeAllowed(bool allowed);
+
+    QStringList rooms() const;
+    QStringList occupants(const QString &roomJid) const;
+
+    /// \cond
+    QStringList discoveryItems() const;
+    bool handleStanza(const QDomElement &element);
+    bool start();
+    void stop();
+    /// \endcond
+
+private slots:
+    void _q_clientDisconnected(const QString &jid);
+    void _q_flushPresences();
+    void _q_serverDisconnected(const QString &domain);
+
+private:
+    friend class QXmppMucServicePrivate;
+    QXmppMucServicePrivate *d;
+};
+
+#endif
@@ -21,7 +21,10 @@
  *
  */
 
+#include <QDomDocument>
 #include <QDomElement>
+#include <QElapsedTimer>
+#include <QSet>
 #include <QSslKey>
 #include <QSslSocket>
 #include <QTimer>
@@ -37,10 +40,28 @@
 #include "QXmppStreamFeatures.h"
 #include "QXmppUtils.h"
 
+/// Dialback state for an additional local domain which piggybacks
+/// on an established stream.
+
+class QXmppOutgoingServerDomain
+{
+public:
+    QXmppOutgoingServerDomain() : ready(false) {}
+
+    QList<QByteArray> dataQueue;
+    QString key;
+    bool ready;
+};
+
 class QXmppOutgoingServerPrivate
 {
 public:
+    bool isLocalDomain(const QString &domain) const;
+
     QList<QByteArray> dataQueue;
+    int queuedBytes;
+    int queueLimit;
+
     QDnsLookup dns;
     QString localDomain;
     QString localStreamKey;
@@ -48,9 +69,26 @@ public:
     QString verifyId;
     QString verifyKey;
     QTimer *dialbackTimer;
+    QTimer *idleTimer;
+    QTimer *setupTimer;
     bool ready;
+
+    // additional local domains authorized over this stream
+    QHash<QString, QXmppOutgoingServerDomain> piggybackDomains;
+
+    // local domains the remote server refused to piggyback
+    QSet<QString> refusedDomains;
+
+    // setup latency
+    QElapsedTimer setupClock;
+    int setupTime;
 };
 
+bool QXmppOutgoingServerPrivate::isLocalDomain(const QString &domain) const
+{
+    return domain == localDomain || piggybackDomains.contains(domain);
+}
+
 /// Constructs a new outgoing server-to-server stream.
 ///
 /// \param domain the local domain
@@ -88,8 +126,24 @@ QXmppOutgoingServer::QXmppOutgoingServer(const QString &domain, QObject *parent)
                     this, SLOT(sendDialback()));
     Q_ASSERT(check);
 
+    d->idleTimer = new QTimer(this);
+    d->idleTimer->setSingleShot(true);
+    check = connect(d->idleTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_idleTimeout()));
+    Q_ASSERT(check);
+
+    d->setupTimer = new QTimer(this);
+    d->setupTimer->setInterval(60000);
+    d->setupTimer->setSingleShot(true);
+    check = connect(d->setupTimer, SIGNAL(timeout()),
+                    this, SLOT(_q_setupTimeout()));
+    Q_ASSERT(check);
+
     d->localDomain = domain;
     d->ready = false;
+    d->queuedBytes = 0;
+    d->queueLimit = 0;
+    d->setupTime = -1;
 
     check = connect(socket, SIGNAL(sslErrors(QList<QSslError>)),
                     this, SLOT(slotSslErrors(QList<QSslError>)));
@@ -111,6 +165,9 @@ QXmppOutgoingServer::~QXmppOutgoingServer()
 void QXmppOutgoingServer::connectToHost(const QString &domain)
 {
     d->remoteDomain = domain;
+    d->setupClock.start();
+    if (d->setupTimer->interval())
+        d->setupTimer->start();
 
     // lookup server for domain
     debug(QString("Looking up server for domain %1").arg(domain));
@@ -147,6 +204,35 @@ void QXmppOutgoingServer::_q_dnsLookupFinished()
     socket()->connectToHost(host, port);
 }
 
+void QXmppOutgoingServer::_q_idleTimeout()
+{
+    info(QString("Closing idle outgoing server stream to %1").arg(d->remoteDomain));
+    disconnectFromHost();
+}
+
+void QXmppOutgoingServer::_q_setupTimeout()
+{
+    warning(QString("Outgoing server stream to %1 is not ready after %2 s, giving up").arg(d->remoteDomain, QString::number(setupTimeout())));
+    updateCounter("outgoing-server.setup.timeout");
+
+    // return the queued stanzas to their senders
+    QList<QByteArray> dropped = d->dataQueue;
+    d->dataQueue.clear();
+    foreach (const QString &localDomain, d->piggybackDomains.keys()) {
+        dropped += d->piggybackDomains[localDomain].dataQueue;
+        d->piggybackDomains[localDomain].dataQueue.clear();
+    }
+    d->queuedBytes = 0;
+    foreach (const QByteArray &data, dropped)
+        bounceData(data, "remote-server-timeout");
+
+    // a socket which never connected does not report its disconnection
+    const bool wasConnected = socket()->state() == QAbstractSocket::ConnectedState;
+    socket()->abort();
+    if (!wasConnected)
+        emit disconnected();
+}
+
 void QXmppOutgoingServer::_q_socketDisconnected()
 {
     debug("Socket disconnected");
@@ -225,23 +311,55 @@ void QXmppOutgoingServer::handleStanza(const QDomElement &stanza)
 
         // check the request is valid
         if (response.from().isEmpty() ||
-            response.to() != d->localDomain ||
+            !d->isLocalDomain(response.to()) ||
             response.type().isEmpty())
         {
             warning("Invalid dialback response received");
             return;
         }
-        if (response.command() == QXmppDialback::Result)
+        if (response.command() == QXmppDialback::Result &&
+            response.to() != d->localDomain)
+        {
+            QXmppOutgoingServerDomain &piggyback = d->piggybackDomains[response.to()];
+            foreach (const QByteArray &data, piggyback.dataQueue)
+                d->queuedBytes -= data.size();
+
+            if (response.type() == QLatin1String("valid"))
+            {
+                info(QString("Outgoing server stream to %1 is ready for %2").arg(response.from(), response.to()));
+                piggyback.ready = true;
+                foreach (const QByteArray &data, piggyback.dataQueue)
+                    sendData(data);
+                piggyback.dataQueue.clear();
+            } else {
+                warning(QString("Outgoing server stream to %1 was refused for %2").arg(response.from(), response.to()));
+                const QList<QByteArray> refusedData = piggyback.dataQueue;
+                d->piggybackDomains.remove(response.to());
+                d->refusedDomains.insert(response.to());
+                emit domainRefused(response.to(), refusedData);
+            }
+        }
+        else if (response.command() == QXmppDialback::Result)
         {
             if (response.type() == QLatin1String("valid"))
             {
-                info(QString("Outgoing server stream to %1 is ready").arg(response.from()));
                 d->ready = true;
+                d->setupTimer->stop();
+                d->setupTime = d->setupClock.isValid() ? d->setupClock.elapsed() : 0;
+                info(QString("Outgoing server stream to %1 is ready after %2 ms").arg(response.from(), QString::number(d->setupTime)));
 
                 // send queued data
-                foreach (const QByteArray &data, d->dataQueue)
+                foreach (const QByteArray &data, d->dataQueue) {
                     sendData(data);
+                    d->queuedBytes -= data.size();
+                }
                 d->dataQueue.clear();
+                if (d->idleTimer->interval())
+                    d->idleTimer->start();
+
+                // authorize additional local domains over this stream
+                foreach (const QString &localDomain, d->piggybackDomains.keys())
+                    sendDialback(localDomain);
 
                 // emit signal
                 emit connected();
@@ -264,6 +382,105 @@ bool QXmppOutgoingServer::isConnected() const
     return QXmppStream::isConnected() && d->ready;
 }
 
+/// Returns the number of seconds after which the stream is closed if
+/// no data was sent over it, or 0 if the stream is never closed for
+/// inactivity.
+
+int QXmppOutgoingServer::idleTimeout() const
+{
+    return d->idleTimer->interval() / 1000;
+}
+
+/// Sets the number of seconds after which the stream is closed if no
+/// data was sent over it. A value of 0 keeps the stream open.
+///
+/// \param secs
+
+void QXmppOutgoingServer::setIdleTimeout(int secs)
+{
+    d->idleTimer->stop();
+    d->idleTimer->setInterval(qMax(0, secs) * 1000);
+    if (d->idleTimer->interval() && d->ready)
+        d->idleTimer->start();
+}
+
+/// Returns the number of seconds the stream is given to become ready,
+/// or 0 if there is no deadline.
+
+int QXmppOutgoingServer::setupTimeout() const
+{
+    return d->setupTimer->interval() / 1000;
+}
+
+/// Sets the number of seconds the stream is given to become ready once
+/// connectToHost() is called. When the deadline passes, the queued
+/// stanzas are bounced with a remote-server-timeout error and the stream
+/// is closed, so that it can be retried.
+///
+/// The default value is 60 seconds, a value of 0 removes the deadline.
+///
+/// \param secs
+
+void QXmppOutgoingServer::setSetupTimeout(int secs)
+{
+    d->setupTimer->setInterval(qMax(0, secs) * 1000);
+}
+
+/// Returns the maximum number of bytes which can be queued while the
+/// stream is being established, or 0 if the queue is unbounded.
+
+int QXmppOutgoingServer::queueLimit() const
+{
+    return d->queueLimit;
+}
+
+/// Sets the maximum number of bytes which can be queued while the stream
+/// is being established. Data which would exceed this limit is dropped.
+///
+/// A value of 0, the default, leaves the queue unbounded.
+///
+/// \param bytes
+
+void QXmppOutgoingServer::setQueueLimit(int bytes)
+{
+    d->queueLimit = qMax(0, bytes);
+}
+
+/// Returns the number of bytes currently queued waiting for the stream
+/// to be established.
+
+int QXmppOutgoingServer::queuedBytes() const
+{
+    return d->queuedBytes;
+}
+
+/// Returns the number of milliseconds it took to establish the stream,
+/// from the DNS lookup to the dialback result, or -1 if the stream is
+/// not ready yet.
+
+int QXmppOutgoingServer::setupTime() const
+{
+    return d->setupTime;
+}
+
+/// Returns the local domains which use this stream, starting with the
+/// domain the stream was created for.
+
+QStringList QXmppOutgoingServer::localDomains() const
+{
+    return QStringList() << d->localDomain << d->piggybackDomains.keys();
+}
+
+/// Returns true if the remote server refused to authorize \a localDomain
+/// over this stream.
+///
+/// \param localDomain
+
+bool QXmppOutgoingServer::isDomainRefused(const QString &localDomain) const
+{
+    return d->refusedDomains.contains(localDomain);
+}
+
 /// Returns the stream's local dialback key.
 
 QString QXmppOutgoingServer::localStreamKey() const
@@ -271,6 +488,18 @@ QString QXmppOutgoingServer::localStreamKey() const
     return d->localStreamKey;
 }
 
+/// Returns the dialback key used to authorize \a localDomain over this
+/// stream, or an empty string if the domain does not use this stream.
+///
+/// \param localDomain
+
+QString QXmppOutgoingServer::localStreamKey(const QString &localDomain) const
+{
+    if (localDomain == d->localDomain)
+        return d->localStreamKey;
+    return d->piggybackDomains.value(localDomain).key;
+}
+
 /// Sets the stream's local dialback key.
 ///
 /// \param key
@@ -293,14 +522,103 @@ void QXmppOutgoingServer::setVerify(const QString &id, const QString &key)
 
 /// Sends or queues data until connected.
 ///
+/// While the stream is being established, data exceeding the queue
+/// limit is dropped and a resource-constraint error is returned to the
+/// sender.
+///
 /// \param data
 
 void QXmppOutgoingServer::queueData(const QByteArray &data)
 {
-    if (isConnected())
+    if (isConnected()) {
         sendData(data);
-    else
+        if (d->idleTimer->interval())
+            d->idleTimer->start();
+    } else if (d->queueLimit && d->queuedBytes + data.size() > d->queueLimit) {
+        warning(QString("Dropping %1 bytes for %2, queue limit reached").arg(QString::number(data.size()), d->remoteDomain));
+        updateCounter("outgoing-server.queue.dropped");
+        bounceData(data, "resource-constraint");
+    } else {
         d->dataQueue.append(data);
+        d->queuedBytes += data.size();
+    }
+}
+
+/// Sends or queues data on behalf of \a localDomain.
+///
+/// If \a localDomain is not the domain the stream was created for, it is
+/// authorized over the existing stream using dialback piggybacking
+/// instead of opening a new connection. Data is queued until the domain
+/// is authorized. Once the remote server refused \a localDomain, its data
+/// is handed back through domainRefused() for the lifetime of the stream.
+///
+/// \param data
+/// \param localDomain
+
+void QXmppOutgoingServer::queueData(const QByteArray &data, const QString &localDomain)
+{
+    if (localDomain.isEmpty() || localDomain == d->localDomain) {
+        queueData(data);
+        return;
+    }
+
+    if (d->refusedDomains.contains(localDomain)) {
+        emit domainRefused(localDomain, QList<QByteArray>() << data);
+        return;
+    }
+
+    if (!d->piggybackDomains.contains(localDomain)) {
+        QXmppOutgoingServerDomain piggyback;
+        piggyback.key = QXmppUtils::generateStanzaHash();
+        d->piggybackDomains.insert(localDomain, piggyback);
+        if (isConnected())
+            sendDialback(localDomain);
+    }
+
+    QXmppOutgoingServerDomain &piggyback = d->piggybackDomains[localDomain];
+    if (piggyback.ready) {
+        sendData(data);
+        if (d->idleTimer->interval())
+            d->idleTimer->start();
+    } else if (d->queueLimit && d->queuedBytes + data.size() > d->queueLimit) {
+        warning(QString("Dropping %1 bytes for %2, queue limit reached").arg(QString::number(data.size()), d->remoteDomain));
+        updateCounter("outgoing-server.queue.dropped");
+        bounceData(data, "resource-constraint");
+    } else {
+        piggyback.dataQueue.append(data);
+        d->queuedBytes += data.size();
+    }
+}
+
+/// Returns an error with the given \a condition to the sender of an
+/// undelivered stanza, as required by RFC 6120 section 8.3.
+///
+/// \param data
+/// \param condition
+
+void QXmppOutgoingServer::bounceData(const QByteArray &data, const QString &condition)
+{
+    QDomDocument doc;
+    if (!doc.setContent(data, true))
+        return;
+
+    // never answer an error with an error
+    QDomElement stanza = doc.documentElement();
+    const QString from = stanza.attribute("from");
+    const QString to = stanza.attribute("to");
+    if (from.isEmpty() || stanza.attribute("type") == QLatin1String("error"))
+        return;
+
+    stanza.setAttribute("from", to);
+    stanza.setAttribute("to", from);
+    stanza.setAttribute("type", "error");
+
+    QDomElement error = doc.createElementNS(stanza.namespaceURI(), "error");
+    error.setAttribute("type", "wait");
+    error.appendChild(doc.createElementNS(ns_stanza, condition));
+    stanza.appendChild(error);
+
+    emit stanzaBounced(stanza);
 }
 
 /// Returns the remote server's domain.
@@ -337,6 +655,21 @@ void QXmppOutgoingServer::sendDialback()
     }
 }
 
+/// Sends a dialback result to authorize an additional local domain.
+///
+/// \param localDomain
+
+void QXmppOutgoingServer::sendDialback(const QString &localDomain)
+{
+    debug(QString("Sending dialback result to %1 for %2").arg(d->remoteDomain, localDomain));
+    QXmppDialback dialback;
+    dialback.setCommand(QXmppDialback::Result);
+    dialback.setFrom(localDomain);
+    dialback.setTo(d->remoteDomain);
+    dialback.setKey(d->piggybackDomains.value(localDomain).key);
+    sendPacket(dialback);
+}
+
 void QXmppOutgoingServer::slotSslErrors(const QList<QSslError> &errors)
 {
     warning("SSL errors");
@@ -47,7 +47,22 @@ public:
 
     bool isConnected() const;
 
+    int idleTimeout() const;
+    void setIdleTimeout(int secs);
+
+    int setupTimeout() const;
+    void setSetupTimeout(int secs);
+
+    int queueLimit() const;
+    void setQueueLimit(int bytes);
+    int queuedBytes() const;
+
+    int setupTime() const;
+
+    QStringList localDomains() const;
+    bool isDomainRefused(const QString &localDomain) const;
     QString localStreamKey() const;
+    QString localStreamKey(const QString &localDomain) const;
     void setLocalStreamKey(const QString &key);
     void setVerify(const QString &id, const QString &key);
 
@@ -57,6 +72,15 @@ signals:
     /// This signal is emitted when a dialback verify response is received.
     void dialbackResponseReceived(const QXmppDialback &response);
 
+    /// This signal is emitted when a stanza could not be delivered and
+    /// an error \a element must be returned to its sender.
+    void stanzaBounced(const QDomElement &element);
+
+    /// This signal is emitted when the remote server refuses to authorize
+    /// \a localDomain over this stream. \a data holds the stanzas which
+    /// were queued for that domain.
+    void domainRefused(const QString &localDomain, const QList<QByteArray> &data);
+
 protected:
     /// \cond
     void handleStart();
@@ -67,15 +91,21 @@ protected:
 public slots:
     void connectToHost(const QString &domain);
     void queueData(const QByteArray &data);
+    void queueData(const QByteArray &data, const QString &localDomain);
 
 private slots:
     void _q_dnsLookupFinished();
+    void _q_idleTimeout();
+    void _q_setupTimeout();
     void _q_socketDisconnected();
     void sendDialback();
+    void sendDialback(const QString &localDomain);
     void slotSslErrors(const QList<QSslError> &errors);
     void socketError(QAbstractSocket::SocketError error);
 
 private:
+    void bounceData(const QByteArray &data, const QString &condition);
+
     Q_DISABLE_COPY(QXmppOutgoingServer)
     QXmppOutgoingServerPrivate* const d;
 };
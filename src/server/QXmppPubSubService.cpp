@@ -0,0 +1,798 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QCache>
+#include <QDataStream>
+#include <QDomElement>
+#include <QFile>
+#include <QStringList>
+#include <QXmlStreamWriter>
+
+#include "QXmppConstants.h"
+#include "QXmppPubSubIq.h"
+#include "QXmppPubSubService.h"
+#include "QXmppServer.h"
+#include "QXmppUtils.h"
+
+// the store is compacted once it holds more stale than live records
+static const qint64 storeCompactSize = 1024 * 1024;
+
+enum StoreRecordType
+{
+    PublishRecord = 1,
+    RetractRecord,
+    SubscribeRecord,
+    UnsubscribeRecord
+};
+
+static QByteArray escapeAttribute(const QString &value)
+{
+    QByteArray data = value.toUtf8();
+    if (data.contains('&') || data.contains('<') || data.contains('"'))
+        data.replace('&', "&amp;").replace('<', "&lt;").replace('"', "&quot;");
+    return data;
+}
+
+static QByteArray storeRecord(quint8 type, const QString &owner, const QString &node, const QString &jid, const QString &id, const QByteArray &data)
+{
+    QByteArray record;
+    QDataStream stream(&record, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_4_6);
+    stream << type << owner << node << jid << id << data;
+    return record;
+}
+
+class QXmppPubSubServiceItem
+{
+public:
+    QString id;
+
+    // the serialized <item/>, unless it is held by the store
+    QByteArray data;
+
+    // location of the item's record in the store
+    qint64 offset;
+    int size;
+};
+
+class QXmppPubSubServiceNode
+{
+public:
+    QString owner;
+    QString name;
+    QString publisher;
+
+    // items, oldest first
+    QList<QXmppPubSubServiceItem> items;
+
+    // subscriber JIDs, with the size of their record in the store
+    QHash<QString, int> subscribers;
+};
+
+class QXmppPubSubServicePrivate
+{
+public:
+    QXmppPubSubServicePrivate(QXmppPubSubService *qq);
+
+    QXmppPubSubServiceNode *node(const QString &owner, const QString &name, bool create);
+    void addItem(QXmppPubSubServiceNode *node, const QXmppPubSubServiceItem &item, const QByteArray &data);
+    bool removeItem(QXmppPubSubServiceNode *node, const QString &id);
+    QByteArray itemData(QXmppPubSubServiceNode *node, int index);
+    void publish(QXmppPubSubServiceNode *node, const QString &id, const QByteArray &data, const QString &publisher);
+    void notify(QXmppPubSubServiceNode *node, const QByteArray &data, const QStringList &recipients);
+    QStringList recipients(QXmppPubSubServiceNode *node);
+    bool isAuthorized(QXmppPubSubServiceNode *node, const QString &jid);
+
+    bool handleIq(const QDomElement &element, const QString &owner);
+    void sendError(const QDomElement &element, QXmppStanza::Error::Type type, QXmppStanza::Error::Condition condition);
+
+    // store
+    bool openStore();
+    void closeStore();
+    qint64 writeRecord(quint8 type, const QString &owner, const QString &node, const QString &jid, const QString &id, const QByteArray &data, int *size = 0);
+    void compactStore();
+
+    QString jid;
+    int maxItems;
+    QString storagePath;
+
+    QHash<QString, QHash<QString, QXmppPubSubServiceNode*> > nodes;
+    QCache<QXmppPubSubServiceNode*, QByteArray> lastItems;
+    QFile *store;
+    qint64 liveBytes;
+
+private:
+    QXmppPubSubService *q;
+};
+
+QXmppPubSubServicePrivate::QXmppPubSubServicePrivate(QXmppPubSubService *qq)
+    : maxItems(10),
+    store(0),
+    liveBytes(0),
+    q(qq)
+{
+    lastItems.setMaxCost(4 * 1024 * 1024);
+}
+
+QXmppPubSubServiceNode *QXmppPubSubServicePrivate::node(const QString &owner, const QString &name, bool create)
+{
+    QXmppPubSubServiceNode *node = nodes.value(owner).value(name);
+    if (!node && create) {
+        node = new QXmppPubSubServiceNode;
+        node->owner = owner;
+        node->name = name;
+        nodes[owner].insert(name, node);
+    }
+    return node;
+}
+
+/// Adds an item to a node, replacing any item with the same ID and
+/// dropping the oldest items beyond maxItems.
+
+void QXmppPubSubServicePrivate::addItem(QXmppPubSubServiceNode *node, const QXmppPubSubServiceItem &item, const QByteArray &data)
+{
+    for (int i = 0; i < node->items.size(); ++i) {
+        if (node->items[i].id == item.id) {
+            liveBytes -= node->items[i].size;
+            node->items.removeAt(i);
+            break;
+        }
+    }
+    node->items.append(item);
+    liveBytes += item.size;
+    while (node->items.size() > qMax(1, maxItems))
+        liveBytes -= node->items.takeFirst().size;
+
+    if (item.offset >= 0)
+        lastItems.insert(node, new QByteArray(data), data.size());
+}
+
+bool QXmppPubSubServicePrivate::removeItem(QXmppPubSubServiceNode *node, const QString &id)
+{
+    for (int i = 0; i < node->items.size(); ++i) {
+        if (node->items[i].id == id) {
+            if (i == node->items.size() - 1)
+                lastItems.remove(node);
+            liveBytes -= node->items[i].size;
+            node->items.removeAt(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+/// Returns the serialized item at the given index, reading it from the
+/// store if needed.
+
+QByteArray QXmppPubSubServicePrivate::itemData(QXmppPubSubServiceNode *node, int index)
+{
+    const QXmppPubSubServiceItem &item = node->items.at(index);
+    if (item.offset < 0)
+        return item.data;
+
+    const bool last = (index == node->items.size() - 1);
+    if (last) {
+        QByteArray *cached = lastItems.object(node);
+        if (cached)
+            return *cached;
+    }
+
+    QByteArray data;
+    if (store && store->seek(item.offset)) {
+        quint8 type;
+        QString owner, name, jid, id;
+        QDataStream stream(store);
+        stream.setVersion(QDataStream::Qt_4_6);
+        stream >> type >> owner >> name >> jid >> id >> data;
+        if (stream.status() != QDataStream::Ok)
+            data.clear();
+    }
+    if (last && !data.isEmpty())
+        lastItems.insert(node, new QByteArray(data), data.size());
+    return data;
+}
+
+void QXmppPubSubServicePrivate::publish(QXmppPubSubServiceNode *node, const QString &id, const QByteArray &data, const QString &publisher)
+{
+    QXmppPubSubServiceItem item;
+    item.id = id;
+    item.size = 0;
+    item.offset = writeRecord(PublishRecord, node->owner, node->name, publisher, id, data, &item.size);
+    if (item.offset < 0)
+        item.data = data;
+    addItem(node, item, data);
+
+    notify(node, data, recipients(node));
+    compactStore();
+}
+
+/// Returns the JIDs to notify of a node's items.
+
+QStringList QXmppPubSubServicePrivate::recipients(QXmppPubSubServiceNode *node)
+{
+    QStringList recipients = node->subscribers.keys();
+
+    // personal nodes also notify the owner and its presence subscribers
+    if (node->owner != jid) {
+        QSet<QString> extra;
+        extra << node->owner;
+        foreach (QXmppServerExtension *extension, q->server()->extensions())
+            extra += extension->presenceSubscribers(node->owner);
+        foreach (const QString &recipient, extra) {
+            if (!node->subscribers.contains(recipient))
+                recipients << recipient;
+        }
+    }
+    return recipients;
+}
+
+/// Returns true if the given bare JID may retrieve the items of a node
+/// or subscribe to it.
+///
+/// Nodes of the service are open, personal nodes use the presence access
+/// model: only the owner and the JIDs with a "from" or "both" roster
+/// subscription to the owner are authorized.
+
+bool QXmppPubSubServicePrivate::isAuthorized(QXmppPubSubServiceNode *node, const QString &jid)
+{
+    if (node->owner == this->jid || jid == node->owner)
+        return true;
+    foreach (QXmppServerExtension *extension, q->server()->extensions()) {
+        if (extension->presenceSubscribers(node->owner).contains(jid))
+            return true;
+    }
+    return false;
+}
+
+/// Sends an item to the given recipients.
+///
+/// The notification is serialized once, only the recipient's address
+/// differs between the copies.
+
+void QXmppPubSubServicePrivate::notify(QXmppPubSubServiceNode *node, const QByteArray &data, const QStringList &recipients)
+{
+    QByteArray tail;
+    tail += " from=\"" + escapeAttribute(node->owner) + "\" type=\"headline\">";
+    tail += QByteArray("<event xmlns=\"") + ns_pubsub_event + "\">";
+    tail += "<items node=\"" + escapeAttribute(node->name) + "\">";
+    tail += data;
+    tail += "</items></event></message>";
+
+    QXmppServer *server = q->server();
+    foreach (const QString &recipient, recipients) {
+        const QByteArray to = escapeAttribute(recipient);
+        QByteArray message;
+        message.reserve(tail.size() + to.size() + 14);
+        message += "<message to=\"";
+        message += to;
+        message += '"';
+        message += tail;
+        server->sendData(recipient, message, node->owner);
+    }
+    q->updateCounter("pubsub.notifications", recipients.size());
+}
+
+bool QXmppPubSubServicePrivate::handleIq(const QDomElement &element, const QString &owner)
+{
+    QXmppPubSubIq request;
+    request.parse(element);
+
+    const QString fromBare = QXmppUtils::jidToBareJid(request.from());
+    const QDomElement queryElement = element.firstChildElement("pubsub").firstChildElement();
+    const QString query = queryElement.tagName();
+    const QString nodeName = request.queryNode();
+
+    if (request.type() == QXmppIq::Set && query == QLatin1String("publish")) {
+        if (nodeName.isEmpty()) {
+            sendError(element, QXmppStanza::Error::Modify, QXmppStanza::Error::BadRequest);
+            return true;
+        }
+
+        // only the first publisher of a node can publish to it, nodes
+        // loaded without any item are claimed by their first publish
+        QXmppPubSubServiceNode *node = this->node(owner, nodeName, false);
+        QString publisher = (owner == jid) ? fromBare : owner;
+        if (node && !node->publisher.isEmpty())
+            publisher = node->publisher;
+        if (fromBare != publisher) {
+            sendError(element, QXmppStanza::Error::Auth, QXmppStanza::Error::Forbidden);
+            return true;
+        }
+        if (!node)
+            node = this->node(owner, nodeName, true);
+        node->publisher = publisher;
+
+        QList<QXmppPubSubItem> items = request.items();
+        if (items.isEmpty())
+            items << QXmppPubSubItem();
+        QList<QXmppPubSubItem> published;
+        foreach (QXmppPubSubItem item, items) {
+            if (item.id().isEmpty())
+                item.setId(QXmppUtils::generateStanzaHash());
+
+            QByteArray data;
+            QXmlStreamWriter writer(&data);
+            item.toXml(&writer);
+            publish(node, item.id(), data, publisher);
+
+            QXmppPubSubItem ack;
+            ack.setId(item.id());
+            published << ack;
+        }
+
+        QXmppPubSubIq response;
+        response.setType(QXmppIq::Result);
+        response.setId(request.id());
+        response.setFrom(request.to());
+        response.setTo(request.from());
+        response.setQueryType(QXmppPubSubIq::PublishQuery);
+        response.setQueryNode(nodeName);
+        response.setItems(published);
+        q->server()->sendPacket(response);
+        return true;
+
+    } else if (request.type() == QXmppIq::Set && query == QLatin1String("retract")) {
+        QXmppPubSubServiceNode *node = this->node(owner, nodeName, false);
+        if (!node) {
+            sendError(element, QXmppStanza::Error::Cancel, QXmppStanza::Error::ItemNotFound);
+            return true;
+        } else if (fromBare != node->publisher) {
+            sendError(element, QXmppStanza::Error::Auth, QXmppStanza::Error::Forbidden);
+            return true;
+        }
+
+        QDomElement itemElement = queryElement.firstChildElement("item");
+        while (!itemElement.isNull()) {
+            const QString id = itemElement.attribute("id");
+            if (removeItem(node, id))
+                writeRecord(RetractRecord, owner, nodeName, fromBare, id, QByteArray());
+            itemElement = itemElement.nextSiblingElement("item");
+        }
+        compactStore();
+
+        QXmppIq response(QXmppIq::Result);
+        response.setId(request.id());
+        response.setFrom(request.to());
+        response.setTo(request.from());
+        q->server()->sendPacket(response);
+        return true;
+
+    } else if (request.type() == QXmppIq::Get && query == QLatin1String("items")) {
+        QXmppPubSubServiceNode *node = this->node(owner, nodeName, false);
+        if (!node) {
+            sendError(element, QXmppStanza::Error::Cancel, QXmppStanza::Error::ItemNotFound);
+            return true;
+        } else if (!isAuthorized(node, fromBare)) {
+            sendError(element, QXmppStanza::Error::Auth, QXmppStanza::Error::NotAuthorized);
+            return true;
+        }
+
+        // the items are sent as stored, without parsing them
+        const int maxItems = queryElement.attribute("max_items").toInt();
+        const int first = maxItems > 0 ? qMax(0, node->items.size() - maxItems) : 0;
+        QByteArray data;
+        data += "<iq id=\"" + escapeAttribute(request.id()) + "\"";
+        data += " to=\"" + escapeAttribute(request.from()) + "\"";
+        data += " from=\"" + escapeAttribute(request.to()) + "\" type=\"result\">";
+        data += QByteArray("<pubsub xmlns=\"") + ns_pubsub + "\">";
+        data += "<items node=\"" + escapeAttribute(nodeName) + "\">";
+        for (int i = first; i < node->items.size(); ++i)
+            data += itemData(node, i);
+        data += "</items></pubsub></iq>";
+        q->server()->sendData(request.from(), data, request.to());
+        return true;
+
+    } else if (request.type() == QXmppIq::Set && query == QLatin1String("subscribe")) {
+        const QString subscriber = request.queryJid();
+        if (QXmppUtils::jidToBareJid(subscriber) != fromBare) {
+            sendError(element, QXmppStanza::Error::Modify, QXmppStanza::Error::BadRequest);
+            return true;
+        }
+
+        QXmppPubSubServiceNode *node = this->node(owner, nodeName, false);
+        if (!node) {
+            sendError(element, QXmppStanza::Error::Cancel, QXmppStanza::Error::ItemNotFound);
+            return true;
+        } else if (!isAuthorized(node, fromBare)) {
+            sendError(element, QXmppStanza::Error::Auth, QXmppStanza::Error::NotAuthorized);
+            return true;
+        }
+
+        if (!node->subscribers.contains(subscriber)) {
+            int size = 0;
+            writeRecord(SubscribeRecord, owner, nodeName, subscriber, QString(), QByteArray(), &size);
+            node->subscribers.insert(subscriber, size);
+            liveBytes += size;
+        }
+
+        QXmppPubSubIq response;
+        response.setType(QXmppIq::Result);
+        response.setId(request.id());
+        response.setFrom(request.to());
+        response.setTo(request.from());
+        response.setQueryType(QXmppPubSubIq::SubscriptionQuery);
+        response.setQueryJid(subscriber);
+        response.setQueryNode(nodeName);
+        response.setSubscriptionType("subscribed");
+        q->server()->sendPacket(response);
+
+        // send the last published item
+        if (!node->items.isEmpty())
+            notify(node, itemData(node, node->items.size() - 1), QStringList() << subscriber);
+        return true;
+
+    } else if (request.type() == QXmppIq::Set && query == QLatin1String("unsubscribe")) {
+        QXmppPubSubServiceNode *node = this->node(owner, nodeName, false);
+        const QString subscriber = request.queryJid();
+        if (!node || !node->subscribers.contains(subscriber)) {
+            sendError(element, QXmppStanza::Error::Cancel, QXmppStanza::Error::UnexpectedRequest);
+            return true;
+        } else if (QXmppUtils::jidToBareJid(subscriber) != fromBare) {
+            sendError(element, QXmppStanza::Error::Auth, QXmppStanza::Error::Forbidden);
+            return true;
+        }
+        liveBytes -= node->subscribers.take(subscriber);
+        writeRecord(UnsubscribeRecord, owner, nodeName, subscriber, QString(), QByteArray());
+        compactStore();
+
+        QXmppIq response(QXmppIq::Result);
+        response.setId(request.id());
+        response.setFrom(request.to());
+        response.setTo(request.from());
+        q->server()->sendPacket(response);
+        return true;
+    }
+    return false;
+}
+
+void QXmppPubSubServicePrivate::sendError(const QDomElement &element, QXmppStanza::Error::Type type, QXmppStanza::Error::Condition condition)
+{
+    QXmppIq response(QXmppIq::Error);
+    response.setId(element.attribute("id"));
+    response.setFrom(element.attribute("to"));
+    response.setTo(element.attribute("from"));
+    response.setError(QXmppStanza::Error(type, condition));
+    q->server()->sendPacket(response);
+}
+
+/// Opens the store and loads the nodes it contains.
+
+bool QXmppPubSubServicePrivate::openStore()
+{
+    store = new QFile(storagePath);
+    if (!store->open(QIODevice::ReadWrite)) {
+        q->warning(QString("Could not open pubsub store %1").arg(storagePath));
+        delete store;
+        store = 0;
+        return false;
+    }
+
+    QDataStream stream(store);
+    stream.setVersion(QDataStream::Qt_4_6);
+    while (!stream.atEnd()) {
+        const qint64 offset = store->pos();
+        quint8 type;
+        QString owner, name, jid, id;
+        QByteArray data;
+        stream >> type >> owner >> name >> jid >> id >> data;
+        if (stream.status() != QDataStream::Ok) {
+            q->warning(QString("Truncating pubsub store %1 at %2").arg(storagePath, QString::number(offset)));
+            store->resize(offset);
+            break;
+        }
+        const int size = store->pos() - offset;
+
+        QXmppPubSubServiceNode *node = this->node(owner, name, true);
+        if (type == PublishRecord) {
+            if (node->publisher.isEmpty())
+                node->publisher = jid;
+            QXmppPubSubServiceItem item;
+            item.id = id;
+            item.offset = offset;
+            item.size = size;
+            addItem(node, item, data);
+        } else if (type == RetractRecord) {
+            removeItem(node, id);
+        } else if (type == SubscribeRecord) {
+            liveBytes += size - node->subscribers.value(jid);
+            node->subscribers.insert(jid, size);
+        } else if (type == UnsubscribeRecord) {
+            liveBytes -= node->subscribers.take(jid);
+        }
+    }
+    return true;
+}
+
+void QXmppPubSubServicePrivate::closeStore()
+{
+    if (store) {
+        store->close();
+        delete store;
+        store = 0;
+    }
+    liveBytes = 0;
+}
+
+/// Appends a record to the store.
+///
+/// Returns the record's offset, or -1 if there is no store.
+
+qint64 QXmppPubSubServicePrivate::writeRecord(quint8 type, const QString &owner, const QString &node, const QString &jid, const QString &id, const QByteArray &data, int *size)
+{
+    if (!store)
+        return -1;
+
+    const QByteArray record = storeRecord(type, owner, node, jid, id, data);
+    const qint64 offset = store->size();
+    if (!store->seek(offset) || store->write(record) != record.size()) {
+        q->warning(QString("Could not write to pubsub store %1").arg(storagePath));
+        return -1;
+    }
+    store->flush();
+    if (size)
+        *size = record.size();
+    return offset;
+}
+
+/// Rewrites the store without its stale records, if they take up more
+/// room than the live ones.
+
+void QXmppPubSubServicePrivate::compactStore()
+{
+    if (!store || store->size() < storeCompactSize || store->size() < 2 * liveBytes)
+        return;
+
+    QFile tmp(storagePath + ".tmp");
+    if (!tmp.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        q->warning(QString("Could not compact pubsub store %1").arg(storagePath));
+        return;
+    }
+
+    QList<QXmppPubSubServiceItem*> items;
+    QList<qint64> offsets;
+    QList<int> sizes;
+    bool ok = true;
+    foreach (const QString &owner, nodes.keys()) {
+        foreach (QXmppPubSubServiceNode *node, nodes.value(owner)) {
+            for (int i = 0; ok && i < node->items.size(); ++i) {
+                QXmppPubSubServiceItem *item = &node->items[i];
+                if (item->offset < 0)
+                    continue;
+                const QByteArray record = storeRecord(PublishRecord, owner, node->name, node->publisher, item->id, itemData(node, i));
+                items << item;
+                offsets << tmp.pos();
+                sizes << record.size();
+                ok = tmp.write(record) == record.size();
+            }
+            QHash<QString, int>::iterator it;
+            for (it = node->subscribers.begin(); ok && it != node->subscribers.end(); ++it) {
+                const QByteArray record = storeRecord(SubscribeRecord, owner, node->name, it.key(), QString(), QByteArray());
+                it.value() = record.size();
+                ok = tmp.write(record) == record.size();
+            }
+        }
+    }
+    tmp.close();
+    if (!ok) {
+        q->warning(QString("Could not compact pubsub store %1").arg(storagePath));
+        tmp.remove();
+        return;
+    }
+
+    // swap the files, keeping the old store until the new one is in place
+    const QString oldPath = storagePath + ".old";
+    store->close();
+    QFile::remove(oldPath);
+    bool swapped = QFile::rename(storagePath, oldPath);
+    if (swapped && !tmp.rename(storagePath)) {
+        QFile::rename(oldPath, storagePath);
+        swapped = false;
+    }
+    if (swapped) {
+        QFile::remove(oldPath);
+    } else {
+        q->warning(QString("Could not replace pubsub store %1").arg(storagePath));
+        tmp.remove();
+    }
+    if (!store->open(QIODevice::ReadWrite)) {
+        q->warning(QString("Could not reopen pubsub store %1").arg(storagePath));
+        delete store;
+        store = 0;
+        return;
+    }
+    if (!swapped)
+        return;
+    for (int i = 0; i < items.size(); ++i) {
+        items[i]->offset = offsets[i];
+        items[i]->size = sizes[i];
+    }
+    liveBytes = store->size();
+}
+
+/// Constructs a new publish-subscribe service.
+
+QXmppPubSubService::QXmppPubSubService()
+{
+    d = new QXmppPubSubServicePrivate(this);
+}
+
+/// Destroys a publish-subscribe service.
+
+QXmppPubSubService::~QXmppPubSubService()
+{
+    d->closeStore();
+    foreach (const QString &owner, d->nodes.keys())
+        qDeleteAll(d->nodes.value(owner));
+    delete d;
+}
+
+/// Returns the JID of the service, for instance "pubsub.example.com".
+
+QString QXmppPubSubService::jid() const
+{
+    return d->jid;
+}
+
+/// Sets the JID of the service.
+///
+/// If no JID is set, "pubsub." followed by the server's domain is used
+/// when the service starts. Personal eventing nodes are addressed to
+/// the bare JIDs of the users.
+///
+/// \param jid
+
+void QXmppPubSubService::setJid(const QString &jid)
+{
+    d->jid = jid;
+}
+
+/// Returns the maximum number of bytes used to cache the last item of
+/// each node when a store is used.
+
+int QXmppPubSubService::cacheSize() const
+{
+    return d->lastItems.maxCost();
+}
+
+/// Sets the maximum number of bytes used to cache the last item of each
+/// node when a store is used. Items which do not fit in the cache are
+/// read from the store when needed.
+///
+/// The default is 4 MiB.
+///
+/// \param bytes
+
+void QXmppPubSubService::setCacheSize(int bytes)
+{
+    d->lastItems.setMaxCost(qMax(0, bytes));
+}
+
+/// Returns the maximum number of items kept per node.
+
+int QXmppPubSubService::maxItems() const
+{
+    return d->maxItems;
+}
+
+/// Sets the maximum number of items kept per node, older items are
+/// dropped when new ones are published.
+///
+/// The default is 10.
+///
+/// \param items
+
+void QXmppPubSubService::setMaxItems(int items)
+{
+    d->maxItems = qMax(1, items);
+}
+
+/// Returns the path of the file storing items and subscriptions.
+
+QString QXmppPubSubService::storagePath() const
+{
+    return d->storagePath;
+}
+
+/// Sets the path of the file storing items and subscriptions.
+///
+/// If no path is set, which is the default, all items are kept in memory
+/// and are lost when the service stops. This must be set before the
+/// service starts.
+///
+/// \param path
+
+void QXmppPubSubService::setStoragePath(const QString &path)
+{
+    d->storagePath = path;
+}
+
+/// Returns the explicit subscribers of a node.
+///
+/// \param owner The JID of the service, or the bare JID of a user.
+/// \param node The name of the node.
+
+QStringList QXmppPubSubService::subscribers(const QString &owner, const QString &node) const
+{
+    QXmppPubSubServiceNode *n = d->nodes.value(owner).value(node);
+    return n ? n->subscribers.keys() : QStringList();
+}
+
+QStringList QXmppPubSubService::discoveryFeatures() const
+{
+    return QStringList() << ns_pubsub
+        << QString(ns_pubsub) + "#auto-create"
+        << QString(ns_pubsub) + "#last-published"
+        << QString(ns_pubsub) + "#presence-access"
+        << QString(ns_pubsub) + "#publish"
+        << QString(ns_pubsub) + "#retract-items"
+        << QString(ns_pubsub) + "#retrieve-items"
+        << QString(ns_pubsub) + "#subscribe";
+}
+
+QStringList QXmppPubSubService::discoveryItems() const
+{
+    return QStringList() << d->jid;
+}
+
+bool QXmppPubSubService::handleStanza(const QDomElement &element)
+{
+    if (element.tagName() != QLatin1String("iq") || !QXmppPubSubIq::isPubSubIq(element))
+        return false;
+
+    const QString to = element.attribute("to");
+    const QString from = element.attribute("from");
+    if (!QXmppUtils::jidToResource(to).isEmpty())
+        return false;
+
+    // determine who owns the node
+    const QStringList domains = server()->domains();
+    QString owner;
+    if (to == d->jid)
+        owner = d->jid;
+    else if (domains.contains(to) && domains.contains(QXmppUtils::jidToDomain(from)))
+        owner = QXmppUtils::jidToBareJid(from);
+    else if (!QXmppUtils::jidToUser(to).isEmpty() && domains.contains(QXmppUtils::jidToDomain(to)))
+        owner = to;
+    else
+        return false;
+
+    return d->handleIq(element, owner);
+}
+
+bool QXmppPubSubService::start()
+{
+    if (d->jid.isEmpty())
+        d->jid = "pubsub." + server()->domain();
+    if (!d->storagePath.isEmpty() && !d->store)
+        return d->openStore();
+    return true;
+}
+
+void QXmppPubSubService::stop()
+{
+    d->closeStore();
+    foreach (const QString &owner, d->nodes.keys())
+        qDeleteAll(d->nodes.value(owner));
+    d->nodes.clear();
+    d->lastItems.clear();
+}
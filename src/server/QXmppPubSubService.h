@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPPUBSUBSERVICE_H
+#define QXMPPPUBSUBSERVICE_H
+
+#include "QXmppServerExtension.h"
+
+class QXmppPubSubServicePrivate;
+
+/// \brief The QXmppPubSubService class is a server extension providing
+/// publish-subscribe nodes as defined by XEP-0060: Publish-Subscribe, and
+/// personal eventing as defined by XEP-0163: Personal Eventing Protocol.
+///
+/// Nodes are created when an item is first published to them. Nodes owned
+/// by a user's bare JID notify the user's presence subscribers in addition
+/// to explicit subscribers, and only the user and its presence subscribers
+/// may retrieve their items or subscribe to them. A notification is serialized once and the
+/// recipient's address is spliced in for each subscriber.
+///
+/// If a storage path is set, items and subscriptions are written to an
+/// append-only file which is compacted as it accumulates stale records,
+/// and only the most recently used items are kept in memory.
+///
+/// \ingroup Core
+
+class QXMPP_EXPORT QXmppPubSubService : public QXmppServerExtension
+{
+    Q_OBJECT
+    Q_CLASSINFO("ExtensionName", "pubsub");
+
+public:
+    QXmppPubSubService();
+    ~QXmppPubSubService();
+
+    QString jid() const;
+    void setJid(const QString &jid);
+
+    int cacheSize() const;
+    void setCacheSize(int bytes);
+
+    int maxItems() const;
+    void setMaxItems(int items);
+
+    QString storagePath() const;
+    void setStoragePath(const QString &path);
+
+    QStringList subscribers(const QString &owner, const QString &node) const;
+
+    /// \cond
+    QStringList discoveryFeatures() const;
+    QStringList discoveryItems() const;
+    bool handleStanza(const QDomElement &element);
+    bool start();
+    void stop();
+    /// \endcond
+
+private:
+    friend class QXmppPubSubServicePrivate;
+    QXmppPubSubServicePrivate *d;
+};
+
+#endif
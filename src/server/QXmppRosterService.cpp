@@ -0,0 +1,322 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QDomElement>
+#include <QStringList>
+
+#include "QXmppRosterService.h"
+#include "QXmppServer.h"
+#include "QXmppUtils.h"
+
+class QXmppRosterServiceUser
+{
+public:
+    QXmppRosterServiceUser() : version(0) {}
+
+    qint64 version;
+    QMap<QString, QXmppRosterIq::Item> items;
+
+    // the contacts by the version at which they last changed, including
+    // removed contacts, and the reverse lookup
+    QMap<qint64, QString> changes;
+    QHash<QString, qint64> changeVersions;
+};
+
+class QXmppRosterServicePrivate
+{
+public:
+    QXmppRosterServicePrivate(QXmppRosterService *qq);
+
+    void change(const QString &bareJid, const QXmppRosterIq::Item &item);
+    QString versionString(qint64 version) const;
+    void push(const QString &bareJid, const QString &to, const QString &contactJid, qint64 version);
+
+    void handleGet(const QDomElement &element);
+    void handleSet(const QDomElement &element);
+    void sendError(const QDomElement &element, QXmppStanza::Error::Type type, QXmppStanza::Error::Condition condition);
+
+    QHash<QString, QXmppRosterServiceUser> users;
+
+    // versions only count changes since the service started, so they are
+    // prefixed with an epoch which differs on each start
+    QString epoch;
+
+private:
+    QXmppRosterService *q;
+};
+
+QXmppRosterServicePrivate::QXmppRosterServicePrivate(QXmppRosterService *qq)
+    : epoch(QXmppUtils::generateStanzaHash(8)),
+    q(qq)
+{
+}
+
+/// Stores a new or removed \a item in the roster of \a bareJid, and
+/// pushes it to the user's connected resources.
+
+void QXmppRosterServicePrivate::change(const QString &bareJid, const QXmppRosterIq::Item &item)
+{
+    QXmppRosterServiceUser &user = users[bareJid];
+    const QString contactJid = item.bareJid();
+    if (item.subscriptionType() == QXmppRosterIq::Item::Remove)
+        user.items.remove(contactJid);
+    else
+        user.items.insert(contactJid, item);
+
+    // keep a single change per contact
+    const qint64 version = ++user.version;
+    if (user.changeVersions.contains(contactJid))
+        user.changes.remove(user.changeVersions.value(contactJid));
+    user.changes.insert(version, contactJid);
+    user.changeVersions.insert(contactJid, version);
+
+    if (q->server())
+        push(bareJid, bareJid, contactJid, version);
+}
+
+/// Returns the roster version string for \a version in the current epoch.
+
+QString QXmppRosterServicePrivate::versionString(qint64 version) const
+{
+    return epoch + QLatin1Char('-') + QString::number(version);
+}
+
+/// Sends a roster push for \a contactJid, as it was at \a version.
+
+void QXmppRosterServicePrivate::push(const QString &bareJid, const QString &to, const QString &contactJid, qint64 version)
+{
+    const QXmppRosterServiceUser &user = users[bareJid];
+
+    QXmppRosterIq::Item item;
+    if (user.items.contains(contactJid)) {
+        item = user.items.value(contactJid);
+    } else {
+        item.setBareJid(contactJid);
+        item.setSubscriptionType(QXmppRosterIq::Item::Remove);
+    }
+
+    QXmppRosterIq iq;
+    iq.setType(QXmppIq::Set);
+    iq.setTo(to);
+    iq.setVersion(versionString(version));
+    iq.addItem(item);
+    q->server()->sendPacket(iq);
+}
+
+void QXmppRosterServicePrivate::handleGet(const QDomElement &element)
+{
+    QXmppRosterIq request;
+    request.parse(element);
+
+    const QString from = element.attribute("from");
+    const QString bareJid = QXmppUtils::jidToBareJid(from);
+    const QXmppRosterServiceUser user = users.value(bareJid);
+
+    // send the changes since a version of the current epoch as roster
+    // pushes, a version from an earlier epoch gets the full roster
+    bool ok = false;
+    qint64 known = -1;
+    const QString prefix = epoch + QLatin1Char('-');
+    if (request.version().startsWith(prefix))
+        known = request.version().mid(prefix.size()).toLongLong(&ok);
+    if (ok && known >= 0 && known <= user.version) {
+        QXmppIq response(QXmppIq::Result);
+        response.setId(request.id());
+        response.setFrom(element.attribute("to"));
+        response.setTo(from);
+        q->server()->sendPacket(response);
+
+        for (QMap<qint64, QString>::const_iterator it = user.changes.upperBound(known);
+             it != user.changes.constEnd(); ++it)
+            push(bareJid, from, it.value(), it.key());
+        return;
+    }
+
+    QXmppRosterIq response;
+    response.setType(QXmppIq::Result);
+    response.setId(request.id());
+    response.setFrom(element.attribute("to"));
+    response.setTo(from);
+    if (!request.version().isNull())
+        response.setVersion(versionString(user.version));
+    foreach (const QXmppRosterIq::Item &item, user.items)
+        response.addItem(item);
+    q->server()->sendPacket(response);
+}
+
+void QXmppRosterServicePrivate::handleSet(const QDomElement &element)
+{
+    QXmppRosterIq request;
+    request.parse(element);
+
+    const QString bareJid = QXmppUtils::jidToBareJid(element.attribute("from"));
+    const QList<QXmppRosterIq::Item> requestItems = request.items();
+    if (requestItems.size() != 1 || requestItems.first().bareJid().isEmpty() ||
+        requestItems.first().bareJid() == bareJid) {
+        sendError(element, QXmppStanza::Error::Modify, QXmppStanza::Error::BadRequest);
+        return;
+    }
+
+    QXmppRosterIq::Item item = requestItems.first();
+    const QXmppRosterServiceUser &user = users[bareJid];
+    if (item.subscriptionType() == QXmppRosterIq::Item::Remove) {
+        if (!user.items.contains(item.bareJid())) {
+            sendError(element, QXmppStanza::Error::Cancel, QXmppStanza::Error::ItemNotFound);
+            return;
+        }
+    } else {
+        // clients cannot change subscriptions with a roster set
+        const QXmppRosterIq::Item existing = user.items.value(item.bareJid());
+        item.setSubscriptionType(user.items.contains(item.bareJid()) ? existing.subscriptionType() : QXmppRosterIq::Item::None);
+        item.setSubscriptionStatus(existing.subscriptionStatus());
+    }
+
+    QXmppIq response(QXmppIq::Result);
+    response.setId(request.id());
+    response.setFrom(element.attribute("to"));
+    response.setTo(element.attribute("from"));
+    q->server()->sendPacket(response);
+
+    change(bareJid, item);
+}
+
+void QXmppRosterServicePrivate::sendError(const QDomElement &element, QXmppStanza::Error::Type type, QXmppStanza::Error::Condition condition)
+{
+    QXmppIq response(QXmppIq::Error);
+    response.setId(element.attribute("id"));
+    response.setFrom(element.attribute("to"));
+    response.setTo(element.attribute("from"));
+    response.setError(QXmppStanza::Error(type, condition));
+    q->server()->sendPacket(response);
+}
+
+/// Constructs a new roster service.
+
+QXmppRosterService::QXmppRosterService()
+{
+    d = new QXmppRosterServicePrivate(this);
+}
+
+/// Destroys a roster service.
+
+QXmppRosterService::~QXmppRosterService()
+{
+    delete d;
+}
+
+/// Returns the roster items of the given user.
+///
+/// \param bareJid
+
+QList<QXmppRosterIq::Item> QXmppRosterService::items(const QString &bareJid) const
+{
+    return d->users.value(bareJid).items.values();
+}
+
+/// Returns the roster version of the given user.
+///
+/// \param bareJid
+
+QString QXmppRosterService::version(const QString &bareJid) const
+{
+    return d->versionString(d->users.value(bareJid).version);
+}
+
+/// Adds or updates an item in the roster of the given user, and pushes
+/// it to the user's connected resources.
+///
+/// \param bareJid
+/// \param item
+
+void QXmppRosterService::setItem(const QString &bareJid, const QXmppRosterIq::Item &item)
+{
+    QXmppRosterIq::Item stored = item;
+    if (stored.subscriptionType() == QXmppRosterIq::Item::NotSet)
+        stored.setSubscriptionType(QXmppRosterIq::Item::None);
+    d->change(bareJid, stored);
+}
+
+/// Removes an item from the roster of the given user, and pushes the
+/// removal to the user's connected resources.
+///
+/// \param bareJid
+/// \param contactJid
+
+void QXmppRosterService::removeItem(const QString &bareJid, const QString &contactJid)
+{
+    if (!d->users.value(bareJid).items.contains(contactJid))
+        return;
+
+    QXmppRosterIq::Item item;
+    item.setBareJid(contactJid);
+    item.setSubscriptionType(QXmppRosterIq::Item::Remove);
+    d->change(bareJid, item);
+}
+
+/// \cond
+bool QXmppRosterService::handleStanza(const QDomElement &element)
+{
+    if (element.tagName() != QLatin1String("iq") || !QXmppRosterIq::isRosterIq(element))
+        return false;
+
+    // only answer local users about their own roster
+    const QString from = element.attribute("from");
+    const QString to = element.attribute("to");
+    const QString domain = QXmppUtils::jidToDomain(from);
+    if (!server()->domains().contains(domain) || QXmppUtils::jidToUser(from).isEmpty() ||
+        (to != domain && to != QXmppUtils::jidToBareJid(from)))
+        return false;
+
+    const QString type = element.attribute("type");
+    if (type == QLatin1String("get")) {
+        d->handleGet(element);
+        return true;
+    } else if (type == QLatin1String("set")) {
+        d->handleSet(element);
+        return true;
+    }
+    return false;
+}
+
+QSet<QString> QXmppRosterService::presenceSubscribers(const QString &jid)
+{
+    QSet<QString> subscribers;
+    foreach (const QXmppRosterIq::Item &item, d->users.value(QXmppUtils::jidToBareJid(jid)).items) {
+        if (item.subscriptionType() == QXmppRosterIq::Item::From ||
+            item.subscriptionType() == QXmppRosterIq::Item::Both)
+            subscribers << item.bareJid();
+    }
+    return subscribers;
+}
+
+QSet<QString> QXmppRosterService::presenceSubscriptions(const QString &jid)
+{
+    QSet<QString> subscriptions;
+    foreach (const QXmppRosterIq::Item &item, d->users.value(QXmppUtils::jidToBareJid(jid)).items) {
+        if (item.subscriptionType() == QXmppRosterIq::Item::To ||
+            item.subscriptionType() == QXmppRosterIq::Item::Both)
+            subscriptions << item.bareJid();
+    }
+    return subscriptions;
+}
+/// \endcond
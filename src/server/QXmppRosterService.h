@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#ifndef QXMPPROSTERSERVICE_H
+#define QXMPPROSTERSERVICE_H
+
+#include "QXmppRosterIq.h"
+#include "QXmppServerExtension.h"
+
+class QXmppRosterServicePrivate;
+
+/// \brief The QXmppRosterService class is a server extension which stores
+/// the rosters of local users and supports XEP-0237: Roster Versioning.
+///
+/// Each change to a roster bumps its version. A client which presents the
+/// version it has cached receives an empty result followed by a roster
+/// push for each item which changed since, instead of the full roster.
+/// Versions are prefixed with an epoch which changes each time the service
+/// is created, so a version cached before a restart gets the full roster.
+///
+/// Rosters are kept in memory, use setItem() and removeItem() to
+/// provision them.
+///
+/// \ingroup Core
+
+class QXMPP_EXPORT QXmppRosterService : public QXmppServerExtension
+{
+    Q_OBJECT
+    Q_CLASSINFO("ExtensionName", "roster");
+
+public:
+    QXmppRosterService();
+    ~QXmppRosterService();
+
+    QList<QXmppRosterIq::Item> items(const QString &bareJid) const;
+    QString version(const QString &bareJid) const;
+
+    void setItem(const QString &bareJid, const QXmppRosterIq::Item &item);
+    void removeItem(const QString &bareJid, const QString &contactJid);
+
+    /// \cond
+    bool handleStanza(const QDomElement &element);
+    QSet<QString> presenceSubscribers(const QString &jid);
+    QSet<QString> presenceSubscriptions(const QString &jid);
+    /// \endcond
+
+private:
+    friend class QXmppRosterServicePrivate;
+    QXmppRosterServicePrivate *d;
+};
+
+#endif
@@ -22,25 +22,103 @@
  */
 
 #include <QCoreApplication>
+#include <QCryptographicHash>
 #include <QDomElement>
 #include <QFileInfo>
 #include <QPluginLoader>
 #include <QSslCertificate>
 #include <QSslKey>
 #include <QSslSocket>
+#include <QTimer>
 
+#include "QXmppCluster.h"
 #include "QXmppConstants.h"
 #include "QXmppDialback.h"
 #include "QXmppIq.h"
 #include "QXmppIncomingClient.h"
+#include "QXmppIncomingComponent.h"
 #include "QXmppIncomingServer.h"
 #include "QXmppOutgoingServer.h"
 #include "QXmppPresence.h"
+#include "QXmppRosterService.h"
 #include "QXmppServer.h"
 #include "QXmppServerExtension.h"
 #include "QXmppServerPlugin.h"
+#include "QXmppTracer.h"
 #include "QXmppUtils.h"
 
+static const int webSocketRequestLimit = 8192;
+
+/// Answers a WebSocket opening handshake for the "xmpp" sub-protocol.
+///
+/// Returns an empty array if \a request is not a valid handshake, and an
+/// "Upgrade Required" response if it asks for a version other than 13.
+
+static QByteArray webSocketHandshake(const QByteArray &request)
+{
+    const QList<QByteArray> lines = request.split('\n');
+    if (lines.isEmpty() || !lines.first().startsWith("GET "))
+        return QByteArray();
+
+    QByteArray key;
+    QByteArray version;
+    bool upgrade = false;
+    bool xmpp = false;
+    for (int i = 1; i < lines.size(); ++i) {
+        const int colon = lines[i].indexOf(':');
+        if (colon < 0)
+            continue;
+        const QByteArray name = lines[i].left(colon).trimmed().toLower();
+        const QByteArray value = lines[i].mid(colon + 1).trimmed();
+        if (name == "upgrade")
+            upgrade = value.toLower() == "websocket";
+        else if (name == "sec-websocket-key")
+            key = value;
+        else if (name == "sec-websocket-version")
+            version = value;
+        else if (name == "sec-websocket-protocol")
+            foreach (const QByteArray &protocol, value.split(','))
+                xmpp = xmpp || protocol.trimmed() == "xmpp";
+    }
+    if (!upgrade || !xmpp || key.isEmpty())
+        return QByteArray();
+    if (version != "13")
+        return "HTTP/1.1 426 Upgrade Required\r\n"
+               "Sec-WebSocket-Version: 13\r\n"
+               "Connection: close\r\n"
+               "Content-Length: 0\r\n"
+               "\r\n";
+
+    const QByteArray accept = QCryptographicHash::hash(
+        key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11",
+        QCryptographicHash::Sha1).toBase64();
+    return "HTTP/1.1 101 Switching Protocols\r\n"
+           "Upgrade: websocket\r\n"
+           "Connection: Upgrade\r\n"
+           "Sec-WebSocket-Accept: " + accept + "\r\n"
+           "Sec-WebSocket-Protocol: xmpp\r\n"
+           "\r\n";
+}
+
+/// Returns true if the address belongs to the loopback network, including
+/// IPv4 loopback addresses mapped to IPv6.
+
+static bool isLoopbackAddress(const QHostAddress &address)
+{
+    if (address.protocol() == QAbstractSocket::IPv4Protocol)
+        return (address.toIPv4Address() >> 24) == 127;
+    if (address == QHostAddress(QHostAddress::LocalHostIPv6))
+        return true;
+
+    // ::ffff:127.x.y.z
+    const Q_IPV6ADDR ip6 = address.toIPv6Address();
+    for (int i = 0; i < 10; ++i) {
+        if (ip6[i])
+            return false;
+    }
+    return ip6[10] == 0xff && ip6[11] == 0xff && ip6[12] == 127;
+}
+
 static void helperToXmlAddDomElement(QXmlStreamWriter* stream, const QDomElement& element, const QStringList &omitNamespaces)
 {
     stream->writeStartElement(element.tagName());
@@ -71,33 +149,87 @@ static void helperToXmlAddDomElement(QXmlStreamWriter* stream, const QDomElement
     stream->writeEndElement();
 }
 
+/// A domain hosted by the server, with its own settings and client
+/// routing tables.
+
+class QXmppServerHost
+{
+public:
+    QXmppServerHost() : passwordChecker(0), rosterVersioning(false) {}
+
+    QList<QXmppServerExtension*> extensions;
+    QXmppPasswordChecker *passwordChecker;
+    bool rosterVersioning;
+    QSslCertificate localCertificate;
+    QSslKey privateKey;
+
+    // client-to-server routing tables
+    QHash<QString, QXmppIncomingClient*> incomingClientsByJid;
+    QHash<QString, QSet<QXmppIncomingClient*> > incomingClientsByBareJid;
+};
+
 class QXmppServerPrivate
 {
 public:
     QXmppServerPrivate(QXmppServer *qq);
+    ~QXmppServerPrivate();
+    QXmppOutgoingServer *connectToServer(const QString &remoteDomain, const QString &localDomain);
+    QXmppOutgoingServer *outgoingServer(const QString &remoteDomain, const QString &localDomain);
+    QList<QXmppIncomingClient*> findClients(QXmppServerHost *host, const QString &to) const;
+    QXmppIncomingComponent *findComponent(const QString &domain) const;
+    QXmppServerHost *host(const QString &domain) const;
+    QString hostedDomain(const QString &domain) const;
+    QStringList localDomains() const;
+    void updateLocalDomains();
+    void handleStanza(const QDomElement &element);
     void loadExtensions(QXmppServer *server);
-    bool routeData(const QString &to, const QByteArray &data);
+    void rebuildExtensions();
+    bool routeData(const QString &to, const QByteArray &data, const QString &from = QString());
     void startExtensions();
     void stopExtensions();
 
+    QSslCertificate readCertificate(const QString &path);
+    QSslKey readPrivateKey(const QString &path);
+
     void info(const QString &message);
     void warning(const QString &message);
 
     QString domain;
     QList<QXmppServerExtension*> extensions;
+    QHash<QXmppServerExtension*, QString> extensionDomains;
     QXmppLogger *logger;
     QXmppPasswordChecker *passwordChecker;
+    QXmppCluster *cluster;
+
+    // client rate limits
+    int clientByteRate;
+    int clientStanzaRate;
+    int clientCompactTimeout;
+
+    // hosted domains
+    QHash<QString, QXmppServerHost*> hosts;
 
     // client-to-server
     QSet<QXmppIncomingClient*> incomingClients;
-    QHash<QString, QXmppIncomingClient*> incomingClientsByJid;
-    QHash<QString, QSet<QXmppIncomingClient*> > incomingClientsByBareJid;
     QSet<QXmppSslServer*> serversForClients;
 
+    // components
+    QHash<QString, QString> componentSecrets;
+    bool loopbackComponentPlainText;
+    QSet<QXmppIncomingComponent*> incomingComponents;
+    QHash<QString, QXmppIncomingComponent*> incomingComponentsByDomain;
+    QSet<QXmppSslServer*> serversForComponents;
+
     // server-to-server
     QSet<QXmppIncomingServer*> incomingServers;
     QSet<QXmppOutgoingServer*> outgoingServers;
+    QHash<QString, QXmppOutgoingServer*> outgoingServersByDomain;
+    QHash<QPair<QString, QString>, QXmppOutgoingServer*> refusedOutgoingServers;
     QSet<QXmppSslServer*> serversForServers;
+    int outgoingServerIdleTimeout;
+    int outgoingServerQueueLimit;
+    QStringList warmDomains;
+    QTimer *warmTimer;
 
     // ssl
     QList<QSslCertificate> caCertificates;
@@ -113,75 +245,203 @@ private:
 QXmppServerPrivate::QXmppServerPrivate(QXmppServer *qq)
     : logger(0),
     passwordChecker(0),
+    cluster(0),
+    clientByteRate(0),
+    clientStanzaRate(0),
+    clientCompactTimeout(30),
+    loopbackComponentPlainText(true),
+    outgoingServerIdleTimeout(0),
+    outgoingServerQueueLimit(1024 * 1024),
+    warmTimer(0),
     loaded(false),
     started(false),
     q(qq)
 {
 }
 
+QXmppServerPrivate::~QXmppServerPrivate()
+{
+    qDeleteAll(hosts);
+}
+
+/// Returns the hosted domain \a domain belongs to, or 0 if it is not
+/// local.
+///
+/// \param domain
+
+QXmppServerHost *QXmppServerPrivate::host(const QString &domain) const
+{
+    return hosts.value(hostedDomain(domain));
+}
+
+/// Returns the hosted domain which \a domain is equal to or is a
+/// sub-domain of, or an empty string if \a domain is not local.
+///
+/// \param domain
+
+QString QXmppServerPrivate::hostedDomain(const QString &domain) const
+{
+    if (hosts.contains(domain))
+        return domain;
+
+    int dot = domain.indexOf(QLatin1Char('.'));
+    while (dot >= 0) {
+        const QString parent = domain.mid(dot + 1);
+        if (hosts.contains(parent))
+            return parent;
+        dot = domain.indexOf(QLatin1Char('.'), dot + 1);
+    }
+    return QString();
+}
+
+/// Returns the domains which remote servers may authorize using dialback:
+/// the hosted domains, the external component domains and the service
+/// domains of the extensions.
+
+QStringList QXmppServerPrivate::localDomains() const
+{
+    QStringList domains = q->domains();
+    foreach (const QString &component, componentSecrets.keys()) {
+        if (!domains.contains(component))
+            domains << component;
+    }
+    foreach (QXmppServerExtension *extension, extensions) {
+        foreach (const QString &item, extension->discoveryItems()) {
+            if (!item.contains(QLatin1Char('@')) && !hostedDomain(item).isEmpty() && !domains.contains(item))
+                domains << item;
+        }
+    }
+    return domains;
+}
+
+/// Lets the incoming server streams accept dialback for the current
+/// local domains.
+
+void QXmppServerPrivate::updateLocalDomains()
+{
+    const QStringList domains = localDomains();
+    foreach (QXmppIncomingServer *stream, incomingServers)
+        stream->setLocalDomains(domains);
+}
+
+/// Rebuilds the list of extensions for each hosted domain, keeping them
+/// sorted by priority.
+
+void QXmppServerPrivate::rebuildExtensions()
+{
+    foreach (const QString &hostDomain, hosts.keys()) {
+        QXmppServerHost *host = hosts.value(hostDomain);
+        host->extensions.clear();
+        host->rosterVersioning = false;
+        foreach (QXmppServerExtension *extension, extensions) {
+            const QString extensionDomain = extensionDomains.value(extension);
+            if (extensionDomain.isEmpty() || extensionDomain == hostDomain) {
+                host->extensions << extension;
+                if (qobject_cast<QXmppRosterService*>(extension))
+                    host->rosterVersioning = true;
+            }
+        }
+    }
+}
+
+/// Returns the local client connections for the given recipient.
+///
+/// \param host
+/// \param to
+
+QList<QXmppIncomingClient*> QXmppServerPrivate::findClients(QXmppServerHost *host, const QString &to) const
+{
+    QList<QXmppIncomingClient*> found;
+    if (QXmppUtils::jidToResource(to).isEmpty()) {
+        foreach (QXmppIncomingClient *conn, host->incomingClientsByBareJid.value(to))
+            found << conn;
+    } else {
+        QXmppIncomingClient *conn = host->incomingClientsByJid.value(to);
+        if (conn)
+            found << conn;
+    }
+    return found;
+}
+
+/// Returns the authenticated component owning \a domain, or 0 if there
+/// is none.
+///
+/// \param domain
+
+QXmppIncomingComponent *QXmppServerPrivate::findComponent(const QString &domain) const
+{
+    if (incomingComponentsByDomain.isEmpty())
+        return 0;
+
+    QXmppIncomingComponent *component = incomingComponentsByDomain.value(domain);
+    int dot = domain.indexOf(QLatin1Char('.'));
+    while (!component && dot >= 0) {
+        component = incomingComponentsByDomain.value(domain.mid(dot + 1));
+        dot = domain.indexOf(QLatin1Char('.'), dot + 1);
+    }
+    return component;
+}
+
 /// Routes XMPP data to the given recipient.
 ///
 /// \param to
 /// \param data
+/// \param from
 ///
 
-bool QXmppServerPrivate::routeData(const QString &to, const QByteArray &data)
+bool QXmppServerPrivate::routeData(const QString &to, const QByteArray &data, const QString &from)
 {
-    // refuse to route packets to empty destination, own domain or sub-domains
-    const QString toDomain = QXmppUtils::jidToDomain(to);
-    if (to.isEmpty() || to == domain || toDomain.endsWith("." + domain))
+    // refuse to route packets to empty destination
+    if (to.isEmpty())
         return false;
+    QXmppTracer::trace(QXmppTracer::RouteStage);
 
-    if (toDomain == domain) {
+    // a single lookup finds the routing tables for the recipient's domain
+    const QString toDomain = QXmppUtils::jidToDomain(to);
+    QXmppServerHost *toHost = hosts.value(toDomain);
+    QXmppIncomingComponent *toComponent = toHost ? 0 : findComponent(toDomain);
+
+    if (toComponent) {
+
+        // the component handles all the addresses of its domain
+        QMetaObject::invokeMethod(toComponent, "sendData", Q_ARG(QByteArray, data));
+        return true;
+
+    } else if (toHost) {
+
+        // refuse to route packets to our own domain
+        if (to == toDomain)
+            return false;
 
         // look for a client connection
-        QList<QXmppIncomingClient*> found;
-        if (QXmppUtils::jidToResource(to).isEmpty()) {
-            foreach (QXmppIncomingClient *conn, incomingClientsByBareJid.value(to))
-                found << conn;
-        } else {
-            QXmppIncomingClient *conn = incomingClientsByJid.value(to);
-            if (conn)
-                found << conn;
-        }
+        const QList<QXmppIncomingClient*> found = findClients(toHost, to);
 
         // send data
         foreach (QXmppStream *conn, found)
             QMetaObject::invokeMethod(conn, "sendData", Q_ARG(QByteArray, data));
-        return !found.isEmpty();
 
-    } else if (!serversForServers.isEmpty()) {
+        // forward data to the cluster nodes holding other sessions
+        const bool forwarded = cluster && cluster->sendData(to, data);
+        return !found.isEmpty() || forwarded;
 
-        bool check;
-        Q_UNUSED(check);
+    } else if (!hostedDomain(toDomain).isEmpty()) {
 
-        // look for an outgoing S2S connection
-        foreach (QXmppOutgoingServer *conn, outgoingServers) {
-            if (conn->remoteDomain() == toDomain) {
-                // send or queue data
-                QMetaObject::invokeMethod(conn, "queueData", Q_ARG(QByteArray, data));
-                return true;
-            }
-        }
+        // refuse to route packets to our sub-domains
+        return false;
 
-        // if we did not find an outgoing server,
+    } else if (!serversForServers.isEmpty()) {
+
+        // stanzas from any of our domains or their sub-domains share
+        // the stream using dialback piggybacking
+        const QString fromDomain = QXmppUtils::jidToDomain(from);
+        const QString localDomain = hostedDomain(fromDomain).isEmpty() ? domain : fromDomain;
+
+        // look for an outgoing S2S connection, if we did not find one
         // we need to establish the S2S connection
-        QXmppOutgoingServer *conn = new QXmppOutgoingServer(domain, 0);
-        conn->setLocalStreamKey(QXmppUtils::generateStanzaHash().toLatin1());
-        conn->moveToThread(q->thread());
-        conn->setParent(q);
-
-        check = QObject::connect(conn, SIGNAL(disconnected()),
-                                 q, SLOT(_q_outgoingServerDisconnected()));
-        Q_UNUSED(check);
-
-        // add stream
-        outgoingServers.insert(conn);
-        q->setGauge("outgoing-server.count", outgoingServers.size());
-
-        // queue data and connect to remote server
-        QMetaObject::invokeMethod(conn, "queueData", Q_ARG(QByteArray, data));
-        QMetaObject::invokeMethod(conn, "connectToHost", Q_ARG(QString, toDomain));
+        QXmppOutgoingServer *conn = outgoingServer(toDomain, localDomain);
+
+        // send or queue data
+        QMetaObject::invokeMethod(conn, "queueData", Q_ARG(QByteArray, data), Q_ARG(QString, localDomain));
         return true;
 
     } else {
@@ -192,23 +452,98 @@ bool QXmppServerPrivate::routeData(const QString &to, const QByteArray &data)
     }
 }
 
+/// Establishes an outgoing S2S connection to the given domain.
+///
+/// \param remoteDomain
+/// \param localDomain
+
+QXmppOutgoingServer *QXmppServerPrivate::connectToServer(const QString &remoteDomain, const QString &localDomain)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    QXmppOutgoingServer *conn = new QXmppOutgoingServer(localDomain, 0);
+    conn->setLocalStreamKey(QXmppUtils::generateStanzaHash().toLatin1());
+    conn->setQueueLimit(outgoingServerQueueLimit);
+    if (!warmDomains.contains(remoteDomain))
+        conn->setIdleTimeout(outgoingServerIdleTimeout);
+    conn->moveToThread(q->thread());
+    conn->setParent(q);
+
+    check = QObject::connect(conn, SIGNAL(connected()),
+                             q, SLOT(_q_outgoingServerConnected()));
+    Q_ASSERT(check);
+
+    check = QObject::connect(conn, SIGNAL(disconnected()),
+                             q, SLOT(_q_outgoingServerDisconnected()));
+    Q_ASSERT(check);
+
+    check = QObject::connect(conn, SIGNAL(stanzaBounced(QDomElement)),
+                             q, SLOT(handleElement(QDomElement)));
+    Q_ASSERT(check);
+
+    check = QObject::connect(conn, SIGNAL(domainRefused(QString,QList<QByteArray>)),
+                             q, SLOT(_q_outgoingServerDomainRefused(QString,QList<QByteArray>)));
+    Q_ASSERT(check);
+
+    // add stream, a second stream to the same domain carries a local
+    // domain which was refused over the first one
+    outgoingServers.insert(conn);
+    if (outgoingServersByDomain.contains(remoteDomain))
+        refusedOutgoingServers.insert(qMakePair(remoteDomain, localDomain), conn);
+    else
+        outgoingServersByDomain.insert(remoteDomain, conn);
+    q->setGauge("outgoing-server.count", outgoingServers.size());
+
+    // connect to remote server
+    QMetaObject::invokeMethod(conn, "connectToHost", Q_ARG(QString, remoteDomain));
+    return conn;
+}
+
+/// Returns the outgoing S2S connection which carries data from
+/// \a localDomain to \a remoteDomain, establishing it if needed.
+///
+/// Local domains share a single stream to each remote domain, except
+/// those the remote server refused to piggyback which get a stream of
+/// their own.
+///
+/// \param remoteDomain
+/// \param localDomain
+
+QXmppOutgoingServer *QXmppServerPrivate::outgoingServer(const QString &remoteDomain, const QString &localDomain)
+{
+    QXmppOutgoingServer *conn = outgoingServersByDomain.value(remoteDomain);
+    if (conn && conn->isDomainRefused(localDomain))
+        conn = refusedOutgoingServers.value(qMakePair(remoteDomain, localDomain));
+    if (!conn)
+        conn = connectToServer(remoteDomain, localDomain);
+    return conn;
+}
+
 /// Handles an incoming XML element.
 ///
-/// \param server
-/// \param stream
 /// \param element
 
-static void handleStanza(QXmppServer *server, const QDomElement &element)
+void QXmppServerPrivate::handleStanza(const QDomElement &element)
 {
-    // try extensions
-    foreach (QXmppServerExtension *extension, server->extensions())
+    QXmppTracer::trace(QXmppTracer::DispatchStage);
+    const QString to = element.attribute("to");
+
+    // try the extensions of the recipient's domain, or the sender's
+    QXmppServerHost *extensionHost = host(QXmppUtils::jidToDomain(to));
+    if (!extensionHost)
+        extensionHost = host(QXmppUtils::jidToDomain(element.attribute("from")));
+    loadExtensions(q);
+    foreach (QXmppServerExtension *extension, extensionHost ? extensionHost->extensions : extensions) {
+        if (!extensionHost && !extensionDomains.value(extension).isEmpty())
+            continue;
         if (extension->handleStanza(element))
             return;
+    }
+    QXmppTracer::trace(QXmppTracer::ExtensionStage);
 
     // default handlers
-    const QString domain = server->domain();
-    const QString to = element.attribute("to");
-    if (to == domain) {
+    if (hosts.contains(to)) {
         if (element.tagName() == QLatin1String("iq")) {
             // we do not support the given IQ
             QXmppIq request;
@@ -217,19 +552,19 @@ static void handleStanza(QXmppServer *server, const QDomElement &element)
             if (request.type() != QXmppIq::Error && request.type() != QXmppIq::Result) {
                 QXmppIq response(QXmppIq::Error);
                 response.setId(request.id());
-                response.setFrom(domain);
+                response.setFrom(to);
                 response.setTo(request.from());
                 QXmppStanza::Error error(QXmppStanza::Error::Cancel,
                     QXmppStanza::Error::FeatureNotImplemented);
                 response.setError(error);
-                server->sendPacket(response);
+                q->sendPacket(response);
             }
         }
 
     } else {
 
         // route element or reply on behalf of missing peer
-        if (!server->sendElement(element) && element.tagName() == QLatin1String("iq")) {
+        if (!q->sendElement(element) && element.tagName() == QLatin1String("iq")) {
             QXmppIq request;
             request.parse(element);
 
@@ -240,11 +575,45 @@ static void handleStanza(QXmppServer *server, const QDomElement &element)
             QXmppStanza::Error error(QXmppStanza::Error::Cancel,
                 QXmppStanza::Error::ServiceUnavailable);
             response.setError(error);
-            server->sendPacket(response);
+            q->sendPacket(response);
         }
     }
 }
 
+/// Reads an SSL certificate from the given path.
+///
+/// \param path
+
+QSslCertificate QXmppServerPrivate::readCertificate(const QString &path)
+{
+    QFile file(path);
+    if (path.isEmpty()) {
+        return QSslCertificate();
+    } else if (file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        return QSslCertificate(file.readAll());
+    } else {
+        warning(QString("SSL certificate is not readable %1").arg(path));
+        return QSslCertificate();
+    }
+}
+
+/// Reads an SSL private key from the given path.
+///
+/// \param path
+
+QSslKey QXmppServerPrivate::readPrivateKey(const QString &path)
+{
+    QFile file(path);
+    if (path.isEmpty()) {
+        return QSslKey();
+    } else if (file.open(QIODevice::ReadOnly)) {
+        return QSslKey(file.readAll(), QSsl::Rsa);
+    } else {
+        warning(QString("SSL key is not readable %1").arg(path));
+        return QSslKey();
+    }
+}
+
 void QXmppServerPrivate::info(const QString &message)
 {
     if (logger)
@@ -323,25 +692,41 @@ QXmppServer::~QXmppServer()
 
 /// Registers a new extension with the server.
 ///
+/// The extension handles stanzas for all the hosted domains.
+///
 /// \param extension
 
 void QXmppServer::addExtension(QXmppServerExtension *extension)
+{
+    addExtension(extension, QString());
+}
+
+/// Registers a new extension with the server, which only handles
+/// stanzas for the given hosted \a domain.
+///
+/// \param extension
+/// \param domain
+
+void QXmppServer::addExtension(QXmppServerExtension *extension, const QString &domain)
 {
     if (!extension || d->extensions.contains(extension))
         return;
-    d->info(QString("Added extension %1").arg(extension->extensionName()));
+    if (domain.isEmpty())
+        d->info(QString("Added extension %1").arg(extension->extensionName()));
+    else
+        d->info(QString("Added extension %1 for %2").arg(extension->extensionName(), domain));
     extension->setParent(this);
     extension->setServer(this);
+    if (!domain.isEmpty())
+        d->extensionDomains.insert(extension, domain);
 
     // keep extensions sorted by priority
-    for (int i = 0; i < d->extensions.size(); ++i) {
-        QXmppServerExtension *other = d->extensions[i];
-        if (other->extensionPriority() < extension->extensionPriority()) {
-            d->extensions.insert(i, extension);
-            return;
-        }
-    }
-    d->extensions << extension;
+    int i = 0;
+    while (i < d->extensions.size() &&
+           d->extensions[i]->extensionPriority() >= extension->extensionPriority())
+        ++i;
+    d->extensions.insert(i, extension);
+    d->rebuildExtensions();
 }
 
 /// Returns the list of loaded extensions.
@@ -353,7 +738,7 @@ QList<QXmppServerExtension*> QXmppServer::extensions()
     return d->extensions;
 }
 
-/// Returns the server's domain.
+/// Returns the server's primary domain.
 ///
 
 QString QXmppServer::domain() const
@@ -361,13 +746,71 @@ QString QXmppServer::domain() const
     return d->domain;
 }
 
-/// Sets the server's domain.
+/// Sets the server's primary domain.
+///
+/// The primary domain is used for incoming streams which have not yet
+/// requested a domain, and for outgoing server streams.
 ///
 /// \param domain
 
 void QXmppServer::setDomain(const QString &domain)
 {
+    if (domain == d->domain)
+        return;
+
+    // rename the primary host, keeping its settings
+    QXmppServerHost *host = d->hosts.take(d->domain);
+    if (!domain.isEmpty()) {
+        if (d->hosts.contains(domain)) {
+            delete host;
+        } else {
+            d->hosts.insert(domain, host ? host : new QXmppServerHost);
+        }
+    } else {
+        delete host;
+    }
     d->domain = domain;
+    d->rebuildExtensions();
+}
+
+/// Returns the list of domains hosted by the server, starting with the
+/// primary domain.
+
+QStringList QXmppServer::domains() const
+{
+    QStringList domains;
+    if (!d->domain.isEmpty())
+        domains << d->domain;
+    foreach (const QString &domain, d->hosts.keys()) {
+        if (domain != d->domain)
+            domains << domain;
+    }
+    return domains;
+}
+
+/// Adds a domain hosted by the server.
+///
+/// Each hosted domain has its own routing tables, and can have its own
+/// password checker, SSL certificate and extensions. If no primary
+/// domain was set, \a domain becomes the primary domain.
+///
+/// \param domain
+
+void QXmppServer::addDomain(const QString &domain)
+{
+    if (domain.isEmpty() || d->hosts.contains(domain))
+        return;
+
+    if (d->domain.isEmpty()) {
+        setDomain(domain);
+    } else {
+        d->hosts.insert(domain, new QXmppServerHost);
+        d->rebuildExtensions();
+    }
+    d->info(QString("Hosting domain %1").arg(domain));
+
+    // let incoming server streams accept dialback for the new domain
+    d->updateLocalDomains();
 }
 
 /// Returns the QXmppLogger associated with the server.
@@ -404,37 +847,295 @@ void QXmppServer::setLogger(QXmppLogger *logger)
                     d->logger, SLOT(updateCounter(QString,qint64)));
         }
 
-        emit loggerChanged(d->logger);
-    }
+        emit loggerChanged(d->logger);
+    }
+}
+
+/// Returns the cluster this server is a node of, if any.
+///
+
+QXmppCluster *QXmppServer::cluster() const
+{
+    return d->cluster;
+}
+
+/// Makes this server a node of the given \a cluster.
+///
+/// The server advertises its client sessions to the other nodes, and
+/// stanzas for sessions held by other nodes are forwarded to them.
+///
+/// \param cluster
+
+void QXmppServer::setCluster(QXmppCluster *cluster)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    if (cluster == d->cluster)
+        return;
+
+    if (d->cluster) {
+        disconnect(d->cluster, SIGNAL(dataReceived(QString,QByteArray)),
+                   this, SLOT(_q_clusterDataReceived(QString,QByteArray)));
+        disconnect(d->cluster, SIGNAL(sessionReplaced(QString)),
+                   this, SLOT(_q_clusterSessionReplaced(QString)));
+        foreach (QXmppServerHost *host, d->hosts)
+            foreach (const QString &jid, host->incomingClientsByJid.keys())
+                d->cluster->removeSession(jid);
+    }
+
+    d->cluster = cluster;
+    if (d->cluster) {
+        check = connect(d->cluster, SIGNAL(dataReceived(QString,QByteArray)),
+                        this, SLOT(_q_clusterDataReceived(QString,QByteArray)));
+        Q_ASSERT(check);
+
+        check = connect(d->cluster, SIGNAL(sessionReplaced(QString)),
+                        this, SLOT(_q_clusterSessionReplaced(QString)));
+        Q_ASSERT(check);
+        foreach (QXmppServerHost *host, d->hosts)
+            foreach (const QString &jid, host->incomingClientsByJid.keys())
+                d->cluster->addSession(jid);
+    }
+}
+
+/// Allows an external component to connect for the given \a domain,
+/// authenticating with the given shared \a secret.
+///
+/// Once connected, the component receives all the stanzas addressed
+/// to its domain or any sub-domain of it.
+///
+/// \sa listenForComponents()
+///
+/// \param domain
+/// \param secret
+
+void QXmppServer::addComponent(const QString &domain, const QString &secret)
+{
+    d->componentSecrets.insert(domain, secret);
+    d->updateLocalDomains();
+}
+
+/// Returns true if components connecting from the loopback interface
+/// may use plain text.
+
+bool QXmppServer::isLoopbackComponentPlainTextAllowed() const
+{
+    return d->loopbackComponentPlainText;
+}
+
+/// Sets whether components connecting from the loopback interface may
+/// use plain text. If not, every component connection must use TLS from
+/// the start, which requires a local certificate.
+///
+/// The default is true.
+///
+/// \param allowed
+
+void QXmppServer::setLoopbackComponentPlainTextAllowed(bool allowed)
+{
+    d->loopbackComponentPlainText = allowed;
+}
+
+/// Returns the maximum number of bytes per second read from each client,
+/// or 0 if it is not limited.
+
+int QXmppServer::clientByteRateLimit() const
+{
+    return d->clientByteRate;
+}
+
+/// Sets the maximum number of bytes per second read from each client
+/// connection.
+///
+/// The limit applies to connections accepted afterwards.
+///
+/// \sa QXmppStream::setByteRateLimit()
+///
+/// \param bytesPerSecond
+
+void QXmppServer::setClientByteRateLimit(int bytesPerSecond)
+{
+    d->clientByteRate = qMax(0, bytesPerSecond);
+}
+
+/// Returns the maximum number of stanzas per second accepted from each
+/// client, or 0 if it is not limited.
+
+int QXmppServer::clientStanzaRateLimit() const
+{
+    return d->clientStanzaRate;
+}
+
+/// Sets the maximum number of stanzas per second accepted from each
+/// client connection.
+///
+/// The limit applies to connections accepted afterwards.
+///
+/// \sa QXmppStream::setStanzaRateLimit()
+///
+/// \param stanzasPerSecond
+
+void QXmppServer::setClientStanzaRateLimit(int stanzasPerSecond)
+{
+    d->clientStanzaRate = qMax(0, stanzasPerSecond);
+}
+
+/// Returns the number of seconds without traffic after which a client
+/// connection releases its buffers, or 0 if compaction is disabled.
+
+int QXmppServer::clientCompactTimeout() const
+{
+    return d->clientCompactTimeout;
+}
+
+/// Sets the number of seconds without traffic after which a client
+/// connection releases its buffers.
+///
+/// The default is 30 seconds, 0 disables compaction. The timeout applies
+/// to connections accepted afterwards.
+///
+/// \sa QXmppStream::setCompactTimeout()
+///
+/// \param secs
+
+void QXmppServer::setClientCompactTimeout(int secs)
+{
+    d->clientCompactTimeout = qMax(0, secs);
+}
+
+/// Returns the password checker used to verify client credentials.
+///
+
+QXmppPasswordChecker *QXmppServer::passwordChecker()
+{
+    return d->passwordChecker;
+}
+
+/// Returns the password checker used to verify client credentials for
+/// the given hosted \a domain, which is the default checker unless the
+/// domain has its own.
+///
+/// \param domain
+
+QXmppPasswordChecker *QXmppServer::passwordChecker(const QString &domain)
+{
+    QXmppServerHost *host = d->hosts.value(domain);
+    return (host && host->passwordChecker) ? host->passwordChecker : d->passwordChecker;
+}
+
+/// Sets the password checker used to verify client credentials.
+///
+/// This checker is used for hosted domains which do not have their own.
+///
+/// \param checker
+///
+
+void QXmppServer::setPasswordChecker(QXmppPasswordChecker *checker)
+{
+    d->passwordChecker = checker;
+}
+
+/// Sets the password checker used to verify client credentials for the
+/// given hosted \a domain.
+///
+/// \param checker
+/// \param domain
+
+void QXmppServer::setPasswordChecker(QXmppPasswordChecker *checker, const QString &domain)
+{
+    QXmppServerHost *host = d->hosts.value(domain);
+    if (host)
+        host->passwordChecker = checker;
+    else
+        d->warning(QString("Cannot set password checker, %1 is not hosted").arg(domain));
+}
+
+/// Returns the number of seconds after which an outgoing server stream
+/// which carried no data is closed, or 0 if such streams are kept open.
+
+int QXmppServer::outgoingServerIdleTimeout() const
+{
+    return d->outgoingServerIdleTimeout;
+}
+
+/// Sets the number of seconds after which an outgoing server stream
+/// which carried no data is closed. Streams to warm domains are never
+/// closed for inactivity.
+///
+/// A value of 0, the default, keeps streams open.
+///
+/// \param secs
+
+void QXmppServer::setOutgoingServerIdleTimeout(int secs)
+{
+    d->outgoingServerIdleTimeout = qMax(0, secs);
+}
+
+/// Returns the maximum number of bytes queued for an outgoing server
+/// stream while it is being established.
+
+int QXmppServer::outgoingServerQueueLimit() const
+{
+    return d->outgoingServerQueueLimit;
 }
 
-/// Returns the password checker used to verify client credentials.
+/// Sets the maximum number of bytes queued for an outgoing server
+/// stream while it is being established. Data exceeding this limit is
+/// dropped.
+///
+/// The default value is 1 MiB, a value of 0 leaves the queue unbounded.
 ///
+/// \param bytes
 
-QXmppPasswordChecker *QXmppServer::passwordChecker()
+void QXmppServer::setOutgoingServerQueueLimit(int bytes)
 {
-    return d->passwordChecker;
+    d->outgoingServerQueueLimit = qMax(0, bytes);
 }
 
-/// Sets the password checker used to verify client credentials.
-///
-/// \param checker
+/// Returns the remote domains to which outgoing server streams are
+/// established in advance and kept open.
+
+QStringList QXmppServer::warmDomains() const
+{
+    return d->warmDomains;
+}
+
+/// Sets the remote domains to which outgoing server streams are
+/// established as soon as the server listens for servers, and which are
+/// reconnected if they go down. This avoids paying for DNS, TCP, TLS and
+/// dialback when the first stanza for these domains is routed.
 ///
+/// \param domains
 
-void QXmppServer::setPasswordChecker(QXmppPasswordChecker *checker)
+void QXmppServer::setWarmDomains(const QStringList &domains)
 {
-    d->passwordChecker = checker;
+    d->warmDomains = domains;
+    if (!d->serversForServers.isEmpty())
+        _q_warmUpServers();
 }
 
 /// Returns the statistics for the server.
+///
+/// The "outgoing-server-setup-times" entry maps each remote domain to the
+/// number of milliseconds it took to establish the outgoing stream.
 
 QVariantMap QXmppServer::statistics() const
 {
+    QVariantMap setupTimes;
+    foreach (QXmppOutgoingServer *conn, d->outgoingServers) {
+        if (conn->setupTime() >= 0)
+            setupTimes[conn->remoteDomain()] = conn->setupTime();
+    }
+
     QVariantMap stats;
     stats["version"] = qApp->applicationVersion();
+    stats["domains"] = d->hosts.size();
     stats["incoming-clients"] = d->incomingClients.size();
+    stats["incoming-components"] = d->incomingComponents.size();
     stats["incoming-servers"] = d->incomingServers.size();
     stats["outgoing-servers"] = d->outgoingServers.size();
+    stats["outgoing-server-setup-times"] = setupTimes;
     return stats;
 }
 
@@ -455,7 +1156,7 @@ void QXmppServer::addCaCertificates(const QString &path)
     }
 
     // reconfigure servers
-    foreach (QXmppSslServer *server, d->serversForClients + d->serversForServers)
+    foreach (QXmppSslServer *server, d->serversForClients + d->serversForComponents + d->serversForServers)
         server->addCaCertificates(d->caCertificates);
 }
 
@@ -466,19 +1167,10 @@ void QXmppServer::addCaCertificates(const QString &path)
 void QXmppServer::setLocalCertificate(const QString &path)
 {
     // load certificate
-    QSslCertificate certificate;
-    QFile file(path);
-    if (path.isEmpty()) {
-        d->localCertificate = QSslCertificate();
-    } else if (file.open(QIODevice::ReadOnly | QIODevice::Text)) {
-        d->localCertificate = QSslCertificate(file.readAll());
-    } else {
-        d->warning(QString("SSL certificate is not readable %1").arg(path));
-        d->localCertificate = QSslCertificate();
-    }
+    d->localCertificate = d->readCertificate(path);
 
     // reconfigure servers
-    foreach (QXmppSslServer *server, d->serversForClients + d->serversForServers)
+    foreach (QXmppSslServer *server, d->serversForClients + d->serversForComponents + d->serversForServers)
         server->setLocalCertificate(d->localCertificate);
 }
 
@@ -489,22 +1181,43 @@ void QXmppServer::setLocalCertificate(const QString &path)
 void QXmppServer::setPrivateKey(const QString &path)
 {
     // load key
-    QSslKey key;
-    QFile file(path);
-    if (path.isEmpty()) {
-        d->privateKey = QSslKey();
-    } else if (file.open(QIODevice::ReadOnly)) {
-        d->privateKey = QSslKey(file.readAll(), QSsl::Rsa);
-    } else {
-        d->warning(QString("SSL key is not readable %1").arg(path));
-        d->privateKey = QSslKey();
-    }
+    d->privateKey = d->readPrivateKey(path);
 
     // reconfigure servers
-    foreach (QXmppSslServer *server, d->serversForClients + d->serversForServers)
+    foreach (QXmppSslServer *server, d->serversForClients + d->serversForComponents + d->serversForServers)
         server->setPrivateKey(d->privateKey);
 }
 
+/// Sets the path for the local SSL certificate presented to clients of
+/// the given hosted \a domain.
+///
+/// \param path
+/// \param domain
+
+void QXmppServer::setLocalCertificate(const QString &path, const QString &domain)
+{
+    QXmppServerHost *host = d->hosts.value(domain);
+    if (host)
+        host->localCertificate = d->readCertificate(path);
+    else
+        d->warning(QString("Cannot set SSL certificate, %1 is not hosted").arg(domain));
+}
+
+/// Sets the path for the local SSL private key used for clients of the
+/// given hosted \a domain.
+///
+/// \param path
+/// \param domain
+
+void QXmppServer::setPrivateKey(const QString &path, const QString &domain)
+{
+    QXmppServerHost *host = d->hosts.value(domain);
+    if (host)
+        host->privateKey = d->readPrivateKey(path);
+    else
+        d->warning(QString("Cannot set SSL key, %1 is not hosted").arg(domain));
+}
+
 /// Listen for incoming XMPP client connections.
 ///
 /// \param address
@@ -515,7 +1228,7 @@ bool QXmppServer::listenForClients(const QHostAddress &address, quint16 port)
     bool check;
     Q_UNUSED(check);
 
-    if (d->domain.isEmpty()) {
+    if (d->hosts.isEmpty()) {
         d->warning("No domain was specified!");
         return false;
     }
@@ -543,18 +1256,96 @@ bool QXmppServer::listenForClients(const QHostAddress &address, quint16 port)
     return true;
 }
 
+/// Listen for incoming connections from external components, as defined
+/// by XEP-0114: Jabber Component Protocol.
+///
+/// The component protocol has no TLS negotiation, so connections from
+/// the loopback interface are accepted in plain text while other
+/// connections must use TLS from the start, which requires a local
+/// certificate.
+///
+/// \sa setLoopbackComponentPlainTextAllowed()
+///
+/// \param address
+/// \param port
+
+bool QXmppServer::listenForComponents(const QHostAddress &address, quint16 port)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    // create new server
+    QXmppSslServer *server = new QXmppSslServer(this);
+    server->addCaCertificates(d->caCertificates);
+    server->setLocalCertificate(d->localCertificate);
+    server->setPrivateKey(d->privateKey);
+
+    check = connect(server, SIGNAL(newConnection(QSslSocket*)),
+                    this, SLOT(_q_componentConnection(QSslSocket*)));
+    Q_ASSERT(check);
+
+    if (!server->listen(address, port)) {
+        d->warning(QString("Could not start listening for components on %1 %2").arg(address.toString(), QString::number(port)));
+        delete server;
+        return false;
+    }
+    d->serversForComponents.insert(server);
+    return true;
+}
+
+/// Listen for incoming XMPP client connections over WebSocket, as
+/// described in RFC 7395.
+///
+/// Each WebSocket message carries exactly one stanza. TLS is not offered
+/// on these streams, it is expected to be handled by the HTTP frontend.
+///
+/// \param address
+/// \param port
+
+bool QXmppServer::listenForWebSocketClients(const QHostAddress &address, quint16 port)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    if (d->hosts.isEmpty()) {
+        d->warning("No domain was specified!");
+        return false;
+    }
+
+    // create new server
+    QXmppSslServer *server = new QXmppSslServer(this);
+    check = connect(server, SIGNAL(newConnection(QSslSocket*)),
+                    this, SLOT(_q_webSocketConnection(QSslSocket*)));
+    Q_ASSERT(check);
+
+    if (!server->listen(address, port)) {
+        d->warning(QString("Could not start listening for WebSocket C2S on %1 %2").arg(address.toString(), QString::number(port)));
+        delete server;
+        return false;
+    }
+    d->serversForClients.insert(server);
+
+    // start extensions
+    d->loadExtensions(this);
+    d->startExtensions();
+    return true;
+}
+
 /// Closes the server.
 ///
 
 void QXmppServer::close()
 {
     // prevent new connections
-    foreach (QXmppSslServer *server, d->serversForClients + d->serversForServers) {
+    foreach (QXmppSslServer *server, d->serversForClients + d->serversForComponents + d->serversForServers) {
         server->close();
         delete server;
     }
     d->serversForClients.clear();
+    d->serversForComponents.clear();
     d->serversForServers.clear();
+    if (d->warmTimer)
+        d->warmTimer->stop();
 
     // stop extensions
     d->stopExtensions();
@@ -562,6 +1353,8 @@ void QXmppServer::close()
     // close XMPP streams
     foreach (QXmppIncomingClient *stream, d->incomingClients)
        stream->disconnectFromHost();
+    foreach (QXmppIncomingComponent *stream, d->incomingComponents)
+       stream->disconnectFromHost();
     foreach (QXmppIncomingServer *stream, d->incomingServers)
        stream->disconnectFromHost();
     foreach (QXmppOutgoingServer *stream, d->outgoingServers)
@@ -578,7 +1371,7 @@ bool QXmppServer::listenForServers(const QHostAddress &address, quint16 port)
     bool check;
     Q_UNUSED(check);
 
-    if (d->domain.isEmpty()) {
+    if (d->hosts.isEmpty()) {
         d->warning("No domain was specified!");
         return false;
     }
@@ -600,12 +1393,37 @@ bool QXmppServer::listenForServers(const QHostAddress &address, quint16 port)
     }
     d->serversForServers.insert(server);
 
+    // keep streams to warm domains open
+    if (!d->warmTimer) {
+        d->warmTimer = new QTimer(this);
+        d->warmTimer->setInterval(30000);
+        check = connect(d->warmTimer, SIGNAL(timeout()),
+                        this, SLOT(_q_warmUpServers()));
+        Q_ASSERT(check);
+    }
+    d->warmTimer->start();
+    _q_warmUpServers();
+
     // start extensions
     d->loadExtensions(this);
     d->startExtensions();
     return true;
 }
 
+/// Route serialized XMPP data.
+///
+/// This allows extensions which deliver the same stanza to many
+/// recipients to serialize it only once.
+///
+/// \param to The recipient of the stanza.
+/// \param data The serialized stanza.
+/// \param from The sender of the stanza.
+
+bool QXmppServer::sendData(const QString &to, const QByteArray &data, const QString &from)
+{
+    return d->routeData(to, data, from);
+}
+
 /// Route an XMPP stanza.
 ///
 /// \param element
@@ -615,11 +1433,11 @@ bool QXmppServer::sendElement(const QDomElement &element)
     // serialize data
     QByteArray data;
     QXmlStreamWriter xmlStream(&data);
-    const QStringList omitNamespaces = QStringList() << ns_client << ns_server;
+    const QStringList omitNamespaces = QStringList() << ns_client << ns_server << ns_component;
     helperToXmlAddDomElement(&xmlStream, element, omitNamespaces);
 
     // route data
-    return d->routeData(element.attribute("to"), data);
+    return d->routeData(element.attribute("to"), data, element.attribute("from"));
 }
 
 /// Route an XMPP packet.
@@ -634,7 +1452,7 @@ bool QXmppServer::sendPacket(const QXmppStanza &packet)
     packet.toXml(&xmlStream);
 
     // route data
-    return d->routeData(packet.to(), data);
+    return d->routeData(packet.to(), data, packet.from());
 }
 
 /// Add a new incoming client \a stream.
@@ -647,12 +1465,23 @@ void QXmppServer::addIncomingClient(QXmppIncomingClient *stream)
     bool check;
     Q_UNUSED(check);
 
-    stream->setPasswordChecker(d->passwordChecker);
+    QXmppServerHost *host = d->hosts.value(stream->domain());
+    stream->setPasswordChecker((host && host->passwordChecker) ? host->passwordChecker : d->passwordChecker);
+    stream->setRosterVersioning(host && host->rosterVersioning);
+    if (d->clientByteRate)
+        stream->setByteRateLimit(d->clientByteRate);
+    if (d->clientStanzaRate)
+        stream->setStanzaRateLimit(d->clientStanzaRate);
+    stream->setCompactTimeout(d->clientCompactTimeout);
 
     check = connect(stream, SIGNAL(connected()),
                     this, SLOT(_q_clientConnected()));
     Q_ASSERT(check);
 
+    check = connect(stream, SIGNAL(domainRequested(QString)),
+                    this, SLOT(_q_clientDomainRequested(QString)));
+    Q_ASSERT(check);
+
     check = connect(stream, SIGNAL(disconnected()),
                     this, SLOT(_q_clientDisconnected()));
     Q_ASSERT(check);
@@ -684,6 +1513,78 @@ void QXmppServer::_q_clientConnection(QSslSocket *socket)
     addIncomingClient(stream);
 }
 
+/// Handle a new incoming TCP connection from a WebSocket client.
+///
+/// \param socket
+
+void QXmppServer::_q_webSocketConnection(QSslSocket *socket)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    // check the socket didn't die since the signal was emitted
+    if (socket->state() != QAbstractSocket::ConnectedState) {
+        delete socket;
+        return;
+    }
+
+    check = connect(socket, SIGNAL(readyRead()),
+                    this, SLOT(_q_webSocketReadyRead()));
+    Q_ASSERT(check);
+
+    check = connect(socket, SIGNAL(disconnected()),
+                    socket, SLOT(deleteLater()));
+    Q_ASSERT(check);
+}
+
+/// Handle the opening handshake of a WebSocket client.
+
+void QXmppServer::_q_webSocketReadyRead()
+{
+    QSslSocket *socket = qobject_cast<QSslSocket*>(sender());
+    if (!socket)
+        return;
+
+    // wait for the complete HTTP request
+    const QByteArray buffer = socket->peek(webSocketRequestLimit);
+    const int requestEnd = buffer.indexOf("\r\n\r\n");
+    if (requestEnd < 0) {
+        if (buffer.size() >= webSocketRequestLimit) {
+            d->warning("WebSocket handshake request is too large");
+            socket->disconnectFromHost();
+        }
+        return;
+    }
+    const QByteArray request = socket->read(requestEnd + 4);
+    disconnect(socket, SIGNAL(readyRead()), this, SLOT(_q_webSocketReadyRead()));
+
+    const QByteArray response = webSocketHandshake(request);
+    if (response.isEmpty()) {
+        socket->write("HTTP/1.1 400 Bad Request\r\n"
+                      "Connection: close\r\n"
+                      "Content-Length: 0\r\n"
+                      "\r\n");
+        socket->disconnectFromHost();
+        return;
+    } else if (!response.startsWith("HTTP/1.1 101")) {
+        socket->write(response);
+        socket->disconnectFromHost();
+        return;
+    }
+    disconnect(socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()));
+    socket->write(response);
+
+    QXmppIncomingClient *stream = new QXmppIncomingClient(socket, d->domain, this);
+    stream->setWebSocket(true);
+    stream->setInactivityTimeout(120);
+    socket->setParent(stream);
+    addIncomingClient(stream);
+
+    // process any data which arrived along with the handshake
+    if (socket->bytesAvailable())
+        QMetaObject::invokeMethod(stream, "_q_socketReadyRead", Qt::QueuedConnection);
+}
+
 /// Handle a successful stream connection for a client.
 ///
 
@@ -696,14 +1597,20 @@ void QXmppServer::_q_clientConnected()
     // FIXME: at this point the JID must contain a resource, assert it?
     const QString jid = client->jid();
 
+    QXmppServerHost *host = d->hosts.value(QXmppUtils::jidToDomain(jid));
+    if (!host)
+        return;
+
     // check whether the connection conflicts with another one
-    QXmppIncomingClient *old = d->incomingClientsByJid.value(jid);
+    QXmppIncomingClient *old = host->incomingClientsByJid.value(jid);
     if (old && old != client) {
         old->sendData("<stream:error><conflict xmlns='urn:ietf:params:xml:ns:xmpp-streams'/><text xmlns='urn:ietf:params:xml:ns:xmpp-streams'>Replaced by new connection</text></stream:error>");
         old->disconnectFromHost();
     }
-    d->incomingClientsByJid.insert(jid, client);
-    d->incomingClientsByBareJid[QXmppUtils::jidToBareJid(jid)].insert(client);
+    host->incomingClientsByJid.insert(jid, client);
+    host->incomingClientsByBareJid[QXmppUtils::jidToBareJid(jid)].insert(client);
+    if (d->cluster)
+        d->cluster->addSession(jid);
 
     // emit signal
     emit clientConnected(jid);
@@ -720,14 +1627,18 @@ void QXmppServer::_q_clientDisconnected()
     if (d->incomingClients.remove(client)) {
         // remove stream from routing tables
         const QString jid = client->jid();
-        if (!jid.isEmpty()) {
-            if (d->incomingClientsByJid.value(jid) == client)
-                d->incomingClientsByJid.remove(jid);
+        QXmppServerHost *host = d->hosts.value(QXmppUtils::jidToDomain(jid));
+        if (!jid.isEmpty() && host) {
+            if (host->incomingClientsByJid.value(jid) == client) {
+                host->incomingClientsByJid.remove(jid);
+                if (d->cluster)
+                    d->cluster->removeSession(jid);
+            }
             const QString bareJid = QXmppUtils::jidToBareJid(jid);
-            if (d->incomingClientsByBareJid.contains(bareJid)) {
-                d->incomingClientsByBareJid[bareJid].remove(client);
-                if (d->incomingClientsByBareJid[bareJid].isEmpty())
-                    d->incomingClientsByBareJid.remove(bareJid);
+            if (host->incomingClientsByBareJid.contains(bareJid)) {
+                host->incomingClientsByBareJid[bareJid].remove(client);
+                if (host->incomingClientsByBareJid[bareJid].isEmpty())
+                    host->incomingClientsByBareJid.remove(bareJid);
             }
         }
 
@@ -743,6 +1654,140 @@ void QXmppServer::_q_clientDisconnected()
     }
 }
 
+/// Handle a client requesting a stream for another hosted domain.
+///
+/// \param domain
+
+void QXmppServer::_q_clientDomainRequested(const QString &domain)
+{
+    QXmppIncomingClient *client = qobject_cast<QXmppIncomingClient*>(sender());
+    QXmppServerHost *host = d->hosts.value(domain);
+    if (!client || !host)
+        return;
+
+    client->setDomain(domain);
+    client->setPasswordChecker(host->passwordChecker ? host->passwordChecker : d->passwordChecker);
+    client->setRosterVersioning(host->rosterVersioning);
+    if (!host->localCertificate.isNull() && !host->privateKey.isNull()) {
+        client->setLocalCertificate(host->localCertificate);
+        client->setPrivateKey(host->privateKey);
+    }
+}
+
+/// Handle data forwarded by another cluster node for a local session.
+///
+/// \param to
+/// \param data
+
+void QXmppServer::_q_clusterDataReceived(const QString &to, const QByteArray &data)
+{
+    QXmppServerHost *host = d->hosts.value(QXmppUtils::jidToDomain(to));
+    if (!host)
+        return;
+
+    // deliver locally only, to avoid forwarding loops between nodes
+    foreach (QXmppStream *conn, d->findClients(host, to))
+        conn->sendData(data);
+}
+
+/// Handle a local session being replaced by a newer session for the same
+/// full JID on another cluster node.
+///
+/// \param jid
+
+void QXmppServer::_q_clusterSessionReplaced(const QString &jid)
+{
+    QXmppServerHost *host = d->hosts.value(QXmppUtils::jidToDomain(jid));
+    QXmppIncomingClient *client = host ? host->incomingClientsByJid.value(jid) : 0;
+    if (!client)
+        return;
+
+    client->sendData("<stream:error><conflict xmlns='urn:ietf:params:xml:ns:xmpp-streams'/><text xmlns='urn:ietf:params:xml:ns:xmpp-streams'>Replaced by new connection</text></stream:error>");
+    client->disconnectFromHost();
+}
+
+/// Handle a successful authentication for a component.
+
+void QXmppServer::_q_componentConnected()
+{
+    QXmppIncomingComponent *component = qobject_cast<QXmppIncomingComponent*>(sender());
+    if (!component)
+        return;
+
+    // only one component may own a domain
+    QXmppIncomingComponent *old = d->incomingComponentsByDomain.value(component->domain());
+    if (old && old != component) {
+        d->warning(QString("Refusing component for %1, the domain is already connected").arg(component->domain()));
+        component->sendData("<stream:error><conflict xmlns='urn:ietf:params:xml:ns:xmpp-streams'/></stream:error>");
+        component->disconnectFromHost();
+        return;
+    }
+    d->incomingComponentsByDomain.insert(component->domain(), component);
+}
+
+/// Handle a new incoming TCP connection from a component.
+///
+/// \param socket
+
+void QXmppServer::_q_componentConnection(QSslSocket *socket)
+{
+    bool check;
+    Q_UNUSED(check);
+
+    // check the socket didn't die since the signal was emitted
+    if (socket->state() != QAbstractSocket::ConnectedState) {
+        delete socket;
+        return;
+    }
+
+    // only loopback connections may skip TLS
+    const QHostAddress peer = socket->peerAddress();
+    if (!d->loopbackComponentPlainText || !isLoopbackAddress(peer)) {
+        if (socket->localCertificate().isNull() || socket->privateKey().isNull()) {
+            d->warning(QString("Refusing component connection from %1 without TLS").arg(peer.toString()));
+            delete socket;
+            return;
+        }
+        socket->startServerEncryption();
+    }
+
+    QXmppIncomingComponent *stream = new QXmppIncomingComponent(socket, this);
+    stream->setSecrets(d->componentSecrets);
+    socket->setParent(stream);
+
+    check = connect(stream, SIGNAL(connected()),
+                    this, SLOT(_q_componentConnected()));
+    Q_ASSERT(check);
+
+    check = connect(stream, SIGNAL(disconnected()),
+                    this, SLOT(_q_componentDisconnected()));
+    Q_ASSERT(check);
+
+    check = connect(stream, SIGNAL(elementReceived(QDomElement)),
+                    this, SLOT(handleElement(QDomElement)));
+    Q_ASSERT(check);
+
+    // add stream
+    d->incomingComponents.insert(stream);
+    setGauge("incoming-component.count", d->incomingComponents.size());
+}
+
+/// Handle a stream disconnection for a component.
+
+void QXmppServer::_q_componentDisconnected()
+{
+    QXmppIncomingComponent *component = qobject_cast<QXmppIncomingComponent*>(sender());
+    if (!component)
+        return;
+
+    if (d->incomingComponents.remove(component)) {
+        if (d->incomingComponentsByDomain.value(component->domain()) == component)
+            d->incomingComponentsByDomain.remove(component->domain());
+        component->deleteLater();
+        setGauge("incoming-component.count", d->incomingComponents.size());
+    }
+}
+
 void QXmppServer::_q_dialbackRequestReceived(const QXmppDialback &dialback)
 {
     QXmppIncomingServer *stream = qobject_cast<QXmppIncomingServer *>(sender());
@@ -752,19 +1797,19 @@ void QXmppServer::_q_dialbackRequestReceived(const QXmppDialback &dialback)
     if (dialback.command() == QXmppDialback::Verify)
     {
         // handle a verify request
-        foreach (QXmppOutgoingServer *out, d->outgoingServers) {
-            if (out->remoteDomain() != dialback.from())
-                continue;
-
-            bool isValid = dialback.key() == out->localStreamKey();
+        QXmppOutgoingServer *out = d->refusedOutgoingServers.value(qMakePair(dialback.from(), dialback.to()));
+        if (!out)
+            out = d->outgoingServersByDomain.value(dialback.from());
+        if (out) {
+            const QString localKey = out->localStreamKey(dialback.to());
+            bool isValid = !localKey.isEmpty() && dialback.key() == localKey;
             QXmppDialback verify;
             verify.setCommand(QXmppDialback::Verify);
             verify.setId(dialback.id());
             verify.setTo(dialback.from());
-            verify.setFrom(d->domain);
+            verify.setFrom(dialback.to());
             verify.setType(isValid ? "valid" : "invalid");
             stream->sendPacket(verify);
-            return;
         }
     }
 }
@@ -773,7 +1818,18 @@ void QXmppServer::_q_dialbackRequestReceived(const QXmppDialback &dialback)
 
 void QXmppServer::handleElement(const QDomElement &element)
 {
-    handleStanza(this, element);
+    d->handleStanza(element);
+}
+
+/// Handle a successful stream connection for an outgoing server.
+
+void QXmppServer::_q_outgoingServerConnected()
+{
+    QXmppOutgoingServer *outgoing = qobject_cast<QXmppOutgoingServer *>(sender());
+    if (!outgoing)
+        return;
+
+    setGauge(QString("outgoing-server.setup-time.%1").arg(outgoing->remoteDomain()), outgoing->setupTime());
 }
 
 /// Handle a stream disconnection for an outgoing server.
@@ -785,11 +1841,34 @@ void QXmppServer::_q_outgoingServerDisconnected()
         return;
 
     if (d->outgoingServers.remove(outgoing)) {
+        if (d->outgoingServersByDomain.value(outgoing->remoteDomain()) == outgoing)
+            d->outgoingServersByDomain.remove(outgoing->remoteDomain());
+        const QPair<QString, QString> key = qMakePair(outgoing->remoteDomain(), outgoing->localDomains().first());
+        if (d->refusedOutgoingServers.value(key) == outgoing)
+            d->refusedOutgoingServers.remove(key);
         outgoing->deleteLater();
         setGauge("outgoing-server.count", d->outgoingServers.size());
+        emit serverDisconnected(outgoing->remoteDomain());
     }
 }
 
+/// Handle a local domain being refused over a shared outgoing server
+/// stream by routing its data over a stream of its own.
+///
+/// \param localDomain
+/// \param data
+
+void QXmppServer::_q_outgoingServerDomainRefused(const QString &localDomain, const QList<QByteArray> &data)
+{
+    QXmppOutgoingServer *outgoing = qobject_cast<QXmppOutgoingServer *>(sender());
+    if (!outgoing)
+        return;
+
+    QXmppOutgoingServer *conn = d->outgoingServer(outgoing->remoteDomain(), localDomain);
+    foreach (const QByteArray &packet, data)
+        conn->queueData(packet, localDomain);
+}
+
 /// Handle a new incoming TCP connection from a server.
 ///
 /// \param socket
@@ -806,6 +1885,7 @@ void QXmppServer::_q_serverConnection(QSslSocket *socket)
     }
 
     QXmppIncomingServer *stream = new QXmppIncomingServer(socket, d->domain, this);
+    stream->setLocalDomains(d->localDomains());
     socket->setParent(stream);
 
     check = connect(stream, SIGNAL(disconnected()),
@@ -836,6 +1916,26 @@ void QXmppServer::_q_serverDisconnected()
     if (d->incomingServers.remove(incoming)) {
         incoming->deleteLater();
         setGauge("incoming-server.count", d->incomingServers.size());
+        foreach (const QString &domain, incoming->remoteDomains())
+            emit serverDisconnected(domain);
+    }
+}
+
+/// Establish outgoing streams to warm domains which are not connected.
+///
+/// A stream which does not become ready within its setup timeout closes
+/// itself, so a stuck warm domain is retried on the next pass.
+
+void QXmppServer::_q_warmUpServers()
+{
+    if (d->serversForServers.isEmpty())
+        return;
+
+    foreach (const QString &remoteDomain, d->warmDomains) {
+        if (!remoteDomain.isEmpty() && !d->outgoingServersByDomain.contains(remoteDomain)) {
+            d->info(QString("Pre-connecting to warm domain %1").arg(remoteDomain));
+            d->connectToServer(remoteDomain, d->domain);
+        }
     }
 }
 
@@ -34,6 +34,7 @@ class QSslCertificate;
 class QSslKey;
 class QSslSocket;
 
+class QXmppCluster;
 class QXmppDialback;
 class QXmppIncomingClient;
 class QXmppOutgoingServer;
@@ -50,6 +51,8 @@ class QXmppStream;
 /// It provides support for both client-to-server and server-to-server
 /// communications, SSL encryption and logging facilities.
 ///
+/// A single server can host several domains, see addDomain().
+///
 /// QXmppServer comes with a number of modules for service discovery,
 /// XMPP ping, statistics and file transfer proxy support. You can write
 /// your own extensions for QXmppServer by subclassing QXmppServerExtension.
@@ -66,27 +69,64 @@ public:
     ~QXmppServer();
 
     void addExtension(QXmppServerExtension *extension);
+    void addExtension(QXmppServerExtension *extension, const QString &domain);
     QList<QXmppServerExtension*> extensions();
 
     QString domain() const;
     void setDomain(const QString &domain);
 
+    QStringList domains() const;
+    void addDomain(const QString &domain);
+
     QXmppLogger *logger();
     void setLogger(QXmppLogger *logger);
 
+    QXmppCluster *cluster() const;
+    void setCluster(QXmppCluster *cluster);
+
+    void addComponent(const QString &domain, const QString &secret);
+
+    bool isLoopbackComponentPlainTextAllowed() const;
+    void setLoopbackComponentPlainTextAllowed(bool allowed);
+
+    int clientByteRateLimit() const;
+    void setClientByteRateLimit(int bytesPerSecond);
+
+    int clientStanzaRateLimit() const;
+    void setClientStanzaRateLimit(int stanzasPerSecond);
+
+    int clientCompactTimeout() const;
+    void setClientCompactTimeout(int secs);
+
     QXmppPasswordChecker *passwordChecker();
+    QXmppPasswordChecker *passwordChecker(const QString &domain);
     void setPasswordChecker(QXmppPasswordChecker *checker);
+    void setPasswordChecker(QXmppPasswordChecker *checker, const QString &domain);
+
+    int outgoingServerIdleTimeout() const;
+    void setOutgoingServerIdleTimeout(int secs);
+
+    int outgoingServerQueueLimit() const;
+    void setOutgoingServerQueueLimit(int bytes);
+
+    QStringList warmDomains() const;
+    void setWarmDomains(const QStringList &domains);
 
     QVariantMap statistics() const;
 
     void addCaCertificates(const QString &caCertificates);
     void setLocalCertificate(const QString &path);
     void setPrivateKey(const QString &path);
+    void setLocalCertificate(const QString &path, const QString &domain);
+    void setPrivateKey(const QString &path, const QString &domain);
 
     void close();
     bool listenForClients(const QHostAddress &address = QHostAddress::Any, quint16 port = 5222);
+    bool listenForComponents(const QHostAddress &address = QHostAddress::LocalHost, quint16 port = 5347);
     bool listenForServers(const QHostAddress &address = QHostAddress::Any, quint16 port = 5269);
+    bool listenForWebSocketClients(const QHostAddress &address = QHostAddress::Any, quint16 port = 5280);
 
+    bool sendData(const QString &to, const QByteArray &data, const QString &from = QString());
     bool sendElement(const QDomElement &element);
     bool sendPacket(const QXmppStanza &stanza);
 
@@ -99,6 +139,10 @@ signals:
     /// This signal is emitted when a client has disconnected.
     void clientDisconnected(const QString &jid);
 
+    /// This signal is emitted when a server-to-server stream with the
+    /// remote \a domain is closed, in either direction.
+    void serverDisconnected(const QString &domain);
+
     /// This signal is emitted when the logger changes.
     void loggerChanged(QXmppLogger *logger);
 
@@ -109,10 +153,21 @@ private slots:
     void _q_clientConnection(QSslSocket *socket);
     void _q_clientConnected();
     void _q_clientDisconnected();
+    void _q_clientDomainRequested(const QString &domain);
+    void _q_clusterDataReceived(const QString &to, const QByteArray &data);
+    void _q_clusterSessionReplaced(const QString &jid);
+    void _q_componentConnected();
+    void _q_componentConnection(QSslSocket *socket);
+    void _q_componentDisconnected();
     void _q_dialbackRequestReceived(const QXmppDialback &dialback);
+    void _q_outgoingServerConnected();
     void _q_outgoingServerDisconnected();
+    void _q_outgoingServerDomainRefused(const QString &localDomain, const QList<QByteArray> &data);
     void _q_serverConnection(QSslSocket *socket);
     void _q_serverDisconnected();
+    void _q_warmUpServers();
+    void _q_webSocketConnection(QSslSocket *socket);
+    void _q_webSocketReadyRead();
 
 private:
     friend class QXmppServerPrivate;
@@ -1,20 +1,32 @@
 # Headers
 INSTALL_HEADERS += \
+    server/QXmppArchiveService.h \
+    server/QXmppCluster.h \
     server/QXmppDialback.h \
     server/QXmppIncomingClient.h \
+    server/QXmppIncomingComponent.h \
     server/QXmppIncomingServer.h \
+    server/QXmppMucService.h \
     server/QXmppOutgoingServer.h \
     server/QXmppPasswordChecker.h \
+    server/QXmppPubSubService.h \
+    server/QXmppRosterService.h \
     server/QXmppServer.h \
     server/QXmppServerExtension.h \
     server/QXmppServerPlugin.h
 
 # Source files
 SOURCES += \
+    server/QXmppArchiveService.cpp \
+    server/QXmppCluster.cpp \
     server/QXmppDialback.cpp \
     server/QXmppIncomingClient.cpp \
+    server/QXmppIncomingComponent.cpp \
     server/QXmppIncomingServer.cpp \
+    server/QXmppMucService.cpp \
     server/QXmppOutgoingServer.cpp \
     server/QXmppPasswordChecker.cpp \
+    server/QXmppPubSubService.cpp \
+    server/QXmppRosterService.cpp \
     server/QXmppServer.cpp \
     server/QXmppServerExtension.cpp
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include "QXmppPasswordChecker.h"
+
+/// Password checker for the server extension tests, which accepts any
+/// username with the password "testpwd", or a single user if one is given.
+
+class TestPasswordChecker : public QXmppPasswordChecker
+{
+public:
+    TestPasswordChecker()
+        : m_getPassword(true), m_password("testpwd")
+    {
+    }
+
+    TestPasswordChecker(const QString &username, const QString &password)
+        : m_getPassword(true), m_username(username), m_password(password)
+    {
+    }
+
+    /// Retrieves the password for the given username.
+    QXmppPasswordReply::Error getPassword(const QXmppPasswordRequest &request, QString &password)
+    {
+        if (!m_username.isEmpty() && request.username() != m_username)
+            return QXmppPasswordReply::AuthorizationError;
+        password = m_password;
+        return QXmppPasswordReply::NoError;
+    }
+
+    /// Sets whether getPassword() is enabled.
+    void setGetPassword(bool getPassword)
+    {
+        m_getPassword = getPassword;
+    }
+
+    /// Returns whether getPassword() is enabled.
+    bool hasGetPassword() const
+    {
+        return m_getPassword;
+    }
+
+private:
+    bool m_getPassword;
+    QString m_username;
+    QString m_password;
+};
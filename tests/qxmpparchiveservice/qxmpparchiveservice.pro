@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmpparchiveservice
+SOURCES += tst_qxmpparchiveservice.cpp
@@ -0,0 +1,438 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QDir>
+#include <QFileInfo>
+
+#include "QXmppArchiveIq.h"
+#include "QXmppArchiveManager.h"
+#include "QXmppArchiveService.h"
+#include "QXmppClient.h"
+#include "QXmppMessage.h"
+#include "QXmppServer.h"
+#include "passwordchecker.h"
+#include "util.h"
+
+class TestArchiveCollector : public QObject
+{
+    Q_OBJECT
+
+public slots:
+    void archiveChatReceived(const QXmppArchiveChat &chat, const QXmppResultSetReply &rsm)
+    {
+        this->chat = chat;
+        this->rsm = rsm;
+        emit received();
+    }
+
+    void archiveListReceived(const QList<QXmppArchiveChat> &chats, const QXmppResultSetReply &rsm)
+    {
+        this->chats = chats;
+        this->rsm = rsm;
+        emit received();
+    }
+
+signals:
+    void received();
+
+public:
+    QXmppArchiveChat chat;
+    QList<QXmppArchiveChat> chats;
+    QXmppResultSetReply rsm;
+};
+
+class TestIqCollector : public QObject
+{
+    Q_OBJECT
+
+public slots:
+    void iqReceived(const QXmppIq &iq)
+    {
+        iqs << iq;
+        emit received();
+    }
+
+signals:
+    void received();
+
+public:
+    QList<QXmppIq> iqs;
+};
+
+class TestArchiveStreamCollector : public QObject
+{
+    Q_OBJECT
+
+public slots:
+    void archiveStreamReceived(const QString &streamId, const QXmppArchiveChat &chat)
+    {
+        Q_UNUSED(streamId);
+        pages << chat;
+    }
+
+    void archiveStreamFinished(const QString &streamId)
+    {
+        finished << streamId;
+        emit received();
+    }
+
+signals:
+    void received();
+
+public:
+    QStringList finished;
+    QList<QXmppArchiveChat> pages;
+};
+
+static QDomElement autoElement(QDomDocument &doc, const QString &from, const QString &scope)
+{
+    doc.setContent(QString("<iq id=\"auto1\" from=\"%1\" to=\"localhost\" type=\"set\">"
+                           "<auto xmlns=\"urn:xmpp:archive\" save=\"true\" scope=\"%2\"/>"
+                           "</iq>").arg(from, scope), true);
+    return doc.documentElement();
+}
+
+static QDomElement messageElement(QDomDocument &doc, const QString &from, const QString &to, const QString &body)
+{
+    QXmppMessage message;
+    message.setFrom(from);
+    message.setTo(to);
+    message.setBody(body);
+
+    QByteArray data;
+    QXmlStreamWriter writer(&data);
+    message.toXml(&writer);
+    doc.setContent(data, true);
+    return doc.documentElement();
+}
+
+static void removeDirectory(const QString &path)
+{
+    QDir dir(path);
+    foreach (const QFileInfo &info, dir.entryInfoList(QDir::AllEntries | QDir::NoDotAndDotDot)) {
+        if (info.isDir())
+            removeDirectory(info.filePath());
+        else
+            QFile::remove(info.filePath());
+    }
+    dir.rmdir(path);
+}
+
+class tst_QXmppArchiveService : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testAuto();
+    void testRetrieve();
+    void testStream();
+};
+
+void tst_QXmppArchiveService::testAuto()
+{
+    const QString path = QDir::temp().filePath("qxmpp-archive");
+    removeDirectory(path);
+
+    TestPasswordChecker passwordChecker("alice", "testpwd");
+    QXmppArchiveService *service = new QXmppArchiveService;
+    service->setStoragePath(path);
+
+    QXmppServer server;
+    server.setDomain("localhost");
+    server.setPasswordChecker(&passwordChecker);
+    server.addExtension(service);
+    QVERIFY(server.listenForClients(QHostAddress::LocalHost, 12345));
+
+    // nothing is archived without opting in
+    QDomDocument doc;
+    server.handleElement(messageElement(doc, "alice@localhost/QXmpp", "bob@localhost", "hello"));
+    QVERIFY(!QFileInfo(path + "/users/alice@localhost").exists());
+    QVERIFY(!QFileInfo(path + "/users/bob@localhost").exists());
+
+    // only existing accounts are archived
+    server.handleElement(autoElement(doc, "alice@localhost/QXmpp", "session"));
+    server.handleElement(autoElement(doc, "bob@localhost/QXmpp", "session"));
+    server.handleElement(messageElement(doc, "alice@localhost/QXmpp", "bob@localhost", "hello"));
+    QVERIFY(QFileInfo(path + "/users/alice@localhost/contacts.lst").exists());
+    QVERIFY(!QFileInfo(path + "/users/bob@localhost").exists());
+
+    // session archiving ends with the session
+    QVERIFY(QMetaObject::invokeMethod(service, "_q_clientDisconnected",
+                                      Q_ARG(QString, "alice@localhost/QXmpp")));
+    server.handleElement(messageElement(doc, "alice@localhost/QXmpp", "carol@localhost", "hello"));
+    service->stop();
+    QFile contacts(path + "/users/alice@localhost/contacts.lst");
+    QVERIFY(contacts.open(QIODevice::ReadOnly));
+    QCOMPARE(contacts.readAll(), QByteArray("bob@localhost\n"));
+    contacts.close();
+
+    server.close();
+    removeDirectory(path);
+}
+
+void tst_QXmppArchiveService::testRetrieve()
+{
+    const QString path = QDir::temp().filePath("qxmpp-archive");
+    removeDirectory(path);
+
+    TestPasswordChecker passwordChecker;
+    QXmppArchiveService *service = new QXmppArchiveService;
+    service->setStoragePath(path);
+
+    QXmppServer server;
+    server.setDomain("localhost");
+    server.setPasswordChecker(&passwordChecker);
+    server.addExtension(service);
+    QVERIFY(server.listenForClients(QHostAddress::LocalHost, 12345));
+
+    // archive a conversation between two local users
+    QDomDocument doc;
+    server.handleElement(autoElement(doc, "alice@localhost/QXmpp", "global"));
+    server.handleElement(autoElement(doc, "bob@localhost/QXmpp", "global"));
+    for (int i = 0; i < 10; ++i) {
+        server.handleElement(messageElement(doc, "alice@localhost/QXmpp", "bob@localhost", QString("ping %1").arg(i)));
+        server.handleElement(messageElement(doc, "bob@localhost/QXmpp", "alice@localhost", QString("pong %1").arg(i)));
+    }
+
+    // connect client
+    QXmppClient client;
+    QXmppArchiveManager *manager = new QXmppArchiveManager;
+    client.addExtension(manager);
+    TestArchiveCollector collector;
+    connect(manager, SIGNAL(archiveListReceived(QList<QXmppArchiveChat>,QXmppResultSetReply)),
+            &collector, SLOT(archiveListReceived(QList<QXmppArchiveChat>,QXmppResultSetReply)));
+    connect(manager, SIGNAL(archiveChatReceived(QXmppArchiveChat,QXmppResultSetReply)),
+            &collector, SLOT(archiveChatReceived(QXmppArchiveChat,QXmppResultSetReply)));
+
+    QEventLoop loop;
+    connect(&client, SIGNAL(connected()),
+            &loop, SLOT(quit()));
+    connect(&collector, SIGNAL(received()),
+            &loop, SLOT(quit()));
+    QXmppConfiguration config;
+    config.setDomain("localhost");
+    config.setHost("127.0.0.1");
+    config.setPort(12345);
+    config.setUser("bob");
+    config.setPassword("testpwd");
+    client.connectToServer(config);
+    loop.exec();
+    QVERIFY(client.isConnected());
+
+    // list conversations
+    manager->listCollections("alice@localhost");
+    QTimer::singleShot(1000, &loop, SLOT(quit()));
+    loop.exec();
+    QCOMPARE(collector.chats.size(), 1);
+    QCOMPARE(collector.chats[0].with(), QString("alice@localhost"));
+    QCOMPARE(collector.rsm.count(), 1);
+
+    // retrieve the second page of messages
+    QXmppResultSetQuery rsm;
+    rsm.setIndex(5);
+    rsm.setMax(5);
+    manager->retrieveCollection("alice@localhost", collector.chats[0].start(), rsm);
+    QTimer::singleShot(1000, &loop, SLOT(quit()));
+    loop.exec();
+    QCOMPARE(collector.rsm.count(), 20);
+    QCOMPARE(collector.rsm.index(), 5);
+    QCOMPARE(collector.chat.messages().size(), 5);
+    QCOMPARE(collector.chat.messages()[0].body(), QString("pong 2"));
+    QCOMPARE(collector.chat.messages()[0].isReceived(), false);
+    QCOMPARE(collector.chat.messages()[1].body(), QString("ping 3"));
+    QCOMPARE(collector.chat.messages()[1].isReceived(), true);
+
+    // continue after the last message of the page
+    QXmppResultSetQuery next;
+    next.setAfter(collector.rsm.last());
+    next.setMax(100);
+    manager->retrieveCollection("alice@localhost", collector.chats[0].start(), next);
+    QTimer::singleShot(1000, &loop, SLOT(quit()));
+    loop.exec();
+    QCOMPARE(collector.rsm.index(), 10);
+    QCOMPARE(collector.chat.messages().size(), 10);
+    QCOMPARE(collector.chat.messages()[9].body(), QString("pong 9"));
+
+    // an empty "before" requests the last page
+    QXmppResultSetQuery lastPage;
+    lastPage.setBefore("");
+    lastPage.setMax(3);
+    manager->retrieveCollection("alice@localhost", collector.chats[0].start(), lastPage);
+    QTimer::singleShot(1000, &loop, SLOT(quit()));
+    loop.exec();
+    QCOMPARE(collector.rsm.index(), 17);
+    QCOMPARE(collector.chat.messages().size(), 3);
+    QCOMPARE(collector.chat.messages()[2].body(), QString("pong 9"));
+
+    // removing is not supported, but answered
+    TestIqCollector iqCollector;
+    connect(&client, SIGNAL(iqReceived(QXmppIq)),
+            &iqCollector, SLOT(iqReceived(QXmppIq)));
+    connect(&iqCollector, SIGNAL(received()),
+            &loop, SLOT(quit()));
+    QXmppArchiveRemoveIq remove;
+    remove.setType(QXmppIq::Set);
+    remove.setWith("alice@localhost");
+    QVERIFY(client.sendPacket(remove));
+    QTimer::singleShot(1000, &loop, SLOT(quit()));
+    loop.exec();
+    QCOMPARE(iqCollector.iqs.size(), 1);
+    QCOMPARE(iqCollector.iqs[0].type(), QXmppIq::Error);
+    QCOMPARE(iqCollector.iqs[0].error().condition(), QXmppStanza::Error::FeatureNotImplemented);
+
+    client.disconnectFromServer();
+    server.close();
+    removeDirectory(path);
+}
+
+void tst_QXmppArchiveService::testStream()
+{
+    const QString path = QDir::temp().filePath("qxmpp-archive");
+    const QString cachePath = QDir::temp().filePath("qxmpp-archive-cache");
+    removeDirectory(path);
+    removeDirectory(cachePath);
+
+    TestPasswordChecker passwordChecker;
+    QXmppArchiveService *service = new QXmppArchiveService;
+    service->setStoragePath(path);
+
+    QXmppServer server;
+    server.setDomain("localhost");
+    server.setPasswordChecker(&passwordChecker);
+    server.addExtension(service);
+    QVERIFY(server.listenForClients(QHostAddress::LocalHost, 12345));
+
+    QDomDocument doc;
+    server.handleElement(autoElement(doc, "bob@localhost/QXmpp", "global"));
+    for (int i = 0; i < 10; ++i) {
+        server.handleElement(messageElement(doc, "alice@localhost/QXmpp", "bob@localhost", QString("ping %1").arg(i)));
+        server.handleElement(messageElement(doc, "bob@localhost/QXmpp", "alice@localhost", QString("pong %1").arg(i)));
+    }
+
+    // connect client
+    QXmppClient client;
+    QXmppArchiveManager *manager = new QXmppArchiveManager;
+    manager->setCachePath(cachePath);
+    client.addExtension(manager);
+    TestArchiveStreamCollector collector;
+    connect(manager, SIGNAL(archiveStreamReceived(QString,QXmppArchiveChat)),
+            &collector, SLOT(archiveStreamReceived(QString,QXmppArchiveChat)));
+    connect(manager, SIGNAL(archiveStreamFinished(QString)),
+            &collector, SLOT(archiveStreamFinished(QString)));
+
+    QEventLoop loop;
+    connect(&client, SIGNAL(connected()),
+            &loop, SLOT(quit()));
+    connect(&collector, SIGNAL(received()),
+            &loop, SLOT(quit()));
+    QXmppConfiguration config;
+    config.setDomain("localhost");
+    config.setHost("127.0.0.1");
+    config.setPort(12345);
+    config.setUser("bob");
+    config.setPassword("testpwd");
+    client.connectToServer(config);
+    loop.exec();
+    QVERIFY(client.isConnected());
+
+    // stream the conversation five messages at a time
+    QVERIFY(manager->cachedCollections("alice@localhost").isEmpty());
+    const QString streamId = manager->streamCollections("alice@localhost", QDateTime(), QDateTime(), 5);
+    QVERIFY(!streamId.isEmpty());
+    QTimer::singleShot(1000, &loop, SLOT(quit()));
+    loop.exec();
+    QCOMPARE(collector.finished, QStringList() << streamId);
+    QCOMPARE(collector.pages.size(), 4);
+    QCOMPARE(collector.pages[0].with(), QString("alice@localhost"));
+    QCOMPARE(collector.pages[0].messages().size(), 5);
+    QCOMPARE(collector.pages[0].messages()[0].body(), QString("ping 0"));
+    QCOMPARE(collector.pages[3].messages().size(), 5);
+    QCOMPARE(collector.pages[3].messages()[4].body(), QString("pong 9"));
+
+    // the collection is now cached, including across reloads
+    manager->setCachePath(QString());
+    manager->setCachePath(cachePath);
+    QList<QXmppArchiveChat> chats = manager->cachedCollections("alice@localhost");
+    QCOMPARE(chats.size(), 1);
+    QVERIFY(chats[0].messages().isEmpty());
+
+    // the messages are read from the cache on demand
+    QList<QXmppArchiveMessage> messages = manager->cachedMessages("alice@localhost", chats[0].start());
+    QCOMPARE(messages.size(), 20);
+    QCOMPARE(messages[19].body(), QString("pong 9"));
+    QCOMPARE(messages[19].isReceived(), false);
+    messages = manager->cachedMessages("alice@localhost", chats[0].start(), 15, 10);
+    QCOMPARE(messages.size(), 5);
+    QCOMPARE(messages[4].body(), QString("pong 9"));
+
+    // the newest collection has no version and is retrieved again, so a
+    // message appended to it arrives
+    server.handleElement(messageElement(doc, "alice@localhost/QXmpp", "bob@localhost", "late"));
+    collector.finished.clear();
+    collector.pages.clear();
+    const QString lateId = manager->streamCollections("alice@localhost", QDateTime(), QDateTime(), 5);
+    QVERIFY(!lateId.isEmpty());
+    QTimer::singleShot(1000, &loop, SLOT(quit()));
+    loop.exec();
+    QCOMPARE(collector.finished, QStringList() << lateId);
+    QCOMPARE(collector.pages.size(), 5);
+    QCOMPARE(collector.pages[0].messages()[0].body(), QString("ping 0"));
+    QCOMPARE(collector.pages[4].messages().size(), 1);
+    QCOMPARE(collector.pages[4].messages()[0].body(), QString("late"));
+    QCOMPARE(manager->cachedMessages("alice@localhost", chats[0].start()).size(), 21);
+
+    // once a newer collection exists, the older one is served from the cache
+    service->setChatTimeout(0);
+    QTest::qWait(10);
+    server.handleElement(messageElement(doc, "alice@localhost/QXmpp", "bob@localhost", "again"));
+    collector.finished.clear();
+    collector.pages.clear();
+    const QString cachedId = manager->streamCollections("alice@localhost", QDateTime(), QDateTime(), 5);
+    QVERIFY(!cachedId.isEmpty());
+    QTimer::singleShot(1000, &loop, SLOT(quit()));
+    loop.exec();
+    QCOMPARE(collector.finished, QStringList() << cachedId);
+    QCOMPARE(collector.pages.size(), 6);
+    QCOMPARE(collector.pages[0].messages().size(), 5);
+    QCOMPARE(collector.pages[0].messages()[0].body(), QString("ping 0"));
+    QCOMPARE(collector.pages[4].messages()[0].body(), QString("late"));
+    QCOMPARE(collector.pages[5].messages()[0].body(), QString("again"));
+    QCOMPARE(manager->cachedCollections("alice@localhost").size(), 2);
+
+    // a cancelled stream emits nothing
+    collector.finished.clear();
+    collector.pages.clear();
+    manager->cancelStream(manager->streamCollections("alice@localhost"));
+    QTimer::singleShot(500, &loop, SLOT(quit()));
+    loop.exec();
+    QVERIFY(collector.finished.isEmpty());
+    QVERIFY(collector.pages.isEmpty());
+
+    client.disconnectFromServer();
+    server.close();
+    removeDirectory(path);
+    removeDirectory(cachePath);
+}
+
+QTEST_MAIN(tst_QXmppArchiveService)
+#include "tst_qxmpparchiveservice.moc"
@@ -0,0 +1,291 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QDateTime>
+#include <QDir>
+#include <QTcpSocket>
+#include <QtEndian>
+
+#include "QXmppClient.h"
+#include "QXmppCluster.h"
+#include "QXmppMessage.h"
+#include "QXmppServer.h"
+#include "passwordchecker.h"
+#include "util.h"
+
+class TestMessageCollector : public QObject
+{
+    Q_OBJECT
+
+public slots:
+    void messageReceived(const QXmppMessage &message)
+    {
+        messages << message;
+    }
+
+public:
+    QList<QXmppMessage> messages;
+};
+
+class tst_QXmppCluster : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testAuthentication();
+    void testConflict();
+    void testRouting();
+    void testServerRouting();
+};
+
+static QByteArray clusterFrame(quint8 type, const QString &text, const QByteArray &data)
+{
+    QByteArray frame;
+    QDataStream stream(&frame, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_4_6);
+    stream << quint32(0) << type << text << data;
+    qToBigEndian<quint32>(frame.size() - 4, reinterpret_cast<uchar*>(frame.data()));
+    return frame;
+}
+
+static bool waitForDisconnected(QTcpSocket *socket)
+{
+    for (int i = 0; i < 100 && socket->state() != QAbstractSocket::UnconnectedState; ++i)
+        QTest::qWait(10);
+    return socket->state() == QAbstractSocket::UnconnectedState;
+}
+
+void tst_QXmppCluster::testAuthentication()
+{
+    QXmppCluster nodeA("node-a");
+    nodeA.setSecret("secret");
+    QCOMPARE(nodeA.secret(), QByteArray("secret"));
+    QVERIFY(nodeA.listen(QHostAddress::LocalHost, 12347));
+    QSignalSpy replacedA(&nodeA, SIGNAL(sessionReplaced(QString)));
+    QSignalSpy receivedA(&nodeA, SIGNAL(dataReceived(QString,QByteArray)));
+    nodeA.addSession("foo@example.com/res1");
+
+    // a node with the wrong secret is refused
+    QXmppCluster nodeB("node-b");
+    nodeB.setSecret("wrong");
+    nodeB.addNode(QHostAddress::LocalHost, 12347);
+    QTest::qWait(200);
+    QVERIFY(nodeA.nodes().isEmpty());
+    QVERIFY(nodeB.nodes().isEmpty());
+    QCOMPARE(nodeB.sessionNode("foo@example.com/res1"), QString());
+    nodeB.close();
+
+    // frames sent before the handshake drop the link
+    QTcpSocket socket;
+    socket.connectToHost(QHostAddress::LocalHost, 12347);
+    QVERIFY(socket.waitForConnected());
+    socket.write(clusterFrame(1, "foo@example.com/res1", QByteArray::number(QDateTime::currentMSecsSinceEpoch() + 60000)));
+    socket.write(clusterFrame(3, "foo@example.com/res1", "<message/>"));
+    QVERIFY(waitForDisconnected(&socket));
+    QCOMPARE(replacedA.size(), 0);
+    QCOMPARE(receivedA.size(), 0);
+
+    // a hello without a valid proof drops the link
+    socket.connectToHost(QHostAddress::LocalHost, 12347);
+    QVERIFY(socket.waitForConnected());
+    socket.write(clusterFrame(4, QString(), QByteArray(16, 'x')));
+    socket.write(clusterFrame(0, "node-c", QByteArray(20, 'x')));
+    QVERIFY(waitForDisconnected(&socket));
+    QVERIFY(nodeA.nodes().isEmpty());
+
+    // an oversized frame drops the link
+    socket.connectToHost(QHostAddress::LocalHost, 12347);
+    QVERIFY(socket.waitForConnected());
+    QByteArray header(4, '\0');
+    qToBigEndian<quint32>(0x7fffffff, reinterpret_cast<uchar*>(header.data()));
+    socket.write(header);
+    QVERIFY(waitForDisconnected(&socket));
+}
+
+void tst_QXmppCluster::testConflict()
+{
+    const QString path = QDir::temp().filePath("qxmpp-cluster-test");
+
+    QXmppCluster nodeA("node-a");
+    nodeA.setSecret("secret");
+    QVERIFY(nodeA.listen(path));
+
+    QXmppCluster nodeB("node-b");
+    nodeB.setSecret("secret");
+    QEventLoop loop;
+    connect(&nodeB, SIGNAL(nodeConnected(QString)),
+            &loop, SLOT(quit()));
+    nodeB.addNode(path);
+    loop.exec();
+
+    QSignalSpy replacedA(&nodeA, SIGNAL(sessionReplaced(QString)));
+    QSignalSpy replacedB(&nodeB, SIGNAL(sessionReplaced(QString)));
+    nodeA.addSession("foo@example.com/res1");
+    QTimer::singleShot(100, &loop, SLOT(quit()));
+    loop.exec();
+    QCOMPARE(nodeB.sessionNode("foo@example.com/res1"), QString("node-a"));
+
+    // binding the same full JID on another node replaces the older session
+    nodeB.addSession("foo@example.com/res1");
+    QTimer::singleShot(100, &loop, SLOT(quit()));
+    loop.exec();
+    QCOMPARE(replacedA.size(), 1);
+    QCOMPARE(replacedA[0][0].toString(), QString("foo@example.com/res1"));
+    QCOMPARE(replacedB.size(), 0);
+    QCOMPARE(nodeA.sessionNode("foo@example.com/res1"), QString("node-b"));
+    QCOMPARE(nodeB.sessionNode("foo@example.com/res1"), QString());
+
+    // the replaced session no longer withdraws the new one
+    nodeA.removeSession("foo@example.com/res1");
+    QTimer::singleShot(100, &loop, SLOT(quit()));
+    loop.exec();
+    QCOMPARE(nodeA.sessionNode("foo@example.com/res1"), QString("node-b"));
+}
+
+void tst_QXmppCluster::testRouting()
+{
+    const QString path = QDir::temp().filePath("qxmpp-cluster-test");
+
+    QXmppCluster nodeA("node-a");
+    nodeA.setSecret("secret");
+    QVERIFY(nodeA.listen(path));
+
+    QXmppCluster nodeB("node-b");
+    nodeB.setSecret("secret");
+    QEventLoop loop;
+    connect(&nodeB, SIGNAL(nodeConnected(QString)),
+            &loop, SLOT(quit()));
+    nodeB.addNode(path);
+    loop.exec();
+    QCOMPARE(nodeB.nodes(), QStringList() << "node-a");
+
+    // session directory is replicated
+    nodeA.addSession("foo@example.com/res1");
+    QTimer::singleShot(100, &loop, SLOT(quit()));
+    loop.exec();
+    QCOMPARE(nodeB.sessionNode("foo@example.com/res1"), QString("node-a"));
+    QCOMPARE(nodeB.sessionNode("bar@example.com/res1"), QString());
+
+    // data is forwarded to the node holding the session
+    QSignalSpy spy(&nodeA, SIGNAL(dataReceived(QString,QByteArray)));
+    QVERIFY(nodeB.sendData("foo@example.com", "<message/>"));
+    QVERIFY(!nodeB.sendData("bar@example.com", "<message/>"));
+    QTimer::singleShot(100, &loop, SLOT(quit()));
+    loop.exec();
+    QCOMPARE(spy.count(), 1);
+    QCOMPARE(spy.at(0).at(0).toString(), QString("foo@example.com"));
+    QCOMPARE(spy.at(0).at(1).toByteArray(), QByteArray("<message/>"));
+
+    // sessions are dropped when they end
+    nodeA.removeSession("foo@example.com/res1");
+    QTimer::singleShot(100, &loop, SLOT(quit()));
+    loop.exec();
+    QCOMPARE(nodeB.sessionNode("foo@example.com/res1"), QString());
+}
+
+void tst_QXmppCluster::testServerRouting()
+{
+    const QString path = QDir::temp().filePath("qxmpp-cluster-test");
+    const QString jid("alice@localhost/QXmpp");
+    TestPasswordChecker passwordChecker;
+
+    QXmppCluster clusterA("node-a");
+    clusterA.setSecret("secret");
+    QVERIFY(clusterA.listen(path));
+    QXmppServer serverA;
+    serverA.setDomain("localhost");
+    serverA.setPasswordChecker(&passwordChecker);
+    serverA.setCluster(&clusterA);
+    QVERIFY(serverA.listenForClients(QHostAddress::LocalHost, 12345));
+
+    QXmppCluster clusterB("node-b");
+    clusterB.setSecret("secret");
+    QXmppServer serverB;
+    serverB.setDomain("localhost");
+    serverB.setPasswordChecker(&passwordChecker);
+    serverB.setCluster(&clusterB);
+    QVERIFY(serverB.listenForClients(QHostAddress::LocalHost, 12346));
+
+    QEventLoop loop;
+    connect(&clusterB, SIGNAL(nodeConnected(QString)),
+            &loop, SLOT(quit()));
+    clusterB.addNode(path);
+    loop.exec();
+
+    // a client connects to the first node
+    QXmppClient client;
+    TestMessageCollector collector;
+    connect(&client, SIGNAL(messageReceived(QXmppMessage)),
+            &collector, SLOT(messageReceived(QXmppMessage)));
+    connect(&client, SIGNAL(connected()),
+            &loop, SLOT(quit()));
+    connect(&client, SIGNAL(disconnected()),
+            &loop, SLOT(quit()));
+    QXmppConfiguration config;
+    config.setDomain("localhost");
+    config.setHost("127.0.0.1");
+    config.setPort(12345);
+    config.setUser("alice");
+    config.setPassword("testpwd");
+    client.connectToServer(config);
+    loop.exec();
+    QVERIFY(client.isConnected());
+    for (int i = 0; i < 100 && clusterB.sessionNode(jid).isEmpty(); ++i)
+        QTest::qWait(10);
+    QCOMPARE(clusterB.sessionNode(jid), QString("node-a"));
+
+    // stanzas routed by the second node reach the client
+    QXmppMessage message;
+    message.setFrom("localhost");
+    message.setTo(jid);
+    message.setBody("full");
+    QVERIFY(serverB.sendPacket(message));
+    message.setTo("alice@localhost");
+    message.setBody("bare");
+    QVERIFY(serverB.sendPacket(message));
+    for (int i = 0; i < 100 && collector.messages.size() < 2; ++i)
+        QTest::qWait(10);
+    QCOMPARE(collector.messages.size(), 2);
+    QCOMPARE(collector.messages[0].body(), QString("full"));
+    QCOMPARE(collector.messages[1].body(), QString("bare"));
+
+    // binding the same full JID on the second node closes the older session
+    QXmppClient other;
+    config.setPort(12346);
+    other.connectToServer(config);
+    loop.exec();
+    QVERIFY(!client.isConnected());
+    for (int i = 0; i < 100 && !other.isConnected(); ++i)
+        QTest::qWait(10);
+    QVERIFY(other.isConnected());
+    for (int i = 0; i < 100 && clusterA.sessionNode(jid).isEmpty(); ++i)
+        QTest::qWait(10);
+    QCOMPARE(clusterA.sessionNode(jid), QString("node-b"));
+
+    other.disconnectFromServer();
+    serverA.close();
+    serverB.close();
+}
+
+QTEST_MAIN(tst_QXmppCluster)
+#include "tst_qxmppcluster.moc"
@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmppconnector
+SOURCES += tst_qxmppconnector.cpp
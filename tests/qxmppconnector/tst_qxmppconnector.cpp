@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QTime>
+#include <QObject>
+#include <QTcpServer>
+
+#include "QXmppOutgoingClient_p.h"
+#include "util.h"
+
+class TestConnectorCollector : public QObject
+{
+    Q_OBJECT
+
+public:
+    TestConnectorCollector() : failed(false), port(0) {};
+
+public slots:
+    void connected(const QHostAddress &address, quint16 port)
+    {
+        this->address = address;
+        this->port = port;
+    };
+
+    void failedSlot()
+    {
+        failed = true;
+    };
+
+public:
+    bool failed;
+    QHostAddress address;
+    quint16 port;
+};
+
+class tst_QXmppConnector : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testConnect();
+    void testFailed();
+};
+
+/// Returns a local port on which nothing listens.
+
+static quint16 deadPort()
+{
+    QTcpServer server;
+    server.listen(QHostAddress::LocalHost);
+    return server.serverPort();
+}
+
+void tst_QXmppConnector::testConnect()
+{
+    QTcpServer live;
+    QVERIFY(live.listen(QHostAddress::LocalHost));
+
+    // a server which never accepts, once its backlog is full further
+    // connection attempts hang
+    QTcpServer slow;
+    slow.setMaxPendingConnections(1);
+    QVERIFY(slow.listen(QHostAddress::LocalHost));
+    QList<QTcpSocket*> fillers;
+    for (int i = 0; i < 128; ++i) {
+        QTcpSocket *socket = new QTcpSocket;
+        socket->connectToHost(QHostAddress::LocalHost, slow.serverPort());
+        fillers << socket;
+    }
+    QTest::qWait(200);
+
+    QXmppConnector connector;
+    connector.setAttemptDelay(100);
+    TestConnectorCollector collector;
+    connect(&connector, SIGNAL(connected(QHostAddress,quint16)),
+            &collector, SLOT(connected(QHostAddress,quint16)));
+    connect(&connector, SIGNAL(failed()),
+            &collector, SLOT(failedSlot()));
+
+    // a slow target, a dead target and a live target, which is looked
+    // up by name
+    QList<QPair<QString, quint16> > hosts;
+    hosts << qMakePair(QString("127.0.0.1"), slow.serverPort());
+    hosts << qMakePair(QString("127.0.0.1"), deadPort());
+    hosts << qMakePair(QString("localhost"), live.serverPort());
+
+    QTime timer;
+    timer.start();
+    connector.connectToHosts(hosts);
+    QVERIFY(connector.isActive());
+    for (int i = 0; i < 200 && !collector.port && !collector.failed; ++i)
+        QTest::qWait(10);
+
+    // the live target wins without waiting for the slow one to time out
+    QVERIFY(!collector.failed);
+    QCOMPARE(collector.address, QHostAddress(QHostAddress::LocalHost));
+    QCOMPARE(collector.port, live.serverPort());
+    QVERIFY(timer.elapsed() < 2000);
+    QVERIFY(!connector.isActive());
+    qDeleteAll(fillers);
+}
+
+void tst_QXmppConnector::testFailed()
+{
+    QXmppConnector connector;
+    TestConnectorCollector collector;
+    connect(&connector, SIGNAL(failed()),
+            &collector, SLOT(failedSlot()));
+
+    QList<QPair<QString, quint16> > hosts;
+    hosts << qMakePair(QString("127.0.0.1"), deadPort());
+    hosts << qMakePair(QString("127.0.0.1"), deadPort());
+    connector.connectToHosts(hosts);
+    for (int i = 0; i < 200 && !collector.failed; ++i)
+        QTest::qWait(10);
+    QVERIFY(collector.failed);
+    QVERIFY(!connector.isActive());
+}
+
+QTEST_MAIN(tst_QXmppConnector)
+#include "tst_qxmppconnector.moc"
@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmppmucservice
+SOURCES += tst_qxmppmucservice.cpp
@@ -0,0 +1,319 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QSignalSpy>
+
+#include "QXmppClient.h"
+#include "QXmppMessage.h"
+#include "QXmppMucManager.h"
+#include "QXmppMucService.h"
+#include "QXmppServer.h"
+#include "passwordchecker.h"
+#include "util.h"
+
+class TestMessageCollector : public QObject
+{
+    Q_OBJECT
+
+public slots:
+    void messageReceived(const QXmppMessage &message)
+    {
+        messages << message;
+    }
+
+public:
+    QList<QXmppMessage> messages;
+};
+
+class tst_QXmppMucService : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testParticipants();
+    void testRoom();
+    void testServerDisconnected();
+    void testSubject();
+
+private:
+    QXmppMucRoom *joinRoom(QXmppClient *client, const QString &username);
+};
+
+QXmppMucRoom *tst_QXmppMucService::joinRoom(QXmppClient *client, const QString &username)
+{
+    QXmppMucManager *manager = new QXmppMucManager;
+    client->addExtension(manager);
+
+    QEventLoop loop;
+    connect(client, SIGNAL(connected()),
+            &loop, SLOT(quit()));
+    QXmppConfiguration config;
+    config.setDomain("localhost");
+    config.setHost("127.0.0.1");
+    config.setPort(12345);
+    config.setUser(username);
+    config.setPassword("testpwd");
+    client->connectToServer(config);
+    loop.exec();
+    if (!client->isConnected())
+        return 0;
+
+    QXmppMucRoom *room = manager->addRoom("room@conference.localhost");
+    connect(room, SIGNAL(joined()),
+            &loop, SLOT(quit()));
+    room->setNickName(username);
+    room->join();
+    loop.exec();
+    return room;
+}
+
+void tst_QXmppMucService::testParticipants()
+{
+    TestPasswordChecker passwordChecker;
+
+    QXmppServer server;
+    server.setDomain("localhost");
+    server.setPasswordChecker(&passwordChecker);
+    server.addExtension(new QXmppMucService);
+    QVERIFY(server.listenForClients(QHostAddress::LocalHost, 12345));
+
+    QXmppClient client1;
+    QXmppMucRoom *room1 = joinRoom(&client1, "alice");
+    QVERIFY(room1);
+
+    // joining again does nothing, and changes are still reported
+    QSignalSpy joinedChangedSpy(room1, SIGNAL(participantsChanged()));
+    QVERIFY(!room1->join());
+    QXmppClient client2;
+    QXmppMucRoom *room2 = joinRoom(&client2, "bob");
+    QVERIFY(room2);
+    for (int i = 0; i < 100 && joinedChangedSpy.isEmpty(); ++i)
+        QTest::qWait(10);
+    QCOMPARE(joinedChangedSpy.size(), 1);
+
+    // the occupants present when joining are reported at once
+    QXmppClient client3;
+    QXmppMucManager *manager = new QXmppMucManager;
+    client3.addExtension(manager);
+    QEventLoop loop;
+    connect(&client3, SIGNAL(connected()),
+            &loop, SLOT(quit()));
+    QXmppConfiguration config;
+    config.setDomain("localhost");
+    config.setHost("127.0.0.1");
+    config.setPort(12345);
+    config.setUser("carol");
+    config.setPassword("testpwd");
+    client3.connectToServer(config);
+    loop.exec();
+    QVERIFY(client3.isConnected());
+
+    QXmppMucRoom *room3 = manager->addRoom("room@conference.localhost");
+    QSignalSpy addedSpy(room3, SIGNAL(participantAdded(QString)));
+    QSignalSpy changedSpy(room3, SIGNAL(participantsChanged()));
+    QSignalSpy receivedSpy(room3, SIGNAL(participantsReceived(QStringList)));
+    connect(room3, SIGNAL(joined()),
+            &loop, SLOT(quit()));
+    room3->setNickName("carol");
+    QVERIFY(room3->join());
+    loop.exec();
+
+    const QStringList expected = QStringList()
+        << "room@conference.localhost/alice"
+        << "room@conference.localhost/bob"
+        << "room@conference.localhost/carol";
+    QCOMPARE(addedSpy.size(), 3);
+    QCOMPARE(changedSpy.size(), 1);
+    QCOMPARE(receivedSpy.size(), 1);
+    QCOMPARE(receivedSpy[0][0].toStringList(), expected);
+    QCOMPARE(room3->participants(), expected);
+    QCOMPARE(room3->participantPresences().size(), 3);
+
+    // participants are indexed by role and affiliation
+    QCOMPARE(room3->participantsWithAffiliation(QXmppMucItem::OwnerAffiliation),
+             QStringList() << "room@conference.localhost/alice");
+    QCOMPARE(room3->participantsWithRole(QXmppMucItem::ModeratorRole),
+             QStringList() << "room@conference.localhost/alice");
+    QCOMPARE(room3->participantsWithRole(QXmppMucItem::ParticipantRole).size(), 2);
+
+    // leaving updates the indexes
+    connect(room3, SIGNAL(participantRemoved(QString)),
+            &loop, SLOT(quit()));
+    room1->leave();
+    loop.exec();
+    QCOMPARE(room3->participants(), expected.mid(1));
+    QVERIFY(room3->participantsWithRole(QXmppMucItem::ModeratorRole).isEmpty());
+    QCOMPARE(changedSpy.size(), 2);
+}
+
+void tst_QXmppMucService::testRoom()
+{
+    TestPasswordChecker passwordChecker;
+
+    QXmppMucService *service = new QXmppMucService;
+    service->setHistorySize(1);
+
+    QXmppServer server;
+    server.setDomain("localhost");
+    server.setPasswordChecker(&passwordChecker);
+    server.addExtension(service);
+    QVERIFY(server.listenForClients(QHostAddress::LocalHost, 12345));
+
+    // the first occupant creates the room
+    QXmppClient client1;
+    QXmppMucRoom *room1 = joinRoom(&client1, "alice");
+    QVERIFY(room1);
+    QVERIFY(room1->isJoined());
+    QCOMPARE(service->rooms(), QStringList() << "room@conference.localhost");
+    QCOMPARE(room1->allowedActions() & QXmppMucRoom::ConfigurationAction, QXmppMucRoom::ConfigurationAction);
+    QVERIFY(room1->sendMessage("first"));
+    QVERIFY(room1->sendMessage("second"));
+
+    // the second occupant receives the occupant list and the history
+    QXmppClient client2;
+    TestMessageCollector history;
+    connect(&client2, SIGNAL(messageReceived(QXmppMessage)),
+            &history, SLOT(messageReceived(QXmppMessage)));
+    QXmppMucRoom *room2 = joinRoom(&client2, "bob");
+    QVERIFY(room2);
+    QCOMPARE(room2->participants().size(), 2);
+    QCOMPARE(service->occupants("room@conference.localhost").size(), 2);
+
+    QEventLoop loop;
+    QTimer::singleShot(100, &loop, SLOT(quit()));
+    loop.exec();
+    QCOMPARE(history.messages.size(), 1);
+    QCOMPARE(history.messages[0].body(), QString("second"));
+    QVERIFY(history.messages[0].stamp().isValid());
+
+    // a message is broadcast to every occupant
+    TestMessageCollector collector1;
+    connect(room1, SIGNAL(messageReceived(QXmppMessage)),
+            &collector1, SLOT(messageReceived(QXmppMessage)));
+    TestMessageCollector collector2;
+    connect(room2, SIGNAL(messageReceived(QXmppMessage)),
+            &collector2, SLOT(messageReceived(QXmppMessage)));
+    QVERIFY(room2->sendMessage("hello"));
+    QTimer::singleShot(100, &loop, SLOT(quit()));
+    loop.exec();
+    QCOMPARE(collector1.messages.size(), 1);
+    QCOMPARE(collector2.messages.size(), 1);
+    const QXmppMessage message = collector1.messages[0];
+    QCOMPARE(message.from(), QString("room@conference.localhost/bob"));
+    QCOMPARE(message.to(), QString("alice@localhost/QXmpp"));
+    QCOMPARE(message.body(), QString("hello"));
+
+    // the room is destroyed when the last occupant leaves
+    connect(room1, SIGNAL(participantRemoved(QString)),
+            &loop, SLOT(quit()));
+    room2->leave();
+    loop.exec();
+    QCOMPARE(room1->participants().size(), 1);
+    connect(room1, SIGNAL(left()),
+            &loop, SLOT(quit()));
+    room1->leave();
+    loop.exec();
+    QCOMPARE(service->rooms(), QStringList());
+}
+
+void tst_QXmppMucService::testServerDisconnected()
+{
+    TestPasswordChecker passwordChecker;
+
+    QXmppMucService *service = new QXmppMucService;
+
+    QXmppServer server;
+    server.setDomain("localhost");
+    server.setPasswordChecker(&passwordChecker);
+    server.addExtension(service);
+    QVERIFY(server.listenForClients(QHostAddress::LocalHost, 12345));
+
+    QXmppClient client1;
+    QXmppMucRoom *room1 = joinRoom(&client1, "alice");
+    QVERIFY(room1);
+    QCOMPARE(service->occupants("room@conference.localhost").size(), 1);
+
+    // occupants from other domains are kept
+    QVERIFY(QMetaObject::invokeMethod(service, "_q_serverDisconnected",
+                                      Q_ARG(QString, "example.com")));
+    QCOMPARE(service->occupants("room@conference.localhost").size(), 1);
+
+    // occupants from the disconnected domain are removed
+    QVERIFY(QMetaObject::invokeMethod(service, "_q_serverDisconnected",
+                                      Q_ARG(QString, "localhost")));
+    QCOMPARE(service->occupants("room@conference.localhost"), QStringList());
+    QCOMPARE(service->rooms(), QStringList());
+}
+
+void tst_QXmppMucService::testSubject()
+{
+    TestPasswordChecker passwordChecker;
+
+    QXmppMucService *service = new QXmppMucService;
+    QVERIFY(!service->isSubjectChangeAllowed());
+
+    QXmppServer server;
+    server.setDomain("localhost");
+    server.setPasswordChecker(&passwordChecker);
+    server.addExtension(service);
+    QVERIFY(server.listenForClients(QHostAddress::LocalHost, 12345));
+
+    QXmppClient client1;
+    QXmppMucRoom *room1 = joinRoom(&client1, "alice");
+    QVERIFY(room1);
+    QXmppClient client2;
+    QXmppMucRoom *room2 = joinRoom(&client2, "bob");
+    QVERIFY(room2);
+
+    // the moderator may change the subject
+    QEventLoop loop;
+    connect(room2, SIGNAL(subjectChanged(QString)),
+            &loop, SLOT(quit()));
+    room1->setSubject("first");
+    loop.exec();
+    QCOMPARE(room2->subject(), QString("first"));
+
+    // a participant may not
+    TestMessageCollector collector;
+    connect(&client2, SIGNAL(messageReceived(QXmppMessage)),
+            &collector, SLOT(messageReceived(QXmppMessage)));
+    connect(&client2, SIGNAL(messageReceived(QXmppMessage)),
+            &loop, SLOT(quit()));
+    room2->setSubject("second");
+    loop.exec();
+    QCOMPARE(collector.messages.size(), 1);
+    QCOMPARE(collector.messages[0].type(), QXmppMessage::Error);
+    QCOMPARE(collector.messages[0].error().condition(), QXmppStanza::Error::Forbidden);
+    QCOMPARE(room1->subject(), QString("first"));
+
+    // unless the service allows it
+    service->setSubjectChangeAllowed(true);
+    connect(room1, SIGNAL(subjectChanged(QString)),
+            &loop, SLOT(quit()));
+    room2->setSubject("second");
+    loop.exec();
+    QCOMPARE(room1->subject(), QString("second"));
+}
+
+QTEST_MAIN(tst_QXmppMucService)
+#include "tst_qxmppmucservice.moc"
@@ -33,6 +33,8 @@ private slots:
     void testItems();
     void testItemsResponse();
     void testPublish();
+    void testQueryType_data();
+    void testQueryType();
     void testSubscribe();
     void testSubscription();
     void testSubscriptions();
@@ -135,6 +137,41 @@ void tst_QXmppPubSubIq::testPublish()
     serializePacket(iq, xml);
 }
 
+void tst_QXmppPubSubIq::testQueryType_data()
+{
+    QTest::addColumn<QByteArray>("xml");
+    QTest::addColumn<int>("queryType");
+
+    QTest::newRow("affiliations")
+        << QByteArray("<affiliations/>")
+        << int(QXmppPubSubIq::AffiliationsQuery);
+    QTest::newRow("default")
+        << QByteArray("<default/>")
+        << int(QXmppPubSubIq::DefaultQuery);
+    QTest::newRow("unsubscribe")
+        << QByteArray("<unsubscribe jid=\"francisco@denmark.lit\" node=\"princely_musings\"/>")
+        << int(QXmppPubSubIq::UnsubscribeQuery);
+}
+
+void tst_QXmppPubSubIq::testQueryType()
+{
+    QFETCH(QByteArray, xml);
+    QFETCH(int, queryType);
+
+    const QByteArray iqXml = "<iq"
+        " id=\"query1\""
+        " to=\"pubsub.shakespeare.lit\""
+        " from=\"francisco@denmark.lit/barracks\""
+        " type=\"get\">"
+        "<pubsub xmlns=\"http://jabber.org/protocol/pubsub\">" + xml + "</pubsub>"
+        "</iq>";
+
+    QXmppPubSubIq iq;
+    parsePacket(iq, iqXml);
+    QCOMPARE(int(iq.queryType()), queryType);
+    serializePacket(iq, iqXml);
+}
+
 void tst_QXmppPubSubIq::testSubscribe()
 {
     const QByteArray xml(
@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmpppubsubservice
+SOURCES += tst_qxmpppubsubservice.cpp
@@ -0,0 +1,257 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QDir>
+#include <QFileInfo>
+
+#include "QXmppClient.h"
+#include "QXmppMessage.h"
+#include "QXmppPubSubIq.h"
+#include "QXmppPubSubService.h"
+#include "QXmppRosterService.h"
+#include "QXmppServer.h"
+#include "QXmppUtils.h"
+#include "passwordchecker.h"
+#include "util.h"
+
+class TestMessageCollector : public QObject
+{
+    Q_OBJECT
+
+public slots:
+    void messageReceived(const QXmppMessage &message)
+    {
+        messages << message;
+    }
+
+public:
+    QList<QXmppMessage> messages;
+};
+
+static QDomElement subscribeElement(QDomDocument &doc, const QString &from, const QString &to, const QString &node)
+{
+    QXmppPubSubIq iq;
+    iq.setType(QXmppIq::Set);
+    iq.setFrom(from);
+    iq.setTo(to);
+    iq.setQueryType(QXmppPubSubIq::SubscribeQuery);
+    iq.setQueryJid(from);
+    iq.setQueryNode(node);
+
+    QByteArray data;
+    QXmlStreamWriter writer(&data);
+    iq.toXml(&writer);
+    doc.setContent(data, true);
+    return doc.documentElement();
+}
+
+static QDomElement publishElement(QDomDocument &doc, const QString &from, const QString &node, const QString &id, const QString &text)
+{
+    QXmppElement payload;
+    payload.setTagName("entry");
+    payload.setAttribute("xmlns", "urn:example:news");
+    payload.setValue(text);
+
+    QXmppPubSubItem item;
+    item.setId(id);
+    item.setContents(payload);
+
+    QXmppPubSubIq iq;
+    iq.setType(QXmppIq::Set);
+    iq.setFrom(from);
+    iq.setTo("pubsub.localhost");
+    iq.setQueryType(QXmppPubSubIq::PublishQuery);
+    iq.setQueryNode(node);
+    iq.setItems(QList<QXmppPubSubItem>() << item);
+
+    QByteArray data;
+    QXmlStreamWriter writer(&data);
+    iq.toXml(&writer);
+    doc.setContent(data, true);
+    return doc.documentElement();
+}
+
+class tst_QXmppPubSubService : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testAccess();
+    void testPublish();
+    void testStore();
+};
+
+void tst_QXmppPubSubService::testPublish()
+{
+    const QString path = QDir::temp().filePath("qxmpp-pubsub-publish.db");
+    QFile::remove(path);
+
+    TestPasswordChecker passwordChecker;
+    QXmppPubSubService *service = new QXmppPubSubService;
+    service->setStoragePath(path);
+
+    QXmppServer server;
+    server.setDomain("localhost");
+    server.setPasswordChecker(&passwordChecker);
+    server.addExtension(service);
+    QVERIFY(server.listenForClients(QHostAddress::LocalHost, 12345));
+
+    // connect client
+    QXmppClient client;
+    TestMessageCollector collector;
+    connect(&client, SIGNAL(messageReceived(QXmppMessage)),
+            &collector, SLOT(messageReceived(QXmppMessage)));
+
+    QEventLoop loop;
+    connect(&client, SIGNAL(connected()),
+            &loop, SLOT(quit()));
+    QXmppConfiguration config;
+    config.setDomain("localhost");
+    config.setHost("127.0.0.1");
+    config.setPort(12345);
+    config.setUser("alice");
+    config.setPassword("testpwd");
+    client.connectToServer(config);
+    loop.exec();
+    QVERIFY(client.isConnected());
+
+    // subscribing to a missing node fails
+    QXmppPubSubIq subscribe;
+    subscribe.setType(QXmppIq::Set);
+    subscribe.setTo("pubsub.localhost");
+    subscribe.setQueryType(QXmppPubSubIq::SubscribeQuery);
+    subscribe.setQueryJid("alice@localhost/QXmpp");
+    subscribe.setQueryNode("news");
+    QVERIFY(client.sendPacket(subscribe));
+    QTimer::singleShot(100, &loop, SLOT(quit()));
+    loop.exec();
+    QCOMPARE(service->subscribers("pubsub.localhost", "news"), QStringList());
+
+    // publish an item
+    QDomDocument doc;
+    server.handleElement(publishElement(doc, "bob@localhost/QXmpp", "news", "item1", "Hello"));
+
+    // subscribe, the last item is sent
+    subscribe.setId(QXmppUtils::generateStanzaHash());
+    QVERIFY(client.sendPacket(subscribe));
+    QTimer::singleShot(100, &loop, SLOT(quit()));
+    loop.exec();
+    QCOMPARE(service->subscribers("pubsub.localhost", "news"), QStringList() << "alice@localhost/QXmpp");
+    QCOMPARE(collector.messages.size(), 1);
+    QCOMPARE(collector.messages[0].from(), QString("pubsub.localhost"));
+    QCOMPARE(collector.messages[0].type(), QXmppMessage::Headline);
+
+    // publish another item
+    server.handleElement(publishElement(doc, "bob@localhost/QXmpp", "news", "item2", "World"));
+    QTimer::singleShot(100, &loop, SLOT(quit()));
+    loop.exec();
+    QCOMPARE(collector.messages.size(), 2);
+
+    // only the creator of the node can publish
+    server.handleElement(publishElement(doc, "mallory@localhost/QXmpp", "news", "item3", "Spam"));
+    QTimer::singleShot(100, &loop, SLOT(quit()));
+    loop.exec();
+    QCOMPARE(collector.messages.size(), 2);
+
+    server.close();
+    QFile::remove(path);
+}
+
+void tst_QXmppPubSubService::testStore()
+{
+    const QString path = QDir::temp().filePath("qxmpp-pubsub-store.db");
+    QFile::remove(path);
+
+    QXmppPubSubService *service = new QXmppPubSubService;
+    service->setMaxItems(1);
+    service->setStoragePath(path);
+
+    QXmppServer server;
+    server.setDomain("localhost");
+    server.addExtension(service);
+    QVERIFY(server.listenForClients(QHostAddress::LocalHost, 12345));
+
+    // publish, then subscribe
+    const QString text(4096, QLatin1Char('x'));
+    QDomDocument doc;
+    server.handleElement(publishElement(doc, "bob@localhost/QXmpp", "news", "item", text));
+    server.handleElement(subscribeElement(doc, "alice@localhost/QXmpp", "pubsub.localhost", "news"));
+
+    // overwrite the same item until the store gets compacted
+    for (int i = 0; i < 500; ++i)
+        server.handleElement(publishElement(doc, "bob@localhost/QXmpp", "news", QString("item%1").arg(i), text));
+    QVERIFY(QFileInfo(path).size() < 1024 * 1024);
+    server.close();
+
+    // reload the store
+    QXmppPubSubService reloaded;
+    reloaded.setJid("pubsub.localhost");
+    reloaded.setStoragePath(path);
+    QVERIFY(reloaded.start());
+    QCOMPARE(reloaded.subscribers("pubsub.localhost", "news"), QStringList() << "alice@localhost/QXmpp");
+    reloaded.stop();
+    QFile::remove(path);
+}
+
+void tst_QXmppPubSubService::testAccess()
+{
+    QXmppPubSubService *service = new QXmppPubSubService;
+    QXmppRosterService *roster = new QXmppRosterService;
+
+    QXmppServer server;
+    server.setDomain("localhost");
+    server.addExtension(roster);
+    server.addExtension(service);
+    QVERIFY(server.listenForClients(QHostAddress::LocalHost, 12345));
+
+    // bob has a "from" subscription to alice, carol only a "to" subscription
+    QXmppRosterIq::Item item;
+    item.setBareJid("bob@localhost");
+    item.setSubscriptionType(QXmppRosterIq::Item::From);
+    roster->setItem("alice@localhost", item);
+    item.setBareJid("carol@localhost");
+    item.setSubscriptionType(QXmppRosterIq::Item::To);
+    roster->setItem("alice@localhost", item);
+
+    // alice publishes to her personal node
+    QDomDocument doc;
+    QDomElement element = publishElement(doc, "alice@localhost/QXmpp", "urn:example:mood", "current", "happy");
+    element.setAttribute("to", "localhost");
+    server.handleElement(element);
+
+    // the owner and presence subscribers may subscribe
+    server.handleElement(subscribeElement(doc, "alice@localhost/QXmpp", "alice@localhost", "urn:example:mood"));
+    server.handleElement(subscribeElement(doc, "bob@localhost/QXmpp", "alice@localhost", "urn:example:mood"));
+    server.handleElement(subscribeElement(doc, "carol@localhost/QXmpp", "alice@localhost", "urn:example:mood"));
+    server.handleElement(subscribeElement(doc, "mallory@localhost/QXmpp", "alice@localhost", "urn:example:mood"));
+    QStringList subscribers = service->subscribers("alice@localhost", "urn:example:mood");
+    subscribers.sort();
+    QCOMPARE(subscribers, QStringList() << "alice@localhost/QXmpp" << "bob@localhost/QXmpp");
+
+    // subscribing does not create nodes
+    server.handleElement(subscribeElement(doc, "alice@localhost/QXmpp", "alice@localhost", "urn:example:tune"));
+    QCOMPARE(service->subscribers("alice@localhost", "urn:example:tune"), QStringList());
+}
+
+QTEST_MAIN(tst_QXmppPubSubService)
+#include "tst_qxmpppubsubservice.moc"
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QSignalSpy>
+
+#include "QXmppClient.h"
+#include "QXmppRosterManager.h"
+#include "QXmppServer.h"
+#include "passwordchecker.h"
+#include "util.h"
+
+class tst_QXmppRosterManager : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testPresences();
+};
+
+static bool connectClient(QXmppClient *client, const QString &user, const QString &resource = QLatin1String("QXmpp"))
+{
+    QEventLoop loop;
+    QObject::connect(client, SIGNAL(connected()),
+                     &loop, SLOT(quit()));
+    QObject::connect(client, SIGNAL(disconnected()),
+                     &loop, SLOT(quit()));
+    QXmppConfiguration config;
+    config.setDomain("localhost");
+    config.setHost("127.0.0.1");
+    config.setPort(12345);
+    config.setUser(user);
+    config.setPassword("testpwd");
+    config.setResource(resource);
+    client->connectToServer(config);
+    loop.exec();
+    return client->isConnected();
+}
+
+void tst_QXmppRosterManager::testPresences()
+{
+    TestPasswordChecker passwordChecker;
+
+    QXmppServer server;
+    server.setDomain("localhost");
+    server.setPasswordChecker(&passwordChecker);
+    QVERIFY(server.listenForClients(QHostAddress::LocalHost, 12345));
+
+    QXmppClient bob;
+    QXmppRosterManager *roster = new QXmppRosterManager(&bob);
+    bob.addExtension(roster);
+    QSignalSpy changedSpy(roster, SIGNAL(presenceChanged(QString,QString)));
+    QSignalSpy batchSpy(roster, SIGNAL(presencesChanged(QStringList)));
+    QVERIFY(connectClient(&bob, "bob"));
+
+    QXmppClient alice, aliceOther, carol;
+    QVERIFY(connectClient(&alice, "alice", "zeta"));
+    QVERIFY(connectClient(&aliceOther, "alice", "alpha"));
+    QVERIFY(connectClient(&carol, "carol"));
+
+    QXmppPresence presence;
+    presence.setTo("bob@localhost/QXmpp");
+    for (int i = 0; i < 10; ++i) {
+        presence.setStatusText(QString::number(i));
+        QVERIFY(alice.sendPacket(presence));
+        QVERIFY(carol.sendPacket(presence));
+    }
+    QVERIFY(aliceOther.sendPacket(presence));
+    for (int i = 0; i < 100 && changedSpy.size() < 21; ++i)
+        QTest::qWait(10);
+    QTest::qWait(10);
+    QCOMPARE(changedSpy.size(), 21);
+
+    // resources are listed in sorted order
+    QCOMPARE(roster->getResources("alice@localhost"), QStringList() << "alpha" << "zeta");
+    QCOMPARE(roster->getAllPresencesForBareJid("alice@localhost").keys(), QStringList() << "alpha" << "zeta");
+    QCOMPARE(roster->getResources("carol@localhost"), QStringList() << "QXmpp");
+    QCOMPARE(roster->getPresence("alice@localhost", "zeta").statusText(), QString("9"));
+
+    // each batch lists a bareJid once, and all changes are reported
+    QVERIFY(batchSpy.size() <= changedSpy.size());
+    QSet<QString> changed;
+    for (int i = 0; i < batchSpy.size(); ++i) {
+        const QStringList bareJids = batchSpy[i][0].toStringList();
+        QCOMPARE(bareJids.toSet().size(), bareJids.size());
+        changed += bareJids.toSet();
+    }
+    QVERIFY(changed.contains("alice@localhost"));
+    QVERIFY(changed.contains("carol@localhost"));
+
+    // going offline removes the resource
+    presence.setType(QXmppPresence::Unavailable);
+    QVERIFY(alice.sendPacket(presence));
+    QVERIFY(aliceOther.sendPacket(presence));
+    for (int i = 0; i < 100 && !roster->getResources("alice@localhost").isEmpty(); ++i)
+        QTest::qWait(10);
+    QVERIFY(roster->getResources("alice@localhost").isEmpty());
+    QVERIFY(roster->getAllPresencesForBareJid("alice@localhost").isEmpty());
+    QCOMPARE(roster->getPresence("alice@localhost", "zeta").type(), QXmppPresence::Unavailable);
+}
+
+QTEST_MAIN(tst_QXmppRosterManager)
+#include "tst_qxmpprostermanager.moc"
@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmpprosterservice
+SOURCES += tst_qxmpprosterservice.cpp
@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+
+#include <QDir>
+#include <QSignalSpy>
+
+#include "QXmppClient.h"
+#include "QXmppRosterManager.h"
+#include "QXmppRosterService.h"
+#include "QXmppServer.h"
+#include "QXmppStreamFeatures.h"
+#include "passwordchecker.h"
+#include "util.h"
+
+static QXmppRosterIq::Item rosterItem(const QString &bareJid, QXmppRosterIq::Item::SubscriptionType type)
+{
+    QXmppRosterIq::Item item;
+    item.setBareJid(bareJid);
+    item.setSubscriptionType(type);
+    return item;
+}
+
+class tst_QXmppRosterService : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testVersioning();
+};
+
+void tst_QXmppRosterService::testVersioning()
+{
+    const QString cachePath = QDir::temp().filePath("qxmpp-roster.cache");
+    QFile::remove(cachePath);
+
+    TestPasswordChecker passwordChecker;
+    QXmppRosterService *service = new QXmppRosterService;
+    service->setItem("bob@localhost", rosterItem("alice@localhost", QXmppRosterIq::Item::Both));
+    service->setItem("bob@localhost", rosterItem("carol@localhost", QXmppRosterIq::Item::To));
+    const QString version = service->version("bob@localhost");
+    QVERIFY(version.endsWith("-2"));
+    QCOMPARE(service->presenceSubscribers("bob@localhost/QXmpp"), QSet<QString>() << "alice@localhost");
+    QCOMPARE(service->presenceSubscriptions("bob@localhost"), QSet<QString>() << "alice@localhost" << "carol@localhost");
+
+    QXmppServer server;
+    server.setDomain("localhost");
+    server.setPasswordChecker(&passwordChecker);
+    server.addExtension(service);
+    QVERIFY(server.listenForClients(QHostAddress::LocalHost, 12345));
+
+    // the first connection fetches the full roster
+    QXmppClient client;
+    QXmppRosterManager *roster = new QXmppRosterManager(&client);
+    client.addExtension(roster);
+    roster->setCachePath(cachePath);
+    QSignalSpy removedSpy(roster, SIGNAL(itemRemoved(QString)));
+
+    QEventLoop loop;
+    connect(roster, SIGNAL(rosterReceived()),
+            &loop, SLOT(quit()));
+    connect(&client, SIGNAL(disconnected()),
+            &loop, SLOT(quit()));
+    QXmppConfiguration config;
+    config.setDomain("localhost");
+    config.setHost("127.0.0.1");
+    config.setPort(12345);
+    config.setUser("bob");
+    config.setPassword("testpwd");
+    client.connectToServer(config);
+    loop.exec();
+    QVERIFY(roster->isRosterReceived());
+    QCOMPARE(client.streamFeatures().rosterVersionMode(), QXmppStreamFeatures::Enabled);
+    QCOMPARE(roster->getRosterBareJids(), QStringList() << "alice@localhost" << "carol@localhost");
+    QCOMPARE(roster->rosterVersion(), version);
+
+    // the roster is cached when disconnecting
+    client.disconnectFromServer();
+    loop.exec();
+    QVERIFY(QFile::exists(cachePath));
+    QCOMPARE(roster->getRosterBareJids(), QStringList() << "alice@localhost" << "carol@localhost");
+
+    // changes while offline are pushed on the next connection
+    service->setItem("bob@localhost", rosterItem("dave@localhost", QXmppRosterIq::Item::None));
+    service->removeItem("bob@localhost", "carol@localhost");
+    const QString newVersion = service->version("bob@localhost");
+    QVERIFY(newVersion.endsWith("-4"));
+
+    client.connectToServer(config);
+    loop.exec();
+    QVERIFY(roster->isRosterReceived());
+    for (int i = 0; i < 100 && roster->rosterVersion() != newVersion; ++i)
+        QTest::qWait(10);
+    QCOMPARE(roster->rosterVersion(), newVersion);
+    QCOMPARE(roster->getRosterBareJids(), QStringList() << "alice@localhost" << "dave@localhost");
+    QCOMPARE(removedSpy.size(), 1);
+    QCOMPARE(removedSpy[0][0].toString(), QString("carol@localhost"));
+
+    client.disconnectFromServer();
+    loop.exec();
+    server.close();
+
+    // the cache is loaded straight away
+    QXmppClient offline;
+    QXmppRosterManager *cached = new QXmppRosterManager(&offline);
+    offline.addExtension(cached);
+    cached->setCachePath(cachePath);
+    QVERIFY(!cached->isRosterReceived());
+    QCOMPARE(cached->rosterVersion(), newVersion);
+    QCOMPARE(cached->getRosterBareJids(), QStringList() << "alice@localhost" << "dave@localhost");
+
+    // a restarted service has a new epoch, so it sends the full roster
+    QXmppRosterService *restarted = new QXmppRosterService;
+    restarted->setItem("bob@localhost", rosterItem("erin@localhost", QXmppRosterIq::Item::Both));
+    QVERIFY(restarted->version("bob@localhost") != newVersion);
+    QVERIFY(restarted->version("bob@localhost").endsWith("-1"));
+
+    QXmppServer restartedServer;
+    restartedServer.setDomain("localhost");
+    restartedServer.setPasswordChecker(&passwordChecker);
+    restartedServer.addExtension(restarted);
+    QVERIFY(restartedServer.listenForClients(QHostAddress::LocalHost, 12345));
+
+    connect(cached, SIGNAL(rosterReceived()),
+            &loop, SLOT(quit()));
+    connect(&offline, SIGNAL(disconnected()),
+            &loop, SLOT(quit()));
+    offline.connectToServer(config);
+    loop.exec();
+    QVERIFY(cached->isRosterReceived());
+    QCOMPARE(cached->rosterVersion(), restarted->version("bob@localhost"));
+    QCOMPARE(cached->getRosterBareJids(), QStringList() << "erin@localhost");
+
+    offline.disconnectFromServer();
+    loop.exec();
+    restartedServer.close();
+    QFile::remove(cachePath);
+}
+
+QTEST_MAIN(tst_QXmppRosterService)
+#include "tst_qxmpprosterservice.moc"
@@ -21,9 +21,28 @@
  *
  */
 
+#include <QCryptographicHash>
+#include <QDir>
+#include <QTcpSocket>
+#include <QTemporaryFile>
+#include <QThread>
+
 #include "QXmppClient.h"
+#include "QXmppClientExtension.h"
+#include "QXmppDiscoveryIq.h"
+#include "QXmppDialback.h"
+#include "QXmppDiscoveryManager.h"
+#include "QXmppIncomingServer.h"
+#include "QXmppLogger.h"
+#include "QXmppMessage.h"
+#include "QXmppOutgoingServer.h"
 #include "QXmppPasswordChecker.h"
+#include "QXmppPresence.h"
 #include "QXmppServer.h"
+#include "QXmppTracer.h"
+#include "QXmppTrafficRecorder.h"
+#include "QXmppVCardIq.h"
+#include "QXmppVCardManager.h"
 #include "util.h"
 
 class TestPasswordChecker : public QXmppPasswordChecker
@@ -64,15 +83,427 @@ private:
     QString m_password;
 };
 
+class TestMetricsLogger : public QXmppLogger
+{
+    Q_OBJECT
+
+public slots:
+    void setGauge(const QString &gauge, double value)
+    {
+        gauges[gauge] = value;
+    };
+
+    void updateCounter(const QString &counter, qint64 amount)
+    {
+        counters[counter] += amount;
+    };
+
+public:
+    QMap<QString, double> gauges;
+    QMap<QString, qint64> counters;
+};
+
+class TestMessageCollector : public QObject
+{
+    Q_OBJECT
+
+public slots:
+    void messageReceived(const QXmppMessage &message)
+    {
+        messages << message;
+    };
+
+public:
+    QList<QXmppMessage> messages;
+};
+
+class TestBounceCollector : public QObject
+{
+    Q_OBJECT
+
+public slots:
+    void stanzaBounced(const QDomElement &element)
+    {
+        elements << element;
+    }
+
+public:
+    QList<QDomElement> elements;
+};
+
+class TestDialbackCollector : public QObject
+{
+    Q_OBJECT
+
+public slots:
+    void dialbackRequestReceived(const QXmppDialback &dialback)
+    {
+        domains << dialback.to();
+    }
+
+public:
+    QStringList domains;
+};
+
+class TestIncomingServer : public QXmppIncomingServer
+{
+public:
+    TestIncomingServer()
+        : QXmppIncomingServer(0, "localhost", 0)
+    {
+    }
+
+    void receive(const QByteArray &xml)
+    {
+        QDomDocument doc;
+        doc.setContent(xml, true);
+        handleStanza(doc.documentElement());
+    }
+};
+
+class TestCapabilitiesCollector : public QObject
+{
+    Q_OBJECT
+
+public slots:
+    void capabilitiesChanged(const QString &jid)
+    {
+        jids << jid;
+    };
+
+public:
+    QStringList jids;
+};
+
+class TestIqCollector : public QObject
+{
+    Q_OBJECT
+
+public slots:
+    void iqReceived(const QDomElement &element)
+    {
+        types << element.attribute("type");
+        conditions << element.firstChildElement("error").firstChildElement().tagName();
+    };
+
+public:
+    QStringList types;
+    QStringList conditions;
+};
+
+/// Swallows requests in the "urn:test:silent" namespace without replying.
+
+class TestSilentExtension : public QXmppClientExtension
+{
+public:
+    bool handleStanza(const QDomElement &element)
+    {
+        return element.tagName() == "iq" &&
+               element.firstChildElement().namespaceURI() == "urn:test:silent";
+    };
+};
+
+class TestSilentIq : public QXmppIq
+{
+protected:
+    void toXmlElementFromChild(QXmlStreamWriter *writer) const
+    {
+        writer->writeStartElement("query");
+        writer->writeAttribute("xmlns", "urn:test:silent");
+        writer->writeEndElement();
+    };
+};
+
+class TestVCardCollector : public QObject
+{
+    Q_OBJECT
+
+public slots:
+    void vCardReceived(const QXmppVCardIq &vCard)
+    {
+        types << vCard.type();
+    };
+
+public:
+    QList<QXmppIq::Type> types;
+};
+
+/// Answers vCard requests with a vCard holding a photo.
+
+class TestVCardResponder : public QXmppClientExtension
+{
+public:
+    TestVCardResponder() : requests(0) {};
+
+    bool handleStanza(const QDomElement &element)
+    {
+        if (element.tagName() != "iq" || !QXmppVCardIq::isVCard(element) ||
+            element.attribute("type") != "get")
+            return false;
+
+        QXmppVCardIq vCard;
+        vCard.setType(QXmppIq::Result);
+        vCard.setId(element.attribute("id"));
+        vCard.setTo(element.attribute("from"));
+        vCard.setFullName("Alice");
+        vCard.setPhoto(QByteArray("fake photo data"));
+        vCard.setPhotoType("image/png");
+        client()->sendPacket(vCard);
+        requests++;
+        return true;
+    };
+
+    int requests;
+};
+
 class tst_QXmppServer : public QObject
 {
     Q_OBJECT
 
 private slots:
+    void testCapabilities();
+    void testComponent();
     void testConnect_data();
     void testConnect();
+    void testConnectVirtualHost_data();
+    void testConnectVirtualHost();
+    void testConnectWebSocket();
+    void testDialbackDomains();
+    void testWebSocketErrors();
+    void testIqTracker();
+    void testKeepAlive();
+    void testQueueLimit();
+    void testRateLimit();
+    void testSetupTimeout();
+    void testTracer();
+    void testTrafficRecorder();
+    void testVCardCache();
 };
 
+static QByteArray webSocketFrame(const QByteArray &payload, quint8 opcode = 0x1)
+{
+    // client frames must be masked
+    const char mask[4] = { 0x12, 0x34, 0x56, 0x78 };
+    QByteArray frame;
+    frame.append(char(0x80 | opcode));
+    frame.append(char(0x80 | payload.size()));
+    frame.append(mask, 4);
+    for (int i = 0; i < payload.size(); ++i)
+        frame.append(payload.at(i) ^ mask[i % 4]);
+    return frame;
+}
+
+/// Waits for \a bytes to be available on the socket.
+///
+/// The server runs in the same thread, so the event loop must keep
+/// running while we wait.
+
+static bool waitForBytes(QTcpSocket *socket, qint64 bytes)
+{
+    for (int i = 0; i < 100 && socket->bytesAvailable() < bytes; ++i)
+        QTest::qWait(10);
+    return socket->bytesAvailable() >= bytes;
+}
+
+static QByteArray readWebSocketFrame(QTcpSocket *socket)
+{
+    if (!waitForBytes(socket, 2))
+        return QByteArray();
+    const QByteArray header = socket->read(2);
+
+    int length = header.at(1) & 0x7f;
+    if (length == 126) {
+        if (!waitForBytes(socket, 2))
+            return QByteArray();
+        const QByteArray extended = socket->read(2);
+        length = (uchar(extended.at(0)) << 8) | uchar(extended.at(1));
+    }
+    waitForBytes(socket, length);
+    return socket->read(length);
+}
+
+/// Reads from the socket until \a marker is received.
+
+static QByteArray readUntil(QTcpSocket *socket, const QByteArray &marker)
+{
+    QByteArray data;
+    for (int i = 0; i < 100 && !data.contains(marker); ++i) {
+        QTest::qWait(10);
+        data += socket->readAll();
+    }
+    return data;
+}
+
+static bool connectClient(QXmppClient *client, const QString &resource)
+{
+    QEventLoop loop;
+    QObject::connect(client, SIGNAL(connected()),
+                     &loop, SLOT(quit()));
+    QXmppConfiguration config;
+    config.setDomain("localhost");
+    config.setHost(QHostAddress(QHostAddress::LocalHost).toString());
+    config.setPort(12345);
+    config.setUser("testuser");
+    config.setPassword("testpwd");
+    config.setResource(resource);
+    client->connectToServer(config);
+    loop.exec();
+    return client->isConnected();
+}
+
+static QXmppPresence capabilitiesPresence(const QXmppDiscoveryIq &info, const QString &to)
+{
+    QXmppPresence presence;
+    presence.setTo(to);
+    presence.setCapabilityHash("sha-1");
+    presence.setCapabilityNode("http://code.google.com/p/qxmpp");
+    presence.setCapabilityVer(info.verificationString());
+    return presence;
+}
+
+void tst_QXmppServer::testCapabilities()
+{
+    const QString cachePath = QDir::temp().filePath("tst_qxmppserver-caps.dat");
+    QFile::remove(cachePath);
+
+    TestPasswordChecker passwordChecker("testuser", "testpwd");
+
+    QXmppServer server;
+    server.setDomain("localhost");
+    server.setPasswordChecker(&passwordChecker);
+    QVERIFY(server.listenForClients(QHostAddress::LocalHost, 12345));
+
+    QXmppClient alice;
+    QXmppClient bob;
+    QVERIFY(connectClient(&alice, "alice"));
+    QVERIFY(connectClient(&bob, "bob"));
+
+    QXmppDiscoveryManager *bobManager = bob.findExtension<QXmppDiscoveryManager>();
+    bobManager->setCachePath(cachePath);
+    TestCapabilitiesCollector collector;
+    connect(bobManager, SIGNAL(capabilitiesChanged(QString)),
+            &collector, SLOT(capabilitiesChanged(QString)));
+
+    // bob queries alice's capabilities once
+    const QXmppDiscoveryIq info = alice.findExtension<QXmppDiscoveryManager>()->capabilities();
+    QVERIFY(alice.sendPacket(capabilitiesPresence(info, "testuser@localhost/bob")));
+    QVERIFY(alice.sendPacket(capabilitiesPresence(info, "testuser@localhost/bob")));
+    for (int i = 0; i < 100 && collector.jids.isEmpty(); ++i)
+        QTest::qWait(10);
+    QCOMPARE(collector.jids, QStringList() << "testuser@localhost/alice");
+    QVERIFY(bobManager->hasFeature("testuser@localhost/alice", "urn:xmpp:ping"));
+    QVERIFY(!bobManager->hasFeature("testuser@localhost/alice", "urn:test:missing"));
+    QCOMPARE(bobManager->cachedInfo("testuser@localhost/alice").features(), info.features());
+
+    // the cache is written when the manager goes away
+    QVERIFY(bob.removeExtension(bobManager));
+    QVERIFY(QFile::exists(cachePath));
+    bobManager = new QXmppDiscoveryManager;
+    bob.addExtension(bobManager);
+    bobManager->setCachePath(cachePath);
+    connect(bobManager, SIGNAL(capabilitiesChanged(QString)),
+            &collector, SLOT(capabilitiesChanged(QString)));
+
+    // carol cannot answer queries, her capabilities come from the cache
+    QXmppClient carol;
+    QVERIFY(carol.removeExtension(carol.findExtension<QXmppDiscoveryManager>()));
+    QVERIFY(connectClient(&carol, "carol"));
+    QVERIFY(carol.sendPacket(capabilitiesPresence(info, "testuser@localhost/bob")));
+    for (int i = 0; i < 100 && collector.jids.size() < 2; ++i)
+        QTest::qWait(10);
+    QCOMPARE(collector.jids.size(), 2);
+    QCOMPARE(collector.jids[1], QString("testuser@localhost/carol"));
+    QVERIFY(bobManager->hasFeature("testuser@localhost/carol", "urn:xmpp:ping"));
+
+    QFile::remove(cachePath);
+}
+
+void tst_QXmppServer::testComponent()
+{
+    const QString testDomain("localhost");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12345;
+    const quint16 componentPort = 12346;
+
+    TestPasswordChecker passwordChecker("testuser", "testpwd");
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    server.addComponent("gateway.localhost", "s3cr3t");
+    QVERIFY(server.listenForClients(testHost, testPort));
+    QVERIFY(server.listenForComponents(testHost, componentPort));
+
+    // connect client
+    QXmppClient client;
+    TestMessageCollector collector;
+    connect(&client, SIGNAL(messageReceived(QXmppMessage)),
+            &collector, SLOT(messageReceived(QXmppMessage)));
+
+    QEventLoop loop;
+    connect(&client, SIGNAL(connected()),
+            &loop, SLOT(quit()));
+    QXmppConfiguration config;
+    config.setDomain(testDomain);
+    config.setHost(testHost.toString());
+    config.setPort(testPort);
+    config.setUser("testuser");
+    config.setPassword("testpwd");
+    client.connectToServer(config);
+    loop.exec();
+    QVERIFY(client.isConnected());
+
+    // a bad secret is refused
+    QTcpSocket intruder;
+    intruder.connectToHost(testHost, componentPort);
+    QVERIFY(intruder.waitForConnected(1000));
+    intruder.write("<stream:stream xmlns='jabber:component:accept' xmlns:stream='http://etherx.jabber.org/streams' to='gateway.localhost'>");
+    readUntil(&intruder, "id=");
+    intruder.write("<handshake>0123456789abcdef0123456789abcdef01234567</handshake>");
+    QVERIFY(readUntil(&intruder, "</stream:error>").contains("<not-authorized"));
+
+    // connect component
+    QTcpSocket socket;
+    socket.connectToHost(testHost, componentPort);
+    QVERIFY(socket.waitForConnected(1000));
+    socket.write("<stream:stream xmlns='jabber:component:accept' xmlns:stream='http://etherx.jabber.org/streams' to='gateway.localhost'>");
+    const QByteArray header = readUntil(&socket, "'>");
+    const int idStart = header.indexOf("id='") + 4;
+    QVERIFY(idStart >= 4);
+    const QByteArray streamId = header.mid(idStart, header.indexOf('\'', idStart) - idStart);
+
+    const QByteArray digest = QCryptographicHash::hash(streamId + "s3cr3t", QCryptographicHash::Sha1).toHex();
+    socket.write("<handshake>" + digest + "</handshake>");
+    QVERIFY(readUntil(&socket, "<handshake/>").contains("<handshake/>"));
+    QCOMPARE(server.statistics().value("incoming-components").toInt(), 1);
+
+    // the component delivers a message from one of its users
+    socket.write("<message from='bot@gateway.localhost' to='testuser@localhost/QXmpp' type='chat'><body>Hello</body></message>");
+    QTest::qWait(100);
+    QCOMPARE(collector.messages.size(), 1);
+    QCOMPARE(collector.messages[0].from(), QString("bot@gateway.localhost"));
+    QCOMPARE(collector.messages[0].body(), QString("Hello"));
+
+    // messages to the component's domain and sub-domains reach it
+    client.sendMessage("bot@gateway.localhost", "Hi bot");
+    QVERIFY(readUntil(&socket, "Hi bot</body>").contains("to=\"bot@gateway.localhost\""));
+    client.sendMessage("room@irc.gateway.localhost", "Hi room");
+    QVERIFY(readUntil(&socket, "Hi room</body>").contains("to=\"room@irc.gateway.localhost\""));
+
+    // the component cannot send from other domains
+    socket.write("<message from='admin@localhost' to='testuser@localhost/QXmpp'><body>Spoofed</body></message>");
+    QVERIFY(readUntil(&socket, "</stream:error>").contains("<invalid-from"));
+    QCOMPARE(collector.messages.size(), 1);
+
+    // plain text from the loopback interface can be refused too
+    QVERIFY(server.isLoopbackComponentPlainTextAllowed());
+    server.setLoopbackComponentPlainTextAllowed(false);
+    QTcpSocket plain;
+    plain.connectToHost(testHost, componentPort);
+    QVERIFY(plain.waitForConnected(1000));
+    QVERIFY(plain.state() == QAbstractSocket::UnconnectedState || plain.waitForDisconnected(1000));
+}
+
 void tst_QXmppServer::testConnect_data()
 {
     QTest::addColumn<QString>("username");
@@ -134,5 +565,641 @@ void tst_QXmppServer::testConnect()
     QCOMPARE(client.isConnected(), connected);
 }
 
+void tst_QXmppServer::testConnectVirtualHost_data()
+{
+    QTest::addColumn<QString>("domain");
+    QTest::addColumn<QString>("username");
+    QTest::addColumn<bool>("connected");
+
+    QTest::newRow("primary-good") << "localhost" << "testuser" << true;
+    QTest::newRow("primary-other-user") << "localhost" << "otheruser" << false;
+    QTest::newRow("virtual-good") << "example.com" << "otheruser" << true;
+    QTest::newRow("virtual-other-user") << "example.com" << "testuser" << false;
+    QTest::newRow("unknown-domain") << "example.org" << "testuser" << false;
+}
+
+void tst_QXmppServer::testConnectVirtualHost()
+{
+    QFETCH(QString, domain);
+    QFETCH(QString, username);
+    QFETCH(bool, connected);
+
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12345;
+
+    QXmppLogger logger;
+    //logger.setLoggingType(QXmppLogger::StdoutLogging);
+
+    // prepare server with a password checker per domain
+    TestPasswordChecker primaryChecker("testuser", "testpwd");
+    TestPasswordChecker virtualChecker("otheruser", "testpwd");
+
+    QXmppServer server;
+    server.setDomain("localhost");
+    server.addDomain("example.com");
+    server.setLogger(&logger);
+    server.setPasswordChecker(&primaryChecker);
+    server.setPasswordChecker(&virtualChecker, "example.com");
+    QCOMPARE(server.domains(), QStringList() << "localhost" << "example.com");
+    server.listenForClients(testHost, testPort);
+
+    // prepare client
+    QXmppClient client;
+    client.setLogger(&logger);
+
+    QEventLoop loop;
+    connect(&client, SIGNAL(connected()),
+            &loop, SLOT(quit()));
+    connect(&client, SIGNAL(disconnected()),
+            &loop, SLOT(quit()));
+
+    QXmppConfiguration config;
+    config.setDomain(domain);
+    config.setHost(testHost.toString());
+    config.setPort(testPort);
+    config.setUser(username);
+    config.setPassword("testpwd");
+    client.connectToServer(config);
+    loop.exec();
+    QCOMPARE(client.isConnected(), connected);
+    if (connected)
+        QCOMPARE(client.configuration().jidBare(), username + "@" + domain);
+}
+
+void tst_QXmppServer::testConnectWebSocket()
+{
+    const QString testDomain("localhost");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12345;
+
+    TestPasswordChecker passwordChecker("testuser", "testpwd");
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    QVERIFY(server.listenForWebSocketClients(testHost, testPort));
+
+    QTcpSocket socket;
+    socket.connectToHost(testHost, testPort);
+    QVERIFY(socket.waitForConnected(1000));
+
+    // opening handshake
+    socket.write("GET /xmpp-websocket HTTP/1.1\r\n"
+                 "Host: localhost\r\n"
+                 "Upgrade: websocket\r\n"
+                 "Connection: Upgrade\r\n"
+                 "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                 "Sec-WebSocket-Protocol: xmpp\r\n"
+                 "Sec-WebSocket-Version: 13\r\n"
+                 "\r\n");
+    QByteArray response;
+    for (int i = 0; i < 100 && !response.contains("\r\n\r\n"); ++i) {
+        QTest::qWait(10);
+        response += socket.readAll();
+    }
+    QVERIFY(response.startsWith("HTTP/1.1 101"));
+    QVERIFY(response.contains("Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n"));
+
+    // each element arrives in its own frame
+    socket.write(webSocketFrame("<open xmlns=\"urn:ietf:params:xml:ns:xmpp-framing\" to=\"localhost\" version=\"1.0\"/>"));
+    const QByteArray open = readWebSocketFrame(&socket);
+    QVERIFY(open.startsWith("<open xmlns=\"urn:ietf:params:xml:ns:xmpp-framing\""));
+    QVERIFY(open.contains("from=\"localhost\""));
+
+    const QByteArray features = readWebSocketFrame(&socket);
+    QVERIFY(features.startsWith("<stream:features xmlns:stream=\"http://etherx.jabber.org/streams\""));
+    QVERIFY(features.contains("<mechanism>PLAIN</mechanism>"));
+    QVERIFY(!features.contains("starttls"));
+
+    // pings are answered with the same payload
+    socket.write(webSocketFrame("keepalive", 0x9));
+    QCOMPARE(readWebSocketFrame(&socket), QByteArray("keepalive"));
+
+    // closing the stream
+    socket.write(webSocketFrame("<close xmlns=\"urn:ietf:params:xml:ns:xmpp-framing\"/>"));
+    QCOMPARE(readWebSocketFrame(&socket), QByteArray("<close xmlns=\"urn:ietf:params:xml:ns:xmpp-framing\"/>"));
+}
+
+void tst_QXmppServer::testWebSocketErrors()
+{
+    const QString testDomain("localhost");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12345;
+
+    TestPasswordChecker passwordChecker("testuser", "testpwd");
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    QVERIFY(server.listenForWebSocketClients(testHost, testPort));
+
+    const QByteArray request = "GET /xmpp-websocket HTTP/1.1\r\n"
+                               "Host: localhost\r\n"
+                               "Upgrade: websocket\r\n"
+                               "Connection: Upgrade\r\n"
+                               "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                               "Sec-WebSocket-Protocol: xmpp\r\n";
+
+    // only version 13 of the protocol is accepted
+    QTcpSocket oldSocket;
+    oldSocket.connectToHost(testHost, testPort);
+    QVERIFY(oldSocket.waitForConnected(1000));
+    oldSocket.write(request + "Sec-WebSocket-Version: 8\r\n\r\n");
+    const QByteArray refused = readUntil(&oldSocket, "\r\n\r\n");
+    QVERIFY(refused.startsWith("HTTP/1.1 426"));
+    QVERIFY(refused.contains("Sec-WebSocket-Version: 13\r\n"));
+
+    // unmasked frames close the connection with a protocol error
+    QTcpSocket socket;
+    socket.connectToHost(testHost, testPort);
+    QVERIFY(socket.waitForConnected(1000));
+    socket.write(request + "Sec-WebSocket-Version: 13\r\n\r\n");
+    QVERIFY(readUntil(&socket, "\r\n\r\n").startsWith("HTTP/1.1 101"));
+
+    const QByteArray payload = "<open xmlns=\"urn:ietf:params:xml:ns:xmpp-framing\" to=\"localhost\" version=\"1.0\"/>";
+    socket.write(QByteArray(1, char(0x81)) + char(payload.size()) + payload);
+    QCOMPARE(readWebSocketFrame(&socket), QByteArray("\x03\xea", 2));
+}
+
+void tst_QXmppServer::testIqTracker()
+{
+    const QString testDomain("localhost");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12345;
+
+    TestPasswordChecker passwordChecker("testuser", "testpwd");
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    QVERIFY(server.listenForClients(testHost, testPort));
+
+    QXmppClient client;
+    client.addExtension(new TestSilentExtension);
+
+    QEventLoop loop;
+    connect(&client, SIGNAL(connected()),
+            &loop, SLOT(quit()));
+    QXmppConfiguration config;
+    config.setDomain(testDomain);
+    config.setHost(testHost.toString());
+    config.setPort(testPort);
+    config.setUser("testuser");
+    config.setPassword("testpwd");
+    client.connectToServer(config);
+    loop.exec();
+    QVERIFY(client.isConnected());
+
+    // the server's reply goes to the receiver
+    TestIqCollector collector;
+    QXmppDiscoveryIq request;
+    request.setType(QXmppIq::Get);
+    request.setQueryType(QXmppDiscoveryIq::InfoQuery);
+    request.setTo(testDomain);
+    QVERIFY(client.sendIq(request, &collector, "iqReceived"));
+    QCOMPARE(client.pendingIqCount(), 1);
+    for (int i = 0; i < 100 && collector.types.isEmpty(); ++i)
+        QTest::qWait(10);
+    QCOMPARE(collector.types, QStringList() << "error");
+    QCOMPARE(collector.conditions, QStringList() << "feature-not-implemented");
+    QCOMPARE(client.pendingIqCount(), 0);
+
+    // a request which gets no reply expires
+    TestSilentIq silent;
+    silent.setTo("testuser@localhost/QXmpp");
+    QVERIFY(client.sendIq(silent, &collector, "iqReceived", 100));
+
+    // a request reusing a pending ID is refused
+    QVERIFY(!client.sendIq(silent, &collector, "iqReceived", 100));
+    QCOMPARE(client.pendingIqCount(), 1);
+    for (int i = 0; i < 100 && collector.types.size() < 2; ++i)
+        QTest::qWait(10);
+    QCOMPARE(collector.types.size(), 2);
+    QCOMPARE(collector.conditions[1], QString("remote-server-timeout"));
+    QCOMPARE(client.pendingIqCount(), 0);
+
+    // pending requests fail when the stream disconnects
+    TestSilentIq lost;
+    lost.setTo("testuser@localhost/QXmpp");
+    QVERIFY(client.sendIq(lost, &collector, "iqReceived"));
+    client.disconnectFromServer();
+    for (int i = 0; i < 100 && collector.types.size() < 3; ++i)
+        QTest::qWait(10);
+    QCOMPARE(collector.types.size(), 3);
+    QCOMPARE(collector.conditions[2], QString("recipient-unavailable"));
+    QCOMPARE(client.pendingIqCount(), 0);
+}
+
+void tst_QXmppServer::testKeepAlive()
+{
+    const QString testDomain("localhost");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12345;
+
+    TestPasswordChecker passwordChecker("testuser", "testpwd");
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    QVERIFY(server.listenForClients(testHost, testPort));
+
+    TestMetricsLogger logger;
+    QXmppClient client;
+    client.setLogger(&logger);
+
+    QEventLoop loop;
+    connect(&client, SIGNAL(connected()),
+            &loop, SLOT(quit()));
+    QXmppConfiguration config;
+    config.setDomain(testDomain);
+    config.setHost(testHost.toString());
+    config.setPort(testPort);
+    config.setUser("testuser");
+    config.setPassword("testpwd");
+    config.setKeepAliveInterval(1);
+    config.setKeepAliveMaximumInterval(3);
+    config.setKeepAliveTimeout(1);
+    client.connectToServer(config);
+    loop.exec();
+    QVERIFY(client.isConnected());
+    QCOMPARE(logger.gauges.value("client.keepalive.interval"), 1.0);
+
+    // an idle stream is pinged, the round trip time is reported and the
+    // interval grows
+    for (int i = 0; i < 300 && !logger.gauges.contains("client.ping.rtt"); ++i)
+        QTest::qWait(10);
+    QCOMPARE(logger.counters.value("client.keepalive.sent"), qint64(1));
+    QVERIFY(logger.gauges.contains("client.ping.rtt"));
+    QCOMPARE(logger.gauges.value("client.keepalive.interval"), 2.0);
+
+    // traffic postpones keep alives
+    QXmppMessage message;
+    message.setTo("testuser@localhost/QXmpp");
+    message.setBody("traffic");
+    for (int i = 0; i < 10; ++i) {
+        QVERIFY(client.sendPacket(message));
+        QTest::qWait(300);
+    }
+    QCOMPARE(logger.counters.value("client.keepalive.sent"), qint64(1));
+    QVERIFY(client.isConnected());
+    QCOMPARE(logger.counters.value("client.keepalive.failure"), qint64(0));
+}
+
+void tst_QXmppServer::testDialbackDomains()
+{
+    TestIncomingServer stream;
+    stream.setLocalDomains(QStringList() << "example.org" << "component.localhost");
+
+    TestDialbackCollector collector;
+    connect(&stream, SIGNAL(dialbackRequestReceived(QXmppDialback)),
+            &collector, SLOT(dialbackRequestReceived(QXmppDialback)));
+
+    // only configured domains are accepted
+    const QString verify("<verify xmlns=\"jabber:server:dialback\" from=\"remote.com\" to=\"%1\" id=\"abc\">key</verify>");
+    stream.receive(verify.arg("localhost").toUtf8());
+    stream.receive(verify.arg("example.org").toUtf8());
+    stream.receive(verify.arg("component.localhost").toUtf8());
+    stream.receive(verify.arg("unknown.localhost").toUtf8());
+    stream.receive(verify.arg("a.b.example.org").toUtf8());
+    QCOMPARE(collector.domains, QStringList() << "localhost" << "example.org" << "component.localhost");
+}
+
+void tst_QXmppServer::testQueueLimit()
+{
+    QXmppOutgoingServer stream("localhost", 0);
+    QCOMPARE(stream.queueLimit(), 0);
+    stream.setQueueLimit(-1);
+    QCOMPARE(stream.queueLimit(), 0);
+    stream.setQueueLimit(150);
+    QCOMPARE(stream.queueLimit(), 150);
+
+    TestBounceCollector collector;
+    connect(&stream, SIGNAL(stanzaBounced(QDomElement)),
+            &collector, SLOT(stanzaBounced(QDomElement)));
+
+    // data within the limit is queued until the stream is established
+    const QByteArray message("<message from=\"alice@localhost/a\" to=\"bob@example.com\" type=\"chat\"><body>hi</body></message>");
+    stream.queueData(message);
+    QCOMPARE(stream.queuedBytes(), message.size());
+    QVERIFY(collector.elements.isEmpty());
+
+    // data beyond the limit is bounced to its sender
+    stream.queueData(message);
+    QCOMPARE(stream.queuedBytes(), message.size());
+    QCOMPARE(collector.elements.size(), 1);
+    const QDomElement bounce = collector.elements.first();
+    QCOMPARE(bounce.tagName(), QString("message"));
+    QCOMPARE(bounce.attribute("from"), QString("bob@example.com"));
+    QCOMPARE(bounce.attribute("to"), QString("alice@localhost/a"));
+    QCOMPARE(bounce.attribute("type"), QString("error"));
+    const QDomElement error = bounce.firstChildElement("error");
+    QCOMPARE(error.attribute("type"), QString("wait"));
+    QCOMPARE(error.firstChildElement().tagName(), QString("resource-constraint"));
+
+    // errors are never answered with errors
+    stream.queueData("<message from=\"alice@localhost/a\" to=\"bob@example.com\" type=\"error\"><body>a much longer message which does not fit</body></message>");
+    QCOMPARE(collector.elements.size(), 1);
+}
+
+void tst_QXmppServer::testRateLimit()
+{
+    TestPasswordChecker passwordChecker("testuser", "testpwd");
+
+    QXmppServer server;
+    server.setDomain("localhost");
+    server.setPasswordChecker(&passwordChecker);
+    QCOMPARE(server.clientByteRateLimit(), 0);
+    QCOMPARE(server.clientStanzaRateLimit(), 0);
+    server.setClientByteRateLimit(-1);
+    QCOMPARE(server.clientByteRateLimit(), 0);
+    server.setClientByteRateLimit(100000);
+    QCOMPARE(server.clientByteRateLimit(), 100000);
+    server.setClientStanzaRateLimit(20);
+    QCOMPARE(server.clientStanzaRateLimit(), 20);
+    QVERIFY(server.listenForClients(QHostAddress::LocalHost, 12345));
+
+    QXmppClient alice;
+    QXmppClient bob;
+    QVERIFY(connectClient(&alice, "alice"));
+    QVERIFY(connectClient(&bob, "bob"));
+    TestMessageCollector collector;
+    connect(&bob, SIGNAL(messageReceived(QXmppMessage)),
+            &collector, SLOT(messageReceived(QXmppMessage)));
+
+    // a burst beyond the stanza budget is spread out
+    for (int i = 0; i < 40; ++i)
+        QVERIFY(alice.sendMessage("testuser@localhost/bob", QString("message %1").arg(i)));
+    QTest::qWait(200);
+    QVERIFY(!collector.messages.isEmpty());
+    QVERIFY(collector.messages.size() < 40);
+
+    for (int i = 0; i < 300 && collector.messages.size() < 40; ++i)
+        QTest::qWait(10);
+    QCOMPARE(collector.messages.size(), 40);
+    QCOMPARE(collector.messages.last().body(), QString("message 39"));
+}
+
+void tst_QXmppServer::testSetupTimeout()
+{
+    QXmppServer server;
+    server.setOutgoingServerIdleTimeout(-1);
+    QCOMPARE(server.outgoingServerIdleTimeout(), 0);
+    server.setOutgoingServerQueueLimit(-1);
+    QCOMPARE(server.outgoingServerQueueLimit(), 0);
+
+    QXmppOutgoingServer stream("localhost", 0);
+    QCOMPARE(stream.setupTimeout(), 60);
+    stream.setSetupTimeout(-1);
+    QCOMPARE(stream.setupTimeout(), 0);
+    stream.setSetupTimeout(1);
+    QCOMPARE(stream.setupTimeout(), 1);
+
+    TestBounceCollector collector;
+    connect(&stream, SIGNAL(stanzaBounced(QDomElement)),
+            &collector, SLOT(stanzaBounced(QDomElement)));
+    QSignalSpy disconnectedSpy(&stream, SIGNAL(disconnected()));
+
+    stream.queueData("<message from=\"alice@localhost/a\" to=\"bob@example.com\" type=\"chat\"><body>hi</body></message>");
+    QVERIFY(stream.queuedBytes() > 0);
+
+    // a stream which is not ready in time bounces its queue and closes
+    QVERIFY(QMetaObject::invokeMethod(&stream, "_q_setupTimeout"));
+    QCOMPARE(stream.queuedBytes(), 0);
+    QCOMPARE(disconnectedSpy.size(), 1);
+    QCOMPARE(collector.elements.size(), 1);
+    const QDomElement bounce = collector.elements.first();
+    QCOMPARE(bounce.attribute("to"), QString("alice@localhost/a"));
+    QCOMPARE(bounce.firstChildElement("error").firstChildElement().tagName(), QString("remote-server-timeout"));
+}
+
+static qint64 histogramCount(const QXmppTracer &tracer, QXmppTracer::Stage stage)
+{
+    qint64 count = 0;
+    foreach (qint64 value, tracer.histogram(stage))
+        count += value;
+    return count;
+}
+
+class TestTracerThread : public QThread
+{
+public:
+    TestTracerThread() : active(0) {}
+    QXmppTracer *active;
+
+protected:
+    void run()
+    {
+        active = QXmppTracer::activeTracer();
+    }
+};
+
+void tst_QXmppServer::testTracer()
+{
+    const QString testDomain("localhost");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12345;
+
+    TestPasswordChecker passwordChecker("testuser", "testpwd");
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    QVERIFY(server.listenForClients(testHost, testPort));
+
+    QXmppClient client;
+    TestMessageCollector collector;
+    connect(&client, SIGNAL(messageReceived(QXmppMessage)),
+            &collector, SLOT(messageReceived(QXmppMessage)));
+
+    QEventLoop loop;
+    connect(&client, SIGNAL(connected()),
+            &loop, SLOT(quit()));
+    QXmppConfiguration config;
+    config.setDomain(testDomain);
+    config.setHost(testHost.toString());
+    config.setPort(testPort);
+    config.setUser("testuser");
+    config.setPassword("testpwd");
+    client.connectToServer(config);
+    loop.exec();
+    QVERIFY(client.isConnected());
+
+    // trace a message sent to ourselves
+    QXmppTracer tracer;
+    tracer.setEnabled(true);
+    QVERIFY(QXmppTracer::activeTracer() == &tracer);
+
+    // the tracer is only enabled in this thread
+    TestTracerThread thread;
+    thread.start();
+    QVERIFY(thread.wait(1000));
+    QVERIFY(thread.active == 0);
+
+    QXmppMessage message;
+    message.setTo("testuser@localhost/QXmpp");
+    message.setBody("traced");
+    QVERIFY(client.sendPacket(message));
+    for (int i = 0; i < 100 && collector.messages.isEmpty(); ++i)
+        QTest::qWait(10);
+    QCOMPARE(collector.messages.size(), 1);
+
+    tracer.setEnabled(false);
+    QVERIFY(QXmppTracer::activeTracer() == 0);
+
+    // the server-side stages were traced once
+    QCOMPARE(histogramCount(tracer, QXmppTracer::DispatchStage), qint64(1));
+    QCOMPARE(histogramCount(tracer, QXmppTracer::ExtensionStage), qint64(1));
+    QCOMPARE(histogramCount(tracer, QXmppTracer::RouteStage), qint64(1));
+    QCOMPARE(histogramCount(tracer, QXmppTracer::WriteStage), qint64(1));
+
+    tracer.reset();
+    QCOMPARE(histogramCount(tracer, QXmppTracer::WriteStage), qint64(0));
+}
+
+void tst_QXmppServer::testTrafficRecorder()
+{
+    const QString testDomain("localhost");
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12345;
+
+    TestPasswordChecker passwordChecker("testuser", "testpwd");
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    QVERIFY(server.listenForClients(testHost, testPort));
+
+    QXmppTrafficRecorder recorder;
+    recorder.setEnabled(true);
+
+    QXmppClient client;
+    QEventLoop loop;
+    connect(&client, SIGNAL(connected()),
+            &loop, SLOT(quit()));
+    QXmppConfiguration config;
+    config.setDomain(testDomain);
+    config.setHost(testHost.toString());
+    config.setPort(testPort);
+    config.setUser("testuser");
+    config.setPassword("testpwd");
+    config.setSaslAuthMechanism("PLAIN");
+    client.connectToServer(config);
+    loop.exec();
+    QVERIFY(client.isConnected());
+    recorder.setEnabled(false);
+
+    // the credentials exchanged by both sides are redacted
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    QVERIFY(recorder.dump(file.fileName()));
+    const QByteArray dump = file.readAll();
+    QVERIFY(dump.contains("bytes redacted"));
+    QVERIFY(!dump.contains(QByteArray("\0testuser\0testpwd", 17).toBase64()));
+
+    // traffic after authentication is recorded
+    QVERIFY(dump.contains("urn:ietf:params:xml:ns:xmpp-bind"));
+}
+
+static void removeVCardCache(const QString &path)
+{
+    QDir dir(path);
+    foreach (const QString &name, dir.entryList(QStringList() << "vcards.dat*", QDir::Files))
+        dir.remove(name);
+    if (dir.cd("photos")) {
+        foreach (const QString &name, dir.entryList(QDir::Files))
+            dir.remove(name);
+        dir.cdUp();
+        dir.rmdir("photos");
+    }
+    QDir().rmdir(path);
+}
+
+void tst_QXmppServer::testVCardCache()
+{
+    const QString cachePath = QDir::temp().filePath("tst_qxmppserver-vcards");
+    removeVCardCache(cachePath);
+
+    TestPasswordChecker passwordChecker("testuser", "testpwd");
+
+    QXmppServer server;
+    server.setDomain("localhost");
+    server.setPasswordChecker(&passwordChecker);
+    QVERIFY(server.listenForClients(QHostAddress::LocalHost, 12345));
+
+    QXmppClient alice;
+    TestVCardResponder *responder = new TestVCardResponder;
+    alice.addExtension(responder);
+    QXmppClient bob;
+    QVERIFY(connectClient(&alice, "alice"));
+    QVERIFY(connectClient(&bob, "bob"));
+
+    QXmppVCardManager &manager = bob.vCardManager();
+    manager.setCachePath(cachePath);
+    TestVCardCollector collector;
+    connect(&manager, SIGNAL(vCardReceived(QXmppVCardIq)),
+            &collector, SLOT(vCardReceived(QXmppVCardIq)));
+
+    // concurrent requests are sent once
+    const QString id = manager.requestVCard("testuser@localhost/alice");
+    QVERIFY(!id.isEmpty());
+    QCOMPARE(manager.requestVCard("testuser@localhost/alice"), id);
+    for (int i = 0; i < 100 && collector.types.isEmpty(); ++i)
+        QTest::qWait(10);
+    QCOMPARE(collector.types, QList<QXmppIq::Type>() << QXmppIq::Result);
+    QCOMPARE(responder->requests, 1);
+
+    QXmppVCardIq cached = manager.cachedVCard("testuser@localhost");
+    QCOMPARE(cached.fullName(), QString("Alice"));
+    QCOMPARE(cached.photo(), QByteArray("fake photo data"));
+    QCOMPARE(cached.photoType(), QString("image/png"));
+
+    // the cache survives the manager
+    manager.setCachePath(QString());
+    QVERIFY(manager.cachedVCard("testuser@localhost").fullName().isEmpty());
+    manager.setCachePath(cachePath);
+    QCOMPARE(manager.cachedVCard("testuser@localhost").photo(), QByteArray("fake photo data"));
+    QCOMPARE(QDir(cachePath + "/photos").entryList(QDir::Files).size(), 1);
+
+    // an advertised photo hash which is cached causes no request
+    QXmppPresence presence;
+    presence.setTo("testuser@localhost/bob");
+    presence.setVCardUpdateType(QXmppPresence::VCardUpdateValidPhoto);
+    presence.setPhotoHash(QCryptographicHash::hash("fake photo data", QCryptographicHash::Sha1));
+    QVERIFY(alice.sendPacket(presence));
+    QTest::qWait(100);
+    QCOMPARE(collector.types.size(), 1);
+
+    // a new photo hash causes the vCard to be requested again, the server
+    // does not store vCards so the cached one is kept
+    presence.setPhotoHash(QCryptographicHash::hash("new photo data", QCryptographicHash::Sha1));
+    QVERIFY(alice.sendPacket(presence));
+    for (int i = 0; i < 100 && collector.types.size() < 2; ++i)
+        QTest::qWait(10);
+    QCOMPARE(collector.types.size(), 2);
+    QCOMPARE(collector.types[1], QXmppIq::Error);
+    QCOMPARE(manager.cachedVCard("testuser@localhost").fullName(), QString("Alice"));
+
+    // presence from a room occupant is ignored
+    QXmppMucItem item;
+    item.setRole(QXmppMucItem::ParticipantRole);
+    presence.setMucItem(item);
+    presence.setPhotoHash(QCryptographicHash::hash("occupant photo data", QCryptographicHash::Sha1));
+    QVERIFY(alice.sendPacket(presence));
+    QTest::qWait(100);
+    QCOMPARE(collector.types.size(), 2);
+
+    // vCards which are not cached are not requested
+    const QString emptyPath = cachePath + "-empty";
+    manager.setCachePath(emptyPath);
+    presence.setMucItem(QXmppMucItem());
+    QVERIFY(alice.sendPacket(presence));
+    QTest::qWait(100);
+    QCOMPARE(collector.types.size(), 2);
+
+    manager.setCachePath(QString());
+    removeVCardCache(cachePath);
+    removeVCardCache(emptyPath);
+}
+
 QTEST_MAIN(tst_QXmppServer)
 #include "tst_qxmppserver.moc"
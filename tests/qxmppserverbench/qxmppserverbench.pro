@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmppserverbench
+SOURCES += tst_qxmppserverbench.cpp
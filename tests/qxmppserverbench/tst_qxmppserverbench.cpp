@@ -0,0 +1,675 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTcpSocket>
+
+#if defined(Q_OS_LINUX)
+#include <unistd.h>
+#endif
+#if defined(Q_OS_UNIX)
+#include <sys/resource.h>
+#endif
+
+#include <QDomDocument>
+
+#include "QXmppMessage.h"
+#include "QXmppMucService.h"
+#include "QXmppPresence.h"
+#include "QXmppServer.h"
+#include "passwordchecker.h"
+#include "util.h"
+
+static const QString testDomain("localhost");
+static const QString testPassword("testpwd");
+static QElapsedTimer benchClock;
+
+/// Returns the number of nanoseconds elapsed since the benchmark started.
+
+static qint64 benchTime()
+{
+#if (QT_VERSION >= QT_VERSION_CHECK(4, 8, 0))
+    return benchClock.nsecsElapsed();
+#else
+    return benchClock.elapsed() * 1000000;
+#endif
+}
+
+/// Returns the CPU time used by the current process in microseconds,
+/// or 0 if it cannot be determined on this platform.
+
+static qint64 cpuTime()
+{
+#if defined(Q_OS_UNIX)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) < 0)
+        return 0;
+    return qint64(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 +
+           usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+#else
+    return 0;
+#endif
+}
+
+/// Returns the resident set size of the current process in bytes,
+/// or 0 if it cannot be determined on this platform.
+
+static qint64 residentBytes()
+{
+#if defined(Q_OS_LINUX)
+    QFile file("/proc/self/statm");
+    if (!file.open(QIODevice::ReadOnly))
+        return 0;
+    const QList<QByteArray> fields = file.readAll().split(' ');
+    if (fields.size() < 2)
+        return 0;
+    return fields[1].toLongLong() * sysconf(_SC_PAGESIZE);
+#else
+    return 0;
+#endif
+}
+
+/// Returns the value of the given environment variable as an integer,
+/// or \a defaultValue if it is not set.
+
+static int envValue(const char *name, int defaultValue)
+{
+    bool ok = false;
+    const int value = qgetenv(name).toInt(&ok);
+    return ok ? value : defaultValue;
+}
+
+/// Collects the latencies measured by a scenario.
+///
+/// Scenarios embed "bench:<time>:" markers in the stanzas they send, and
+/// the clients record the latency when the marker comes back.
+
+class BenchStats
+{
+public:
+    BenchStats()
+        : m_startTime(benchTime()), m_startCpu(cpuTime())
+    {
+    }
+
+    void addLatency(qint64 latency)
+    {
+        m_latencies << latency;
+    }
+
+    int count() const
+    {
+        return m_latencies.size();
+    }
+
+    /// Processes events until \a expected latencies have been recorded,
+    /// or the timeout expires.
+
+    bool waitForCount(int expected, int timeout = 60000)
+    {
+        QTimer wakeup;
+        wakeup.start(100);
+        QElapsedTimer timer;
+        timer.start();
+        while (m_latencies.size() < expected && timer.elapsed() < timeout)
+            QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents);
+        return m_latencies.size() >= expected;
+    }
+
+    /// Prints the throughput, latency percentiles, CPU time and resident
+    /// memory since the statistics were created.
+    ///
+    /// The clients run in the same process, so CPU time and memory cover
+    /// both ends of the connections.
+
+    void report(const char *scenario)
+    {
+        const qint64 elapsed = benchTime() - m_startTime;
+        const qint64 cpu = cpuTime() - m_startCpu;
+        qSort(m_latencies);
+        qDebug("%s: %i stanzas in %lli ms, %lli stanzas/s, latency p50 %lli us, p99 %lli us, p999 %lli us, cpu %lli ms, rss %lli KiB",
+               scenario, m_latencies.size(), elapsed / 1000000,
+               elapsed > 0 ? qint64(m_latencies.size()) * Q_INT64_C(1000000000) / elapsed : 0,
+               percentile(0.5) / 1000, percentile(0.99) / 1000, percentile(0.999) / 1000,
+               cpu / 1000, residentBytes() / 1024);
+    }
+
+private:
+    qint64 percentile(double p) const
+    {
+        if (m_latencies.isEmpty())
+            return 0;
+        return m_latencies[qMin(m_latencies.size() - 1, int(m_latencies.size() * p))];
+    }
+
+    QVector<qint64> m_latencies;
+    qint64 m_startTime;
+    qint64 m_startCpu;
+};
+
+/// Returns a latency marker for the current time.
+
+static QByteArray benchMarker(const char *kind = "bench")
+{
+    return QByteArray(kind) + ":" + QByteArray::number(benchTime()) + ":";
+}
+
+/// A minimal client which speaks just enough raw XMPP to log in and bind
+/// a resource, so that the memory it uses stays negligible compared to
+/// a full QXmppClient.
+
+class BenchClient : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum State {
+        ConnectingState,
+        AuthState,
+        BindState,
+        ReadyState,
+        FailedState
+    };
+
+    BenchClient(const QString &username, QObject *parent = 0)
+        : QObject(parent),
+        m_pings(0),
+        m_startTime(0),
+        m_state(ConnectingState),
+        m_stats(0),
+        m_username(username)
+    {
+        connect(&m_socket, SIGNAL(connected()), this, SLOT(_q_connected()));
+        connect(&m_socket, SIGNAL(readyRead()), this, SLOT(_q_readyRead()));
+        connect(&m_socket, SIGNAL(disconnected()), this, SLOT(_q_failed()));
+        connect(&m_socket, SIGNAL(error(QAbstractSocket::SocketError)), this, SLOT(_q_failed()));
+    }
+
+    void connectToHost(const QHostAddress &host, quint16 port)
+    {
+        m_startTime = benchTime();
+        m_socket.connectToHost(host, port);
+    }
+
+    QString jid() const
+    {
+        return m_username + "@" + testDomain + "/bench";
+    }
+
+    /// Sets the client which answers our pings.
+
+    void setPeer(const QString &peer)
+    {
+        m_peer = peer.toUtf8();
+    }
+
+    /// Sets the statistics in which latencies are recorded, including
+    /// the time taken to log in.
+
+    void setStats(BenchStats *stats)
+    {
+        m_stats = stats;
+    }
+
+    void send(const QByteArray &data)
+    {
+        m_socket.write(data);
+    }
+
+    /// Pings the peer \a count times, sending each ping once the
+    /// previous one has been answered.
+
+    void startPings(int count)
+    {
+        m_pings = count;
+        sendPing();
+    }
+
+    State state() const
+    {
+        return m_state;
+    }
+
+signals:
+    void finished();
+
+private slots:
+    void _q_connected()
+    {
+        m_state = AuthState;
+        sendStreamStart();
+    }
+
+    void _q_failed()
+    {
+        if (m_state != ReadyState && m_state != FailedState) {
+            m_state = FailedState;
+            emit finished();
+        }
+    }
+
+    void _q_readyRead()
+    {
+        m_buffer += m_socket.readAll();
+        if (m_state == AuthState) {
+            if (m_buffer.contains("</stream:features>")) {
+                const QByteArray credentials = QByteArray(1, '\0') + m_username.toUtf8() + QByteArray(1, '\0') + testPassword.toUtf8();
+                m_buffer.clear();
+                m_socket.write("<auth xmlns='urn:ietf:params:xml:ns:xmpp-sasl' mechanism='PLAIN'>" + credentials.toBase64() + "</auth>");
+            } else if (m_buffer.contains("<success")) {
+                m_buffer.clear();
+                m_state = BindState;
+                sendStreamStart();
+            } else if (m_buffer.contains("<failure")) {
+                _q_failed();
+            }
+        } else if (m_state == BindState) {
+            if (m_buffer.contains("</stream:features>")) {
+                m_buffer.clear();
+                m_socket.write("<iq type='set' id='bind'><bind xmlns='urn:ietf:params:xml:ns:xmpp-bind'><resource>bench</resource></bind></iq>");
+            } else if (m_buffer.contains("</jid>")) {
+                m_buffer.clear();
+                m_state = ReadyState;
+                if (m_stats)
+                    m_stats->addLatency(benchTime() - m_startTime);
+                emit finished();
+            }
+        } else {
+            handleMarkers();
+        }
+    }
+
+private:
+    /// Looks for latency markers in the received data, answering pings
+    /// and recording latencies.
+
+    void handleMarkers()
+    {
+        int pos = 0;
+        forever {
+            const int bench = m_buffer.indexOf("bench:", pos);
+            const int ping = m_buffer.indexOf("ping:", pos);
+            const bool isPing = ping >= 0 && (bench < 0 || ping < bench);
+            const int start = isPing ? ping : bench;
+            if (start < 0) {
+                pos = qMax(pos, m_buffer.size() - 6);
+                break;
+            }
+            const int length = isPing ? 5 : 6;
+            const int end = m_buffer.indexOf(':', start + length);
+            if (end < 0) {
+                pos = start;
+                break;
+            }
+            const QByteArray stamp = m_buffer.mid(start + length, end - start - length);
+            pos = end + 1;
+
+            if (isPing) {
+                m_socket.write("<iq type='result' to='" + m_peer + "' id='bench:" + stamp + ":'/>");
+            } else {
+                if (m_stats)
+                    m_stats->addLatency(benchTime() - stamp.toLongLong());
+                if (m_pings > 0)
+                    sendPing();
+            }
+        }
+        m_buffer.remove(0, pos);
+    }
+
+    void sendPing()
+    {
+        if (m_pings <= 0)
+            return;
+        m_pings--;
+        m_socket.write("<iq type='get' to='" + m_peer + "' id='" + benchMarker("ping") + "'><ping xmlns='urn:xmpp:ping'/></iq>");
+    }
+
+    void sendStreamStart()
+    {
+        m_socket.write("<?xml version='1.0'?><stream:stream to='" + testDomain.toUtf8() + "' xmlns='jabber:client' xmlns:stream='http://etherx.jabber.org/streams' version='1.0'>");
+    }
+
+    QByteArray m_buffer;
+    QByteArray m_peer;
+    int m_pings;
+    QTcpSocket m_socket;
+    qint64 m_startTime;
+    State m_state;
+    BenchStats *m_stats;
+    QString m_username;
+};
+
+/// Connects \a count clients to the benchmark server at once and waits
+/// until they have all logged in or failed.
+
+static QList<BenchClient*> connectClients(int count, quint16 port, BenchStats *stats = 0)
+{
+    QList<BenchClient*> clients;
+    QEventLoop loop;
+    for (int i = 0; i < count; ++i) {
+        BenchClient *client = new BenchClient(QString("user%1").arg(i));
+        client->setStats(stats);
+        QObject::connect(client, SIGNAL(finished()), &loop, SLOT(quit()));
+        client->connectToHost(QHostAddress::LocalHost, port);
+        clients << client;
+    }
+
+    int pending = count;
+    while (pending > 0) {
+        loop.exec();
+        pending = 0;
+        foreach (BenchClient *client, clients)
+            if (client->state() != BenchClient::ReadyState && client->state() != BenchClient::FailedState)
+                pending++;
+    }
+    foreach (BenchClient *client, clients)
+        client->setStats(0);
+    return clients;
+}
+
+static int readyCount(const QList<BenchClient*> &clients)
+{
+    int ready = 0;
+    foreach (BenchClient *client, clients)
+        if (client->state() == BenchClient::ReadyState)
+            ready++;
+    return ready;
+}
+
+class tst_QXmppServerBench : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void idleClients();
+    void loginStorm();
+    void messaging();
+    void presenceBroadcast();
+    void iqPingPong();
+    void roomBroadcast_data();
+    void roomBroadcast();
+};
+
+void tst_QXmppServerBench::initTestCase()
+{
+    benchClock.start();
+}
+
+/// Opens a number of idle authenticated connections and reports the
+/// resident memory used per connection, once logged in and once the
+/// idle connections have been compacted.
+///
+/// The number of connections can be set using the QXMPP_BENCH_CLIENTS
+/// environment variable. The figures include the memory used by the
+/// lightweight client socket.
+
+void tst_QXmppServerBench::idleClients()
+{
+    const int clientCount = envValue("QXMPP_BENCH_CLIENTS", 200);
+    const QHostAddress testHost(QHostAddress::LocalHost);
+    const quint16 testPort = 12346;
+
+    TestPasswordChecker passwordChecker;
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    server.setClientCompactTimeout(1);
+    QVERIFY(server.listenForClients(testHost, testPort));
+
+    // let the server settle before taking the reference measurement
+    QCoreApplication::processEvents();
+    const qint64 rssBefore = residentBytes();
+
+    const QList<BenchClient*> clients = connectClients(clientCount, testPort);
+    QCOMPARE(readyCount(clients), clientCount);
+    QCOMPARE(server.statistics().value("incoming-clients").toInt(), clientCount);
+
+    const qint64 rssAfter = residentBytes();
+
+    // wait for the idle connections to be compacted
+    QTest::qWait(1500);
+    const qint64 rssCompacted = residentBytes();
+    if (rssBefore > 0) {
+        qDebug("%i idle connections, %lli resident bytes per connection, %lli once compacted",
+               clientCount, (rssAfter - rssBefore) / clientCount, (rssCompacted - rssBefore) / clientCount);
+    }
+
+    qDeleteAll(clients);
+    server.close();
+}
+
+/// Connects all the clients at once and reports the login rate and the
+/// time taken by each client to authenticate and bind a resource.
+
+void tst_QXmppServerBench::loginStorm()
+{
+    const int clientCount = envValue("QXMPP_BENCH_CLIENTS", 200);
+    const quint16 testPort = 12346;
+
+    TestPasswordChecker passwordChecker;
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    QVERIFY(server.listenForClients(QHostAddress::LocalHost, testPort));
+
+    BenchStats stats;
+    const QList<BenchClient*> clients = connectClients(clientCount, testPort, &stats);
+    stats.report("loginStorm");
+    QCOMPARE(readyCount(clients), clientCount);
+
+    qDeleteAll(clients);
+    server.close();
+}
+
+/// Sends one-to-one messages between pairs of clients and reports the
+/// delivery rate and latency.
+///
+/// Each client sends QXMPP_BENCH_STANZAS messages, one per event loop
+/// pass, so that sending is interleaved with routing.
+
+void tst_QXmppServerBench::messaging()
+{
+    const int clientCount = envValue("QXMPP_BENCH_CLIENTS", 200) & ~1;
+    const int stanzaCount = envValue("QXMPP_BENCH_STANZAS", 100);
+    const quint16 testPort = 12346;
+
+    TestPasswordChecker passwordChecker;
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    QVERIFY(server.listenForClients(QHostAddress::LocalHost, testPort));
+
+    const QList<BenchClient*> clients = connectClients(clientCount, testPort);
+    QCOMPARE(readyCount(clients), clientCount);
+
+    BenchStats stats;
+    foreach (BenchClient *client, clients)
+        client->setStats(&stats);
+    for (int round = 0; round < stanzaCount; ++round) {
+        for (int i = 0; i < clientCount; ++i) {
+            const QByteArray to = clients[i ^ 1]->jid().toUtf8();
+            clients[i]->send("<message type='chat' to='" + to + "'><body>" + benchMarker() + " Hello, this is a benchmark message.</body></message>");
+        }
+        QCoreApplication::processEvents();
+    }
+    QVERIFY(stats.waitForCount(clientCount * stanzaCount));
+    stats.report("messaging");
+
+    qDeleteAll(clients);
+    server.close();
+}
+
+/// Has every client join a room then update its presence, and reports
+/// the rate and latency at which presence is broadcast to the occupants.
+///
+/// Each client sends QXMPP_BENCH_PRESENCES updates, each of which is
+/// delivered to every occupant.
+
+void tst_QXmppServerBench::presenceBroadcast()
+{
+    const int clientCount = envValue("QXMPP_BENCH_CLIENTS", 200);
+    const int presenceCount = envValue("QXMPP_BENCH_PRESENCES", 5);
+    const quint16 testPort = 12346;
+    const QByteArray roomJid = "bench@conference." + testDomain.toUtf8();
+
+    TestPasswordChecker passwordChecker;
+    QXmppMucService *service = new QXmppMucService;
+    service->setCoalesceThreshold(0);
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    server.addExtension(service);
+    QVERIFY(server.listenForClients(QHostAddress::LocalHost, testPort));
+
+    const QList<BenchClient*> clients = connectClients(clientCount, testPort);
+    QCOMPARE(readyCount(clients), clientCount);
+
+    // join the room and let the join presences drain
+    for (int i = 0; i < clientCount; ++i)
+        clients[i]->send("<presence to='" + roomJid + "/user" + QByteArray::number(i) + "'><x xmlns='http://jabber.org/protocol/muc'/></presence>");
+    for (int i = 0; i < 100 && service->occupants(QString::fromUtf8(roomJid)).size() < clientCount; ++i)
+        QTest::qWait(100);
+    QCOMPARE(service->occupants(QString::fromUtf8(roomJid)).size(), clientCount);
+    QTest::qWait(500);
+
+    BenchStats stats;
+    foreach (BenchClient *client, clients)
+        client->setStats(&stats);
+    for (int round = 0; round < presenceCount; ++round) {
+        for (int i = 0; i < clientCount; ++i)
+            clients[i]->send("<presence to='" + roomJid + "/user" + QByteArray::number(i) + "'><status>" + benchMarker() + "</status></presence>");
+        QCoreApplication::processEvents();
+    }
+    QVERIFY(stats.waitForCount(clientCount * clientCount * presenceCount));
+    stats.report("presenceBroadcast");
+
+    qDeleteAll(clients);
+    server.close();
+}
+
+/// Has pairs of clients ping each other and reports the round trip rate
+/// and latency.
+///
+/// Half of the clients send QXMPP_BENCH_STANZAS pings each, sending the
+/// next ping as soon as the previous one is answered.
+
+void tst_QXmppServerBench::iqPingPong()
+{
+    const int clientCount = envValue("QXMPP_BENCH_CLIENTS", 200) & ~1;
+    const int stanzaCount = envValue("QXMPP_BENCH_STANZAS", 100);
+    const quint16 testPort = 12346;
+
+    TestPasswordChecker passwordChecker;
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.setPasswordChecker(&passwordChecker);
+    QVERIFY(server.listenForClients(QHostAddress::LocalHost, testPort));
+
+    const QList<BenchClient*> clients = connectClients(clientCount, testPort);
+    QCOMPARE(readyCount(clients), clientCount);
+
+    BenchStats stats;
+    for (int i = 0; i < clientCount; ++i)
+        clients[i]->setPeer(clients[i ^ 1]->jid());
+    for (int i = 0; i < clientCount; i += 2) {
+        clients[i]->setStats(&stats);
+        clients[i]->startPings(stanzaCount);
+    }
+    QVERIFY(stats.waitForCount(clientCount / 2 * stanzaCount));
+    stats.report("iqPingPong");
+
+    qDeleteAll(clients);
+    server.close();
+}
+
+void tst_QXmppServerBench::roomBroadcast_data()
+{
+    QTest::addColumn<int>("occupants");
+
+    QTest::newRow("50") << 50;
+    QTest::newRow("500") << 500;
+    QTest::newRow("5000") << 5000;
+}
+
+/// Measures the time taken to fan out a groupchat message to all the
+/// occupants of a room.
+///
+/// The occupants are not connected, so the figure covers serialization,
+/// address splicing and routing but not socket writes.
+
+void tst_QXmppServerBench::roomBroadcast()
+{
+    QFETCH(int, occupants);
+
+    const QString roomJid = "bench@conference." + testDomain;
+
+    QXmppServer server;
+    server.setDomain(testDomain);
+    server.addExtension(new QXmppMucService);
+    QVERIFY(server.listenForClients(QHostAddress::LocalHost, 12346));
+
+    // fill the room
+    for (int i = 0; i < occupants; ++i) {
+        QXmppPresence presence;
+        presence.setFrom(QString("user%1@%2/bench").arg(QString::number(i), testDomain));
+        presence.setTo(QString("%1/user%2").arg(roomJid, QString::number(i)));
+        presence.setMucSupported(true);
+
+        QByteArray data;
+        QXmlStreamWriter writer(&data);
+        presence.toXml(&writer);
+        QDomDocument doc;
+        doc.setContent(data, true);
+        server.handleElement(doc.documentElement());
+    }
+
+    // prepare message
+    QXmppMessage message;
+    message.setFrom(QString("user0@%1/bench").arg(testDomain));
+    message.setTo(roomJid);
+    message.setType(QXmppMessage::GroupChat);
+    message.setBody("Hello everybody, this is a benchmark message.");
+
+    QByteArray data;
+    QXmlStreamWriter writer(&data);
+    message.toXml(&writer);
+    QDomDocument doc;
+    doc.setContent(data, true);
+    const QDomElement element = doc.documentElement();
+
+    QBENCHMARK {
+        server.handleElement(element);
+    }
+
+    server.close();
+}
+
+QTEST_MAIN(tst_QXmppServerBench)
+#include "tst_qxmppserverbench.moc"
@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmppstanzabench
+SOURCES += tst_qxmppstanzabench.cpp
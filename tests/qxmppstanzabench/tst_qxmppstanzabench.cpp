@@ -0,0 +1,366 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QElapsedTimer>
+
+#include "QXmppArchiveIq.h"
+#include "QXmppDataForm.h"
+#include "QXmppDiscoveryIq.h"
+#include "QXmppRosterIq.h"
+#include "QXmppVCardIq.h"
+#include "util.h"
+
+enum Kind {
+    ArchiveKind,
+    DataFormKind,
+    DiscoveryKind,
+    RosterKind,
+    VCardKind
+};
+
+enum Operation {
+    ParseOperation,
+    SerializeOperation,
+    CopyOperation,
+    DestroyOperation
+};
+
+/// Number of objects destroyed in one measurement, as destruction
+/// cannot be repeated on a single object, and number of batches.
+static const int destroyBatch = 100;
+static const int destroyRounds = 20;
+
+template <class T>
+static QByteArray serialize(const T &packet)
+{
+    QByteArray data;
+    QXmlStreamWriter writer(&data);
+    packet.toXml(&writer);
+    return data;
+}
+
+/// Returns a page of 100 archived messages.
+
+static QByteArray archivePage()
+{
+    QList<QXmppArchiveMessage> messages;
+    for (int i = 0; i < 100; ++i) {
+        QXmppArchiveMessage message;
+        message.setBody(QString("Message number %1 of this conversation, with a typical length.").arg(i));
+        message.setDate(QDateTime(QDate(2013, 1, 1), QTime(12, 0)).addSecs(i * 30));
+        message.setReceived(i % 2);
+        messages << message;
+    }
+
+    QXmppArchiveChat chat;
+    chat.setMessages(messages);
+    chat.setStart(QDateTime(QDate(2013, 1, 1), QTime(12, 0)));
+    chat.setWith("juliet@capulet.com");
+
+    QXmppResultSetReply rsm;
+    rsm.setCount(1000);
+    rsm.setFirst("0");
+    rsm.setLast("99");
+
+    QXmppArchiveChatIq iq;
+    iq.setType(QXmppIq::Result);
+    iq.setChat(chat);
+    iq.setResultSetReply(rsm);
+    return serialize(iq);
+}
+
+/// Returns a form with 50 fields of various types.
+
+static QByteArray dataForm()
+{
+    QList<QPair<QString, QString> > options;
+    for (int i = 0; i < 10; ++i)
+        options << qMakePair(QString("Option %1").arg(i), QString("option%1").arg(i));
+
+    QList<QXmppDataForm::Field> fields;
+    for (int i = 0; i < 50; ++i) {
+        QXmppDataForm::Field field;
+        field.setKey(QString("field%1").arg(i));
+        field.setLabel(QString("Field number %1").arg(i));
+        switch (i % 4) {
+        case 0:
+            field.setType(QXmppDataForm::Field::BooleanField);
+            field.setValue(true);
+            break;
+        case 1:
+            field.setType(QXmppDataForm::Field::ListSingleField);
+            field.setOptions(options);
+            field.setValue("option1");
+            break;
+        case 2:
+            field.setType(QXmppDataForm::Field::TextMultiField);
+            field.setValue(QStringList() << "first line" << "second line");
+            break;
+        default:
+            field.setValue(QString("value %1").arg(i));
+            break;
+        }
+        fields << field;
+    }
+
+    QXmppDataForm form(QXmppDataForm::Form);
+    form.setTitle("Benchmark form");
+    form.setInstructions("Fill in all the fields.");
+    form.setFields(fields);
+    return serialize(form);
+}
+
+/// Returns a disco#items response with 1000 items.
+
+static QByteArray discoveryItems()
+{
+    QList<QXmppDiscoveryIq::Item> items;
+    for (int i = 0; i < 1000; ++i) {
+        QXmppDiscoveryIq::Item item;
+        item.setJid("pubsub.shakespeare.lit");
+        item.setNode(QString("node%1").arg(i));
+        item.setName(QString("Node number %1").arg(i));
+        items << item;
+    }
+
+    QXmppDiscoveryIq iq;
+    iq.setType(QXmppIq::Result);
+    iq.setQueryType(QXmppDiscoveryIq::ItemsQuery);
+    iq.setItems(items);
+    return serialize(iq);
+}
+
+/// Returns a roster with 1000 contacts.
+
+static QByteArray roster()
+{
+    QXmppRosterIq iq;
+    iq.setType(QXmppIq::Result);
+    for (int i = 0; i < 1000; ++i) {
+        QXmppRosterIq::Item item;
+        item.setBareJid(QString("contact%1@shakespeare.lit").arg(i));
+        item.setName(QString("Contact %1").arg(i));
+        item.setGroups(QSet<QString>() << "Friends" << QString("Group %1").arg(i % 10));
+        item.setSubscriptionType(QXmppRosterIq::Item::Both);
+        iq.addItem(item);
+    }
+    return serialize(iq);
+}
+
+/// Returns a vCard with a 32 KiB photo.
+
+static QByteArray vCard()
+{
+    QByteArray photo(32 * 1024, '\0');
+    for (int i = 0; i < photo.size(); ++i)
+        photo[i] = char(i * 7919 % 251);
+
+    QXmppVCardIq iq;
+    iq.setType(QXmppIq::Result);
+    iq.setBirthday(QDate(1983, 9, 14));
+    iq.setDescription("Just a benchmark user.");
+    iq.setEmail("foo.bar@example.com");
+    iq.setFirstName("Foo");
+    iq.setFullName("Foo Bar");
+    iq.setLastName("Bar");
+    iq.setNickName("FooBar");
+    iq.setPhoto(photo);
+    iq.setPhotoType("image/png");
+    iq.setUrl("http://code.google.com/p/qxmpp/");
+    return serialize(iq);
+}
+
+template <class T>
+static void benchmark(Operation operation, const QDomElement &element)
+{
+    T original;
+    original.parse(element);
+
+    switch (operation) {
+    case ParseOperation:
+        QBENCHMARK {
+            T packet;
+            packet.parse(element);
+        }
+        break;
+    case SerializeOperation:
+        QBENCHMARK {
+            serialize(original);
+        }
+        break;
+    case CopyOperation:
+        // implicitly shared members make copies shallow
+        QBENCHMARK {
+            T copy(original);
+            Q_UNUSED(copy);
+        }
+        break;
+    case DestroyOperation: {
+        // only the deletions are timed, in batches to bound memory use
+        qint64 nsecs = 0;
+        for (int round = 0; round < destroyRounds; ++round) {
+            QList<T*> packets;
+            for (int i = 0; i < destroyBatch; ++i) {
+                T *packet = new T;
+                packet->parse(element);
+                packets << packet;
+            }
+            QElapsedTimer timer;
+            timer.start();
+            qDeleteAll(packets);
+#if (QT_VERSION >= QT_VERSION_CHECK(4, 8, 0))
+            nsecs += timer.nsecsElapsed();
+#else
+            nsecs += timer.elapsed() * 1000000;
+#endif
+        }
+        QTest::setBenchmarkResult(qreal(nsecs) / 1000000 / (destroyRounds * destroyBatch), QTest::WalltimeMilliseconds);
+        break;
+    }
+    }
+}
+
+static void benchmark(Operation operation)
+{
+    QFETCH(int, kind);
+    QFETCH(QByteArray, xml);
+
+    QDomDocument doc;
+    QVERIFY(doc.setContent(xml, true));
+    const QDomElement element = doc.documentElement();
+
+    switch (kind) {
+    case ArchiveKind:
+        benchmark<QXmppArchiveChatIq>(operation, element);
+        break;
+    case DataFormKind:
+        benchmark<QXmppDataForm>(operation, element);
+        break;
+    case DiscoveryKind:
+        benchmark<QXmppDiscoveryIq>(operation, element);
+        break;
+    case RosterKind:
+        benchmark<QXmppRosterIq>(operation, element);
+        break;
+    case VCardKind:
+        benchmark<QXmppVCardIq>(operation, element);
+        break;
+    }
+}
+
+class tst_QXmppStanzaBench : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void parse_data();
+    void parse();
+    void serialize_data();
+    void serialize();
+    void copy_data();
+    void copy();
+    void destroy_data();
+    void destroy();
+
+private:
+    void addRows();
+
+    QByteArray m_archivePage;
+    QByteArray m_dataForm;
+    QByteArray m_discoveryItems;
+    QByteArray m_roster;
+    QByteArray m_vCard;
+};
+
+void tst_QXmppStanzaBench::initTestCase()
+{
+    m_archivePage = archivePage();
+    m_dataForm = dataForm();
+    m_discoveryItems = discoveryItems();
+    m_roster = roster();
+    m_vCard = vCard();
+}
+
+void tst_QXmppStanzaBench::addRows()
+{
+    QTest::addColumn<int>("kind");
+    QTest::addColumn<QByteArray>("xml");
+
+    QTest::newRow("archive-page") << int(ArchiveKind) << m_archivePage;
+    QTest::newRow("data-form") << int(DataFormKind) << m_dataForm;
+    QTest::newRow("disco-items") << int(DiscoveryKind) << m_discoveryItems;
+    QTest::newRow("roster") << int(RosterKind) << m_roster;
+    QTest::newRow("vcard") << int(VCardKind) << m_vCard;
+}
+
+void tst_QXmppStanzaBench::parse_data()
+{
+    addRows();
+}
+
+/// Measures parsing a DOM element into a stanza.
+
+void tst_QXmppStanzaBench::parse()
+{
+    benchmark(ParseOperation);
+}
+
+void tst_QXmppStanzaBench::serialize_data()
+{
+    addRows();
+}
+
+/// Measures serializing a stanza to XML.
+
+void tst_QXmppStanzaBench::serialize()
+{
+    benchmark(SerializeOperation);
+}
+
+void tst_QXmppStanzaBench::copy_data()
+{
+    addRows();
+}
+
+/// Measures copying a stanza and releasing the copy.
+
+void tst_QXmppStanzaBench::copy()
+{
+    benchmark(CopyOperation);
+}
+
+void tst_QXmppStanzaBench::destroy_data()
+{
+    addRows();
+}
+
+/// Measures destroying a parsed stanza.
+
+void tst_QXmppStanzaBench::destroy()
+{
+    benchmark(DestroyOperation);
+}
+
+QTEST_MAIN(tst_QXmppStanzaBench)
+#include "tst_qxmppstanzabench.moc"
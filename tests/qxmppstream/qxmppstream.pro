@@ -0,0 +1,3 @@
+include(../tests.pri)
+TARGET = tst_qxmppstream
+SOURCES += tst_qxmppstream.cpp
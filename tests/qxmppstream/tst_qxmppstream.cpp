@@ -0,0 +1,286 @@
+/*
+ * Copyright (C) 2008-2012 The QXmpp developers
+ *
+ * Author:
+ *  Jeremy Lainé
+ *
+ * Source:
+ *  http://code.google.com/p/qxmpp
+ *
+ * This file is a part of QXmpp library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ */
+
+#include <QSslSocket>
+#include <QTcpServer>
+#include <QTemporaryFile>
+
+#include "QXmppStream.h"
+#include "QXmppTrafficRecorder.h"
+#include "util.h"
+
+class TestStream : public QXmppStream
+{
+public:
+    TestStream(QSslSocket *socket)
+        : QXmppStream(0), stanzas(0), started(false)
+    {
+        setSocket(socket);
+    }
+
+    int stanzas;
+    bool started;
+
+protected:
+    void handleStanza(const QDomElement &element)
+    {
+        Q_UNUSED(element);
+        stanzas++;
+    }
+
+    void handleStream(const QDomElement &element)
+    {
+        Q_UNUSED(element);
+        started = true;
+    }
+};
+
+class tst_QXmppStream : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testByteRateLimit();
+    void testPresenceLane();
+    void testPresenceOrder();
+    void testStanzaRateLimit();
+    void testTrafficRecorder();
+};
+
+void tst_QXmppStream::testByteRateLimit()
+{
+    QTcpServer server;
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    QSslSocket socket;
+    socket.connectToHost(QHostAddress::LocalHost, server.serverPort());
+    QVERIFY(socket.waitForConnected(1000));
+    QVERIFY(server.waitForNewConnection(1000));
+    QTcpSocket *peer = server.nextPendingConnection();
+    QVERIFY(peer);
+
+    TestStream stream(&socket);
+    stream.setByteRateLimit(2000);
+
+    // send twice the budget at once
+    QByteArray data = "<stream:stream xmlns='jabber:client' xmlns:stream='http://etherx.jabber.org/streams'>";
+    for (int i = 0; i < 40; ++i)
+        data += "<message to='bob@example.com' id='" + QByteArray::number(1000 + i) + "'><body>this message is throttled by the byte rate limit</body></message>";
+    QVERIFY(data.size() > 4000);
+    peer->write(data);
+
+    // only the first second's worth gets through straight away
+    QTest::qWait(200);
+    QVERIFY(stream.stanzas > 0);
+    QVERIFY(stream.stanzas < 40);
+
+    for (int i = 0; i < 300 && stream.stanzas < 40; ++i)
+        QTest::qWait(10);
+    QCOMPARE(stream.stanzas, 40);
+}
+
+void tst_QXmppStream::testPresenceLane()
+{
+    QTcpServer server;
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    QSslSocket socket;
+    socket.connectToHost(QHostAddress::LocalHost, server.serverPort());
+    QVERIFY(socket.waitForConnected(1000));
+    QVERIFY(server.waitForNewConnection(1000));
+    QTcpSocket *peer = server.nextPendingConnection();
+    QVERIFY(peer);
+
+    TestStream stream(&socket);
+
+    // congest the socket
+    const QByteArray filler = "<message to='bob@example.com'><body>" + QByteArray(65536, 'x') + "</body></message>";
+    QVERIFY(stream.sendData(filler));
+
+    // presence is held back and collapsed, other stanzas go first
+    QVERIFY(stream.sendData("<presence from='alice@example.com/a' to='bob@example.com'><show>away</show></presence>"));
+    QVERIFY(stream.sendData("<presence from='carol@example.com/c' to='bob@example.com'/>"));
+    QVERIFY(stream.sendData("<presence from='alice@example.com/a' to='bob@example.com'><show>dnd</show></presence>"));
+    QVERIFY(stream.sendData("<presence type='subscribe' from='dave@example.com' to='bob@example.com'/>"));
+    QVERIFY(stream.sendData("<iq type='get' id='1'/>"));
+
+    const QByteArray expected = filler +
+        "<iq type='get' id='1'/>"
+        "<presence from='alice@example.com/a' to='bob@example.com'><show>dnd</show></presence>"
+        "<presence from='carol@example.com/c' to='bob@example.com'/>"
+        "<presence type='subscribe' from='dave@example.com' to='bob@example.com'/>";
+    QByteArray received;
+    for (int i = 0; i < 100 && received.size() < expected.size(); ++i) {
+        QTest::qWait(10);
+        received += peer->readAll();
+    }
+    QCOMPARE(received, expected);
+}
+
+void tst_QXmppStream::testPresenceOrder()
+{
+    QTcpServer server;
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    QSslSocket socket;
+    socket.connectToHost(QHostAddress::LocalHost, server.serverPort());
+    QVERIFY(socket.waitForConnected(1000));
+    QVERIFY(server.waitForNewConnection(1000));
+    QTcpSocket *peer = server.nextPendingConnection();
+    QVERIFY(peer);
+
+    TestStream stream(&socket);
+
+    // congest the socket
+    const QByteArray filler = "<message to='bob@example.com'><body>" + QByteArray(65536, 'x') + "</body></message>";
+    QVERIFY(stream.sendData(filler));
+
+    // a message does not overtake the presence joining its room, but
+    // overtakes presence on other routes
+    QVERIFY(stream.sendData("<presence from='alice@example.com/a' to='room@conference.example.com/alice'/>"));
+    QVERIFY(stream.sendData("<presence from='carol@example.com/c' to='bob@example.com'/>"));
+    QVERIFY(stream.sendData("<message from='alice@example.com/a' to='room@conference.example.com' type='groupchat'><body>hi</body></message>"));
+
+    // presence following a subscription change is not collapsed into
+    // presence which preceded it
+    QVERIFY(stream.sendData("<presence type='unsubscribed' from='carol@example.com/c' to='bob@example.com'/>"));
+    QVERIFY(stream.sendData("<presence from='carol@example.com/c' to='bob@example.com'><show>away</show></presence>"));
+
+    const QByteArray expected = filler +
+        "<presence from='alice@example.com/a' to='room@conference.example.com/alice'/>"
+        "<message from='alice@example.com/a' to='room@conference.example.com' type='groupchat'><body>hi</body></message>"
+        "<presence from='carol@example.com/c' to='bob@example.com'/>"
+        "<presence type='unsubscribed' from='carol@example.com/c' to='bob@example.com'/>"
+        "<presence from='carol@example.com/c' to='bob@example.com'><show>away</show></presence>";
+    QByteArray received;
+    for (int i = 0; i < 100 && received.size() < expected.size(); ++i) {
+        QTest::qWait(10);
+        received += peer->readAll();
+    }
+    QCOMPARE(received, expected);
+}
+
+void tst_QXmppStream::testStanzaRateLimit()
+{
+    QTcpServer server;
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    QSslSocket socket;
+    socket.connectToHost(QHostAddress::LocalHost, server.serverPort());
+    QVERIFY(socket.waitForConnected(1000));
+    QVERIFY(server.waitForNewConnection(1000));
+    QTcpSocket *peer = server.nextPendingConnection();
+    QVERIFY(peer);
+
+    TestStream stream(&socket);
+    stream.setStanzaRateLimit(10);
+    QCOMPARE(stream.stanzaRateLimit(), 10);
+
+    // send three times the budget in a single read
+    QByteArray data = "<stream:stream xmlns='jabber:client' xmlns:stream='http://etherx.jabber.org/streams'>";
+    for (int i = 0; i < 30; ++i)
+        data += "<iq type='get' id='" + QByteArray::number(i) + "'/>";
+    peer->write(data);
+
+    // the budget is checked before each stanza is dispatched
+    QTest::qWait(50);
+    QCOMPARE(stream.stanzas, 10);
+
+    for (int i = 0; i < 400 && stream.stanzas < 30; ++i)
+        QTest::qWait(10);
+    QCOMPARE(stream.stanzas, 30);
+}
+
+void tst_QXmppStream::testTrafficRecorder()
+{
+    QTcpServer server;
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    QSslSocket socket;
+    socket.connectToHost(QHostAddress::LocalHost, server.serverPort());
+    QVERIFY(socket.waitForConnected(1000));
+    QVERIFY(server.waitForNewConnection(1000));
+    QTcpSocket *peer = server.nextPendingConnection();
+    QVERIFY(peer);
+
+    TestStream stream(&socket);
+
+    // each record takes 17 bytes of header plus the data
+    QXmppTrafficRecorder recorder;
+    recorder.setCapacity(128);
+    recorder.setSamplingInterval(0);
+    recorder.setEnabled(true);
+    QVERIFY(recorder.isEnabled());
+
+    // streams which are neither sampled nor selected are not recorded
+    peer->write("<stream:stream xmlns='jabber:client' xmlns:stream='http://etherx.jabber.org/streams'>");
+    for (int i = 0; i < 100 && !stream.started; ++i)
+        QTest::qWait(10);
+    QVERIFY(stream.started);
+
+    // the oldest record is evicted to make room
+    recorder.addStream(stream.serial());
+    QVERIFY(stream.sendData("<iq type='get' id='evicted-stanza-0001'/>"));
+    QVERIFY(stream.sendData("<iq type='get' id='recorded-stanza-001'/>"));
+    peer->write("<iq type='result' id='recorded-stanza-001'/>");
+    for (int i = 0; i < 100 && !stream.stanzas; ++i)
+        QTest::qWait(10);
+    QCOMPARE(stream.stanzas, 1);
+    recorder.setEnabled(false);
+
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    QVERIFY(recorder.dump(file.fileName()));
+
+    QDataStream input(&file);
+    QByteArray magic(8, '\0');
+    input.readRawData(magic.data(), magic.size());
+    QCOMPARE(magic, QByteArray("QXMPPCAP"));
+    quint32 version;
+    input >> version;
+    QCOMPARE(version, quint32(1));
+
+    QList<quint8> directions;
+    QList<QByteArray> payloads;
+    while (!input.atEnd()) {
+        qint64 timestamp;
+        quint32 serial;
+        quint8 direction;
+        quint32 length;
+        input >> timestamp >> serial >> direction >> length;
+        QCOMPARE(serial, stream.serial());
+        QVERIFY(timestamp > 0);
+        QByteArray payload(length, '\0');
+        input.readRawData(payload.data(), payload.size());
+        directions << direction;
+        payloads << payload;
+    }
+    QCOMPARE(payloads.size(), 2);
+    QCOMPARE(directions[0], quint8(QXmppTrafficRecorder::Sent));
+    QCOMPARE(payloads[0], QByteArray("<iq type='get' id='recorded-stanza-001'/>"));
+    QCOMPARE(directions[1], quint8(QXmppTrafficRecorder::Received));
+    QCOMPARE(payloads[1], QByteArray("<iq type='result' id='recorded-stanza-001'/>"));
+}
+
+QTEST_MAIN(tst_QXmppStream)
+#include "tst_qxmppstream.moc"
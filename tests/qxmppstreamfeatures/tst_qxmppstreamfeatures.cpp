@@ -42,6 +42,7 @@ void tst_QXmppStreamFeatures::testEmpty()
     QCOMPARE(features.bindMode(), QXmppStreamFeatures::Disabled);
     QCOMPARE(features.sessionMode(), QXmppStreamFeatures::Disabled);
     QCOMPARE(features.nonSaslAuthMode(), QXmppStreamFeatures::Disabled);
+    QCOMPARE(features.rosterVersionMode(), QXmppStreamFeatures::Disabled);
     QCOMPARE(features.tlsMode(), QXmppStreamFeatures::Disabled);
     QCOMPARE(features.authMechanisms(), QStringList());
     QCOMPARE(features.compressionMethods(), QStringList());
@@ -54,6 +55,7 @@ void tst_QXmppStreamFeatures::testFull()
         "<bind xmlns=\"urn:ietf:params:xml:ns:xmpp-bind\"/>"
         "<session xmlns=\"urn:ietf:params:xml:ns:xmpp-session\"/>"
         "<auth xmlns=\"http://jabber.org/features/iq-auth\"/>"
+        "<ver xmlns=\"urn:xmpp:features:rosterver\"/>"
         "<starttls xmlns=\"urn:ietf:params:xml:ns:xmpp-tls\"/>"
         "<compression xmlns=\"http://jabber.org/features/compress\"><method>zlib</method></compression>"
         "<mechanisms xmlns=\"urn:ietf:params:xml:ns:xmpp-sasl\"><mechanism>PLAIN</mechanism></mechanisms>"
@@ -64,6 +66,7 @@ void tst_QXmppStreamFeatures::testFull()
     QCOMPARE(features.bindMode(), QXmppStreamFeatures::Enabled);
     QCOMPARE(features.sessionMode(), QXmppStreamFeatures::Enabled);
     QCOMPARE(features.nonSaslAuthMode(), QXmppStreamFeatures::Enabled);
+    QCOMPARE(features.rosterVersionMode(), QXmppStreamFeatures::Enabled);
     QCOMPARE(features.tlsMode(), QXmppStreamFeatures::Enabled);
     QCOMPARE(features.authMechanisms(), QStringList() << "PLAIN");
     QCOMPARE(features.compressionMethods(), QStringList() << "zlib");
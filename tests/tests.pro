@@ -1,24 +1,33 @@
 TEMPLATE = subdirs
 SUBDIRS = \
     qxmpparchiveiq \
+    qxmpparchiveservice \
     qxmppbindiq \
+    qxmppcluster \
     qxmppdataform \
     qxmppdiscoveryiq \
     qxmppentitytimeiq \
     qxmppiq \
     qxmppjingleiq \
     qxmppmessage \
+    qxmppmucservice \
     qxmppnonsaslauthiq \
     qxmpppresence \
     qxmpppubsubiq \
+    qxmpppubsubservice \
     qxmppregisteriq \
     qxmppresultset \
     qxmpprosteriq \
+    qxmpprostermanager \
+    qxmpprosterservice \
     qxmpprpciq \
     qxmpprtppacket \
     qxmppserver \
+    qxmppserverbench \
     qxmppsessioniq \
     qxmppstanza \
+    qxmppstanzabench \
+    qxmppstream \
     qxmppstreamfeatures \
     qxmppstunmessage \
     qxmpputils \
@@ -28,6 +37,7 @@ SUBDIRS = \
 
 !isEmpty(QXMPP_AUTOTEST_INTERNAL) {
     SUBDIRS += qxmppcodec
+    SUBDIRS += qxmppconnector
     SUBDIRS += qxmppsasl
     SUBDIRS += qxmppstreaminitiationiq
 }